@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+
+#include "aggregate.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+
+// epoll_event.data of the fds that aren't connections
+#define EVENT_LISTEN UINT64_MAX
+#define EVENT_INPUT (UINT64_MAX - 1)
+
+#define MAX_EVENTS 64
+// A whole frame always fits in the receive buffer
+#define RECEIVE_BUFFER_SIZE (EXPORT_MAX_FRAME_SIZE + 11)
+
+static void fleet_watch(struct fleet_t *fleet, int fd, uint64_t data)
+{
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = data;
+	epoll_ctl(fleet->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+int fleet_init(struct fleet_t *fleet, const char *address, int input_fd)
+{
+	memset(fleet, 0, sizeof(struct fleet_t));
+	fleet->listen_fd = -1;
+	fleet->input_fd = input_fd;
+
+	char host[256];
+	const char *port;
+	if (export_split_address(address, host, sizeof(host), &port))
+		return 1;
+
+	struct addrinfo hints, *result;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(host[0] ? host : NULL, port, &hints, &result))
+		return 1;
+	fleet->listen_fd = socket(result->ai_family,
+			SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	int one = 1;
+	int ret = fleet->listen_fd < 0 ||
+		setsockopt(fleet->listen_fd, SOL_SOCKET, SO_REUSEADDR,
+				&one, sizeof(one)) ||
+		bind(fleet->listen_fd, result->ai_addr, result->ai_addrlen) ||
+		listen(fleet->listen_fd, SOMAXCONN);
+	freeaddrinfo(result);
+	if (ret) {
+		if (fleet->listen_fd >= 0)
+			close_fd(fleet->listen_fd);
+		fleet->listen_fd = -1;
+		return 2;
+	}
+
+	fleet->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	fleet_watch(fleet, fleet->listen_fd, EVENT_LISTEN);
+	if (input_fd >= 0)
+		fleet_watch(fleet, input_fd, EVENT_INPUT);
+	return 0;
+}
+
+static void fleet_close_connection(struct fleet_t *fleet, int c)
+{
+	struct fleet_connection_t *connection = &fleet->connections[c];
+	// Closing the fd also removes it from the epoll set
+	close_fd(connection->fd);
+	connection->fd = -1;
+	if (connection->node >= 0)
+		fleet->nodes[connection->node].connected = 0;
+	free(connection->buffer);
+	connection->buffer = NULL;
+	--fleet->connection_count;
+}
+
+void fleet_delete(struct fleet_t *fleet)
+{
+	for (int c = 0; c < fleet->max_connection_count; ++c)
+		if (fleet->connections[c].fd >= 0)
+			fleet_close_connection(fleet, c);
+	free(fleet->connections);
+	free(fleet->nodes);
+	if (fleet->listen_fd >= 0) {
+		close_fd(fleet->listen_fd);
+		close_fd(fleet->epoll_fd);
+	}
+}
+
+static void fleet_accept(struct fleet_t *fleet)
+{
+	for (;;) {
+		struct sockaddr_storage address;
+		socklen_t address_length = sizeof(address);
+		int fd = accept4(fleet->listen_fd, (struct sockaddr *)&address,
+				&address_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		// Reuse a closed connection or add one
+		int c = 0;
+		while (c < fleet->max_connection_count &&
+				fleet->connections[c].fd >= 0)
+			++c;
+		if (c == fleet->max_connection_count) {
+			fleet->max_connection_count += 128;
+			fleet->connections = (struct fleet_connection_t *)realloc(
+					fleet->connections, sizeof(struct fleet_connection_t) *
+					fleet->max_connection_count);
+			for (int i = c; i < fleet->max_connection_count; ++i)
+				fleet->connections[i].fd = -1;
+		}
+		++fleet->connection_count;
+
+		struct fleet_connection_t *connection = &fleet->connections[c];
+		memset(connection, 0, sizeof(struct fleet_connection_t));
+		connection->fd = fd;
+		connection->node = -1;
+		connection->buffer = (unsigned char *)malloc(RECEIVE_BUFFER_SIZE);
+
+		char ip[INET6_ADDRSTRLEN] = "?";
+		int port = 0;
+		if (address.ss_family == AF_INET) {
+			const struct sockaddr_in *in = (const struct sockaddr_in *)&address;
+			inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+			port = ntohs(in->sin_port);
+		} else if (address.ss_family == AF_INET6) {
+			const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)&address;
+			inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+			port = ntohs(in6->sin6_port);
+		}
+		snprintf(connection->address, sizeof(connection->address),
+				"%s:%d", ip, port);
+
+		fleet_watch(fleet, fd, c);
+	}
+}
+
+// Handle a hello. Returns nonzero if it is invalid
+static int fleet_hello(struct fleet_t *fleet, struct fleet_connection_t *connection,
+		const unsigned char *payload, size_t size)
+{
+	size_t pos = 0;
+	unsigned long long version, metric_count, length;
+	if (connection->node >= 0 ||
+			export_get_varint(payload, size, &pos, &version) ||
+			version != EXPORT_VERSION ||
+			export_get_varint(payload, size, &pos, &metric_count) ||
+			metric_count > EXPORT_MAX_FRAME_SIZE ||
+			export_get_varint(payload, size, &pos, &length) ||
+			length > EXPORT_MAX_HOSTNAME_LENGTH || length > size - pos)
+		return 1;
+	char name[EXPORT_MAX_HOSTNAME_LENGTH + 1];
+	memcpy(name, payload + pos, length);
+	name[length] = '\0';
+
+	// A node that reconnects keeps its entry. Nodes with the same
+	// name that are connected at the same time get one entry each
+	int n = 0;
+	while (n < fleet->node_count && (fleet->nodes[n].connected ||
+				strcmp(fleet->nodes[n].name, name)))
+		++n;
+	if (n == fleet->node_count) {
+		if (fleet->node_count == fleet->max_node_count) {
+			fleet->max_node_count += 128;
+			fleet->nodes = (struct fleet_node_t *)realloc(fleet->nodes,
+					sizeof(struct fleet_node_t) * fleet->max_node_count);
+		}
+		memset(&fleet->nodes[n], 0, sizeof(struct fleet_node_t));
+		strcpy(fleet->nodes[n].name, name);
+		fleet->nodes[n].first_seen = monotonic_ns();
+		++fleet->node_count;
+	}
+	struct fleet_node_t *node = &fleet->nodes[n];
+	node->connected = 1;
+	node->has_sample = 0;
+	strcpy(node->address, connection->address);
+	connection->node = n;
+	connection->metric_count = metric_count;
+	memset(connection->last, 0, sizeof(connection->last));
+	return 0;
+}
+
+// Handle a batch of samples. Returns nonzero if it is invalid
+static int fleet_samples(struct fleet_t *fleet,
+		struct fleet_connection_t *connection,
+		const unsigned char *payload, size_t size)
+{
+	size_t pos = 0;
+	unsigned long long count;
+	if (connection->node < 0 ||
+			export_get_varint(payload, size, &pos, &count))
+		return 1;
+	for (unsigned long long s = 0; s < count; ++s) {
+		for (int m = 0; m < 1 + connection->metric_count; ++m) {
+			long long delta;
+			if (export_get_svarint(payload, size, &pos, &delta))
+				return 1;
+			// Metrics that we don't know of are skipped
+			if (m < 1 + EXPORT_METRIC_COUNT)
+				connection->last[m] += delta;
+		}
+	}
+
+	struct fleet_node_t *node = &fleet->nodes[connection->node];
+	if (count > 0) {
+		node->time_ms = connection->last[0];
+		memcpy(node->values, connection->last + 1, sizeof(node->values));
+		node->has_sample = 1;
+		node->sample_count += count;
+	}
+	return 0;
+}
+
+// Receive everything that is available from a connection
+static void fleet_receive(struct fleet_t *fleet, int c)
+{
+	struct fleet_connection_t *connection = &fleet->connections[c];
+	for (;;) {
+		ssize_t bytes = read(connection->fd,
+				connection->buffer + connection->buffer_used,
+				RECEIVE_BUFFER_SIZE - connection->buffer_used);
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (bytes <= 0) {
+			fleet_close_connection(fleet, c);
+			return;
+		}
+		connection->buffer_used += bytes;
+
+		// Handle all whole frames
+		size_t pos = 0;
+		for (;;) {
+			size_t payload = pos + 1;
+			unsigned long long length;
+			if (export_get_varint(connection->buffer, connection->buffer_used,
+						&payload, &length))
+				break;
+			if (length > EXPORT_MAX_FRAME_SIZE) {
+				fleet_close_connection(fleet, c);
+				return;
+			}
+			if (payload + length > (size_t)connection->buffer_used)
+				break;
+
+			const int type = connection->buffer[pos];
+			int invalid = 1;
+			if (type == EXPORT_HELLO)
+				invalid = fleet_hello(fleet, connection,
+						connection->buffer + payload, length);
+			else if (type == EXPORT_SAMPLES)
+				invalid = fleet_samples(fleet, connection,
+						connection->buffer + payload, length);
+			if (invalid) {
+				fleet_close_connection(fleet, c);
+				return;
+			}
+			struct fleet_node_t *node = &fleet->nodes[connection->node];
+			node->bytes_received += payload + length - pos;
+			node->last_seen = monotonic_ns();
+			pos = payload + length;
+		}
+		memmove(connection->buffer, connection->buffer + pos,
+				connection->buffer_used - pos);
+		connection->buffer_used -= pos;
+	}
+}
+
+int fleet_wait(struct fleet_t *fleet, long long timeout_ns)
+{
+	const long long deadline = monotonic_ns() + timeout_ns;
+	struct epoll_event events[MAX_EVENTS];
+	for (;;) {
+		long long remaining = deadline - monotonic_ns();
+		if (remaining < 0)
+			remaining = 0;
+		// Round up, so that we don't wake up just before the deadline
+		int count = epoll_wait(fleet->epoll_fd, events, MAX_EVENTS,
+				(remaining + 999999) / 1000000);
+		int input = 0;
+		for (int i = 0; i < count; ++i) {
+			if (events[i].data.u64 == EVENT_LISTEN)
+				fleet_accept(fleet);
+			else if (events[i].data.u64 == EVENT_INPUT)
+				input = 1;
+			else if (fleet->connections[events[i].data.u64].fd >= 0)
+				fleet_receive(fleet, events[i].data.u64);
+		}
+		if (input)
+			return 1;
+		if (count <= 0 && monotonic_ns() >= deadline)
+			return 0;
+	}
+}
+
+void fleet_totals(const struct fleet_t *fleet, struct fleet_totals_t *totals)
+{
+	memset(totals, 0, sizeof(struct fleet_totals_t));
+	double cpus = 0.0;
+	for (int n = 0; n < fleet->node_count; ++n) {
+		const struct fleet_node_t *node = &fleet->nodes[n];
+		if (!node->connected) {
+			++totals->nodes_down;
+			continue;
+		}
+		if (!node->has_sample)
+			continue;
+		++totals->nodes_up;
+		cpus += node->values[EXPORT_CPU_COUNT];
+		for (int m = 0; m < EXPORT_METRIC_COUNT; ++m) {
+			const double value = node->values[m] * export_metric(m)->scale;
+			switch (export_metric(m)->combine) {
+				case EXPORT_COMBINE_SUM:
+					totals->values[m] += value;
+					break;
+				case EXPORT_COMBINE_MAX:
+					if (value > totals->values[m])
+						totals->values[m] = value;
+					break;
+				case EXPORT_COMBINE_CPU_AVERAGE:
+					totals->values[m] += value * node->values[EXPORT_CPU_COUNT];
+					break;
+			}
+		}
+	}
+	for (int m = 0; m < EXPORT_METRIC_COUNT; ++m)
+		if (export_metric(m)->combine == EXPORT_COMBINE_CPU_AVERAGE && cpus > 0)
+			totals->values[m] /= cpus;
+}
@@ -0,0 +1,80 @@
+#ifndef AGGREGATE_H_INCLUDED
+#define AGGREGATE_H_INCLUDED
+
+#include "export.h"
+
+#define MAX_NODE_ADDRESS_LENGTH 63
+
+/** A node that streams its samples to us (see export.h) */
+struct fleet_node_t
+{
+	char name[EXPORT_MAX_HOSTNAME_LENGTH + 1]; /**< From its hello */
+	char address[MAX_NODE_ADDRESS_LENGTH + 1]; /**< "ip:port" of the
+												 last connection */
+	int connected; /**< A connection sends its samples */
+	int has_sample; /**< values are valid */
+
+	long long time_ms; /**< The time of the last sample (ms since the epoch) */
+	long long values[EXPORT_METRIC_COUNT]; /**< The last sample */
+	long long last_seen; /**< CLOCK_MONOTONIC time of the last frame (ns) */
+
+	long long first_seen; /**< CLOCK_MONOTONIC time of its first hello (ns) */
+	unsigned long long bytes_received; /**< Since it first connected */
+	unsigned long long sample_count;
+};
+
+/** A connection to the aggregator */
+struct fleet_connection_t
+{
+	int fd; /**< -1 if this entry is free */
+	int node; /**< The index of its node, -1 before the hello */
+	char address[MAX_NODE_ADDRESS_LENGTH + 1];
+	int metric_count; /**< The number of metrics in its samples */
+	long long last[1 + EXPORT_METRIC_COUNT]; /**< The time and the metrics
+											   of the last sample */
+
+	unsigned char *buffer; /**< Received bytes that aren't a whole frame yet */
+	int buffer_used;
+};
+
+/** The receiving side: all nodes and their connections */
+struct fleet_t
+{
+	int listen_fd;
+	int epoll_fd;
+	int input_fd; /**< Waiting stops when it is readable, -1 for none */
+
+	int node_count;
+	struct fleet_node_t *nodes;
+	int max_node_count;
+
+	int connection_count;
+	struct fleet_connection_t *connections;
+	int max_connection_count;
+};
+
+/** Combined values of the connected nodes */
+struct fleet_totals_t
+{
+	int nodes_up; /**< Connected nodes with a sample */
+	int nodes_down; /**< Nodes that disconnected */
+	double values[EXPORT_METRIC_COUNT]; /**< In the units of the log, see
+										  struct export_metric_t */
+};
+
+/** Listen on "[host:]port" and also wait on input_fd (e.g. stdin).
+ * Returns 0 on success, 1 for an invalid address and 2 if it can't
+ * be listened on */
+int fleet_init(struct fleet_t *fleet, const char *address, int input_fd);
+
+/** Close all connections and free the memory */
+void fleet_delete(struct fleet_t *fleet);
+
+/** Accept connections and receive samples for up to timeout_ns.
+ * Returns 1 if input_fd became readable before that, 0 otherwise */
+int fleet_wait(struct fleet_t *fleet, long long timeout_ns);
+
+/** Combine the last samples of the connected nodes */
+void fleet_totals(const struct fleet_t *fleet, struct fleet_totals_t *totals);
+
+#endif
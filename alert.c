@@ -0,0 +1,807 @@
+#define _GNU_SOURCE
+
+#include "alert.h"
+#include "system.h"
+#include "util.h"
+#include "cpu.h"
+#include "disk.h"
+#include "interface.h"
+#include "psi.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// What a slot is
+enum {
+	SOURCE_CPU_USAGE,
+	SOURCE_CPU_FREQUENCY,
+	SOURCE_CPU_TEMPERATURE,
+	SOURCE_RAM_USED,
+	SOURCE_RAM_BUFFERS,
+	SOURCE_RAM_CACHED,
+	SOURCE_DISK_READ,
+	SOURCE_DISK_WRITE,
+	SOURCE_IFACE_READ,
+	SOURCE_IFACE_WRITE,
+	SOURCE_PSI_SOME,
+	SOURCE_PSI_FULL
+};
+
+// How the values of many CPUs or devices are combined
+enum {
+	REDUCE_NONE, // A single value
+	REDUCE_ANY, // Replaced by MAX or MIN when the comparison is known
+	REDUCE_ALL,
+	REDUCE_MAX,
+	REDUCE_MIN,
+	REDUCE_AVG,
+	REDUCE_SUM
+};
+
+static const char * const reduce_names[] = {
+	"", "any", "all", "max", "min", "avg", "sum"
+};
+
+enum {
+	ALERT_OP_GT,
+	ALERT_OP_GE,
+	ALERT_OP_LT,
+	ALERT_OP_LE,
+	ALERT_OP_AND,
+	ALERT_OP_OR
+};
+
+static const char * const psi_names[PSI_RESOURCE_COUNT] = {
+	"cpu", "memory", "io"
+};
+
+void alert_set_init(struct alert_set_t *alerts)
+{
+	memset(alerts, 0, sizeof(struct alert_set_t));
+	sigprocmask(SIG_SETMASK, NULL, &alerts->exec_mask);
+}
+
+void alert_set_delete(struct alert_set_t *alerts)
+{
+	for (int r = 0; r < alerts->rule_count; ++r) {
+		for (int a = 0; a < alerts->rules[r].action_count; ++a)
+			free(alerts->rules[r].actions[a].command);
+		free(alerts->rules[r].actions);
+	}
+	for (int f = 0; f < alerts->file_count; ++f) {
+		fclose(alerts->files[f].file);
+		free(alerts->files[f].path);
+	}
+	free(alerts->files);
+	free(alerts->rules);
+	free(alerts->instructions);
+	free(alerts->slots);
+}
+
+
+// The state of the parser of a rule
+struct parser_t
+{
+	const char *s;
+	struct alert_set_t *alerts;
+	struct alert_rule_t *rule;
+	char *error;
+	int error_size;
+};
+
+#define PARSE_ERROR(parser, ...) { \
+	snprintf((parser)->error, (parser)->error_size, __VA_ARGS__); \
+	return 1; }
+
+static void skip_space(struct parser_t *p)
+{
+	while (isspace((unsigned char)*p->s))
+		++p->s;
+}
+
+static int is_word_char(char c)
+{
+	return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '*' ||
+		c == '-' || c == '@';
+}
+
+// Read a word (a keyword, a name or a value) into out
+static int parse_word(struct parser_t *p, char *out, int size)
+{
+	skip_space(p);
+	int len = 0;
+	while (is_word_char(p->s[len]))
+		++len;
+	if (len == 0)
+		PARSE_ERROR(p, "Expected a word at \"%s\"", p->s);
+	if (len >= size)
+		PARSE_ERROR(p, "Too long: \"%.*s\"", len, p->s);
+	memcpy(out, p->s, len);
+	out[len] = '\0';
+	p->s += len;
+	return 0;
+}
+
+// Consume keyword if it is next
+static int accept_keyword(struct parser_t *p, const char *keyword)
+{
+	skip_space(p);
+	const int len = strlen(keyword);
+	if (strncmp(p->s, keyword, len) || is_word_char(p->s[len]))
+		return 0;
+	p->s += len;
+	return 1;
+}
+
+// A number with an optional unit, e.g. 95, 95%, 1.5GiB or 100M/s
+static int parse_number(struct parser_t *p, double *value)
+{
+	skip_space(p);
+	char *end;
+	*value = strtod(p->s, &end);
+	if (end == p->s)
+		PARSE_ERROR(p, "Expected a number at \"%s\"", p->s);
+	p->s = end;
+
+	static const struct {
+		const char *unit;
+		double scale;
+	} units[] = {
+		{ "KiB", 1024.0 }, { "MiB", 1048576.0 },
+		{ "GiB", 1073741824.0 }, { "TiB", 1099511627776.0 },
+		{ "K", 1e3 }, { "M", 1e6 }, { "G", 1e9 }, { "T", 1e12 },
+		{ "%", 1.0 }, { "B", 1.0 }
+	};
+	for (unsigned u = 0; u < sizeof(units) / sizeof(units[0]); ++u) {
+		const int len = strlen(units[u].unit);
+		if (!strncmp(p->s, units[u].unit, len)) {
+			*value *= units[u].scale;
+			p->s += len;
+			// "GiB" may be followed by "B" in "GB"
+			if (len == 1 && *p->s == 'B')
+				++p->s;
+			break;
+		}
+	}
+	if (!strncmp(p->s, "/s", 2))
+		p->s += 2;
+	return 0;
+}
+
+// A duration like 500ms, 10s, 5m or 1h, in ns
+static int parse_duration(struct parser_t *p, long long *ns)
+{
+	skip_space(p);
+	char *end;
+	double value = strtod(p->s, &end);
+	if (end == p->s || value < 0)
+		PARSE_ERROR(p, "Expected a duration at \"%s\"", p->s);
+	double scale;
+	if (!strncmp(end, "ms", 2)) {
+		scale = 1e6;
+		end += 2;
+	} else if (*end == 's') {
+		scale = 1e9;
+		++end;
+	} else if (*end == 'm') {
+		scale = 60e9;
+		++end;
+	} else if (*end == 'h') {
+		scale = 3600e9;
+		++end;
+	} else {
+		PARSE_ERROR(p, "Expected ms, s, m or h after the duration");
+	}
+	*ns = value * scale;
+	p->s = end;
+	return 0;
+}
+
+// A string in double quotes, where \" and \\ are escaped
+static int parse_string(struct parser_t *p, char **out)
+{
+	skip_space(p);
+	if (*p->s != '"')
+		PARSE_ERROR(p, "Expected a string in quotes at \"%s\"", p->s);
+	++p->s;
+	char *value = (char *)malloc(strlen(p->s) + 1);
+	int len = 0;
+	while (*p->s && *p->s != '"') {
+		if (*p->s == '\\' && p->s[1])
+			++p->s;
+		value[len++] = *p->s++;
+	}
+	value[len] = '\0';
+	if (*p->s != '"') {
+		free(value);
+		PARSE_ERROR(p, "Missing the closing quote");
+	}
+	++p->s;
+	*out = value;
+	return 0;
+}
+
+// Parse a value like cpu.usage, cpu3.temp or disk.sda.write into slot
+static int parse_value(struct parser_t *p, const char *value,
+		struct alert_slot_t *slot)
+{
+	memset(slot, 0, sizeof(struct alert_slot_t));
+	slot->id = -1;
+	slot->device_index = -1;
+	const char *field = strrchr(value, '.');
+	if (field == NULL)
+		PARSE_ERROR(p, "Unknown value %s", value);
+	++field;
+
+	if (!strncmp(value, "cpu", 3) && (value[3] == '.' || isdigit(value[3]))) {
+		if (value[3] != '.')
+			slot->id = atoi(value + 3);
+		if (!strcmp(field, "usage"))
+			slot->source = SOURCE_CPU_USAGE;
+		else if (!strcmp(field, "freq"))
+			slot->source = SOURCE_CPU_FREQUENCY;
+		else if (!strcmp(field, "temp"))
+			slot->source = SOURCE_CPU_TEMPERATURE;
+		else
+			PARSE_ERROR(p, "Unknown value %s", value);
+		slot->reduce = slot->id == -1 ? REDUCE_ANY : REDUCE_NONE;
+		return 0;
+	}
+	if (!strncmp(value, "ram.", 4)) {
+		if (!strcmp(field, "used"))
+			slot->source = SOURCE_RAM_USED;
+		else if (!strcmp(field, "buffers"))
+			slot->source = SOURCE_RAM_BUFFERS;
+		else if (!strcmp(field, "cached"))
+			slot->source = SOURCE_RAM_CACHED;
+		else
+			PARSE_ERROR(p, "Unknown value %s", value);
+		return 0;
+	}
+	if (!strncmp(value, "psi.", 4)) {
+		for (int r = 0; r < PSI_RESOURCE_COUNT; ++r) {
+			const int len = strlen(psi_names[r]);
+			if (!strncmp(value + 4, psi_names[r], len) &&
+					value + 4 + len + 1 == field)
+				slot->id = r;
+		}
+		if (slot->id == -1)
+			PARSE_ERROR(p, "Unknown value %s", value);
+		if (!strcmp(field, "some"))
+			slot->source = SOURCE_PSI_SOME;
+		else if (!strcmp(field, "full"))
+			slot->source = SOURCE_PSI_FULL;
+		else
+			PARSE_ERROR(p, "Unknown value %s", value);
+		return 0;
+	}
+
+	// disk.NAME.FIELD and iface.NAME.FIELD, where NAME may contain dots
+	int read_source, write_source, prefix;
+	const char *read_name, *write_name;
+	if (!strncmp(value, "disk.", 5)) {
+		prefix = 5;
+		read_source = SOURCE_DISK_READ;
+		write_source = SOURCE_DISK_WRITE;
+		read_name = "read";
+		write_name = "write";
+	} else if (!strncmp(value, "iface.", 6)) {
+		prefix = 6;
+		read_source = SOURCE_IFACE_READ;
+		write_source = SOURCE_IFACE_WRITE;
+		read_name = "rx";
+		write_name = "tx";
+	} else {
+		PARSE_ERROR(p, "Unknown value %s", value);
+	}
+	const int len = field - 1 - (value + prefix);
+	if (len <= 0 || len >= (int)sizeof(slot->device))
+		PARSE_ERROR(p, "Invalid device in %s", value);
+	if (!strcmp(field, read_name))
+		slot->source = read_source;
+	else if (!strcmp(field, write_name))
+		slot->source = write_source;
+	else
+		PARSE_ERROR(p, "Unknown value %s", value);
+	if (len == 1 && value[prefix] == '*') {
+		slot->reduce = REDUCE_ANY;
+	} else {
+		memcpy(slot->device, value + prefix, len);
+		slot->device[len] = '\0';
+	}
+	return 0;
+}
+
+// The index of a slot like this one, which is added if there is none
+static int alert_find_slot(struct alert_set_t *alerts,
+		const struct alert_slot_t *slot)
+{
+	for (int i = 0; i < alerts->slot_count; ++i) {
+		const struct alert_slot_t *s = &alerts->slots[i];
+		if (s->source == slot->source && s->reduce == slot->reduce &&
+				s->id == slot->id && !strcmp(s->device, slot->device))
+			return i;
+	}
+	if (alerts->slot_count == alerts->max_slot_count) {
+		alerts->max_slot_count += 128;
+		alerts->slots = (struct alert_slot_t *)realloc(alerts->slots,
+				sizeof(struct alert_slot_t) * alerts->max_slot_count);
+	}
+	alerts->slots[alerts->slot_count] = *slot;
+	alerts->slots[alerts->slot_count].value = NAN;
+	return alerts->slot_count++;
+}
+
+static int alert_emit(struct parser_t *p, int op, int slot,
+		double threshold, double clear)
+{
+	struct alert_set_t *alerts = p->alerts;
+	if (p->rule->instruction_count == MAX_ALERT_INSTRUCTIONS)
+		PARSE_ERROR(p, "The condition is too long");
+	if (alerts->instruction_count == alerts->max_instruction_count) {
+		alerts->max_instruction_count += 128;
+		alerts->instructions = (struct alert_instruction_t *)realloc(
+				alerts->instructions, sizeof(struct alert_instruction_t) *
+				alerts->max_instruction_count);
+	}
+	struct alert_instruction_t *instruction =
+		&alerts->instructions[alerts->instruction_count++];
+	instruction->op = op;
+	instruction->slot = slot;
+	instruction->threshold = threshold;
+	instruction->clear = clear;
+	++p->rule->instruction_count;
+	return 0;
+}
+
+static int parse_or(struct parser_t *p);
+
+// (CONDITION) or [REDUCE(]VALUE[)] OP NUMBER [clear NUMBER]
+static int parse_comparison(struct parser_t *p)
+{
+	skip_space(p);
+	if (*p->s == '(') {
+		++p->s;
+		if (parse_or(p))
+			return 1;
+		skip_space(p);
+		if (*p->s != ')')
+			PARSE_ERROR(p, "Expected ) at \"%s\"", p->s);
+		++p->s;
+		return 0;
+	}
+
+	char word[64], value[64];
+	const char *start = p->s;
+	if (parse_word(p, word, sizeof(word)))
+		return 1;
+	int reduce = REDUCE_ANY;
+	if (*p->s == '(') {
+		reduce = -1;
+		for (int r = REDUCE_ANY; r <= REDUCE_SUM; ++r)
+			if (!strcmp(word, reduce_names[r]))
+				reduce = r;
+		if (reduce == -1)
+			PARSE_ERROR(p, "Unknown function %s", word);
+		++p->s;
+		if (parse_word(p, value, sizeof(value)))
+			return 1;
+		skip_space(p);
+		if (*p->s != ')')
+			PARSE_ERROR(p, "Expected ) at \"%s\"", p->s);
+		++p->s;
+	} else {
+		strcpy(value, word);
+	}
+	struct alert_slot_t slot;
+	if (parse_value(p, value, &slot))
+		return 1;
+
+	skip_space(p);
+	int op;
+	if (!strncmp(p->s, ">=", 2))
+		op = ALERT_OP_GE;
+	else if (!strncmp(p->s, "<=", 2))
+		op = ALERT_OP_LE;
+	else if (*p->s == '>')
+		op = ALERT_OP_GT;
+	else if (*p->s == '<')
+		op = ALERT_OP_LT;
+	else
+		PARSE_ERROR(p, "Expected >, >=, < or <= at \"%s\"", p->s);
+	p->s += op == ALERT_OP_GE || op == ALERT_OP_LE ? 2 : 1;
+
+	// any() holds if the largest value is above the threshold,
+	// or the smallest is below it. all() is the other way round
+	if (slot.reduce != REDUCE_NONE) {
+		const int above = op == ALERT_OP_GT || op == ALERT_OP_GE;
+		if (reduce == REDUCE_ANY)
+			reduce = above ? REDUCE_MAX : REDUCE_MIN;
+		else if (reduce == REDUCE_ALL)
+			reduce = above ? REDUCE_MIN : REDUCE_MAX;
+		slot.reduce = reduce;
+	}
+
+	double threshold, clear;
+	if (parse_number(p, &threshold))
+		return 1;
+	clear = threshold;
+	if (accept_keyword(p, "clear") && parse_number(p, &clear))
+		return 1;
+
+	const int index = alert_find_slot(p->alerts, &slot);
+	if (p->rule->instruction_count == 0) {
+		snprintf(p->rule->subject, sizeof(p->rule->subject), "%.*s",
+				(int)(p->s - start), start);
+		// Only the value itself
+		char *op_start = strpbrk(p->rule->subject, "<>");
+		if (op_start) {
+			while (op_start > p->rule->subject && op_start[-1] == ' ')
+				--op_start;
+			*op_start = '\0';
+		}
+		p->rule->subject_slot = index;
+	}
+	return alert_emit(p, op, index, threshold, clear);
+}
+
+// COMPARISON [and COMPARISON]...
+static int parse_and(struct parser_t *p)
+{
+	if (parse_comparison(p))
+		return 1;
+	while (accept_keyword(p, "and"))
+		if (parse_comparison(p) || alert_emit(p, ALERT_OP_AND, -1, 0, 0))
+			return 1;
+	return 0;
+}
+
+// AND [or AND]...
+static int parse_or(struct parser_t *p)
+{
+	if (parse_and(p))
+		return 1;
+	while (accept_keyword(p, "or"))
+		if (parse_and(p) || alert_emit(p, ALERT_OP_OR, -1, 0, 0))
+			return 1;
+	return 0;
+}
+
+// The index of the event file called path, which is opened if needed
+static int alert_find_file(struct alert_set_t *alerts, const char *path)
+{
+	for (int f = 0; f < alerts->file_count; ++f)
+		if (!strcmp(alerts->files[f].path, path))
+			return f;
+	FILE *file = fopen(path, "ae");
+	if (file == NULL)
+		return -1;
+	alerts->files = (struct alert_file_t *)realloc(alerts->files,
+			sizeof(struct alert_file_t) * (alerts->file_count + 1));
+	alerts->files[alerts->file_count].path = strdup(path);
+	alerts->files[alerts->file_count].file = file;
+	return alerts->file_count++;
+}
+
+static int parse_actions(struct parser_t *p)
+{
+	struct alert_rule_t *rule = p->rule;
+	for (;;) {
+		skip_space(p);
+		if (*p->s == '\0')
+			break;
+		struct alert_action_t action;
+		action.command = NULL;
+		action.file = -1;
+		if (accept_keyword(p, "exec")) {
+			action.type = ALERT_EXEC;
+			if (parse_string(p, &action.command))
+				return 1;
+		} else if (accept_keyword(p, "event")) {
+			action.type = ALERT_EVENT;
+			char *path;
+			if (parse_string(p, &path))
+				return 1;
+			action.file = alert_find_file(p->alerts, path);
+			if (action.file < 0) {
+				snprintf(p->error, p->error_size, "Can't open %s", path);
+				free(path);
+				return 1;
+			}
+			free(path);
+		} else if (accept_keyword(p, "burst")) {
+			action.type = ALERT_BURST;
+		} else {
+			PARSE_ERROR(p, "Unknown action at \"%s\"", p->s);
+		}
+		rule->actions = (struct alert_action_t *)realloc(rule->actions,
+				sizeof(struct alert_action_t) * (rule->action_count + 1));
+		rule->actions[rule->action_count++] = action;
+	}
+	if (rule->action_count == 0)
+		PARSE_ERROR(p, "No actions after do");
+	return 0;
+}
+
+int alert_add_rule(struct alert_set_t *alerts, const char *text,
+		char *error, int error_size)
+{
+	if (alerts->rule_count == alerts->max_rule_count) {
+		alerts->max_rule_count += 128;
+		alerts->rules = (struct alert_rule_t *)realloc(alerts->rules,
+				sizeof(struct alert_rule_t) * alerts->max_rule_count);
+	}
+	struct alert_rule_t *rule = &alerts->rules[alerts->rule_count];
+	memset(rule, 0, sizeof(struct alert_rule_t));
+	rule->first_instruction = alerts->instruction_count;
+
+	struct parser_t parser = { text, alerts, rule, error, error_size };
+	struct parser_t *p = &parser;
+
+	// An optional "NAME:"
+	skip_space(p);
+	int len = 0;
+	while (is_word_char(p->s[len]))
+		++len;
+	if (len > 0 && p->s[len] == ':') {
+		memcpy(rule->name, p->s, len < MAX_ALERT_NAME_LENGTH ? len :
+				MAX_ALERT_NAME_LENGTH);
+		p->s += len + 1;
+	} else {
+		snprintf(rule->name, sizeof(rule->name), "rule%d",
+				alerts->rule_count + 1);
+	}
+
+	int ret = parse_or(p);
+	if (!ret && accept_keyword(p, "for"))
+		ret = parse_duration(p, &rule->duration);
+	if (!ret && !accept_keyword(p, "do")) {
+		snprintf(error, error_size, "Expected do at \"%s\"", p->s);
+		ret = 1;
+	}
+	if (!ret)
+		ret = parse_actions(p);
+	if (ret) {
+		// Forget the instructions of the rule. Its slots may stay
+		for (int a = 0; a < rule->action_count; ++a)
+			free(rule->actions[a].command);
+		free(rule->actions);
+		alerts->instruction_count = rule->first_instruction;
+		return 1;
+	}
+	++alerts->rule_count;
+	return 0;
+}
+
+int alert_add_rule_file(struct alert_set_t *alerts, const char *filename,
+		char *error, int error_size)
+{
+	FILE *file = fopen(filename, "re");
+	if (file == NULL) {
+		snprintf(error, error_size, "Can't open %s", filename);
+		return 1;
+	}
+	char line[1024];
+	int line_number = 0;
+	int ret = 0;
+	while (!ret && fgets(line, sizeof(line), file)) {
+		++line_number;
+		line[strcspn(line, "\r\n")] = '\0';
+		const char *s = line;
+		while (isspace((unsigned char)*s))
+			++s;
+		if (*s == '\0' || *s == '#')
+			continue;
+		char rule_error[256];
+		ret = alert_add_rule(alerts, s, rule_error, sizeof(rule_error));
+		if (ret)
+			snprintf(error, error_size, "%s:%d: %s", filename, line_number,
+					rule_error);
+	}
+	fclose(file);
+	return ret;
+}
+
+
+// The value of a source for CPU, disk, interface or PSI resource i
+static double alert_source_value(int source, const struct system_t *system,
+		int i)
+{
+	switch (source) {
+		case SOURCE_CPU_USAGE:
+			return system->cpu_counters->usage[i] * 100.0;
+		case SOURCE_CPU_FREQUENCY:
+			return system->cpu_counters->freq[i];
+		case SOURCE_CPU_TEMPERATURE:
+			return system->cpus[i].cur_temp / 1000.0;
+		case SOURCE_RAM_USED:
+			return system->ram_used;
+		case SOURCE_RAM_BUFFERS:
+			return system->ram_buffers;
+		case SOURCE_RAM_CACHED:
+			return system->ram_cached;
+		case SOURCE_DISK_READ:
+			return system->disks[i].stats_rate[DISK_READ_SECTORS] *
+				DISK_SECTOR_SIZE;
+		case SOURCE_DISK_WRITE:
+			return system->disks[i].stats_rate[DISK_WRITE_SECTORS] *
+				DISK_SECTOR_SIZE;
+		case SOURCE_IFACE_READ:
+			return system->interfaces[i].rx_rate;
+		case SOURCE_IFACE_WRITE:
+			return system->interfaces[i].tx_rate;
+		case SOURCE_PSI_SOME:
+			return system->psi ? system->psi[i].some.stall * 100.0 : NAN;
+		case SOURCE_PSI_FULL:
+			return system->psi ? system->psi[i].full.stall * 100.0 : NAN;
+	}
+	return NAN;
+}
+
+// The number of CPUs or devices that source has values for
+static int alert_source_count(int source, const struct system_t *system)
+{
+	if (source <= SOURCE_CPU_TEMPERATURE)
+		return system->cpu_count;
+	if (source == SOURCE_DISK_READ || source == SOURCE_DISK_WRITE)
+		return system->disk_count;
+	if (source == SOURCE_IFACE_READ || source == SOURCE_IFACE_WRITE)
+		return system->interface_count;
+	return 1;
+}
+
+// The index of the disk or interface of a slot, -1 if it is gone
+static int alert_device_index(struct alert_slot_t *slot,
+		const struct system_t *system)
+{
+	const int disk = slot->source == SOURCE_DISK_READ ||
+		slot->source == SOURCE_DISK_WRITE;
+	const int count = disk ? system->disk_count : system->interface_count;
+	// The devices rarely change, so it usually is where it was
+	const int i = slot->device_index;
+	if (i >= 0 && i < count && !strcmp(slot->device,
+				disk ? system->disks[i].name : system->interfaces[i].name))
+		return i;
+	slot->device_index = -1;
+	for (int d = 0; d < count; ++d)
+		if (!strcmp(slot->device, disk ?
+					system->disks[d].name : system->interfaces[d].name))
+			slot->device_index = d;
+	return slot->device_index;
+}
+
+static void alert_fill_slot(struct alert_slot_t *slot,
+		const struct system_t *system)
+{
+	if (slot->reduce == REDUCE_NONE) {
+		int i = 0;
+		if (slot->source <= SOURCE_CPU_TEMPERATURE) {
+			const struct cpu_counters_t *counters = system->cpu_counters;
+			i = slot->id < counters->index_count ?
+				counters->index[slot->id] : -1;
+		} else if (slot->device[0]) {
+			i = alert_device_index(slot, system);
+		} else if (slot->source >= SOURCE_PSI_SOME) {
+			i = slot->id;
+		}
+		slot->value = i >= 0 ? alert_source_value(slot->source, system, i) : NAN;
+		return;
+	}
+
+	const int count = alert_source_count(slot->source, system);
+	double result = NAN;
+	for (int i = 0; i < count; ++i) {
+		const double v = alert_source_value(slot->source, system, i);
+		if (i == 0)
+			result = v;
+		else if (slot->reduce == REDUCE_MAX)
+			result = v > result ? v : result;
+		else if (slot->reduce == REDUCE_MIN)
+			result = v < result ? v : result;
+		else
+			result += v;
+	}
+	if (slot->reduce == REDUCE_AVG && count > 0)
+		result /= count;
+	slot->value = result;
+}
+
+// Run exec and event actions
+static void alert_notify(struct alert_set_t *alerts,
+		const struct alert_rule_t *rule, const char *state)
+{
+	const double value = alerts->slots[rule->subject_slot].value;
+	for (int a = 0; a < rule->action_count; ++a) {
+		const struct alert_action_t *action = &rule->actions[a];
+		if (action->type == ALERT_EVENT) {
+			time_t now = time(NULL);
+			struct tm tm;
+			localtime_r(&now, &tm);
+			char timestamp[32];
+			strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm);
+			FILE *file = alerts->files[action->file].file;
+			fprintf(file, "%s %s %s %s=%g\n", timestamp, rule->name, state,
+					rule->subject, value);
+			flush_file(file);
+		} else if (action->type == ALERT_EXEC) {
+			const pid_t pid = fork();
+			if (pid > 0)
+				++alerts->running_count;
+			if (pid == 0) {
+				// Not the signals blocked for the loop's signalfd, nor the
+				// SIGPIPE ignored for the stream
+				signal(SIGPIPE, SIG_DFL);
+				sigprocmask(SIG_SETMASK, &alerts->exec_mask, NULL);
+				char value_string[32];
+				snprintf(value_string, sizeof(value_string), "%g", value);
+				setenv("SMON_ALERT", rule->name, 1);
+				setenv("SMON_ALERT_STATE", state, 1);
+				setenv("SMON_ALERT_VALUE", value_string, 1);
+				execl("/bin/sh", "sh", "-c", action->command, (char *)NULL);
+				_exit(127);
+			}
+		}
+	}
+}
+
+int alert_evaluate(struct alert_set_t *alerts, const struct system_t *system)
+{
+	// Reap the commands that have finished
+	while (alerts->running_count > 0 && waitpid(-1, NULL, WNOHANG) > 0)
+		--alerts->running_count;
+
+	for (int s = 0; s < alerts->slot_count; ++s)
+		alert_fill_slot(&alerts->slots[s], system);
+
+	const long long now = system->timestamp;
+	int burst = 0;
+	for (int r = 0; r < alerts->rule_count; ++r) {
+		struct alert_rule_t *rule = &alerts->rules[r];
+		const struct alert_instruction_t *instruction =
+			&alerts->instructions[rule->first_instruction];
+		// Comparisons with NAN (a missing device) are false
+		char stack[MAX_ALERT_INSTRUCTIONS];
+		int top = 0;
+		for (int i = 0; i < rule->instruction_count; ++i, ++instruction) {
+			const double v = alerts->slots[instruction->slot < 0 ? 0 :
+				instruction->slot].value;
+			const double t = rule->firing ?
+				instruction->clear : instruction->threshold;
+			switch (instruction->op) {
+				case ALERT_OP_GT: stack[top++] = v > t; break;
+				case ALERT_OP_GE: stack[top++] = v >= t; break;
+				case ALERT_OP_LT: stack[top++] = v < t; break;
+				case ALERT_OP_LE: stack[top++] = v <= t; break;
+				case ALERT_OP_AND: --top; stack[top - 1] &= stack[top]; break;
+				case ALERT_OP_OR: --top; stack[top - 1] |= stack[top]; break;
+			}
+		}
+
+		if (stack[0]) {
+			if (rule->since == 0)
+				rule->since = now;
+			if (!rule->firing && now - rule->since >= rule->duration) {
+				rule->firing = 1;
+				++rule->fire_count;
+				++alerts->firing_count;
+				alert_notify(alerts, rule, "firing");
+				for (int a = 0; a < rule->action_count; ++a)
+					burst |= rule->actions[a].type == ALERT_BURST;
+			}
+		} else {
+			rule->since = 0;
+			if (rule->firing) {
+				rule->firing = 0;
+				--alerts->firing_count;
+				alert_notify(alerts, rule, "cleared");
+			}
+		}
+	}
+	return burst;
+}
@@ -0,0 +1,150 @@
+#ifndef ALERT_H_INCLUDED
+#define ALERT_H_INCLUDED
+
+#include <stdio.h>
+#include <signal.h>
+
+/*
+ * Alert rules, e.g.
+ *
+ *   hot: any(cpu.usage) > 95 clear 90 for 10s do event "alerts.log" burst
+ *   disk.nvme0n1.write > 1GiB do exec "notify-send 'disk busy'"
+ *
+ * A rule is [NAME:] CONDITION [for DURATION] do ACTION...
+ *
+ * CONDITION compares values with > >= < <=, combined with and, or and
+ * parentheses. A comparison may have a clear threshold for hysteresis:
+ * once the rule is firing, the comparison uses it instead (e.g. the
+ * rule above clears when no CPU is above 90%). The rule fires when the
+ * condition has held for DURATION (e.g. 500ms, 10s, 5m) and clears as
+ * soon as it doesn't.
+ *
+ * Values are cpu[N].{usage,freq,temp}, ram.{used,buffers,cached},
+ * disk.NAME.{read,write}, iface.NAME.{rx,tx} and
+ * psi.{cpu,memory,io}.{some,full}, in %, KHz, C and bytes (per second).
+ * NAME can be * for all devices. Values of many CPUs or devices are
+ * combined with any(), all(), max(), min(), avg() or sum(), any() by
+ * default. Numbers can have the units K, M, G, T (powers of 1000) or
+ * KiB, MiB, GiB, TiB (powers of 1024), optionally followed by /s.
+ *
+ * ACTION is exec "COMMAND" (run with sh, SMON_ALERT, SMON_ALERT_STATE
+ * and SMON_ALERT_VALUE are set), event "FILE" (append a line) or burst
+ * (sample every 100ms for a while, like a PSI trigger). exec and event
+ * run when the rule fires and when it clears.
+ *
+ * Rules are compiled once. Every value that a rule reads gets a slot,
+ * shared by all rules that read it, and every tick the slots are filled
+ * in once, then each rule runs a few instructions over them.
+ */
+
+#define MAX_ALERT_NAME_LENGTH 31
+#define MAX_ALERT_INSTRUCTIONS 32
+
+struct system_t;
+
+/** A value that rules read */
+struct alert_slot_t
+{
+	int source; /**< What the value is, see alert.c */
+	int reduce; /**< How the values of many devices are combined */
+	int id; /**< N of cpuN (-1 for all CPUs) or the PSI resource */
+	char device[32]; /**< The disk or interface, "" for all of them */
+	int device_index; /**< Where device was found the last time */
+	double value; /**< NAN if there is no such device */
+};
+
+/** An instruction of a rule */
+struct alert_instruction_t
+{
+	int op; /**< ALERT_OP_* in alert.c */
+	int slot; /**< The slot that a comparison reads */
+	double threshold; /**< Used by a comparison while the rule is clear */
+	double clear; /**< Used while the rule is firing */
+};
+
+/** Something to do when a rule fires or clears */
+struct alert_action_t
+{
+	int type; /**< ALERT_EXEC, ALERT_EVENT or ALERT_BURST */
+	char *command; /**< For ALERT_EXEC */
+	int file; /**< For ALERT_EVENT, an index in alert_set_t::files */
+};
+
+/** A file that events are appended to */
+struct alert_file_t
+{
+	char *path;
+	FILE *file;
+};
+
+enum {
+	ALERT_EXEC,
+	ALERT_EVENT,
+	ALERT_BURST
+};
+
+struct alert_rule_t
+{
+	char name[MAX_ALERT_NAME_LENGTH + 1];
+	int first_instruction; /**< In alert_set_t::instructions */
+	int instruction_count; /**< At most MAX_ALERT_INSTRUCTIONS */
+	long long duration; /**< How long the condition must hold (ns) */
+
+	int action_count;
+	struct alert_action_t *actions;
+
+	char subject[48]; /**< The value of the first comparison, as written */
+	int subject_slot;
+
+	int firing;
+	long long since; /**< CLOCK_MONOTONIC time since the condition has
+					   held, 0 if it doesn't (ns) */
+	unsigned long long fire_count;
+};
+
+struct alert_set_t
+{
+	int rule_count;
+	struct alert_rule_t *rules;
+	int max_rule_count;
+
+	int instruction_count; /**< Of all rules, one after another */
+	struct alert_instruction_t *instructions;
+	int max_instruction_count;
+
+	int slot_count;
+	struct alert_slot_t *slots;
+	int max_slot_count;
+
+	int file_count;
+	struct alert_file_t *files;
+
+	int firing_count; /**< The number of rules that are firing */
+
+	sigset_t exec_mask; /**< The signal mask of the commands, the one of
+						  the process before the loop blocked signals */
+	int running_count; /**< Commands that haven't been reaped yet */
+};
+
+/** Must be called before the signals are blocked, the commands of exec
+ * actions are run with the signal mask of that time */
+void alert_set_init(struct alert_set_t *alerts);
+
+/** Compile a rule. Returns 0 on success, otherwise writes
+ * what is wrong with it to error */
+int alert_add_rule(struct alert_set_t *alerts, const char *rule,
+		char *error, int error_size);
+
+/** Compile the rules in a file, one per line. Empty lines and lines
+ * starting with # are skipped. Returns 0 on success */
+int alert_add_rule_file(struct alert_set_t *alerts, const char *filename,
+		char *error, int error_size);
+
+/** Evaluate all rules on the values of system and run the actions of
+ * those that fire or clear. Returns nonzero if a burst was asked for */
+int alert_evaluate(struct alert_set_t *alerts, const struct system_t *system);
+
+/** Close the event files and free the memory */
+void alert_set_delete(struct alert_set_t *alerts);
+
+#endif
@@ -0,0 +1,45 @@
+#include "arena.h"
+
+#include <stdlib.h>
+
+// Every allocation is aligned to this many bytes
+#define ARENA_ALIGNMENT 16
+
+int arena_init(struct arena_t *arena, size_t size)
+{
+	arena->used = 0;
+	arena->size = size;
+	arena->memory = size > 0 ? (char *)malloc(size) : NULL;
+	if (arena->memory == NULL)
+		arena->size = 0;
+	return size > 0 && arena->memory == NULL;
+}
+
+void arena_delete(struct arena_t *arena)
+{
+	free(arena->memory);
+	arena->memory = NULL;
+	arena->size = arena->used = 0;
+}
+
+size_t arena_size(size_t size)
+{
+	return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+void *arena_alloc(struct arena_t *arena, size_t size)
+{
+	size = arena_size(size);
+	if (size == 0 || arena->size - arena->used < size)
+		return NULL;
+	void *ptr = arena->memory + arena->used;
+	arena->used += size;
+	return ptr;
+}
+
+int arena_owns(const struct arena_t *arena, const void *ptr)
+{
+	const char *p = (const char *)ptr;
+	return arena->memory && p >= arena->memory &&
+		p < arena->memory + arena->size;
+}
@@ -0,0 +1,31 @@
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+#include <stddef.h>
+
+/** A single block of memory that is handed out in pieces and
+ * freed all at once */
+struct arena_t
+{
+	char *memory;
+	size_t size; /**< The size of memory in bytes */
+	size_t used; /**< How many bytes were handed out */
+};
+
+/** Allocate size bytes for the arena. Returns 0 on success */
+int arena_init(struct arena_t *arena, size_t size);
+
+/** Free all memory of the arena */
+void arena_delete(struct arena_t *arena);
+
+/** Returns size bytes from the arena, aligned for any type,
+ * or NULL if there is not enough space left */
+void *arena_alloc(struct arena_t *arena, size_t size);
+
+/** The space that arena_alloc() will need for size bytes */
+size_t arena_size(size_t size);
+
+/** Returns 1 if ptr points into the arena */
+int arena_owns(const struct arena_t *arena, const void *ptr);
+
+#endif
@@ -0,0 +1,377 @@
+#include "fixture.h"
+
+#include "../system.h"
+#include "../util.h"
+#include "../cpu.h"
+#include "../irq.h"
+#include "../interface.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define error(...) { fprintf(stderr, __VA_ARGS__); exit(-1); }
+
+#define MAX_COLLECTORS 32
+
+// How many times the CPU usage is computed for each version
+#define CPU_USAGE_PASSES 1000
+// and /proc/interrupts is parsed
+#define IRQ_PARSER_PASSES 20
+// and the busiest interfaces are found for smon --top
+#define TOP_PASSES 100
+#define TOP_COUNT 20
+
+// The allocator is interposed to count the allocations made by the
+// collectors, which must be 0 after the warm-up. glibc exports its
+// own implementation as __libc_*
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static int counting_allocations = 0;
+static unsigned long long allocation_count = 0;
+
+void *malloc(size_t size)
+{
+	allocation_count += counting_allocations;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	allocation_count += counting_allocations;
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocation_count += counting_allocations;
+	return __libc_realloc(ptr, size);
+}
+
+// Time cpu_counters_compute_usage() alone, with the SIMD and the scalar
+// version, on two consecutive samples. Returns 1 if their results differ
+static int bench_cpu_usage(struct system_t *system, struct fixture_t *fixture)
+{
+	struct cpu_counters_t *counters = system->cpu_counters;
+	const int n = counters->padded_count;
+	unsigned long long *last = (unsigned long long *)malloc(
+			sizeof(unsigned long long) * n * CPU_STATS_COUNT);
+	double *usage = (double *)malloc(sizeof(double) * n);
+
+	// Keep the current sample, then take the next one
+	for (int t = 0; t < CPU_STATS_COUNT; ++t)
+		memcpy(last + t * n, counters->last_times[t],
+				sizeof(unsigned long long) * n);
+	fixture_advance(fixture);
+	for (int c = 0; c < system_collector_count(); ++c)
+		if (!strcmp(system_collector_name(c), "cpus"))
+			system_refresh_collector(system, c);
+
+	// The previous tick is restored before each pass, so that
+	// every pass sees the same deltas, and the usage is cleared, so
+	// that a version that writes nothing can't match the other
+	int differ = 0;
+	for (int simd = 1; simd >= 0; --simd) {
+		const char *name = cpu_counters_use_simd(counters, simd);
+		long long ns = 0;
+		for (int pass = 0; pass < CPU_USAGE_PASSES; ++pass) {
+			for (int t = 0; t < CPU_STATS_COUNT; ++t)
+				memcpy(counters->last_times[t], last + t * n,
+						sizeof(unsigned long long) * n);
+			for (int c = 0; c < n; ++c)
+				counters->usage[c] = -1.0;
+			long long before = monotonic_ns();
+			cpu_counters_compute_usage(counters);
+			ns += monotonic_ns() - before;
+		}
+		printf("%-12s %14lld\n", name, ns / CPU_USAGE_PASSES);
+
+		if (simd)
+			memcpy(usage, counters->usage, sizeof(double) * n);
+		else
+			differ = memcmp(usage, counters->usage,
+					sizeof(double) * counters->count) != 0;
+	}
+
+	free(last);
+	free(usage);
+	return differ;
+}
+
+// Time the irqs collector with the SIMD and the scalar parser on the
+// same files. Returns 1 if they parse different counts
+static int bench_irq_parser(struct system_t *system)
+{
+	int collector = 0;
+	while (strcmp(system_collector_name(collector), "irqs"))
+		++collector;
+	struct irq_table_t *tables[] = {
+		&system->irqs->interrupts, &system->irqs->softirqs
+	};
+	size_t cells[2];
+	unsigned long long *counts[2];
+	for (int t = 0; t < 2; ++t) {
+		cells[t] = (size_t)tables[t]->row_count * system->cpu_count;
+		counts[t] = (unsigned long long *)malloc(
+				sizeof(unsigned long long) * cells[t]);
+	}
+
+	int differ = 0;
+	// SSE2 is forced on, it's only used on bigger machines otherwise
+	const int modes[] = { IRQ_SIMD_ALWAYS, IRQ_SIMD_OFF };
+	for (int m = 0; m < 2; ++m) {
+		const int simd = modes[m] != IRQ_SIMD_OFF;
+		const char *name = irq_use_simd(system->irqs, modes[m]);
+		long long ns = 0;
+		for (int pass = 0; pass < IRQ_PARSER_PASSES; ++pass) {
+			// Fill the counts with a value that no file has, so that
+			// a parser that writes nothing can't match the other
+			for (int t = 0; t < 2; ++t)
+				memset(tables[t]->counts, 0xff,
+						sizeof(unsigned long long) * cells[t]);
+			long long before = monotonic_ns();
+			system_refresh_collector(system, collector);
+			ns += monotonic_ns() - before;
+		}
+		printf("%-12s %14lld\n", name, ns / IRQ_PARSER_PASSES);
+
+		for (int t = 0; t < 2; ++t) {
+			if (simd)
+				memcpy(counts[t], tables[t]->counts,
+						sizeof(unsigned long long) * cells[t]);
+			else
+				differ |= memcmp(counts[t], tables[t]->counts,
+						sizeof(unsigned long long) * cells[t]) != 0;
+		}
+	}
+
+	for (int t = 0; t < 2; ++t)
+		free(counts[t]);
+	return differ;
+}
+
+static int compare_activity(const void *a, const void *b)
+{
+	const double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// Find the busiest interfaces like smon --top does, and by sorting all
+// of them. Returns 1 if they disagree on the rates of the busiest
+static int bench_top(const struct system_t *system)
+{
+	const int n = system->interface_count;
+	double *activity = (double *)malloc(sizeof(double) * (n + 1));
+	double *sorted = (double *)malloc(sizeof(double) * (n + 1));
+	int top[TOP_COUNT];
+	int top_count = 0;
+
+	long long ns = 0;
+	for (int pass = 0; pass < TOP_PASSES; ++pass) {
+		long long before = monotonic_ns();
+		for (int i = 0; i < n; ++i)
+			activity[i] = system->interfaces[i].rx_rate +
+				system->interfaces[i].tx_rate;
+		top_count = top_k(activity, n, top, TOP_COUNT);
+		ns += monotonic_ns() - before;
+	}
+	printf("%-12s %14lld\n", "top_k", ns / TOP_PASSES);
+
+	ns = 0;
+	for (int pass = 0; pass < TOP_PASSES; ++pass) {
+		long long before = monotonic_ns();
+		memcpy(sorted, activity, sizeof(double) * n);
+		qsort(sorted, n, sizeof(double), compare_activity);
+		ns += monotonic_ns() - before;
+	}
+	printf("%-12s %14lld\n", "qsort", ns / TOP_PASSES);
+
+	int differ = top_count != (n < TOP_COUNT ? n : TOP_COUNT);
+	for (int i = 0; !differ && i < top_count; ++i)
+		differ = activity[top[i]] != sorted[i];
+	free(activity);
+	free(sorted);
+	return differ;
+}
+
+int main(int argc, char **argv)
+{
+	int cpu_count = 1024;
+	int interface_count = 10000;
+	int disk_count = 500;
+	int cgroup_count = 200;
+	int ticks = 20;
+	int warmup_ticks = 1;
+	int keep = 0;
+	int simd = 1;
+	const char *dir = NULL;
+
+	// Parse command line arguments
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		int *value = NULL;
+		if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+			printf(
+					"Benchmark the smon collectors on a synthetic /proc and /sys\n"
+					"-h --help               Print this help message\n"
+					"-c --cpus N             Number of CPUs (default %d)\n"
+					"-i --interfaces N       Number of network interfaces (default %d)\n"
+					"-d --disks N            Number of disks (default %d)\n"
+					"-g --cgroups N          Number of cgroups (default %d)\n"
+					"-t --ticks N            Number of measured refreshes (default %d)\n"
+					"-w --warmup N           Number of refreshes before measuring (default %d)\n"
+					"-o --output DIR         Where to create the fixture (default: in /tmp)\n"
+					"-k --keep               Don't remove the fixture at the end\n"
+					"-s --scalar             Don't use SIMD for the CPU usage and the\n"
+					"                        IRQ parser\n",
+					cpu_count, interface_count, disk_count, cgroup_count, ticks,
+					warmup_ticks);
+			return 0;
+		} else if (!strcmp(arg, "-c") || !strcmp(arg, "--cpus")) {
+			value = &cpu_count;
+		} else if (!strcmp(arg, "-i") || !strcmp(arg, "--interfaces")) {
+			value = &interface_count;
+		} else if (!strcmp(arg, "-d") || !strcmp(arg, "--disks")) {
+			value = &disk_count;
+		} else if (!strcmp(arg, "-g") || !strcmp(arg, "--cgroups")) {
+			value = &cgroup_count;
+		} else if (!strcmp(arg, "-t") || !strcmp(arg, "--ticks")) {
+			value = &ticks;
+		} else if (!strcmp(arg, "-w") || !strcmp(arg, "--warmup")) {
+			value = &warmup_ticks;
+		} else if (!strcmp(arg, "-o") || !strcmp(arg, "--output")) {
+			if (++i == argc)
+				error("Directory required\n");
+			dir = argv[i];
+		} else if (!strcmp(arg, "-k") || !strcmp(arg, "--keep")) {
+			keep = 1;
+		} else if (!strcmp(arg, "-s") || !strcmp(arg, "--scalar")) {
+			simd = 0;
+		} else {
+			error("Unknown argument %s. Try %s --help\n", argv[i], argv[0]);
+		}
+
+		if (value) {
+			if (++i == argc)
+				error("Number required after %s\n", arg);
+			*value = atoi(argv[i]);
+		}
+	}
+	if (ticks <= 0)
+		error("At least one tick is required\n");
+
+	char root[] = "/tmp/smon_bench.XXXXXX";
+	if (dir == NULL && (dir = mkdtemp(root)) == NULL)
+		error("Failed to create a temporary directory\n");
+
+	printf("Creating fixture in %s: %d CPUs, %d interfaces, %d disks, "
+			"%d cgroups\n", dir, cpu_count, interface_count, disk_count,
+			cgroup_count);
+	struct fixture_t fixture;
+	if (fixture_create(&fixture, dir, cpu_count, interface_count,
+				disk_count, cgroup_count))
+		error("Failed to create the fixture\n");
+
+	struct system_config_t config;
+	system_config_init(&config);
+	config.root = dir;
+	config.irqs = 1;
+
+	raise_open_file_limit();
+	long long start = monotonic_ns();
+	struct system_t system = system_init(&config);
+	printf("system_init(): %.3f ms, found %d CPUs, %d interfaces, "
+			"%d disks, %d cgroups\n", (monotonic_ns() - start) / 1e6,
+			system.cpu_count, system.interface_count, system.disk_count,
+			system.cgroup_count);
+	const char *cpu_kernel = cpu_counters_use_simd(system.cpu_counters, simd);
+	irq_use_simd(system.irqs, simd);
+	printf("%s CPU usage\n\n", cpu_kernel);
+	if (system.interface_count < interface_count ||
+			system.disk_count < disk_count ||
+			system.cgroup_count < cgroup_count)
+		printf("Warning: not all devices were opened, "
+				"check the open files limit (ulimit -n)\n\n");
+
+	const int collector_count = system_collector_count();
+	if (collector_count > MAX_COLLECTORS)
+		error("Too many collectors\n");
+	long long ns[MAX_COLLECTORS] = { 0 };
+	unsigned long long syscalls[MAX_COLLECTORS] = { 0 };
+	unsigned long long allocations[MAX_COLLECTORS] = { 0 };
+
+	for (int t = 0; t < warmup_ticks; ++t) {
+		fixture_advance(&fixture);
+		system_refresh_info(&system);
+	}
+
+	for (int t = 0; t < ticks; ++t) {
+		// Writing the fixture is not measured
+		fixture_advance(&fixture);
+
+		system_refresh_clock(&system);
+		for (int c = 0; c < collector_count; ++c) {
+			unsigned long long syscalls_before = util_syscall_count;
+			unsigned long long allocations_before = allocation_count;
+			long long before = monotonic_ns();
+			counting_allocations = 1;
+			system_refresh_collector(&system, c);
+			counting_allocations = 0;
+			ns[c] += monotonic_ns() - before;
+			syscalls[c] += util_syscall_count - syscalls_before;
+			allocations[c] += allocation_count - allocations_before;
+		}
+	}
+
+	long long total_ns = 0;
+	unsigned long long total_syscalls = 0;
+	unsigned long long total_allocations = 0;
+	printf("%-12s %14s %17s %12s\n", "Collector", "ns/refresh",
+			"syscalls/refresh", "allocations");
+	for (int c = 0; c < collector_count; ++c) {
+		printf("%-12s %14lld %17llu %12llu\n", system_collector_name(c),
+				ns[c] / ticks, syscalls[c] / ticks, allocations[c]);
+		total_ns += ns[c];
+		total_syscalls += syscalls[c];
+		total_allocations += allocations[c];
+	}
+	printf("%-12s %14lld %17llu %12llu\n", "total",
+			total_ns / ticks, total_syscalls / ticks, total_allocations);
+
+	printf("\n%-12s %14s\n", "CPU usage", "ns/refresh");
+	int usage_differs = bench_cpu_usage(&system, &fixture);
+	cpu_counters_use_simd(system.cpu_counters, simd);
+
+	printf("\n%-12s %14s\n", "IRQ parser", "ns/refresh");
+	int irqs_differ = bench_irq_parser(&system);
+	irq_use_simd(system.irqs, simd);
+
+	printf("\n%-12s %14s\n", "Top devices", "ns/frame");
+	int top_differs = bench_top(&system);
+
+	system_delete(system);
+	if (!keep)
+		fixture_destroy(&fixture);
+
+	// Refreshing must not allocate once the devices are known
+	if (total_allocations > 0) {
+		fprintf(stderr, "FAIL: %llu allocations after the warm-up\n",
+				total_allocations);
+		return 1;
+	}
+	if (usage_differs) {
+		fprintf(stderr, "FAIL: the SIMD and scalar CPU usage differ\n");
+		return 1;
+	}
+	if (irqs_differ) {
+		fprintf(stderr, "FAIL: the SIMD and scalar IRQ parsers differ\n");
+		return 1;
+	}
+	if (top_differs) {
+		fprintf(stderr, "FAIL: top_k() and qsort() disagree\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,516 @@
+#define _XOPEN_SOURCE 500
+
+#include "fixture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// Sector counters start right below 2^32 so that 32-bit overflows show up
+#define DISK_SECTORS_BASE 0xfffff000ULL
+
+// Returns 0 on success
+static int write_file(const char *path, const char *contents, int len)
+{
+	// Truncate instead of replacing the file, so that the inode (and
+	// thus the descriptors that smon keeps open) stays the same
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	int ret = write(fd, contents, len) != len;
+	if (ret)
+		perror(path);
+	close(fd);
+	return ret;
+}
+
+static int write_format(const char *path, const char *format,
+		unsigned long long value)
+{
+	char contents[64];
+	int len = snprintf(contents, sizeof(contents), format, value);
+	return write_file(path, contents, len);
+}
+
+// mkdir -p for the directory at fixture->root/path. Returns 0 on success
+static int make_dirs(struct fixture_t *fixture, const char *path)
+{
+	char dir[PATH_MAX];
+	int len = snprintf(dir, sizeof(dir), "%s/%s", fixture->root, path);
+	for (int i = strlen(fixture->root) + 1; i <= len; ++i) {
+		if (dir[i] == '/' || dir[i] == '\0') {
+			char c = dir[i];
+			dir[i] = '\0';
+			if (mkdir(dir, 0755) && errno != EEXIST) {
+				perror(dir);
+				return 1;
+			}
+			dir[i] = c;
+		}
+	}
+	return 0;
+}
+
+// How busy a CPU is during a tick [0, 100]
+static int cpu_busy(int cpu, unsigned long long tick)
+{
+	return (cpu * 37 + tick * 11) % 101;
+}
+
+static int write_proc_stat(struct fixture_t *fixture)
+{
+	int ret = 0;
+	// Every CPU line is at most ~120 bytes
+	int size = 256 + fixture->cpu_count * 128;
+	char *contents = (char *)malloc(size);
+	int len = sprintf(contents, "cpu  0 0 0 0 0 0 0 0 0 0\n");
+	for (int c = 0; c < fixture->cpu_count; ++c) {
+		// Sum of the busy time of all previous ticks
+		unsigned long long busy = 0;
+		for (unsigned long long t = 1; t <= fixture->tick; ++t)
+			busy += cpu_busy(c, t);
+		unsigned long long idle = fixture->tick * 100 - busy;
+		len += sprintf(contents + len,
+				"cpu%d %llu %llu %llu %llu %llu %llu %llu %llu 0 0\n",
+				c, busy * 2 / 3, busy / 50, busy / 3 - busy / 50,
+				idle, idle / 20, busy / 100, busy / 80, 0ULL);
+	}
+	len += sprintf(contents + len, "intr 0\nctxt %llu\nbtime 0\n"
+			"processes 1\nprocs_running 1\nprocs_blocked 0\n",
+			fixture->tick * 1000);
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/proc/stat", fixture->root);
+	ret |= write_file(path, contents, len);
+	free(contents);
+	return ret;
+}
+
+// The interrupts of a NIC with a queue per 32 CPUs, then the
+// architecture-specific ones
+#define FIXTURE_NIC_QUEUES(cpu_count) (((cpu_count) + 31) / 32)
+
+static int write_interrupts(struct fixture_t *fixture)
+{
+	int ret = 0;
+	static const char * const named[][2] = {
+		{ "NMI", "Non-maskable interrupts" },
+		{ "LOC", "Local timer interrupts" },
+		{ "RES", "Rescheduling interrupts" },
+		{ "CAL", "Function call interrupts" },
+		{ "TLB", "TLB shootdowns" }
+	};
+	const int cpu_count = fixture->cpu_count;
+	const int queue_count = FIXTURE_NIC_QUEUES(cpu_count);
+	unsigned long long t = fixture->tick;
+	// The buffer is reused for softirqs, which has 10 rows, and for
+	// softnet_stat, which has a line of about 120 bytes per CPU
+	const int rows = queue_count + 5 > 10 ? queue_count + 5 : 10;
+	int size = 256 + rows * (cpu_count * 11 + 64) + cpu_count * 128;
+	char *contents = (char *)malloc(size);
+	int len = sprintf(contents, "     ");
+	for (int c = 0; c < cpu_count; ++c)
+		len += sprintf(contents + len, "  CPU%-6d", c);
+	contents[len++] = '\n';
+
+	// Each queue is mostly handled by one CPU
+	for (int q = 0; q < queue_count + 5; ++q) {
+		if (q < queue_count)
+			len += sprintf(contents + len, "%4d:", 64 + q);
+		else
+			len += sprintf(contents + len, "%4s:", named[q - queue_count][0]);
+		for (int c = 0; c < cpu_count; ++c) {
+			unsigned long long count = q >= queue_count ? t * (c + 100) :
+				c == q * 32 ? t * 50000 + q : t * (c % 7);
+			len += sprintf(contents + len, " %10llu", count);
+		}
+		if (q < queue_count)
+			len += sprintf(contents + len, "  IR-PCI-MSI 524288%d-edge      "
+					"eth0-TxRx-%d\n", q, q);
+		else
+			len += sprintf(contents + len, "   %s\n", named[q - queue_count][1]);
+	}
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/proc/interrupts", fixture->root);
+	ret |= write_file(path, contents, len);
+
+	// softirqs has the same layout, without the descriptions
+	static const char * const softirqs[] = {
+		"HI", "TIMER", "NET_TX", "NET_RX", "BLOCK", "IRQ_POLL", "TASKLET",
+		"SCHED", "HRTIMER", "RCU"
+	};
+	len = sprintf(contents, "          ");
+	for (int c = 0; c < cpu_count; ++c)
+		len += sprintf(contents + len, "  CPU%-6d", c);
+	contents[len++] = '\n';
+	for (int i = 0; i < 10; ++i) {
+		len += sprintf(contents + len, "%12s:", softirqs[i]);
+		for (int c = 0; c < cpu_count; ++c)
+			len += sprintf(contents + len, " %10llu", t * (i * 10 + c % 13));
+		contents[len++] = '\n';
+	}
+	snprintf(path, sizeof(path), "%s/proc/softirqs", fixture->root);
+	ret |= write_file(path, contents, len);
+
+	len = 0;
+	for (int c = 0; c < cpu_count; ++c)
+		len += sprintf(contents + len, "%08llx %08llx %08llx 00000000 00000000 "
+				"00000000 00000000 00000000 00000000 00000000 00000000 "
+				"00000000 %08x\n", t * 1000 + c, t * (c % 3), t * (c % 5), c);
+	snprintf(path, sizeof(path), "%s/proc/net/softnet_stat", fixture->root);
+	ret |= write_file(path, contents, len);
+	free(contents);
+	return ret;
+}
+
+static int write_meminfo(struct fixture_t *fixture)
+{
+	int ret = 0;
+	unsigned long long t = fixture->tick;
+	char contents[512];
+	int len = sprintf(contents,
+			"MemTotal:       %llu kB\n"
+			"MemFree:        %llu kB\n"
+			"MemAvailable:   %llu kB\n"
+			"Buffers:        %llu kB\n"
+			"Cached:         %llu kB\n"
+			"SwapCached:            0 kB\n"
+			"Shmem:          %llu kB\n"
+			"SReclaimable:   %llu kB\n",
+			// 4 TiB, so that values don't fit in an int
+			4ULL << 30, (1ULL << 30) + t * 1024 % (1ULL << 20),
+			2ULL << 30, 64ULL << 10, (512ULL << 20) + t * 16,
+			1ULL << 20, 4ULL << 20);
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/proc/meminfo", fixture->root);
+	ret |= write_file(path, contents, len);
+	return ret;
+}
+
+static int write_vmstat(struct fixture_t *fixture)
+{
+	int ret = 0;
+	// A subset of a real /proc/vmstat, with the counters that smon reads
+	// spread among those it skips
+	static const char * const keys[] = {
+		"nr_free_pages", "nr_zone_inactive_anon", "nr_zone_active_anon",
+		"nr_zone_inactive_file", "nr_zone_active_file", "nr_mlock",
+		"nr_bounce", "nr_free_cma", "numa_hit", "numa_miss", "numa_foreign",
+		"numa_interleave", "numa_local", "numa_other", "nr_inactive_anon",
+		"nr_active_anon", "nr_inactive_file", "nr_active_file",
+		"nr_unevictable", "nr_slab_reclaimable", "nr_slab_unreclaimable",
+		"nr_isolated_anon", "nr_isolated_file", "workingset_nodes",
+		"workingset_refault_anon", "workingset_refault_file", "nr_anon_pages",
+		"nr_mapped", "nr_file_pages", "nr_dirty", "nr_writeback", "nr_shmem",
+		"nr_kernel_stack", "nr_page_table_pages", "nr_dirty_threshold",
+		"pgpgin", "pgpgout", "pswpin", "pswpout", "pgalloc_dma",
+		"pgalloc_dma32", "pgalloc_normal", "pgalloc_movable",
+		"allocstall_dma", "allocstall_dma32", "allocstall_normal",
+		"allocstall_movable", "pgskip_dma", "pgskip_normal", "pgfree",
+		"pgactivate", "pgdeactivate", "pglazyfree", "pgfault", "pgmajfault",
+		"pglazyfreed", "pgrefill", "pgreuse", "pgsteal_kswapd",
+		"pgsteal_direct", "pgsteal_khugepaged", "pgscan_kswapd",
+		"pgscan_direct", "pgscan_khugepaged", "pgscan_direct_throttle",
+		"pgscan_anon", "pgscan_file", "pgsteal_anon", "pgsteal_file",
+		"zone_reclaim_failed", "pginodesteal", "slabs_scanned",
+		"kswapd_inodesteal", "pageoutrun", "pgrotated", "drop_pagecache",
+		"drop_slab", "oom_kill", "numa_pte_updates", "numa_hint_faults",
+		"pgmigrate_success", "pgmigrate_fail", "compact_stall",
+		"compact_fail", "compact_success", "thp_fault_alloc",
+		"thp_collapse_alloc", "thp_split_page", "swap_ra", "swap_ra_hit",
+		"direct_map_level2_splits", "direct_map_level3_splits"
+	};
+	const int key_count = sizeof(keys) / sizeof(keys[0]);
+	unsigned long long t = fixture->tick;
+	char contents[4096];
+	int len = 0;
+	for (int k = 0; k < key_count; ++k)
+		len += sprintf(contents + len, "%s %llu\n", keys[k],
+				(1ULL << 40) + t * (k + 1) * 1000);
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/proc/vmstat", fixture->root);
+	ret |= write_file(path, contents, len);
+	return ret;
+}
+
+static int write_pressure(struct fixture_t *fixture)
+{
+	int ret = 0;
+	static const char * const resources[] = { "cpu", "memory", "io" };
+	unsigned long long t = fixture->tick;
+	for (int r = 0; r < 3; ++r) {
+		char contents[256];
+		int len = sprintf(contents,
+				"some avg10=%.2f avg60=1.00 avg300=0.50 total=%llu\n"
+				"full avg10=0.00 avg60=0.00 avg300=0.00 total=%llu\n",
+				(t * (r + 1)) % 100 / 10.0, t * 10000 * (r + 1), t * 1000);
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/proc/pressure/%s",
+				fixture->root, resources[r]);
+		ret |= write_file(path, contents, len);
+	}
+	return ret;
+}
+
+static int write_cpu_freqs(struct fixture_t *fixture)
+{
+	int ret = 0;
+	char path[PATH_MAX];
+	for (int c = 0; c < fixture->cpu_count; ++c) {
+		snprintf(path, sizeof(path),
+				"%s/sys/bus/cpu/devices/cpu%d/cpufreq/scaling_cur_freq",
+				fixture->root, c);
+		ret |= write_format(path, "%llu\n",
+				800000 + cpu_busy(c, fixture->tick) * 30000ULL);
+	}
+	return ret;
+}
+
+// A NUMA node per package
+static int node_count(const struct fixture_t *fixture)
+{
+	return (fixture->cpu_count + 127) / 128;
+}
+
+static int write_numa_stats(struct fixture_t *fixture)
+{
+	int ret = 0;
+	unsigned long long t = fixture->tick;
+	for (int n = 0; n < node_count(fixture); ++n) {
+		char contents[1024];
+		int len = 0;
+		static const char * const keys[] = {
+			"MemTotal", "MemFree", "MemUsed", "FilePages", "Shmem",
+			"SReclaimable"
+		};
+		const unsigned long long values[] = {
+			16ULL << 20, (8ULL << 20) - t * 4, (8ULL << 20) + t * 4,
+			2ULL << 20, 64ULL << 10, 256ULL << 10
+		};
+		for (int k = 0; k < 6; ++k)
+			len += sprintf(contents + len, "Node %d %-15s %12llu kB\n",
+					n, keys[k], values[k]);
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path),
+				"%s/sys/devices/system/node/node%d/meminfo", fixture->root, n);
+		ret |= write_file(path, contents, len);
+
+		len = sprintf(contents, "numa_hit %llu\nnuma_miss %llu\n"
+				"numa_foreign %llu\ninterleave_hit 0\nlocal_node %llu\n"
+				"other_node %llu\n", t * 10000, t * 100 * n, t * 100,
+				t * 9900, t * 100);
+		snprintf(path, sizeof(path),
+				"%s/sys/devices/system/node/node%d/numastat", fixture->root, n);
+		ret |= write_file(path, contents, len);
+	}
+	return ret;
+}
+
+static int write_disk_stats(struct fixture_t *fixture)
+{
+	int ret = 0;
+	char path[PATH_MAX];
+	unsigned long long t = fixture->tick;
+	for (int d = 0; d < fixture->disk_count; ++d) {
+		char contents[256];
+		unsigned long long sectors = DISK_SECTORS_BASE + t * (d + 1) * 2048;
+		int len = sprintf(contents,
+				"%8llu %8llu %8llu %8llu %8llu %8llu %8llu %8llu"
+				"        0 %8llu %8llu\n",
+				t * 100, t, sectors, t * 50,
+				t * 200, t * 2, sectors * 2, t * 90, t * 10, t * 140);
+		snprintf(path, sizeof(path), "%s/sys/block/sd%d/stat",
+				fixture->root, d);
+		ret |= write_file(path, contents, len);
+	}
+	return ret;
+}
+
+static int write_interface_stats(struct fixture_t *fixture)
+{
+	int ret = 0;
+	char path[PATH_MAX];
+	unsigned long long t = fixture->tick;
+	for (int i = 0; i < fixture->interface_count; ++i) {
+		int len = snprintf(path, sizeof(path),
+				"%s/sys/class/net/veth%d/statistics/", fixture->root, i);
+		strcpy(path + len, "rx_bytes");
+		ret |= write_format(path, "%llu\n", t * (i % 1000 + 1) * 1500);
+		strcpy(path + len, "tx_bytes");
+		ret |= write_format(path, "%llu\n", t * (i % 100 + 1) * 900);
+	}
+	return ret;
+}
+
+static int write_cgroup_stats(struct fixture_t *fixture)
+{
+	int ret = 0;
+	char path[PATH_MAX];
+	unsigned long long t = fixture->tick;
+	for (int g = 0; g < fixture->cgroup_count; ++g) {
+		char contents[512];
+		int dir_len = snprintf(path, sizeof(path),
+				"%s/sys/fs/cgroup/kubepods/pod%d/", fixture->root, g);
+
+		strcpy(path + dir_len, "cpu.stat");
+		int len = sprintf(contents, "usage_usec %llu\nuser_usec %llu\n"
+				"system_usec %llu\nnr_periods 0\nnr_throttled 0\n"
+				"throttled_usec 0\n", t * (g + 1) * 1000,
+				t * (g + 1) * 700, t * (g + 1) * 300);
+		ret |= write_file(path, contents, len);
+
+		strcpy(path + dir_len, "memory.current");
+		ret |= write_format(path, "%llu\n", (g + 1) * 1048576ULL + t * 4096);
+
+		strcpy(path + dir_len, "memory.stat");
+		len = sprintf(contents, "anon %llu\nfile %llu\nkernel 0\n"
+				"shmem 0\nsock 0\n", (g + 1) * 786432ULL + t * 4096,
+				(g + 1) * 262144ULL);
+		ret |= write_file(path, contents, len);
+
+		strcpy(path + dir_len, "io.stat");
+		len = sprintf(contents, "8:0 rbytes=%llu wbytes=%llu rios=%llu "
+				"wios=%llu dbytes=0 dios=0\n", t * g * 4096,
+				t * g * 8192, t * g, t * g * 2);
+		ret |= write_file(path, contents, len);
+	}
+	return ret;
+}
+
+int fixture_create(struct fixture_t *fixture, const char *root,
+		int cpu_count, int interface_count, int disk_count, int cgroup_count)
+{
+	if (strlen(root) >= sizeof(fixture->root))
+		return 1;
+	// Fail once here rather than for each file if root doesn't exist
+	struct stat st;
+	if (stat(root, &st) || !S_ISDIR(st.st_mode)) {
+		fprintf(stderr, "%s is not a directory\n", root);
+		return 1;
+	}
+	strcpy(fixture->root, root);
+	fixture->cpu_count = cpu_count;
+	fixture->interface_count = interface_count;
+	fixture->disk_count = disk_count;
+	fixture->cgroup_count = cgroup_count;
+	fixture->tick = 0;
+
+	int ret = 0;
+	char dir[PATH_MAX], path[PATH_MAX];
+	ret |= make_dirs(fixture, "proc/pressure");
+	ret |= make_dirs(fixture, "proc/net");
+	ret |= make_dirs(fixture, "proc/sys/kernel/random");
+	snprintf(path, sizeof(path), "%s/proc/sys/kernel/random/boot_id",
+			fixture->root);
+	ret |= write_file(path, "3f1e5c2a-8d4b-4e0f-9a6c-7b2d1e0f4a5b\n", 37);
+	ret |= make_dirs(fixture, "sys/class/hwmon/hwmon0");
+	ret |= make_dirs(fixture, "sys/class/power_supply");
+	ret |= make_dirs(fixture, "sys/block");
+	ret |= make_dirs(fixture, "sys/class/net");
+
+	// Two threads per core, 64 cores per package
+	for (int c = 0; c < cpu_count; ++c) {
+		snprintf(dir, sizeof(dir), "sys/bus/cpu/devices/cpu%d/topology", c);
+		ret |= make_dirs(fixture, dir);
+		snprintf(dir, sizeof(dir), "sys/bus/cpu/devices/cpu%d/cpufreq", c);
+		ret |= make_dirs(fixture, dir);
+
+		int len = snprintf(path, sizeof(path),
+				"%s/sys/bus/cpu/devices/cpu%d/", fixture->root, c);
+		strcpy(path + len, "topology/core_id");
+		ret |= write_format(path, "%llu\n", c / 2 % 64);
+		strcpy(path + len, "topology/physical_package_id");
+		ret |= write_format(path, "%llu\n", c / 128);
+	}
+
+	for (int n = 0; n < node_count(fixture); ++n) {
+		snprintf(dir, sizeof(dir), "sys/devices/system/node/node%d", n);
+		ret |= make_dirs(fixture, dir);
+		snprintf(path, sizeof(path),
+				"%s/sys/devices/system/node/node%d/cpulist", fixture->root, n);
+		char list[64];
+		int last = (n + 1) * 128 < cpu_count ? (n + 1) * 128 : cpu_count;
+		int len = sprintf(list, "%d-%d\n", n * 128, last - 1);
+		ret |= write_file(path, list, len);
+	}
+
+	// One coretemp-like sensor per core
+	int core_count = cpu_count < 128 ? (cpu_count + 1) / 2 : 64;
+	for (int c = 0; c < core_count; ++c) {
+		int len = snprintf(path, sizeof(path),
+				"%s/sys/class/hwmon/hwmon0/temp%d_", fixture->root, c + 2);
+		strcpy(path + len, "label");
+		ret |= write_format(path, "Core %llu\n", c);
+		strcpy(path + len, "input");
+		ret |= write_format(path, "%llu\n", 40000 + c * 500);
+	}
+
+	for (int d = 0; d < disk_count; ++d) {
+		snprintf(dir, sizeof(dir), "sys/block/sd%d", d);
+		ret |= make_dirs(fixture, dir);
+	}
+
+	for (int i = 0; i < interface_count; ++i) {
+		snprintf(dir, sizeof(dir), "sys/class/net/veth%d/statistics", i);
+		ret |= make_dirs(fixture, dir);
+	}
+
+	ret |= make_dirs(fixture, "sys/fs/cgroup/kubepods");
+	snprintf(path, sizeof(path), "%s/sys/fs/cgroup/cgroup.controllers",
+			fixture->root);
+	ret |= write_file(path, "cpu io memory\n", 14);
+	for (int g = 0; g < cgroup_count; ++g) {
+		snprintf(dir, sizeof(dir), "sys/fs/cgroup/kubepods/pod%d", g);
+		ret |= make_dirs(fixture, dir);
+	}
+
+	fixture->tick = 0;
+	ret |= write_proc_stat(fixture);
+	ret |= write_meminfo(fixture);
+	ret |= write_vmstat(fixture);
+	ret |= write_interrupts(fixture);
+	ret |= write_pressure(fixture);
+	ret |= write_cpu_freqs(fixture);
+	ret |= write_numa_stats(fixture);
+	ret |= write_disk_stats(fixture);
+	ret |= write_interface_stats(fixture);
+	ret |= write_cgroup_stats(fixture);
+	return ret;
+}
+
+void fixture_advance(struct fixture_t *fixture)
+{
+	++fixture->tick;
+	write_proc_stat(fixture);
+	write_meminfo(fixture);
+	write_vmstat(fixture);
+	write_interrupts(fixture);
+	write_pressure(fixture);
+	write_cpu_freqs(fixture);
+	write_numa_stats(fixture);
+	write_disk_stats(fixture);
+	write_interface_stats(fixture);
+	write_cgroup_stats(fixture);
+}
+
+static int remove_entry(const char *path, const struct stat *st,
+		int type, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+void fixture_destroy(struct fixture_t *fixture)
+{
+	nftw(fixture->root, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
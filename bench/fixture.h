@@ -0,0 +1,32 @@
+#ifndef FIXTURE_H_INCLUDED
+#define FIXTURE_H_INCLUDED
+
+#include <limits.h>
+
+/** A synthetic /proc and /sys tree that smon can be pointed at
+ * with system_config_t.root */
+struct fixture_t
+{
+	char root[PATH_MAX / 2]; /**< The directory containing proc/ and sys/ */
+
+	int cpu_count;
+	int interface_count;
+	int disk_count;
+	int cgroup_count;
+
+	unsigned long long tick; /**< How many times the counters were advanced */
+};
+
+/** Build a tree under root (which must exist and be empty) with the
+ * given number of devices. Returns 0 on success */
+int fixture_create(struct fixture_t *fixture, const char *root,
+		int cpu_count, int interface_count, int disk_count, int cgroup_count);
+
+/** Advance all counters by one tick, rewriting the files in place so
+ * that the file descriptors smon keeps open see the new values */
+void fixture_advance(struct fixture_t *fixture);
+
+/** Remove the whole tree */
+void fixture_destroy(struct fixture_t *fixture);
+
+#endif
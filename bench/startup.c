@@ -0,0 +1,111 @@
+#include "fixture.h"
+
+#include "../system.h"
+#include "../util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#define error(...) { fprintf(stderr, __VA_ARGS__); exit(-1); }
+
+// Run system_init() and system_delete() runs times and print the
+// average time and syscalls of system_init(). If stale is not NULL,
+// it is removed before each run
+static void bench_startup(const char *name, struct system_config_t *config,
+		int runs, const char *stale)
+{
+	long long ns = 0;
+	unsigned long long syscalls = 0;
+	int cpu_count = 0;
+	for (int r = 0; r < runs; ++r) {
+		if (stale)
+			unlink(stale);
+		unsigned long long syscalls_before = util_syscall_count;
+		long long before = monotonic_ns();
+		struct system_t system = system_init(config);
+		ns += monotonic_ns() - before;
+		syscalls += util_syscall_count - syscalls_before;
+		cpu_count = system.cpu_count;
+		system_delete(system);
+	}
+	printf("%-16s %12.3f %12llu %8d\n", name, ns / 1e6 / runs,
+			syscalls / runs, cpu_count);
+}
+
+int main(int argc, char **argv)
+{
+	int cpu_count = 1024;
+	int runs = 10;
+	int keep = 0;
+	const char *dir = NULL;
+
+	// Parse command line arguments
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		int *value = NULL;
+		if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+			printf(
+					"Benchmark the startup of smon on a synthetic /proc and /sys\n"
+					"with and without the topology cache\n"
+					"-h --help               Print this help message\n"
+					"-c --cpus N             Number of CPUs (default %d)\n"
+					"-r --runs N             Number of measured startups (default %d)\n"
+					"-o --output DIR         Where to create the fixture (default: in /tmp)\n"
+					"-k --keep               Don't remove the fixture at the end\n",
+					cpu_count, runs);
+			return 0;
+		} else if (!strcmp(arg, "-c") || !strcmp(arg, "--cpus")) {
+			value = &cpu_count;
+		} else if (!strcmp(arg, "-r") || !strcmp(arg, "--runs")) {
+			value = &runs;
+		} else if (!strcmp(arg, "-o") || !strcmp(arg, "--output")) {
+			if (++i == argc)
+				error("Directory required\n");
+			dir = argv[i];
+		} else if (!strcmp(arg, "-k") || !strcmp(arg, "--keep")) {
+			keep = 1;
+		} else {
+			error("Unknown argument %s. Try %s --help\n", argv[i], argv[0]);
+		}
+
+		if (value) {
+			if (++i == argc)
+				error("Number required after %s\n", arg);
+			*value = atoi(argv[i]);
+		}
+	}
+	if (runs <= 0)
+		error("At least one run is required\n");
+
+	char root[] = "/tmp/smon_bench.XXXXXX";
+	if (dir == NULL && (dir = mkdtemp(root)) == NULL)
+		error("Failed to create a temporary directory\n");
+
+	printf("Creating fixture in %s: %d CPUs\n\n", dir, cpu_count);
+	struct fixture_t fixture;
+	if (fixture_create(&fixture, dir, cpu_count, 0, 0, 0))
+		error("Failed to create the fixture\n");
+
+	char cache[PATH_MAX];
+	snprintf(cache, sizeof(cache), "%s/topology.cache", dir);
+
+	struct system_config_t config;
+	system_config_init(&config);
+	config.root = dir;
+	raise_open_file_limit();
+
+	printf("%-16s %12s %12s %8s\n", "Topology", "ms/startup",
+			"syscalls", "CPUs");
+	bench_startup("sysfs", &config, runs, NULL);
+	// A missing cache costs the sysfs reads and writing the cache
+	config.topology_cache = cache;
+	bench_startup("cache (cold)", &config, runs, cache);
+	bench_startup("cache (warm)", &config, runs, NULL);
+
+	if (!keep)
+		fixture_destroy(&fixture);
+	return 0;
+}
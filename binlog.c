@@ -0,0 +1,246 @@
+#include "binlog.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Sizes of the parts of the file, everything is aligned to 8 bytes
+static size_t header_size(int column_count)
+{
+	return (sizeof(struct binlog_header_t) +
+			(size_t)column_count * BINLOG_NAME_LENGTH + 7) / 8 * 8;
+}
+
+static size_t block_header_size(int column_count)
+{
+	return sizeof(struct binlog_block_t) +
+		(size_t)column_count * sizeof(struct binlog_summary_t);
+}
+
+static size_t row_size(int column_count)
+{
+	return sizeof(int64_t) + (size_t)column_count * sizeof(double);
+}
+
+int binlog_create(struct binlog_t *binlog, const char *filename,
+		int column_count, const char * const *names)
+{
+	binlog->column_count = column_count;
+	binlog->header_size = header_size(column_count);
+	binlog->row_size = row_size(column_count);
+	binlog->block_size = block_header_size(column_count) +
+		BINLOG_BLOCK_ROWS * binlog->row_size;
+	binlog->block_index = -1;
+
+	// The header, summaries and last row of the current block are kept
+	// in memory, the file header is only needed once
+	char *header = (char *)calloc(1, binlog->header_size);
+	binlog->block = (struct binlog_block_t *)calloc(1,
+			block_header_size(column_count) + binlog->row_size);
+	if (header == NULL || binlog->block == NULL) {
+		free(header);
+		free(binlog->block);
+		return 1;
+	}
+	binlog->row = (double *)((char *)binlog->block +
+			block_header_size(column_count) + sizeof(int64_t));
+
+	struct binlog_header_t *h = (struct binlog_header_t *)header;
+	memcpy(h->magic, BINLOG_MAGIC, sizeof(h->magic));
+	h->version = BINLOG_VERSION;
+	h->column_count = column_count;
+	h->block_rows = BINLOG_BLOCK_ROWS;
+	h->header_size = binlog->header_size;
+	for (int i = 0; i < column_count; ++i)
+		strncpy(header + sizeof(struct binlog_header_t) +
+				i * BINLOG_NAME_LENGTH, names[i], BINLOG_NAME_LENGTH - 1);
+
+	binlog->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			0644);
+	int ret = 0;
+	if (binlog->fd < 0)
+		ret = 2;
+	else if (write_fd_at(binlog->fd, header, binlog->header_size, 0) !=
+			(int)binlog->header_size)
+		ret = 3;
+	free(header);
+	if (ret) {
+		if (binlog->fd >= 0)
+			close_fd(binlog->fd);
+		free(binlog->block);
+	}
+	return ret;
+}
+
+int binlog_append(struct binlog_t *binlog, long long time_ns,
+		const double *values)
+{
+	struct binlog_block_t *block = binlog->block;
+	struct binlog_summary_t *summaries = (struct binlog_summary_t *)(block + 1);
+	const int columns = binlog->column_count;
+
+	// The times are the wall clock, which can be set back. Keep them in
+	// order, as the readers binary search them
+	if (binlog->block_index != -1 && time_ns < block->last_time)
+		time_ns = block->last_time;
+
+	// Start a new block if needed
+	if (binlog->block_index == -1 || block->row_count == BINLOG_BLOCK_ROWS) {
+		++binlog->block_index;
+		block->magic = BINLOG_BLOCK_MAGIC;
+		block->row_count = 0;
+		block->first_time = time_ns;
+		for (int c = 0; c < columns; ++c) {
+			summaries[c].min = values[c];
+			summaries[c].max = values[c];
+			summaries[c].sum = 0.0;
+		}
+	}
+
+	for (int c = 0; c < columns; ++c) {
+		if (values[c] < summaries[c].min)
+			summaries[c].min = values[c];
+		if (values[c] > summaries[c].max)
+			summaries[c].max = values[c];
+		summaries[c].sum += values[c];
+	}
+	block->last_time = time_ns;
+
+	// Write the row first, so that readers never see a row_count
+	// that includes a row which isn't there yet
+	const size_t block_offset = binlog->header_size +
+		binlog->block_index * binlog->block_size;
+	const size_t header_bytes = block_header_size(columns);
+	int64_t *row = (int64_t *)((char *)block + header_bytes);
+	*row = time_ns;
+	memcpy(binlog->row, values, columns * sizeof(double));
+	if (write_fd_at(binlog->fd, row, binlog->row_size, block_offset +
+				header_bytes + block->row_count * binlog->row_size) !=
+			(int)binlog->row_size)
+		return 1;
+	++block->row_count;
+	if (write_fd_at(binlog->fd, block, header_bytes, block_offset) !=
+			(int)header_bytes)
+		return 1;
+	return 0;
+}
+
+void binlog_close(struct binlog_t *binlog)
+{
+	close_fd(binlog->fd);
+	free(binlog->block);
+}
+
+
+int binlog_open(struct binlog_reader_t *reader, const char *filename)
+{
+	int fd = open_file_readonly(filename);
+	if (fd < 0)
+		return 1;
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct binlog_header_t)) {
+		close_fd(fd);
+		return 2;
+	}
+	reader->size = st.st_size;
+	void *data = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, fd, 0);
+	close_fd(fd);
+	if (data == MAP_FAILED)
+		return 3;
+	reader->data = (const char *)data;
+
+	const struct binlog_header_t *h = (const struct binlog_header_t *)data;
+	if (memcmp(h->magic, BINLOG_MAGIC, sizeof(h->magic)) ||
+			h->version != BINLOG_VERSION || h->block_rows == 0 ||
+			h->header_size != header_size(h->column_count) ||
+			h->header_size > reader->size) {
+		binlog_reader_close(reader);
+		return 4;
+	}
+	reader->column_count = h->column_count;
+	reader->header_size = h->header_size;
+	reader->row_size = row_size(h->column_count);
+	reader->block_rows = h->block_rows;
+	reader->block_size = block_header_size(h->column_count) +
+		h->block_rows * reader->row_size;
+
+	// The last block is usually incomplete. Ignore it
+	// if even its header isn't there
+	const size_t blocks_size = reader->size - reader->header_size;
+	reader->block_count = blocks_size / reader->block_size;
+	if (blocks_size % reader->block_size >= block_header_size(h->column_count))
+		++reader->block_count;
+	return 0;
+}
+
+void binlog_reader_close(struct binlog_reader_t *reader)
+{
+	munmap((void *)reader->data, reader->size);
+}
+
+const char *binlog_column_name(const struct binlog_reader_t *reader,
+		int column)
+{
+	return reader->data + sizeof(struct binlog_header_t) +
+		column * BINLOG_NAME_LENGTH;
+}
+
+const struct binlog_block_t *binlog_block(const struct binlog_reader_t *reader,
+		long long i)
+{
+	return (const struct binlog_block_t *)(reader->data +
+			reader->header_size + i * reader->block_size);
+}
+
+const struct binlog_summary_t *binlog_block_summaries(
+		const struct binlog_block_t *block)
+{
+	return (const struct binlog_summary_t *)(block + 1);
+}
+
+int binlog_block_rows(const struct binlog_reader_t *reader, long long i)
+{
+	const struct binlog_block_t *block = binlog_block(reader, i);
+	if (block->magic != BINLOG_BLOCK_MAGIC)
+		return 0;
+	const size_t rows_offset = reader->header_size + i * reader->block_size +
+		block_header_size(reader->column_count);
+	long long rows = (reader->size - rows_offset) / reader->row_size;
+	if (rows > block->row_count)
+		rows = block->row_count;
+	return rows;
+}
+
+int64_t binlog_row_time(const struct binlog_reader_t *reader,
+		const struct binlog_block_t *block, int row)
+{
+	return *(const int64_t *)((const char *)block +
+			block_header_size(reader->column_count) + row * reader->row_size);
+}
+
+const double *binlog_row_values(const struct binlog_reader_t *reader,
+		const struct binlog_block_t *block, int row)
+{
+	return (const double *)((const char *)block +
+			block_header_size(reader->column_count) + row * reader->row_size +
+			sizeof(int64_t));
+}
+
+long long binlog_find_block(const struct binlog_reader_t *reader,
+		long long time_ns)
+{
+	// Blocks are written in time order
+	long long low = 0, high = reader->block_count;
+	while (low < high) {
+		long long mid = low + (high - low) / 2;
+		if (binlog_block(reader, mid)->last_time < time_ns)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
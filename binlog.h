@@ -0,0 +1,132 @@
+#ifndef BINLOG_H_INCLUDED
+#define BINLOG_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * The binary log format. All integers and doubles are in the byte order of
+ * the host that wrote the file.
+ *
+ * The file starts with a struct binlog_header_t, followed by the names of
+ * the columns (BINLOG_NAME_LENGTH bytes each) and then by the blocks. All
+ * blocks have the same size, so block i is at a known offset. A block is a
+ * struct binlog_block_t with the time range of its rows, one
+ * struct binlog_summary_t per column and space for block_rows rows. A row
+ * is the time (int64_t, ns since the epoch) and one double per column.
+ * The times never decrease, even if the clock is set back.
+ *
+ * The block headers form a sparse time index that can be binary searched,
+ * and their summaries allow skipping blocks without looking at the rows.
+ */
+
+#define BINLOG_MAGIC "SMONLOG1"
+#define BINLOG_BLOCK_MAGIC 0x4b4c4253 // "SBLK"
+#define BINLOG_VERSION 1
+#define BINLOG_NAME_LENGTH 64
+#define BINLOG_BLOCK_ROWS 256
+
+struct binlog_header_t
+{
+	char magic[8]; /**< BINLOG_MAGIC */
+	uint32_t version; /**< BINLOG_VERSION */
+	uint32_t column_count;
+	uint32_t block_rows; /**< The number of rows that fit in a block */
+	uint32_t header_size; /**< The offset of the first block */
+};
+
+/** The values of a column in a block */
+struct binlog_summary_t
+{
+	double min;
+	double max;
+	double sum;
+};
+
+struct binlog_block_t
+{
+	uint32_t magic; /**< BINLOG_BLOCK_MAGIC */
+	uint32_t row_count; /**< The number of rows written to the block */
+	int64_t first_time; /**< The time of the first row (ns) */
+	int64_t last_time; /**< The time of the last row (ns) */
+};
+
+/** Writes a binary log */
+struct binlog_t
+{
+	int fd;
+	int column_count;
+	size_t header_size;
+	size_t block_size;
+	size_t row_size;
+	long long block_index; /**< The block that is being filled */
+
+	// The header, summaries and one row of the current block
+	struct binlog_block_t *block;
+	double *row;
+};
+
+/** Create (or truncate) a binary log file. Returns 0 on success */
+int binlog_create(struct binlog_t *binlog, const char *filename,
+		int column_count, const char * const *names);
+
+/** Append a row. The row and the block header are written right away,
+ * so readers (and crashes) only lose what was never appended. A time
+ * before that of the previous row (the clock was set back) is stored as
+ * that time, so that the rows stay in order */
+int binlog_append(struct binlog_t *binlog, long long time_ns,
+		const double *values);
+
+/** Close the file and free the memory */
+void binlog_close(struct binlog_t *binlog);
+
+
+/** A binary log mapped for reading */
+struct binlog_reader_t
+{
+	const char *data;
+	size_t size;
+	int column_count;
+	size_t header_size;
+	size_t block_size;
+	size_t row_size;
+	int block_rows;
+	long long block_count;
+};
+
+/** Map a binary log. Returns 0 on success */
+int binlog_open(struct binlog_reader_t *reader, const char *filename);
+
+/** Unmap the file */
+void binlog_reader_close(struct binlog_reader_t *reader);
+
+/** The name of a column */
+const char *binlog_column_name(const struct binlog_reader_t *reader,
+		int column);
+
+/** The header of block i */
+const struct binlog_block_t *binlog_block(const struct binlog_reader_t *reader,
+		long long i);
+
+/** The summaries of a block, one per column */
+const struct binlog_summary_t *binlog_block_summaries(
+		const struct binlog_block_t *block);
+
+/** The number of complete rows of a block, which can be less than its
+ * row_count if the file is being written */
+int binlog_block_rows(const struct binlog_reader_t *reader, long long i);
+
+/** The time of a row */
+int64_t binlog_row_time(const struct binlog_reader_t *reader,
+		const struct binlog_block_t *block, int row);
+
+/** The values of a row, one per column */
+const double *binlog_row_values(const struct binlog_reader_t *reader,
+		const struct binlog_block_t *block, int row);
+
+/** The first block with rows at or after time_ns (binary search),
+ * or block_count if there is none */
+long long binlog_find_block(const struct binlog_reader_t *reader,
+		long long time_ns);
+
+#endif
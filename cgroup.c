@@ -0,0 +1,318 @@
+#include "cgroup.h"
+#include "system.h"
+#include "util.h"
+#include "kv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/inotify.h>
+
+// The changes of a directory that mean cgroups were created or removed
+#define CGROUP_INOTIFY_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+		IN_MOVED_TO | IN_ONLYDIR)
+
+static void cgroup_scan(struct system_t *system, char *path, int root_len,
+		int path_len, int depth, int *next);
+static void cgroup_close(struct cgroup_t *cgroup);
+
+// The counters of memory.stat that are read
+enum { MEMORY_STAT_ANON, MEMORY_STAT_FILE, MEMORY_STAT_COUNT };
+static const char * const memory_stat_names[MEMORY_STAT_COUNT] = {
+	"anon", "file"
+};
+
+void cgroup_init(struct system_t *system, const char *root, int max_depth)
+{
+	system->cgroups = NULL;
+	system->cgroup_count = 0;
+	system->max_cgroup_count = 0;
+	system->cgroup_root = NULL;
+	system->cgroup_max_depth = max_depth;
+	system->cgroup_inotify_fd = -1;
+	system->cgroup_rescan_ticks = 0;
+	system->cgroup_buffer_size = 4096;
+	system->cgroup_buffer = (char *)malloc(system->cgroup_buffer_size);
+	system->memory_stat_keys = (struct kv_table_t *)malloc(
+			sizeof(struct kv_table_t));
+	if (root == NULL || kv_table_init(system->memory_stat_keys,
+				memory_stat_names, MEMORY_STAT_COUNT))
+		return;
+
+	// Make sure that this is actually a cgroup v2 hierarchy
+	char filename[PATH_MAX];
+	snprintf(filename, sizeof(filename), "%s/cgroup.controllers", root);
+	if (access(filename, R_OK) != 0)
+		return;
+
+	system->cgroup_root = strdup(root);
+	// Drop trailing slashes, we add our own
+	int len = strlen(system->cgroup_root);
+	while (len > 1 && system->cgroup_root[len - 1] == '/')
+		system->cgroup_root[--len] = '\0';
+
+	// The directories are watched as they are scanned
+	system->cgroup_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (system->cgroup_inotify_fd >= 0 &&
+			inotify_add_watch(system->cgroup_inotify_fd, system->cgroup_root,
+				CGROUP_INOTIFY_MASK) < 0) {
+		close_fd(system->cgroup_inotify_fd);
+		system->cgroup_inotify_fd = -1;
+	}
+}
+
+void cgroup_delete(struct system_t *system)
+{
+	for (int i = 0; i < system->cgroup_count; ++i)
+		cgroup_close(&system->cgroups[i]);
+	system_free_array(system, system->cgroups);
+	free(system->cgroup_root);
+	free(system->memory_stat_keys);
+	close_fd(system->cgroup_inotify_fd);
+	free(system->cgroup_buffer);
+}
+
+static void cgroup_close(struct cgroup_t *cgroup)
+{
+	close_fd(cgroup->cpu_stat_fd);
+	close_fd(cgroup->memory_current_fd);
+	close_fd(cgroup->memory_stat_fd);
+	close_fd(cgroup->io_stat_fd);
+}
+
+// Read the whole file from the start into system->cgroup_buffer, which
+// grows if the file fills it (io.stat has a line per device). Returns
+// the number of bytes read
+static int cgroup_read(struct system_t *system, int fd)
+{
+	if (fd < 0)
+		return 0;
+	int bytes;
+	while ((bytes = read_fd_to_string(fd, system->cgroup_buffer,
+					system->cgroup_buffer_size - 1)) ==
+			system->cgroup_buffer_size - 1) {
+		system->cgroup_buffer_size *= 2;
+		system->cgroup_buffer = (char *)realloc(system->cgroup_buffer,
+				system->cgroup_buffer_size);
+	}
+	if (bytes < 0)
+		bytes = 0;
+	system->cgroup_buffer[bytes] = '\0';
+	return bytes;
+}
+
+// Whether the hierarchy must be scanned for created and removed cgroups
+static int cgroup_changed(struct system_t *system)
+{
+	// Only whether there were events matters, including an overflow
+	char events[4096];
+	while (system->cgroup_inotify_fd >= 0 && read_fd(
+				system->cgroup_inotify_fd, events, sizeof(events)) > 0)
+		system->cgroup_rescan_ticks = 0;
+	if (system->cgroup_rescan_ticks != 0) {
+		if (system->cgroup_rescan_ticks > 0)
+			--system->cgroup_rescan_ticks;
+		return 0;
+	}
+	// Without inotify, every CGROUP_RESCAN_TICKS
+	system->cgroup_rescan_ticks = system->cgroup_inotify_fd < 0 ?
+		CGROUP_RESCAN_TICKS - 1 : -1;
+	return 1;
+}
+
+// Find the value of key in a flat keyed file (e.g. cpu.stat),
+// which contains lines of the form "key value"
+static unsigned long long flat_keyed_value(const char *buffer, const char *key)
+{
+	const int key_len = strlen(key);
+	const char *line = buffer;
+	while (*line) {
+		if (!strncmp(line, key, key_len) && line[key_len] == ' ')
+			return strtoull(line + key_len + 1, NULL, 10);
+		line = strchr(line, '\n');
+		if (line == NULL)
+			break;
+		++line;
+	}
+	return 0;
+}
+
+void cgroup_refresh(struct system_t *system)
+{
+	if (system->cgroup_root == NULL)
+		return;
+
+	// Pick up created cgroups and mark the ones that still exist
+	if (cgroup_changed(system)) {
+		for (int i = 0; i < system->cgroup_count; ++i)
+			system->cgroups[i].seen = 0;
+		char path[PATH_MAX];
+		int root_len = strlen(system->cgroup_root);
+		strcpy(path, system->cgroup_root);
+		int next = 0;
+		cgroup_scan(system, path, root_len, root_len, 1, &next);
+	}
+
+	for (int c = 0; c < system->cgroup_count; ++c) {
+		struct cgroup_t *cgroup = &system->cgroups[c];
+		if (!cgroup->seen)
+			continue;
+
+		// The files of removed cgroups return errors on read
+		if (cgroup_read(system, cgroup->cpu_stat_fd) <= 0) {
+			cgroup->seen = 0;
+			continue;
+		}
+		unsigned long long usage = flat_keyed_value(system->cgroup_buffer,
+				"usage_usec");
+		// The first sample of a new cgroup is only the baseline
+		int first = cgroup->last_usage_usec == 0;
+		cgroup->cpu_usage = !first ? counter_rate(
+				counter_delta(usage, cgroup->last_usage_usec),
+				system->elapsed) / 1000000.0 : 0.0;
+		cgroup->last_usage_usec = usage;
+
+		// The memory and io controllers might not be enabled for this group
+		if (cgroup_read(system, cgroup->memory_current_fd) > 0)
+			cgroup->memory_current = strtoll(system->cgroup_buffer, NULL, 10);
+		if (cgroup_read(system, cgroup->memory_stat_fd) > 0) {
+			unsigned long long stat[MEMORY_STAT_COUNT] = {0};
+			kv_parse(system->memory_stat_keys, system->cgroup_buffer, stat);
+			cgroup->memory_anon = stat[MEMORY_STAT_ANON];
+			cgroup->memory_file = stat[MEMORY_STAT_FILE];
+		}
+
+		// io.stat has one line per device:
+		// "MAJ:MIN rbytes=N wbytes=N rios=N wios=N dbytes=N dios=N"
+		unsigned long long read_bytes = 0, write_bytes = 0;
+		if (cgroup_read(system, cgroup->io_stat_fd) > 0) {
+			for (const char *s = system->cgroup_buffer; (s = strchr(s, 'b'));
+					++s) {
+				if (s[-1] == 'r' && !strncmp(s, "bytes=", 6))
+					read_bytes += strtoull(s + 6, NULL, 10);
+				else if (s[-1] == 'w' && !strncmp(s, "bytes=", 6))
+					write_bytes += strtoull(s + 6, NULL, 10);
+			}
+		}
+		// A device can disappear from io.stat, so the sums can go back.
+		// That's not a wraparound, don't report a huge rate then
+		cgroup->delta_read_bytes = read_bytes >= cgroup->last_read_bytes ?
+			read_bytes - cgroup->last_read_bytes : 0;
+		cgroup->delta_write_bytes = write_bytes >= cgroup->last_write_bytes ?
+			write_bytes - cgroup->last_write_bytes : 0;
+		if (first)
+			cgroup->delta_read_bytes = cgroup->delta_write_bytes = 0;
+		cgroup->read_rate = counter_rate(cgroup->delta_read_bytes,
+				system->elapsed);
+		cgroup->write_rate = counter_rate(cgroup->delta_write_bytes,
+				system->elapsed);
+		cgroup->last_read_bytes = read_bytes;
+		cgroup->last_write_bytes = write_bytes;
+	}
+
+	// Remove cgroups that no longer exist from the array
+	int i = 0;
+	for (int j = 0; j < system->cgroup_count; ++j) {
+		if (system->cgroups[j].seen) {
+			if (i != j)
+				system->cgroups[i] = system->cgroups[j];
+			++i;
+		} else {
+			cgroup_close(&system->cgroups[j]);
+		}
+	}
+	if (i != system->cgroup_count)
+		++system->device_generation;
+	system->cgroup_count = i;
+}
+
+// Open the files of a newly discovered cgroup and add it to the end of
+// system->cgroups. Returns 0 if it can't be read
+static int cgroup_add(struct system_t *system, char *path, int root_len,
+		int path_len)
+{
+	struct cgroup_t cgroup;
+	memset(&cgroup, 0, sizeof(cgroup));
+	cgroup.seen = 1;
+	strcpy(cgroup.name, path + root_len + 1);
+
+	strcpy(path + path_len, "/cpu.stat");
+	cgroup.cpu_stat_fd = open_file_readonly(path);
+	if (cgroup.cpu_stat_fd == -1) {
+		path[path_len] = '\0';
+		return 0;
+	}
+	strcpy(path + path_len, "/memory.current");
+	cgroup.memory_current_fd = open_file_readonly(path);
+	strcpy(path + path_len, "/memory.stat");
+	cgroup.memory_stat_fd = open_file_readonly(path);
+	strcpy(path + path_len, "/io.stat");
+	cgroup.io_stat_fd = open_file_readonly(path);
+	path[path_len] = '\0';
+
+	// Allocate memory if necessary
+	if (system->cgroup_count == system->max_cgroup_count) {
+		system->cgroups = (struct cgroup_t *)system_grow_array(system,
+				system->cgroups, &system->max_cgroup_count,
+				sizeof(struct cgroup_t), 128);
+	}
+	system->cgroups[system->cgroup_count++] = cgroup;
+	++system->device_generation;
+	return 1;
+}
+
+// Walk the directory at path, adding cgroups that we don't know about yet.
+// The cgroups that are found are moved to system->cgroups[*next] on, so
+// that they stay in the order of the scan
+static void cgroup_scan(struct system_t *system, char *path, int root_len,
+		int path_len, int depth, int *next)
+{
+	struct dir_t dir;
+	if (dir_open(&dir, path))
+		return;
+	const char *name;
+	unsigned char type;
+	while ((name = dir_next(&dir, &type))) {
+		// Every subdirectory is a cgroup, everything else is a control file
+		if (type != DT_DIR || name[0] == '.')
+			continue;
+		int name_len = strlen(name);
+		if (path_len + 1 + name_len - root_len - 1 > MAX_CGROUP_NAME_LENGTH ||
+				path_len + 1 + name_len + 32 > PATH_MAX)
+			continue;
+		path[path_len] = '/';
+		strcpy(path + path_len + 1, name);
+		int sub_len = path_len + 1 + name_len;
+
+		// Check for a known cgroup with the same name. The hierarchy is
+		// listed in the same order every time, so it's usually the next
+		int found = -1;
+		for (int i = *next; i < system->cgroup_count && found < 0; ++i)
+			if (strcmp(path + root_len + 1, system->cgroups[i].name) == 0)
+				found = i;
+		if (found < 0 && cgroup_add(system, path, root_len, sub_len))
+			found = system->cgroup_count - 1;
+		if (found >= 0) {
+			if (found != *next) {
+				const struct cgroup_t cgroup = system->cgroups[found];
+				system->cgroups[found] = system->cgroups[*next];
+				system->cgroups[*next] = cgroup;
+				++system->device_generation;
+			}
+			system->cgroups[(*next)++].seen = 1;
+		}
+
+		if (depth < system->cgroup_max_depth) {
+			if (system->cgroup_inotify_fd >= 0)
+				inotify_add_watch(system->cgroup_inotify_fd, path,
+						CGROUP_INOTIFY_MASK);
+			cgroup_scan(system, path, root_len, sub_len, depth + 1, next);
+		}
+		path[path_len] = '\0';
+	}
+	dir_close(&dir);
+}
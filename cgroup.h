@@ -0,0 +1,55 @@
+#ifndef CGROUP_H_INCLUDED
+#define CGROUP_H_INCLUDED
+
+#define MAX_CGROUP_NAME_LENGTH 127
+/** How often the hierarchy is scanned for new cgroups when inotify
+ * can't tell */
+#define CGROUP_RESCAN_TICKS 10
+
+struct system_t;
+
+/** A cgroup v2 group (usually a container or a systemd unit) */
+struct cgroup_t
+{
+	char name[MAX_CGROUP_NAME_LENGTH + 1]; /**< The path of the cgroup
+											 relative to the cgroup root */
+
+	double cpu_usage; /**< CPU time used per second since last checked
+						(1.0 means one fully busy CPU) */
+	unsigned long long last_usage_usec; /**< usage_usec from cpu.stat */
+
+	long long memory_current; /**< Total memory charged (bytes) */
+	long long memory_anon; /**< Anonymous memory (bytes) */
+	long long memory_file; /**< Page cache memory (bytes) */
+
+	unsigned long long delta_read_bytes; /**< Bytes read since last checked */
+	unsigned long long delta_write_bytes; /**< Bytes written since last checked */
+
+	double read_rate; /**< Bytes read per second */
+	double write_rate; /**< Bytes written per second */
+
+	unsigned long long last_read_bytes; /**< Total bytes read */
+	unsigned long long last_write_bytes; /**< Total bytes written */
+
+	int seen; /**< Set while scanning the hierarchy, used to detect
+				removed cgroups */
+
+	// File descriptors for files that are kept open
+	int cpu_stat_fd;
+	int memory_current_fd;
+	int memory_stat_fd;
+	int io_stat_fd;
+};
+
+/** Start watching the cgroup v2 hierarchy mounted at root.
+ * Only groups up to max_depth levels below root are tracked. */
+void cgroup_init(struct system_t *system, const char *root, int max_depth);
+
+/** Refresh the stats of the cgroups. The hierarchy is only scanned for
+ * created and removed cgroups when inotify reports a change */
+void cgroup_refresh(struct system_t *system);
+
+/** Close all cgroup files and free the memory */
+void cgroup_delete(struct system_t *system);
+
+#endif
@@ -0,0 +1,166 @@
+#include "cpu.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+// Arrays are padded to a multiple of this many elements,
+// which is the number of 64-bit lanes in an AVX2 register
+#define LANES 4
+#define ALIGNMENT 32
+
+int cpu_counters_init(struct cpu_counters_t *counters,
+		const struct cpu_t *cpus, int count)
+{
+	memset(counters, 0, sizeof(struct cpu_counters_t));
+	counters->count = count;
+	counters->padded_count = (count + LANES - 1) / LANES * LANES;
+	for (int c = 0; c < count; ++c)
+		if (cpus[c].id >= counters->index_count)
+			counters->index_count = cpus[c].id + 1;
+
+	// All arrays are in one block, each starting at a multiple of ALIGNMENT
+	const size_t n = counters->padded_count;
+	const size_t index_size = (counters->index_count * sizeof(int) +
+			ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	const size_t size = n * sizeof(unsigned long long) * 2 * CPU_STATS_COUNT +
+		n * sizeof(double) + n * sizeof(int) + index_size + ALIGNMENT;
+	if (posix_memalign(&counters->memory, ALIGNMENT, size))
+		return 1;
+	memset(counters->memory, 0, size);
+
+	char *p = (char *)counters->memory;
+	for (int t = 0; t < CPU_STATS_COUNT; ++t) {
+		counters->times[t] = (unsigned long long *)p;
+		p += n * sizeof(unsigned long long);
+		counters->last_times[t] = (unsigned long long *)p;
+		p += n * sizeof(unsigned long long);
+	}
+	counters->usage = (double *)p;
+	p += n * sizeof(double);
+	counters->index = (int *)p;
+	p += index_size;
+	counters->freq = (int *)p;
+
+	for (int i = 0; i < counters->index_count; ++i)
+		counters->index[i] = -1;
+	for (int c = 0; c < count; ++c)
+		counters->index[cpus[c].id] = c;
+	cpu_counters_use_simd(counters, 1);
+	return 0;
+}
+
+void cpu_counters_delete(struct cpu_counters_t *counters)
+{
+	free(counters->memory);
+	counters->memory = NULL;
+}
+
+// The same as counter_delta() and the usage computation
+// in cpu_counters_compute_usage_avx2(), one CPU at a time
+static void cpu_counters_compute_usage_scalar(struct cpu_counters_t *counters)
+{
+	for (int c = 0; c < counters->count; ++c) {
+		unsigned long long total = 0, idle = 0;
+		for (int t = CPU_USER_TIME; t <= CPU_STEAL_TIME; ++t) {
+			unsigned long long delta = counter_delta(counters->times[t][c],
+					counters->last_times[t][c]);
+			total += delta;
+			if (t == CPU_IDLE_TIME || t == CPU_IOWAIT_TIME)
+				idle += delta;
+		}
+		double usage = (double)(total - idle) / total;
+		// Make sure the value is in [0.0, 1.0]
+		// It will also change nan values to 0.0
+		if (!(usage >= 0.0))
+			usage = 0.0;
+		else if (usage > 1.0)
+			usage = 1.0;
+		counters->usage[c] = usage;
+	}
+}
+
+#ifdef CPU_HAVE_AVX2
+// Convert unsigned 64-bit integers to doubles. AVX2 has no instruction
+// for this, so each 32-bit half is put in the mantissa of 2^52
+__attribute__((target("avx2")))
+static inline __m256d u64_to_double(__m256i x)
+{
+	const __m256d magic = _mm256_set1_pd(4503599627370496.0); // 2^52
+	const __m256i magic_bits = _mm256_castpd_si256(magic);
+	__m256d low = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(
+					_mm256_and_si256(x, _mm256_set1_epi64x(0xffffffffLL)),
+					magic_bits)), magic);
+	__m256d high = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(
+					_mm256_srli_epi64(x, 32), magic_bits)), magic);
+	return _mm256_add_pd(_mm256_mul_pd(high, _mm256_set1_pd(4294967296.0)),
+			low);
+}
+
+// Four CPUs at a time
+__attribute__((target("avx2")))
+static void cpu_counters_compute_usage_avx2(struct cpu_counters_t *counters)
+{
+	// AVX2 only compares signed integers, so flip the sign bits first
+	const __m256i sign = _mm256_set1_epi64x(0x8000000000000000LL);
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d one = _mm256_set1_pd(1.0);
+
+	for (int c = 0; c < counters->padded_count; c += LANES) {
+		__m256i total = _mm256_setzero_si256();
+		__m256i idle = _mm256_setzero_si256();
+		for (int t = CPU_USER_TIME; t <= CPU_STEAL_TIME; ++t) {
+			__m256i cur = _mm256_load_si256(
+					(const __m256i *)&counters->times[t][c]);
+			__m256i last = _mm256_load_si256(
+					(const __m256i *)&counters->last_times[t][c]);
+			__m256i delta = _mm256_sub_epi64(cur, last);
+
+			// Like counter_delta(): if the counter went back, it was reset
+			__m256i went_back = _mm256_cmpgt_epi64(
+					_mm256_xor_si256(last, sign), _mm256_xor_si256(cur, sign));
+			delta = _mm256_andnot_si256(went_back, delta);
+
+			total = _mm256_add_epi64(total, delta);
+			if (t == CPU_IDLE_TIME || t == CPU_IOWAIT_TIME)
+				idle = _mm256_add_epi64(idle, delta);
+		}
+
+		__m256d busy = u64_to_double(_mm256_sub_epi64(total, idle));
+		__m256d usage = _mm256_div_pd(busy, u64_to_double(total));
+		// max() returns the second operand for nan, so 0/0 becomes 0.0
+		usage = _mm256_min_pd(_mm256_max_pd(usage, zero), one);
+		_mm256_store_pd(&counters->usage[c], usage);
+	}
+}
+#endif
+
+void cpu_counters_compute_usage(struct cpu_counters_t *counters)
+{
+#ifdef CPU_HAVE_AVX2
+	if (counters->simd)
+		cpu_counters_compute_usage_avx2(counters);
+	else
+#endif
+		cpu_counters_compute_usage_scalar(counters);
+
+	for (int t = 0; t < CPU_STATS_COUNT; ++t)
+		memcpy(counters->last_times[t], counters->times[t],
+				counters->padded_count * sizeof(unsigned long long));
+}
+
+const char *cpu_counters_use_simd(struct cpu_counters_t *counters,
+		int enable)
+{
+	counters->simd = 0;
+#ifdef CPU_HAVE_AVX2
+	if (enable && __builtin_cpu_supports("avx2"))
+		counters->simd = 1;
+#endif
+	return counters->simd ? "avx2" : "scalar";
+}
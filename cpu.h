@@ -16,6 +16,17 @@ enum {
 	CPU_STATS_COUNT = 10
 };
 
+// perf_event counters
+enum {
+	PERF_CYCLES = 0,
+	PERF_INSTRUCTIONS = 1,
+	PERF_CONTEXT_SWITCHES = 2,
+	PERF_MIGRATIONS = 3,
+	PERF_MINOR_FAULTS = 4,
+	PERF_MAJOR_FAULTS = 5,
+	PERF_COUNTERS_COUNT = 6
+};
+
 /** A logical CPU */
 struct cpu_t
 {
@@ -23,20 +34,71 @@ struct cpu_t
 			  e.g. cpu0, cpu3 */
 	int core_id; /**< The ID of the CPU core */
 	int package_id;  /**< The ID of the CPU package */
+	int node; /**< The ID of its NUMA node, -1 if unknown */
 
-	int min_freq; /**< Minimum CPU frequency in KHz */
-	int max_freq; /**< Maximum CPU frequency in KHz */
-	int cur_freq; /**< Current CPU frequency in KHz */
+	int isolated; /**< In isolcpus= or nohz_full=, so it runs
+					latency-sensitive work that smon mustn't disturb */
 
-	// CPU usage
-	double total_usage; /**< The total usage for this cpu [0.0, 1.0] */
-	int stats[CPU_STATS_COUNT]; /**< The last read time parameters from /proc/stat */
+	// The current frequency and the usage are in struct cpu_counters_t
 
 	int cur_temp; /**< The current core temperature in millidegree Celsius */
 
+	// perf_event counters (only when enabled)
+	unsigned long long perf_delta[PERF_COUNTERS_COUNT]; /**< The change of
+														  the counters */
+	double perf_rate[PERF_COUNTERS_COUNT]; /**< The change of the counters
+											 per second */
+	unsigned long long perf_last[PERF_COUNTERS_COUNT]; /**< The last read
+														 counter values */
+	double ipc; /**< Instructions per cycle, 0.0 without a PMU */
+
 	// File descriptors for files that are kept open
 	int cur_freq_fd;
 	int cur_temp_fd;
+	int perf_fds[PERF_COUNTERS_COUNT]; /**< The first opened counter is the
+										 group leader, -1 if not opened */
+};
+
+/** The data of all CPUs that changes every refresh, with one array per
+ * field, so that all CPUs are processed in one (vectorized) pass.
+ * Indexed like system->cpus. The arrays are aligned to 32 bytes and have
+ * padded_count elements, the ones past count are always 0 */
+struct cpu_counters_t
+{
+	int count; /**< The number of CPUs */
+	int padded_count;
+
+	unsigned long long *times[CPU_STATS_COUNT]; /**< The time parameters
+												  from /proc/stat, e.g.
+												  times[CPU_IDLE_TIME][c] */
+	unsigned long long *last_times[CPU_STATS_COUNT]; /**< times as of the
+													   previous refresh */
+	double *usage; /**< The total usage of each CPU [0.0, 1.0] */
+	int *freq; /**< The current frequency of each CPU in KHz */
+
+	int *index; /**< The index of cpuN in the arrays is index[N],
+				  or -1 if there is no such CPU */
+	int index_count; /**< One more than the largest CPU ID */
+
+	int simd; /**< Use the SIMD version of cpu_counters_compute_usage() */
+	void *memory; /**< Holds all of the arrays */
 };
 
+/** Allocate the arrays for the given CPUs. Returns 0 on success */
+int cpu_counters_init(struct cpu_counters_t *counters,
+		const struct cpu_t *cpus, int count);
+
+/** Free the arrays */
+void cpu_counters_delete(struct cpu_counters_t *counters);
+
+/** Compute usage from the change of times since last_times,
+ * then copy times to last_times */
+void cpu_counters_compute_usage(struct cpu_counters_t *counters);
+
+/** Enable or disable the SIMD version of cpu_counters_compute_usage() for
+ * counters (it is enabled by default if the CPU supports it). Returns the
+ * name of the version that will be used, e.g. "avx2" or "scalar" */
+const char *cpu_counters_use_simd(struct cpu_counters_t *counters,
+		int enable);
+
 #endif
@@ -17,13 +17,19 @@ enum
 
 #define MAX_DISK_NAME_LENGTH 31
 
+/** The unit of the sector counts in the stat file of a disk. The kernel
+ * always counts 512 bytes, whatever the sector size of the disk */
+#define DISK_SECTOR_SIZE 512
+
 /** A block device */
 struct disk_t
 {
 	char name[MAX_DISK_NAME_LENGTH + 1]; /**< The disk name */
 
-	int stats_delta[DISK_STATS_COUNT]; /**< The change of the stats */
-	int last_stats[DISK_STATS_COUNT]; /**< The values from the stat file */
+	unsigned long long stats_delta[DISK_STATS_COUNT]; /**< The change of the stats */
+	double stats_rate[DISK_STATS_COUNT]; /**< The change of the stats per second */
+	unsigned long long last_stats[DISK_STATS_COUNT]; /**< The values from the
+													   stat file */
 
 	// File descriptors for files that are kept open
 	int stat_fd;
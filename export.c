@@ -0,0 +1,330 @@
+#define _DEFAULT_SOURCE
+
+#include "export.h"
+#include "system.h"
+#include "util.h"
+#include "cpu.h"
+#include "disk.h"
+#include "interface.h"
+#include "psi.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+
+// The largest varint
+#define VARINT_MAX_SIZE 10
+// The largest frame header: the type and the length
+#define FRAME_HEADER_MAX_SIZE (1 + VARINT_MAX_SIZE)
+// The largest hello frame
+#define HELLO_MAX_SIZE (FRAME_HEADER_MAX_SIZE + 3 * VARINT_MAX_SIZE + \
+		EXPORT_MAX_HOSTNAME_LENGTH)
+
+static const struct export_metric_t metrics[EXPORT_METRIC_COUNT] = {
+	{ "CPUs", 1.0, EXPORT_COMBINE_SUM },
+	{ "CPU Usage (%)", 0.01, EXPORT_COMBINE_CPU_AVERAGE },
+	{ "Max CPU Usage (%)", 0.01, EXPORT_COMBINE_MAX },
+	{ "RAM Used", 1024.0, EXPORT_COMBINE_SUM },
+	{ "RAM Caches", 1024.0, EXPORT_COMBINE_SUM },
+	{ "Disk Read Speed (B/s)", 1.0, EXPORT_COMBINE_SUM },
+	{ "Disk Write Speed (B/s)", 1.0, EXPORT_COMBINE_SUM },
+	{ "Download Speed (B/s)", 1.0, EXPORT_COMBINE_SUM },
+	{ "Upload Speed (B/s)", 1.0, EXPORT_COMBINE_SUM },
+	{ "Max CPU Pressure (%)", 0.01, EXPORT_COMBINE_MAX },
+	{ "Max Memory Pressure (%)", 0.01, EXPORT_COMBINE_MAX },
+	{ "Max IO Pressure (%)", 0.01, EXPORT_COMBINE_MAX },
+};
+
+const struct export_metric_t *export_metric(int metric)
+{
+	return &metrics[metric];
+}
+
+int export_put_varint(unsigned char *out, unsigned long long value)
+{
+	int size = 0;
+	while (value >= 0x80) {
+		out[size++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	out[size++] = value;
+	return size;
+}
+
+int export_put_svarint(unsigned char *out, long long value)
+{
+	return export_put_varint(out, ((unsigned long long)value << 1) ^
+			(unsigned long long)(value >> 63));
+}
+
+int export_get_varint(const unsigned char *data, size_t size, size_t *pos,
+		unsigned long long *value)
+{
+	*value = 0;
+	for (int shift = 0; *pos < size && shift < 64; shift += 7) {
+		const unsigned char byte = data[(*pos)++];
+		*value |= (unsigned long long)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return 0;
+	}
+	return 1;
+}
+
+int export_get_svarint(const unsigned char *data, size_t size, size_t *pos,
+		long long *value)
+{
+	unsigned long long v;
+	if (export_get_varint(data, size, pos, &v))
+		return 1;
+	*value = (long long)(v >> 1) ^ -(long long)(v & 1);
+	return 0;
+}
+
+int export_split_address(const char *address, char *host, int host_size,
+		const char **port)
+{
+	const char *colon = strrchr(address, ':');
+	if (colon == NULL) {
+		host[0] = '\0';
+		*port = address;
+		return **port == '\0';
+	}
+	int host_length = colon - address;
+	if (address[0] == '[' && host_length >= 2 && colon[-1] == ']') {
+		++address;
+		host_length -= 2;
+	}
+	if (host_length >= host_size || colon[1] == '\0')
+		return 1;
+	memcpy(host, address, host_length);
+	host[host_length] = '\0';
+	*port = colon + 1;
+	return 0;
+}
+
+// Take the metrics of a sample from system
+static void export_fill_sample(long long *metric, const struct system_t *system)
+{
+	memset(metric, 0, sizeof(long long) * EXPORT_METRIC_COUNT);
+
+	const struct cpu_counters_t *counters = system->cpu_counters;
+	double usage = 0.0, max_usage = 0.0;
+	for (int c = 0; c < counters->count; ++c) {
+		usage += counters->usage[c];
+		if (counters->usage[c] > max_usage)
+			max_usage = counters->usage[c];
+	}
+	metric[EXPORT_CPU_COUNT] = counters->count;
+	if (counters->count > 0)
+		metric[EXPORT_CPU_USAGE] = usage / counters->count * 10000.0 + 0.5;
+	metric[EXPORT_CPU_MAX_USAGE] = max_usage * 10000.0 + 0.5;
+
+	metric[EXPORT_RAM_USED] = system->ram_used / 1024;
+	metric[EXPORT_RAM_CACHED] = system->ram_cached / 1024;
+
+	double read = 0.0, write = 0.0;
+	for (int d = 0; d < system->disk_count; ++d) {
+		read += system->disks[d].stats_rate[DISK_READ_SECTORS] *
+			DISK_SECTOR_SIZE;
+		write += system->disks[d].stats_rate[DISK_WRITE_SECTORS] *
+			DISK_SECTOR_SIZE;
+	}
+	metric[EXPORT_DISK_READ] = read + 0.5;
+	metric[EXPORT_DISK_WRITE] = write + 0.5;
+
+	// The export stream itself may go through lo
+	double rx = 0.0, tx = 0.0;
+	for (int i = 0; i < system->interface_count; ++i) {
+		if (!strcmp(system->interfaces[i].name, "lo"))
+			continue;
+		rx += system->interfaces[i].rx_rate;
+		tx += system->interfaces[i].tx_rate;
+	}
+	metric[EXPORT_NET_RX] = rx + 0.5;
+	metric[EXPORT_NET_TX] = tx + 0.5;
+
+	if (system->psi) {
+		metric[EXPORT_PSI_CPU] = system->psi[PSI_CPU].some.stall * 10000.0 + 0.5;
+		metric[EXPORT_PSI_MEMORY] =
+			system->psi[PSI_MEMORY].some.stall * 10000.0 + 0.5;
+		metric[EXPORT_PSI_IO] = system->psi[PSI_IO].some.stall * 10000.0 + 0.5;
+	}
+}
+
+// Write a frame header and payload_size bytes of payload that
+// were already written at out + FRAME_HEADER_MAX_SIZE
+static int export_finish_frame(unsigned char *out, int type, int payload_size)
+{
+	unsigned char header[FRAME_HEADER_MAX_SIZE];
+	header[0] = type;
+	int header_size = 1 + export_put_varint(header + 1, payload_size);
+	memmove(out + header_size, out + FRAME_HEADER_MAX_SIZE, payload_size);
+	memcpy(out, header, header_size);
+	return header_size + payload_size;
+}
+
+static void exporter_disconnect(struct exporter_t *exporter)
+{
+	if (exporter->fd >= 0)
+		close_fd(exporter->fd);
+	exporter->fd = -1;
+	exporter->state = EXPORTER_DISCONNECTED;
+	exporter->out_used = 0;
+}
+
+static void exporter_connect(struct exporter_t *exporter)
+{
+	exporter->fd = socket(exporter->address.ss_family,
+			SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (exporter->fd < 0)
+		return;
+	if (connect(exporter->fd, (struct sockaddr *)&exporter->address,
+				exporter->address_length) == 0 || errno == EINPROGRESS)
+		exporter->state = EXPORTER_CONNECTING;
+	else
+		exporter_disconnect(exporter);
+}
+
+// Returns nonzero if the connection is ready for a frame
+static int exporter_check_connection(struct exporter_t *exporter)
+{
+	if (exporter->state == EXPORTER_CONNECTING) {
+		// A connection that isn't ready after a whole batch never will be
+		struct pollfd fd = { exporter->fd, POLLOUT, 0 };
+		int error = 0;
+		socklen_t length = sizeof(error);
+		if (poll(&fd, 1, 0) != 1 || getsockopt(exporter->fd, SOL_SOCKET,
+					SO_ERROR, &error, &length) || error) {
+			exporter_disconnect(exporter);
+		} else {
+			// Start with a hello, the deltas start from 0
+			exporter->state = EXPORTER_CONNECTED;
+			memset(exporter->last, 0, sizeof(exporter->last));
+			unsigned char *out = exporter->out + FRAME_HEADER_MAX_SIZE;
+			int size = export_put_varint(out, EXPORT_VERSION);
+			size += export_put_varint(out + size, EXPORT_METRIC_COUNT);
+			const int length = strlen(exporter->hostname);
+			size += export_put_varint(out + size, length);
+			memcpy(out + size, exporter->hostname, length);
+			exporter->out_used = export_finish_frame(exporter->out,
+					EXPORT_HELLO, size + length);
+		}
+	}
+	if (exporter->state == EXPORTER_DISCONNECTED)
+		exporter_connect(exporter);
+	return exporter->state == EXPORTER_CONNECTED;
+}
+
+// Send as much of exporter->out as the socket takes
+static void exporter_send(struct exporter_t *exporter)
+{
+	int sent = 0;
+	while (sent < exporter->out_used) {
+		ssize_t bytes = send(exporter->fd, exporter->out + sent,
+				exporter->out_used - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (bytes <= 0) {
+			exporter_disconnect(exporter);
+			return;
+		}
+		sent += bytes;
+		exporter->bytes_sent += bytes;
+	}
+	memmove(exporter->out, exporter->out + sent, exporter->out_used - sent);
+	exporter->out_used -= sent;
+}
+
+// The largest frame with batch samples
+static int exporter_frame_max_size(int batch)
+{
+	return FRAME_HEADER_MAX_SIZE +
+		VARINT_MAX_SIZE * (1 + (1 + EXPORT_METRIC_COUNT) * batch);
+}
+
+int exporter_init(struct exporter_t *exporter, const char *address, int batch)
+{
+	memset(exporter, 0, sizeof(struct exporter_t));
+	exporter->fd = -1;
+	exporter->state = EXPORTER_DISCONNECTED;
+	if (batch < 1 || batch > EXPORT_MAX_BATCH)
+		return 1;
+	exporter->batch = batch;
+
+	char host[256];
+	const char *port;
+	if (export_split_address(address, host, sizeof(host), &port) ||
+			host[0] == '\0')
+		return 1;
+
+	struct addrinfo hints, *result;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &result))
+		return 2;
+	memcpy(&exporter->address, result->ai_addr, result->ai_addrlen);
+	exporter->address_length = result->ai_addrlen;
+	freeaddrinfo(result);
+
+	if (gethostname(exporter->hostname, sizeof(exporter->hostname)))
+		strcpy(exporter->hostname, "unknown");
+	exporter->hostname[EXPORT_MAX_HOSTNAME_LENGTH] = '\0';
+
+	// Room for a hello and a frame with a full batch
+	exporter->samples = (long long *)malloc(
+			sizeof(long long) * (1 + EXPORT_METRIC_COUNT) * batch);
+	exporter->out_size = HELLO_MAX_SIZE + exporter_frame_max_size(batch);
+	exporter->out = (unsigned char *)malloc(exporter->out_size);
+
+	exporter_connect(exporter);
+	return 0;
+}
+
+void exporter_sample(struct exporter_t *exporter,
+		const struct system_t *system)
+{
+	long long *sample = exporter->samples +
+		exporter->sample_count * (1 + EXPORT_METRIC_COUNT);
+	sample[0] = realtime_ns() / 1000000;
+	export_fill_sample(sample + 1, system);
+	if (++exporter->sample_count < exporter->batch)
+		return;
+
+	// Frames are only added once the previous ones are sent, so
+	// a slow aggregator makes us drop batches instead of buffering
+	if (!exporter_check_connection(exporter) ||
+			exporter->out_used + exporter_frame_max_size(exporter->batch) >
+			exporter->out_size) {
+		exporter->dropped_samples += exporter->sample_count;
+		exporter->sample_count = 0;
+		if (exporter->state == EXPORTER_CONNECTED)
+			exporter_send(exporter);
+		return;
+	}
+
+	unsigned char *out = exporter->out + exporter->out_used;
+	unsigned char *payload = out + FRAME_HEADER_MAX_SIZE;
+	int size = export_put_varint(payload, exporter->sample_count);
+	for (int s = 0; s < exporter->sample_count; ++s) {
+		const long long *values = exporter->samples + s * (1 + EXPORT_METRIC_COUNT);
+		for (int m = 0; m < 1 + EXPORT_METRIC_COUNT; ++m) {
+			size += export_put_svarint(payload + size,
+					values[m] - exporter->last[m]);
+			exporter->last[m] = values[m];
+		}
+	}
+	exporter->out_used += export_finish_frame(out, EXPORT_SAMPLES, size);
+	exporter->sample_count = 0;
+	exporter_send(exporter);
+}
+
+void exporter_delete(struct exporter_t *exporter)
+{
+	exporter_disconnect(exporter);
+	free(exporter->samples);
+	free(exporter->out);
+}
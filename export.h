@@ -0,0 +1,138 @@
+#ifndef EXPORT_H_INCLUDED
+#define EXPORT_H_INCLUDED
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+/*
+ * Streaming samples to an aggregator (smon --export host:port).
+ *
+ * The stream is a sequence of frames: a type byte, the payload length as
+ * a varint and the payload. Varints are unsigned LEB128, signed values
+ * are zigzag-encoded first.
+ *
+ * EXPORT_HELLO starts every connection: the protocol version, the number
+ * of metrics in a sample and the name of the node.
+ *
+ * EXPORT_SAMPLES holds a batch: the number of samples, then for every
+ * sample the change of the time (ms since the epoch) and of every metric
+ * since the previous sample of the connection (or since 0 after the
+ * hello). Most metrics barely change between samples, so a sample takes
+ * a couple of dozen bytes.
+ */
+
+#define EXPORT_VERSION 1
+#define EXPORT_DEFAULT_BATCH 5
+#define EXPORT_MAX_BATCH 60
+#define EXPORT_MAX_HOSTNAME_LENGTH 63
+#define EXPORT_MAX_FRAME_SIZE (64 * 1024)
+
+enum {
+	EXPORT_HELLO = 1,
+	EXPORT_SAMPLES = 2
+};
+
+// The metrics of a sample, all integers
+enum {
+	EXPORT_CPU_COUNT = 0,
+	EXPORT_CPU_USAGE = 1, /**< The average of all CPUs (0.01%) */
+	EXPORT_CPU_MAX_USAGE = 2, /**< The busiest CPU (0.01%) */
+	EXPORT_RAM_USED = 3, /**< KiB */
+	EXPORT_RAM_CACHED = 4, /**< KiB */
+	EXPORT_DISK_READ = 5, /**< All disks (B/s) */
+	EXPORT_DISK_WRITE = 6,
+	EXPORT_NET_RX = 7, /**< All interfaces except lo (B/s) */
+	EXPORT_NET_TX = 8,
+	EXPORT_PSI_CPU = 9, /**< Some stall (0.01%) */
+	EXPORT_PSI_MEMORY = 10,
+	EXPORT_PSI_IO = 11,
+	EXPORT_METRIC_COUNT = 12
+};
+
+// How the metric of many nodes is combined into a fleet-wide value
+enum {
+	EXPORT_COMBINE_SUM,
+	EXPORT_COMBINE_MAX,
+	EXPORT_COMBINE_CPU_AVERAGE /**< Average weighted by EXPORT_CPU_COUNT */
+};
+
+/** The description of a metric */
+struct export_metric_t
+{
+	const char *name; /**< The column name in logs, e.g. "RAM Used" */
+	double scale; /**< Multiply by it to get the logged value */
+	int combine; /**< EXPORT_COMBINE_* */
+};
+
+/** Returns the description of a metric */
+const struct export_metric_t *export_metric(int metric);
+
+struct system_t;
+
+/** The sending side of an export stream */
+struct exporter_t
+{
+	char hostname[EXPORT_MAX_HOSTNAME_LENGTH + 1]; /**< Sent in the hello */
+
+	struct sockaddr_storage address; /**< Resolved once at startup */
+	socklen_t address_length;
+	int fd; /**< -1 when not connected */
+	int state; /**< EXPORTER_DISCONNECTED, EXPORTER_CONNECTING
+				 or EXPORTER_CONNECTED */
+
+	int batch; /**< How many samples to send in a frame */
+	int sample_count; /**< The number of samples waiting to be sent */
+	long long *samples; /**< batch samples: the time (ms) and the metrics */
+	long long last[1 + EXPORT_METRIC_COUNT]; /**< The last sample that was
+											   sent on this connection */
+
+	unsigned char *out; /**< Encoded frames that weren't sent yet */
+	int out_size;
+	int out_used;
+
+	unsigned long long bytes_sent; /**< Since smon started */
+	unsigned long long dropped_samples; /**< Samples taken while
+										  disconnected */
+};
+
+enum {
+	EXPORTER_DISCONNECTED,
+	EXPORTER_CONNECTING,
+	EXPORTER_CONNECTED
+};
+
+/** Parse "host:port" and start connecting to it. Returns 0 on success,
+ * 1 for an invalid address and 2 if it can't be resolved */
+int exporter_init(struct exporter_t *exporter, const char *address, int batch);
+
+/** Add a sample of system. Every batch samples they are sent in one
+ * frame, without blocking. If the aggregator can't be reached, the
+ * samples are dropped and it is reconnected to with the next batch */
+void exporter_sample(struct exporter_t *exporter,
+		const struct system_t *system);
+
+/** Close the connection and free the memory */
+void exporter_delete(struct exporter_t *exporter);
+
+
+/** Split "[host:]port" into the host (empty if there is none, without
+ * the brackets of an IPv6 address) and the port. Returns 0 on success */
+int export_split_address(const char *address, char *host, int host_size,
+		const char **port);
+
+/** Append a varint to out. Returns the number of bytes written */
+int export_put_varint(unsigned char *out, unsigned long long value);
+
+/** Append a zigzag-encoded signed varint to out */
+int export_put_svarint(unsigned char *out, long long value);
+
+/** Read a varint from data[*pos, size). Returns 0 on success
+ * and advances *pos, returns 1 if data ends before the varint */
+int export_get_varint(const unsigned char *data, size_t size, size_t *pos,
+		unsigned long long *value);
+
+/** Read a zigzag-encoded signed varint */
+int export_get_svarint(const unsigned char *data, size_t size, size_t *pos,
+		long long *value);
+
+#endif
@@ -0,0 +1,52 @@
+#include "filter.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+int filter_init(struct filter_t *filter, const char *list)
+{
+	filter->count = 0;
+	filter->include_count = 0;
+	for (const char *s = list; s && *s;) {
+		const char *end = strchr(s, ',');
+		const int len = end ? end - s : (int)strlen(s);
+		if (len > 0) {
+			if (filter->count == MAX_FILTER_PATTERNS) {
+				filter_delete(filter);
+				return 1;
+			}
+			const int exclude = s[0] == '!';
+			char *pattern = (char *)malloc(len + 1 - exclude);
+			memcpy(pattern, s + exclude, len - exclude);
+			pattern[len - exclude] = '\0';
+			filter->patterns[filter->count] = pattern;
+			filter->exclude[filter->count] = exclude;
+			filter->include_count += !exclude;
+			++filter->count;
+		}
+		s += len + (end != NULL);
+	}
+	return 0;
+}
+
+int filter_match(const struct filter_t *filter, const char *name)
+{
+	int included = filter->include_count == 0;
+	for (int i = 0; i < filter->count; ++i) {
+		if (fnmatch(filter->patterns[i], name, 0))
+			continue;
+		if (filter->exclude[i])
+			return 0;
+		included = 1;
+	}
+	return included;
+}
+
+void filter_delete(struct filter_t *filter)
+{
+	for (int i = 0; i < filter->count; ++i)
+		free(filter->patterns[i]);
+	filter->count = 0;
+	filter->include_count = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef FILTER_H_INCLUDED
+#define FILTER_H_INCLUDED
+
+/*
+ * Which devices to watch, as a comma-separated list of glob patterns
+ * (see fnmatch(3)) that are matched against device names. Patterns that
+ * start with ! exclude, the others include. A name is kept if it matches
+ * no exclude pattern and either matches an include pattern or there are
+ * none, so "sd*,nvme*" keeps only those disks and "!veth*,!cali*" keeps
+ * all interfaces except the container ones.
+ */
+
+#define MAX_FILTER_PATTERNS 32
+
+struct filter_t
+{
+	int count; /**< The number of patterns */
+	int include_count; /**< How many of them include */
+	char *patterns[MAX_FILTER_PATTERNS]; /**< Without the ! */
+	int exclude[MAX_FILTER_PATTERNS]; /**< Set for the exclude patterns */
+};
+
+/** Parse list, which may be NULL or empty to keep everything.
+ * Returns 0 on success or 1 if there are too many patterns */
+int filter_init(struct filter_t *filter, const char *list);
+
+/** Returns 1 if a device called name is kept */
+int filter_match(const struct filter_t *filter, const char *name);
+
+void filter_delete(struct filter_t *filter);
+
+#endif
@@ -0,0 +1,285 @@
+#include "freq.h"
+#include "system.h"
+#include "cpu.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define CPU_DEVICES_DIR "/sys/bus/cpu/devices/"
+#define CPUINFO_PATH "/proc/cpuinfo"
+#define INTERRUPTS_PATH "/proc/interrupts"
+
+static const char * const source_names[FREQ_SOURCE_COUNT] = {
+	"sysfs", "cpuinfo", "stats", "busy", "none"
+};
+
+const char *freq_source_name(int source)
+{
+	return source_names[source];
+}
+
+int freq_source_parse(const char *name)
+{
+	for (int s = 0; s < FREQ_SOURCE_COUNT; ++s)
+		if (!strcmp(name, source_names[s]))
+			return s;
+	return -1;
+}
+
+// Parse the "cpu MHz" of each processor in system->freq->buffer.
+// Returns the number of CPUs that had one
+static int freq_parse_cpuinfo(struct system_t *system, int len)
+{
+	struct freq_t *freq = system->freq;
+	struct cpu_counters_t *counters = system->cpu_counters;
+	char *s = freq->buffer;
+	s[len] = '\0';
+	int found = 0;
+	int c = -1;
+	while (*s) {
+		if (!strncmp(s, "processor", 9)) {
+			s = strchr(s, ':');
+			if (s == NULL)
+				break;
+			int id = strtol(s + 1, &s, 10);
+			c = id >= 0 && id < counters->index_count ? counters->index[id] : -1;
+		} else if (!strncmp(s, "cpu MHz", 7) && c >= 0) {
+			s = strchr(s, ':');
+			if (s == NULL)
+				break;
+			counters->freq[c] = strtod(s + 1, &s) * 1000.0;
+			++found;
+		}
+		s = strchr(s, '\n');
+		if (s == NULL)
+			break;
+		++s;
+	}
+	return found;
+}
+
+// Read all of time_in_state of a policy. Returns the number of bytes
+static int freq_read_stats(int fd, char *buffer, int size)
+{
+	int len = read_fd_to_string(fd, buffer, size - 1);
+	if (len < 0)
+		len = 0;
+	buffer[len] = '\0';
+	return len;
+}
+
+// Open the time_in_state of the policy of every CPU, once per policy
+static int freq_init_stats(struct system_t *system)
+{
+	struct freq_t *freq = system->freq;
+	char filename[PATH_MAX];
+	const int dir_len = system_path(system, filename, CPU_DEVICES_DIR);
+	char (*policy_paths)[PATH_MAX] = (char (*)[PATH_MAX])malloc(
+			(size_t)PATH_MAX * system->cpu_count);
+	freq->policies = (struct freq_policy_t *)calloc(system->cpu_count,
+			sizeof(struct freq_policy_t));
+	char buffer[4096];
+
+	for (int c = 0; c < system->cpu_count; ++c) {
+		// cpuN/cpufreq links to the policy, which is shared
+		snprintf(filename + dir_len, PATH_MAX - dir_len, "cpu%d/cpufreq",
+				system->cpus[c].id);
+		char path[PATH_MAX];
+		if (realpath(filename, path) == NULL)
+			continue;
+		int p = 0;
+		while (p < freq->policy_count && strcmp(policy_paths[p], path))
+			++p;
+		struct freq_policy_t *policy = &freq->policies[p];
+		if (p == freq->policy_count) {
+			strcpy(policy_paths[p], path);
+			if (strlen(path) + 32 > PATH_MAX)
+				continue;
+			strcat(path, "/stats/time_in_state");
+			policy->fd = open_file_readonly(path);
+			if (policy->fd < 0)
+				continue;
+			freq_read_stats(policy->fd, buffer, sizeof(buffer));
+
+			// A line per state: the frequency and the time in it
+			for (const char *s = buffer; (s = strchr(s, '\n')); ++s)
+				++policy->state_count;
+			policy->freqs = (int *)calloc(policy->state_count, sizeof(int));
+			policy->last_times = (unsigned long long *)calloc(
+					policy->state_count, sizeof(unsigned long long));
+			char *s = buffer;
+			for (int i = 0; i < policy->state_count; ++i) {
+				policy->freqs[i] = strtol(s, &s, 10);
+				policy->last_times[i] = strtoull(s, &s, 10);
+			}
+			policy->cpus = (int *)malloc(sizeof(int) * system->cpu_count);
+			++freq->policy_count;
+		}
+		policy->cpus[policy->cpu_count++] = c;
+	}
+	free(policy_paths);
+	return freq->policy_count > 0;
+}
+
+void freq_init(struct system_t *system, int source)
+{
+	struct freq_t *freq = (struct freq_t *)calloc(1, sizeof(struct freq_t));
+	system->freq = freq;
+	freq->source = source;
+	freq->cpuinfo_fd = -1;
+
+	if (source == FREQ_CPUINFO) {
+		char filename[PATH_MAX];
+		system_path(system, filename, CPUINFO_PATH);
+		freq->cpuinfo_fd = open_file_readonly(filename);
+		if (freq->cpuinfo_fd >= 0) {
+			// Find out how big it is, then leave room for it to grow
+			int len;
+			do {
+				freq->buffer_size = freq->buffer_size * 2 + 65536;
+				freq->buffer = (char *)realloc(freq->buffer, freq->buffer_size);
+				len = read_fd_to_string(freq->cpuinfo_fd, freq->buffer,
+						freq->buffer_size - 1);
+			} while (len >= freq->buffer_size - 1);
+			freq->buffer_size = len * 2 + 4096;
+			freq->buffer = (char *)realloc(freq->buffer, freq->buffer_size);
+			freq->available = freq_parse_cpuinfo(system, len > 0 ? len : 0) > 0;
+		}
+	} else if (source == FREQ_STATS) {
+		freq->available = freq_init_stats(system);
+	} else if (source == FREQ_NONE) {
+		freq->available = 1;
+	} else {
+		// Only these sources read scaling_cur_freq. Isolated CPUs that
+		// smon mustn't disturb are left out, reading it takes an IPI
+		char filename[PATH_MAX];
+		const int dir_len = system_path(system, filename, CPU_DEVICES_DIR);
+		for (int c = 0; c < system->cpu_count; ++c) {
+			struct cpu_t *cpu = &system->cpus[c];
+			if (cpu->isolated && system->skip_isolated)
+				continue;
+			sprintf(filename + dir_len, "cpu%d/cpufreq/scaling_cur_freq", cpu->id);
+			cpu->cur_freq_fd = open_file_readonly(filename);
+			freq->available |= cpu->cur_freq_fd >= 0;
+		}
+		// Idle CPUs start with the frequency they have now
+		if (source == FREQ_BUSY)
+			for (int c = 0; c < system->cpu_count; ++c)
+				system->cpu_counters->freq[c] = read_int_from_fd(
+						system->cpus[c].cur_freq_fd);
+	}
+}
+
+void freq_refresh(struct system_t *system)
+{
+	struct freq_t *freq = system->freq;
+	struct cpu_counters_t *counters = system->cpu_counters;
+
+	if (freq->source == FREQ_SYSFS) {
+		for (int c = 0; c < system->cpu_count; ++c)
+			counters->freq[c] = read_int_from_fd(system->cpus[c].cur_freq_fd);
+	} else if (freq->source == FREQ_BUSY) {
+		// An idle CPU would be woken up just to tell its frequency
+		for (int c = 0; c < system->cpu_count; ++c)
+			if (counters->usage[c] >= FREQ_BUSY_USAGE)
+				counters->freq[c] = read_int_from_fd(
+						system->cpus[c].cur_freq_fd);
+	} else if (freq->source == FREQ_CPUINFO) {
+		if (freq->cpuinfo_fd < 0)
+			return;
+		int len = read_fd_to_string(freq->cpuinfo_fd, freq->buffer,
+				freq->buffer_size - 1);
+		freq_parse_cpuinfo(system, len > 0 ? len : 0);
+	} else if (freq->source == FREQ_STATS) {
+		char buffer[4096];
+		for (int p = 0; p < freq->policy_count; ++p) {
+			struct freq_policy_t *policy = &freq->policies[p];
+			if (policy->fd < 0)
+				continue;
+			freq_read_stats(policy->fd, buffer, sizeof(buffer));
+			// The average frequency, weighted by the time in each state
+			double weighted = 0.0;
+			unsigned long long total = 0;
+			char *s = buffer;
+			for (int i = 0; i < policy->state_count; ++i) {
+				strtol(s, &s, 10);
+				unsigned long long time = strtoull(s, &s, 10);
+				unsigned long long delta = counter_delta(time,
+						policy->last_times[i]);
+				policy->last_times[i] = time;
+				weighted += (double)policy->freqs[i] * delta;
+				total += delta;
+			}
+			// Less than a kernel tick has passed, keep the last value
+			if (total == 0)
+				continue;
+			for (int i = 0; i < policy->cpu_count; ++i)
+				counters->freq[policy->cpus[i]] = weighted / total;
+		}
+	}
+}
+
+void freq_delete(struct system_t *system)
+{
+	struct freq_t *freq = system->freq;
+	close_fd(freq->cpuinfo_fd);
+	free(freq->buffer);
+	for (int p = 0; p < freq->policy_count; ++p) {
+		close_fd(freq->policies[p].fd);
+		free(freq->policies[p].freqs);
+		free(freq->policies[p].last_times);
+		free(freq->policies[p].cpus);
+	}
+	free(freq->policies);
+	free(freq);
+}
+
+void freq_read_disturbance(const struct system_t *system,
+		struct freq_disturbance_t *disturbance)
+{
+	disturbance->ipis = 0;
+	disturbance->wakeups = 0;
+	char filename[PATH_MAX];
+
+	// e.g. " CAL:   12   34   Function call interrupts", or IPIn on arm
+	system_path(system, filename, INTERRUPTS_PATH);
+	FILE *file = fopen(filename, "re");
+	if (file) {
+		char line[65536];
+		while (fgets(line, sizeof(line), file)) {
+			if (!strstr(line, "unction call interrupts") &&
+					!strstr(line, "Rescheduling interrupts"))
+				continue;
+			char *s = strchr(line, ':');
+			if (s == NULL)
+				continue;
+			++s;
+			for (;;) {
+				char *end;
+				unsigned long long count = strtoull(s, &end, 10);
+				if (end == s)
+					break;
+				disturbance->ipis += count;
+				s = end;
+			}
+		}
+		fclose(file);
+	}
+
+	// Every wakeup of an idle CPU ends an idle state
+	const int dir_len = system_path(system, filename, CPU_DEVICES_DIR);
+	for (int c = 0; c < system->cpu_count; ++c) {
+		for (int state = 0;; ++state) {
+			snprintf(filename + dir_len, PATH_MAX - dir_len,
+					"cpu%d/cpuidle/state%d/usage", system->cpus[c].id, state);
+			int fd = open_file_readonly(filename);
+			if (fd < 0)
+				break;
+			disturbance->wakeups += read_ull_from_fd(fd);
+			close_fd(fd);
+		}
+	}
+}
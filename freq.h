@@ -0,0 +1,92 @@
+#ifndef FREQ_H_INCLUDED
+#define FREQ_H_INCLUDED
+
+/*
+ * Where the current frequency of the CPUs comes from.
+ *
+ * Reading cpufreq/scaling_cur_freq makes many kernels ask the CPU itself
+ * (an IPI, or waiting for an APERF/MPERF sample), which wakes idle CPUs
+ * up every tick. The other sources avoid that, except for cpuinfo:
+ *
+ * - cpuinfo: a single read of /proc/cpuinfo for all CPUs (x86 only).
+ *   Recent kernels compute the "cpu MHz" lines with an IPI to every CPU
+ *   (or wait for their APERF/MPERF samples), so this is no better on
+ *   isolated or nohz_full CPUs. It only saves the per-CPU reads
+ * - stats: the average frequency since the last tick, from the deltas of
+ *   cpufreq/stats/time_in_state, read once per cpufreq policy. Its
+ *   resolution is the kernel tick, and it's the frequency that was
+ *   requested, not the one that the CPU actually ran at
+ * - busy: scaling_cur_freq, but only of the CPUs that were busy during
+ *   the last tick. Idle CPUs keep their last frequency
+ * - none: don't read the frequency at all
+ */
+
+// A CPU is busy if its usage was at least this much
+#define FREQ_BUSY_USAGE 0.05
+
+enum freq_source
+{
+	FREQ_SYSFS,
+	FREQ_CPUINFO,
+	FREQ_STATS,
+	FREQ_BUSY,
+	FREQ_NONE,
+	FREQ_SOURCE_COUNT
+};
+
+struct system_t;
+
+/** The CPUs that share a cpufreq policy and its time_in_state */
+struct freq_policy_t
+{
+	int fd; /**< stats/time_in_state */
+	int state_count;
+	int *freqs; /**< The frequency of each state (KHz) */
+	unsigned long long *last_times; /**< The time in each state as of the
+									  last refresh (10ms units) */
+	int cpu_count;
+	int *cpus; /**< Indices in system->cpus */
+};
+
+struct freq_t
+{
+	int source; /**< FREQ_SYSFS, FREQ_CPUINFO, ... */
+	int available; /**< The source could be opened */
+
+	int cpuinfo_fd;
+	char *buffer; /**< Fits all of /proc/cpuinfo */
+	int buffer_size;
+
+	int policy_count;
+	struct freq_policy_t *policies;
+};
+
+/** What smon may cause on the other CPUs */
+struct freq_disturbance_t
+{
+	unsigned long long ipis; /**< Function call and rescheduling
+							   interrupts of all CPUs */
+	unsigned long long wakeups; /**< Entries to idle states of all CPUs */
+};
+
+/** The name of a source, e.g. "cpuinfo" */
+const char *freq_source_name(int source);
+
+/** The source called name, or -1 */
+int freq_source_parse(const char *name);
+
+/** Open the files of a source. Sets system->freq->available */
+void freq_init(struct system_t *system, int source);
+
+/** Update system->cpu_counters->freq. Runs after the CPU usage is known */
+void freq_refresh(struct system_t *system);
+
+/** Close the files and free the memory */
+void freq_delete(struct system_t *system);
+
+/** Read the counters in /proc/interrupts and cpuidle. Slow, this is
+ * for measuring the sources */
+void freq_read_disturbance(const struct system_t *system,
+		struct freq_disturbance_t *disturbance);
+
+#endif
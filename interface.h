@@ -11,12 +11,26 @@ struct interface_t
 	unsigned long long delta_rx_bytes; /**< Bytes received since last checked */
 	unsigned long long delta_tx_bytes; /**< Bytes transferred since last checked */
 
+	double rx_rate; /**< Bytes received per second */
+	double tx_rate; /**< Bytes transferred per second */
+
 	unsigned long long last_total_rx_bytes; /**< Total bytes received */
 	unsigned long long last_total_tx_bytes; /**< Total bytes transferred */
 
+	int seen; /**< Set while listing /sys/class/net, used to detect
+				removed interfaces */
+
 	// File descriptors for files that are kept open
 	int rx_bytes_fd;
 	int tx_bytes_fd;
 };
 
+/** Names of interfaces, in the order of /sys/class/net */
+struct interface_names_t
+{
+	int count;
+	char (*names)[MAX_INTERFACE_NAME_LENGTH + 1];
+	int max_count;
+};
+
 #endif
@@ -0,0 +1,454 @@
+#include "irq.h"
+#include "system.h"
+#include "cpu.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IRQ_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define INTERRUPTS_PATH "/proc/interrupts"
+#define SOFTIRQS_PATH "/proc/softirqs"
+#define SOFTNET_PATH "/proc/net/softnet_stat"
+
+// The SIMD parser may read this many bytes past the end of the text
+#define BUFFER_PADDING 16
+// The fields of a softnet_stat line that are read, the last is the CPU ID
+#define SOFTNET_FIELDS 13
+
+static const char *skip_spaces_scalar(const char *s)
+{
+	while (*s == ' ')
+		++s;
+	return s;
+}
+
+#ifdef IRQ_HAVE_SSE2
+// 16 characters at a time. The buffer is padded, and the text ends with
+// a '\0', so a load never goes past the end of the buffer
+__attribute__((target("sse2")))
+static const char *skip_spaces_sse2(const char *s)
+{
+	const __m128i space = _mm_set1_epi8(' ');
+	for (;;) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)s);
+		int other = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, space)) ^ 0xffff;
+		if (other)
+			return s + __builtin_ctz(other);
+		s += 16;
+	}
+}
+#endif
+
+static inline const char *skip_spaces(const char *s, int simd)
+{
+	// Most columns have only a few spaces left once the first one is
+	// checked, e.g. the single space between two big counters
+	if (*s != ' ')
+		return s;
+#ifdef IRQ_HAVE_SSE2
+	if (simd)
+		return skip_spaces_sse2(s);
+#endif
+	return skip_spaces_scalar(s);
+}
+
+const char *irq_use_simd(struct irq_stats_t *stats, int mode)
+{
+	stats->simd = IRQ_SIMD_OFF;
+#ifdef IRQ_HAVE_SSE2
+	if (mode != IRQ_SIMD_OFF && __builtin_cpu_supports("sse2"))
+		stats->simd = mode;
+#endif
+	return stats->simd ? "sse2" : "scalar";
+}
+
+// Read all of a file into stats->buffer, growing it if it doesn't fit.
+// Returns the length of the text
+static int irq_read(struct irq_stats_t *stats, int fd)
+{
+	int len;
+	for (;;) {
+		len = read_fd_to_string(fd, stats->buffer, stats->buffer_size - 1);
+		if (len < 0)
+			len = 0;
+		if (len < stats->buffer_size - 1)
+			break;
+		stats->buffer_size *= 2;
+		stats->buffer = (char *)realloc(stats->buffer,
+				stats->buffer_size + BUFFER_PADDING);
+	}
+	memset(stats->buffer + len, 0, BUFFER_PADDING);
+	return len;
+}
+
+static void irq_table_init(struct irq_table_t *table, int fd, int cpu_count)
+{
+	memset(table, 0, sizeof(struct irq_table_t));
+	table->fd = fd;
+	table->cpu_rates = (double *)calloc(cpu_count, sizeof(double));
+}
+
+static void irq_table_delete(struct irq_table_t *table)
+{
+	close_fd(table->fd);
+	free(table->rows);
+	free(table->columns);
+	free(table->counts);
+	free(table->rates);
+	free(table->cpu_rates);
+}
+
+void irq_init(struct system_t *system)
+{
+	struct irq_stats_t *stats = (struct irq_stats_t *)calloc(1,
+			sizeof(struct irq_stats_t));
+	system->irqs = stats;
+	irq_use_simd(stats, IRQ_SIMD_AUTO);
+
+	char filename[PATH_MAX];
+	system_path(system, filename, INTERRUPTS_PATH);
+	irq_table_init(&stats->interrupts, open_file_readonly(filename),
+			system->cpu_count);
+	system_path(system, filename, SOFTIRQS_PATH);
+	irq_table_init(&stats->softirqs, open_file_readonly(filename),
+			system->cpu_count);
+	system_path(system, filename, SOFTNET_PATH);
+	stats->softnet_fd = open_file_readonly(filename);
+	for (int k = 0; k < SOFTNET_STATS_COUNT; ++k) {
+		stats->softnet[k] = (unsigned long long *)calloc(system->cpu_count,
+				sizeof(unsigned long long));
+		stats->softnet_rate[k] = (double *)calloc(system->cpu_count,
+				sizeof(double));
+	}
+
+	// Like system->buffer, the buffer fits the files as they are now,
+	// with room for the counters to get longer
+	stats->buffer_size = 65536;
+	stats->buffer = (char *)malloc(stats->buffer_size + BUFFER_PADDING);
+	int max_len = irq_read(stats, stats->interrupts.fd);
+	int len = irq_read(stats, stats->softirqs.fd);
+	if (len > max_len)
+		max_len = len;
+	len = irq_read(stats, stats->softnet_fd);
+	if (len > max_len)
+		max_len = len;
+	if (max_len * 2 + 4096 > stats->buffer_size) {
+		stats->buffer_size = max_len * 2 + 4096;
+		stats->buffer = (char *)realloc(stats->buffer,
+				stats->buffer_size + BUFFER_PADDING);
+	}
+}
+
+void irq_delete(struct system_t *system)
+{
+	struct irq_stats_t *stats = system->irqs;
+	if (stats == NULL)
+		return;
+	irq_table_delete(&stats->interrupts);
+	irq_table_delete(&stats->softirqs);
+	close_fd(stats->softnet_fd);
+	for (int k = 0; k < SOFTNET_STATS_COUNT; ++k) {
+		free(stats->softnet[k]);
+		free(stats->softnet_rate[k]);
+	}
+	free(stats->buffer);
+	free(stats);
+}
+
+// The row called name. The rows come in the same order every time, so
+// it's usually the one after the previous. Adds a row if there is none,
+// and sets *added
+static int irq_find_row(struct irq_table_t *table, const char *name,
+		int name_len, int expected, int cpu_count, int *added)
+{
+	if (name_len > MAX_IRQ_NAME_LENGTH)
+		name_len = MAX_IRQ_NAME_LENGTH;
+	*added = 0;
+	if (expected < table->row_count &&
+			!strncmp(table->rows[expected].name, name, name_len) &&
+			table->rows[expected].name[name_len] == '\0')
+		return expected;
+	for (int r = 0; r < table->row_count; ++r)
+		if (!strncmp(table->rows[r].name, name, name_len) &&
+				table->rows[r].name[name_len] == '\0')
+			return r;
+
+	if (table->row_count == table->max_row_count) {
+		const int old = table->max_row_count;
+		table->max_row_count += IRQ_ROW_STEP;
+		const size_t cells = (size_t)table->max_row_count * cpu_count;
+		const size_t new_cells = (size_t)IRQ_ROW_STEP * cpu_count;
+		table->rows = (struct irq_t *)realloc(table->rows,
+				sizeof(struct irq_t) * table->max_row_count);
+		table->counts = (unsigned long long *)realloc(table->counts,
+				sizeof(unsigned long long) * cells);
+		table->rates = (double *)realloc(table->rates, sizeof(double) * cells);
+		memset(table->counts + (size_t)old * cpu_count, 0,
+				sizeof(unsigned long long) * new_cells);
+		memset(table->rates + (size_t)old * cpu_count, 0,
+				sizeof(double) * new_cells);
+	}
+	struct irq_t *irq = &table->rows[table->row_count];
+	memset(irq, 0, sizeof(struct irq_t));
+	memcpy(irq->name, name, name_len);
+	irq->name[name_len] = '\0';
+	*added = 1;
+	return table->row_count++;
+}
+
+// The actions come after the last run of padding, e.g. "virtio4-tx" in
+// "PCI-MSIX-0000:00:05.0   2-edge      virtio4-tx"
+static void irq_set_description(struct irq_t *irq, const char *s,
+		const char *end)
+{
+	const char *start = s;
+	for (const char *p = s; p + 1 < end; ++p)
+		if (p[0] == ' ' && p[1] == ' ')
+			start = p + 2;
+	while (start < end && *start == ' ')
+		++start;
+	int len = end - start;
+	if (len > MAX_IRQ_DESCRIPTION_LENGTH)
+		len = MAX_IRQ_DESCRIPTION_LENGTH;
+	memcpy(irq->description, start, len);
+	irq->description[len] = '\0';
+}
+
+// Parse a table like /proc/interrupts: a header with the CPUs, then
+// "NAME: count count ... description" lines
+static void irq_parse_table(struct system_t *system,
+		struct irq_table_t *table, const char *s)
+{
+	const struct cpu_counters_t *counters = system->cpu_counters;
+	const int cpu_count = system->cpu_count;
+	const double per_second = counter_rate(1, system->elapsed);
+	const int mode = system->irqs->simd;
+	const int simd = mode == IRQ_SIMD_ALWAYS ||
+		(mode == IRQ_SIMD_AUTO && cpu_count >= IRQ_SIMD_MIN_CPUS);
+
+	// "CPU0 CPU1 ...", only the online CPUs are there
+	table->column_count = 0;
+	for (;;) {
+		s = skip_spaces(s, simd);
+		if (strncmp(s, "CPU", 3))
+			break;
+		s += 3;
+		unsigned int id = 0;
+		for (; *s >= '0' && *s <= '9'; ++s)
+			id = id * 10 + (*s - '0');
+		if (table->column_count == table->max_column_count) {
+			table->max_column_count += 128;
+			table->columns = (int *)realloc(table->columns,
+					sizeof(int) * table->max_column_count);
+		}
+		table->columns[table->column_count++] =
+			id < (unsigned int)counters->index_count ? counters->index[id] : -1;
+	}
+
+	for (int r = 0; r < table->row_count; ++r)
+		table->rows[r].present = 0;
+	// The totals of each row and each CPU are added up while parsing,
+	// a second pass over the rates costs a quarter as much again
+	memset(table->cpu_rates, 0, sizeof(double) * cpu_count);
+	int r = 0;
+	while (*s) {
+		if (*s == '\n') {
+			++s;
+			continue;
+		}
+		s = skip_spaces(s, simd);
+		const char *name = s;
+		while (*s && *s != ':' && *s != '\n')
+			++s;
+		if (*s != ':')
+			continue;
+		int added;
+		r = irq_find_row(table, name, s - name, r, cpu_count, &added);
+		++s;
+		unsigned long long *counts = &table->counts[(size_t)r * cpu_count];
+		double *rates = &table->rates[(size_t)r * cpu_count];
+		struct irq_t *irq = &table->rows[r];
+		irq->rate = 0.0;
+		irq->busiest_cpu = 0;
+		irq->busiest_rate = 0.0;
+		for (int column = 0; column < table->column_count; ++column) {
+			s = skip_spaces(s, simd);
+			if (*s < '0' || *s > '9')
+				break;
+			unsigned long long value = 0;
+			for (; *s >= '0' && *s <= '9'; ++s)
+				value = value * 10 + (*s - '0');
+			const int c = table->columns[column];
+			if (c < 0)
+				continue;
+			// A new row has no previous count
+			const double rate = added ? 0.0 :
+				counter_delta32(value, counts[c]) * per_second;
+			rates[c] = rate;
+			counts[c] = value;
+			irq->rate += rate;
+			table->cpu_rates[c] += rate;
+			if (rate > irq->busiest_rate) {
+				irq->busiest_rate = rate;
+				irq->busiest_cpu = c;
+			}
+		}
+
+		const char *end = strchr(s, '\n');
+		if (end == NULL)
+			end = s + strlen(s);
+		if (added)
+			irq_set_description(irq, s, end);
+		irq->present = 1;
+		s = end;
+		++r;
+	}
+
+	// Interrupts that were freed don't fire anymore
+	for (r = 0; r < table->row_count; ++r) {
+		struct irq_t *irq = &table->rows[r];
+		if (irq->present)
+			continue;
+		memset(&table->rates[(size_t)r * cpu_count], 0,
+				sizeof(double) * cpu_count);
+		irq->rate = 0.0;
+		irq->busiest_cpu = 0;
+		irq->busiest_rate = 0.0;
+	}
+}
+
+// The top bit of each byte of x that is between low and high (exclusive).
+// Bytes from 0x80 up never are
+static inline unsigned long long bytes_between(unsigned long long x,
+		unsigned int low, unsigned int high)
+{
+	const unsigned long long ones = 0x0101010101010101ULL;
+	const unsigned long long low7 = x & ones * 127;
+	return (ones * (127 + high) - low7) & ~x & (low7 + ones * (127 - low)) &
+		ones * 128;
+}
+
+// Parse the 8 hex digits of a "%08x" field at s, all at once in a 64-bit
+// word. Returns 0 if there aren't 8 lowercase digits followed by a space
+// or a newline. The buffer is padded, so s + 8 can always be read
+static int parse_hex8(const char *s, unsigned long long *value)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (s[8] != ' ' && s[8] != '\n')
+		return 0;
+	unsigned long long x;
+	memcpy(&x, s, 8);
+	const unsigned long long letters = bytes_between(x, 'a' - 1, 'f' + 1);
+	if ((bytes_between(x, '0' - 1, '9' + 1) | letters) !=
+			0x8080808080808080ULL)
+		return 0;
+	// The nibbles, the first digit in the lowest byte, then merged in
+	// pairs, fours and eights
+	x = (x & 0x0f0f0f0f0f0f0f0fULL) + (letters >> 7) * 9;
+	x = ((x << 4) | (x >> 8)) & 0x00ff00ff00ff00ffULL;
+	x = ((x << 8) | (x >> 16)) & 0x0000ffff0000ffffULL;
+	*value = ((x << 16) | (x >> 32)) & 0xffffffffULL;
+	return 1;
+#else
+	(void)s;
+	(void)value;
+	return 0;
+#endif
+}
+
+// Parse the hex number at s. Returns its end, s if there is none
+static const char *parse_hex(const char *s, unsigned long long *value)
+{
+	// strtoull() takes longer than all the rest of the parsing
+	if (parse_hex8(s, value))
+		return s + 8;
+	*value = 0;
+	for (;; ++s) {
+		const unsigned int digit = (unsigned char)*s - '0';
+		const unsigned int letter = ((unsigned char)*s | 0x20) - 'a';
+		if (digit < 10)
+			*value = *value << 4 | digit;
+		else if (letter < 6)
+			*value = *value << 4 | (letter + 10);
+		else
+			return s;
+	}
+}
+
+// Parse /proc/net/softnet_stat: a line of hex fields per online CPU
+static void irq_parse_softnet(struct system_t *system, const char *s)
+{
+	struct irq_stats_t *stats = system->irqs;
+	const struct cpu_counters_t *counters = system->cpu_counters;
+	int next_id = 0;
+	while (*s) {
+		unsigned long long fields[SOFTNET_FIELDS];
+		int field_count = 0;
+		while (*s && *s != '\n') {
+			if (*s == ' ') {
+				++s;
+				continue;
+			}
+			unsigned long long value;
+			const char *end = parse_hex(s, &value);
+			if (end == s)
+				break;
+			s = end;
+			if (field_count < SOFTNET_FIELDS)
+				fields[field_count++] = value;
+		}
+		while (*s && *s != '\n')
+			++s;
+		if (*s == '\n')
+			++s;
+		if (field_count < SOFTNET_STATS_COUNT)
+			continue;
+
+		// Older kernels don't have the CPU ID, their lines are
+		// the online CPUs in order
+		int id;
+		if (field_count == SOFTNET_FIELDS) {
+			id = fields[SOFTNET_FIELDS - 1];
+		} else {
+			while (next_id < counters->index_count &&
+					counters->index[next_id] < 0)
+				++next_id;
+			id = next_id++;
+		}
+		if (id < 0 || id >= counters->index_count || counters->index[id] < 0)
+			continue;
+		const int c = counters->index[id];
+		for (int k = 0; k < SOFTNET_STATS_COUNT; ++k) {
+			stats->softnet_rate[k][c] = stats->softnet[k][c] ? counter_rate(
+					counter_delta32(fields[k], stats->softnet[k][c]),
+					system->elapsed) : 0.0;
+			stats->softnet[k][c] = fields[k];
+		}
+	}
+}
+
+void irq_refresh(struct system_t *system)
+{
+	struct irq_stats_t *stats = system->irqs;
+	if (stats == NULL)
+		return;
+	if (stats->interrupts.fd >= 0) {
+		irq_read(stats, stats->interrupts.fd);
+		irq_parse_table(system, &stats->interrupts, stats->buffer);
+	}
+	if (stats->softirqs.fd >= 0) {
+		irq_read(stats, stats->softirqs.fd);
+		irq_parse_table(system, &stats->softirqs, stats->buffer);
+	}
+	if (stats->softnet_fd >= 0) {
+		irq_read(stats, stats->softnet_fd);
+		irq_parse_softnet(system, stats->buffer);
+	}
+}
@@ -0,0 +1,101 @@
+#include "kv.h"
+
+#include <string.h>
+
+// How many seeds are tried for each table size
+#define KV_SEED_ATTEMPTS 4096
+
+// FNV-1a, started from the seed
+#define KV_HASH_START(seed) ((seed) ^ 2166136261u)
+#define KV_HASH_STEP(hash, c) (((hash) ^ (unsigned char)(c)) * 16777619u)
+
+static unsigned int kv_slot(const struct kv_table_t *table, unsigned int hash)
+{
+	return (hash ^ (hash >> 15)) & table->mask;
+}
+
+static unsigned int kv_hash(unsigned int seed, const char *key, int len)
+{
+	unsigned int hash = KV_HASH_START(seed);
+	for (int i = 0; i < len; ++i)
+		hash = KV_HASH_STEP(hash, key[i]);
+	return hash;
+}
+
+int kv_table_init(struct kv_table_t *table, const char * const *keys,
+		int key_count)
+{
+	memset(table, 0, sizeof(struct kv_table_t));
+	if (key_count > KV_MAX_KEYS)
+		return 1;
+	table->keys = keys;
+	table->key_count = key_count;
+	for (int k = 0; k < key_count; ++k)
+		table->key_lengths[k] = strlen(keys[k]);
+
+	// Start with twice as many slots as keys, and double them if no
+	// seed gives every key its own
+	unsigned int slot_count = 2;
+	while (slot_count < 2u * key_count)
+		slot_count *= 2;
+	for (; slot_count <= KV_MAX_SLOTS; slot_count *= 2) {
+		table->mask = slot_count - 1;
+		for (unsigned int seed = 1; seed <= KV_SEED_ATTEMPTS; ++seed) {
+			memset(table->slots, -1, sizeof(table->slots));
+			int k = 0;
+			for (; k < key_count; ++k) {
+				unsigned int slot = kv_slot(table,
+						kv_hash(seed, keys[k], table->key_lengths[k]));
+				if (table->slots[slot] != -1)
+					break;
+				table->slots[slot] = k;
+			}
+			if (k == key_count) {
+				table->seed = seed;
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+int kv_parse(const struct kv_table_t *table, const char *text,
+		unsigned long long *values)
+{
+	return kv_parse_skip(table, text, 0, values);
+}
+
+int kv_parse_skip(const struct kv_table_t *table, const char *text,
+		int skip, unsigned long long *values)
+{
+	int found = 0;
+	const char *s = text;
+	while (*s && found < table->key_count) {
+		for (int i = 0; i < skip && *s && *s != '\n'; ++i)
+			++s;
+		// Hash the key while looking for its end
+		const char *key = s;
+		unsigned int hash = KV_HASH_START(table->seed);
+		for (; *s && *s != ':' && *s != ' ' && *s != '\n'; ++s)
+			hash = KV_HASH_STEP(hash, *s);
+		const int len = s - key;
+
+		const int k = table->slots[kv_slot(table, hash)];
+		if (k >= 0 && table->key_lengths[k] == len &&
+				!memcmp(table->keys[k], key, len)) {
+			while (*s == ':' || *s == ' ' || *s == '\t')
+				++s;
+			unsigned long long value = 0;
+			for (; *s >= '0' && *s <= '9'; ++s)
+				value = value * 10 + (*s - '0');
+			values[k] = value;
+			++found;
+		}
+
+		s = strchr(s, '\n');
+		if (s == NULL)
+			break;
+		++s;
+	}
+	return found;
+}
@@ -0,0 +1,42 @@
+#ifndef KV_H_INCLUDED
+#define KV_H_INCLUDED
+
+/*
+ * A parser for files with a "key value" or "key: value" line per
+ * counter, like /proc/meminfo, /proc/vmstat, /proc/PID/status and the
+ * memory.stat of a cgroup. The keys that are wanted are put in a perfect
+ * hash table when the collector starts: a seed is searched for that gives
+ * every key a slot of its own. So each line of the file costs one hash of its key,
+ * which is computed while looking for its end, and at most one memcmp.
+ */
+
+#define KV_MAX_KEYS 64
+#define KV_MAX_SLOTS 1024
+
+struct kv_table_t
+{
+	int key_count;
+	const char * const *keys;
+	int key_lengths[KV_MAX_KEYS];
+	unsigned int seed; /**< Gives each key its own slot */
+	unsigned int mask; /**< The number of slots minus one */
+	signed char slots[KV_MAX_SLOTS]; /**< The key in each slot, or -1 */
+};
+
+/** Find a perfect hash for keys, which must outlive the table.
+ * Returns 0 on success */
+int kv_table_init(struct kv_table_t *table, const char * const *keys,
+		int key_count);
+
+/** Parse text (NUL-terminated) and write the value of keys[k] to
+ * values[k]. Values of keys that aren't in text are left as they are.
+ * Units (e.g. kB) are ignored. Returns the number of keys found */
+int kv_parse(const struct kv_table_t *table, const char *text,
+		unsigned long long *values);
+
+/** The same for files with a prefix of skip characters before the key on
+ * every line, like the "Node 0 " of a NUMA node's meminfo */
+int kv_parse_skip(const struct kv_table_t *table, const char *text,
+		int skip, unsigned long long *values);
+
+#endif
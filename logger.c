@@ -1,140 +1,1542 @@
 #include "logger.h"
 #include "system.h"
+#include "util.h"
 #include "cpu.h"
+#include "psi.h"
+#include "numa.h"
+#include "irq.h"
+#include "vmstat.h"
+#include "watch.h"
+#include "overhead.h"
+#include "binlog.h"
+#include "rrd.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 
-int logger_init(struct logger_t *logger, int type,
-		const char *filename, int stat_count, struct logger_stat_t *stats)
+static const char * const psi_resource_names[PSI_RESOURCE_COUNT] = {
+	"CPU", "Memory", "IO"
+};
+
+// The vm_ stats, in the order of the VMSTAT_* rates
+static const char * const vm_stats[VMSTAT_RATES_COUNT] = {
+	"pgin", "pgout", "swpin", "swpout", "fault", "majfault", "scan", "steal",
+	"stall", "oom"
+};
+static const char * const vm_stat_titles[VMSTAT_RATES_COUNT] = {
+	"Page In (B/s)", "Page Out (B/s)", "Swap In (B/s)", "Swap Out (B/s)",
+	"Page Faults (/s)", "Major Page Faults (/s)", "Pages Scanned (/s)",
+	"Pages Reclaimed (/s)", "Allocation Stalls (/s)", "OOM Kills (/s)"
+};
+
+// Write the column name of stat to value
+static void logger_stat_name(const struct logger_stat_t *s, char *value)
+{
+	struct logger_stat_t stat = *s;
+	if (stat.type == LOGGER_CPU_USAGE)
+		sprintf(value, "CPU%d Usage", stat.data.cpu_id);
+	else if (stat.type == LOGGER_CPU_TEMPERATURE)
+		sprintf(value, "CPU%d Temperature", stat.data.cpu_id);
+	else if (stat.type == LOGGER_CPU_FREQUENCY)
+		sprintf(value, "CPU%d Frequency (KHz)", stat.data.cpu_id);
+	else if (stat.type == LOGGER_CPU_CONTEXT_SWITCHES)
+		sprintf(value, "CPU%d Context Switches (/s)", stat.data.cpu_id);
+	else if (stat.type == LOGGER_CPU_MIGRATIONS)
+		sprintf(value, "CPU%d Migrations (/s)", stat.data.cpu_id);
+	else if (stat.type == LOGGER_CPU_MINOR_FAULTS)
+		sprintf(value, "CPU%d Minor Faults (/s)", stat.data.cpu_id);
+	else if (stat.type == LOGGER_CPU_MAJOR_FAULTS)
+		sprintf(value, "CPU%d Major Faults (/s)", stat.data.cpu_id);
+	else if (stat.type == LOGGER_CPU_IPC)
+		sprintf(value, "CPU%d IPC", stat.data.cpu_id);
+	else if (stat.type == LOGGER_CPU_IRQS)
+		sprintf(value, "CPU%d Interrupts (/s)", stat.data.cpu_id);
+	else if (stat.type == LOGGER_CPU_SOFTIRQS)
+		sprintf(value, "CPU%d Softirqs (/s)", stat.data.cpu_id);
+	else if (stat.type == LOGGER_CPU_SOFTNET_DROPS)
+		sprintf(value, "CPU%d Backlog Drops (/s)", stat.data.cpu_id);
+	else if (stat.type == LOGGER_CPU_TIME_SQUEEZES)
+		sprintf(value, "CPU%d Time Squeezes (/s)", stat.data.cpu_id);
+	else if (stat.type == LOGGER_RAM_USED)
+		sprintf(value, "RAM Used");
+	else if (stat.type == LOGGER_RAM_BUFFERS)
+		sprintf(value, "RAM Buffers");
+	else if (stat.type == LOGGER_RAM_CACHED)
+		sprintf(value, "RAM Caches");
+	else if (stat.type >= LOGGER_VM_PAGE_IN && stat.type <= LOGGER_VM_OOM_KILLS)
+		sprintf(value, "%s", vm_stat_titles[stat.type - LOGGER_VM_PAGE_IN]);
+	else if (stat.type == LOGGER_NODE_USED)
+		sprintf(value, "Node%d RAM Used", stat.data.node_id);
+	else if (stat.type == LOGGER_NODE_FREE)
+		sprintf(value, "Node%d RAM Free", stat.data.node_id);
+	else if (stat.type == LOGGER_NODE_CACHED)
+		sprintf(value, "Node%d RAM Caches", stat.data.node_id);
+	else if (stat.type == LOGGER_NODE_CPU)
+		sprintf(value, "Node%d CPU Usage (%%)", stat.data.node_id);
+	else if (stat.type == LOGGER_NODE_MISS)
+		sprintf(value, "Node%d NUMA Misses (pages/s)", stat.data.node_id);
+	else if (stat.type == LOGGER_NODE_FOREIGN)
+		sprintf(value, "Node%d NUMA Foreign (pages/s)", stat.data.node_id);
+	else if (stat.type == LOGGER_DISK_READ)
+		sprintf(value, "Disk %s Read Speed (B/s)", stat.data.disk_name);
+	else if (stat.type == LOGGER_DISK_WRITE)
+		sprintf(value, "Disk %s Write Speed (B/s)", stat.data.disk_name);
+	else if (stat.type == LOGGER_IFACE_READ)
+		sprintf(value, "Interface %s Download Speed (B/s)", stat.data.iface_name);
+	else if (stat.type == LOGGER_IFACE_WRITE)
+		sprintf(value, "Interface %s Upload Speed (B/s)", stat.data.iface_name);
+	else if (stat.type == LOGGER_BAT_CHARGE)
+		sprintf(value, "Battery %s Charge (%%)", stat.data.battery_name);
+	else if (stat.type == LOGGER_BAT_CURRENT)
+		sprintf(value, "Battery %s Current (A)", stat.data.battery_name);
+	else if (stat.type == LOGGER_BAT_VOLTAGE)
+		sprintf(value, "Battery %s Voltage (V)", stat.data.battery_name);
+	else if (stat.type == LOGGER_CGROUP_CPU)
+		sprintf(value, "Cgroup %s CPU Usage (%%)", stat.data.cgroup_name);
+	else if (stat.type == LOGGER_CGROUP_MEMORY)
+		sprintf(value, "Cgroup %s Memory", stat.data.cgroup_name);
+	else if (stat.type == LOGGER_CGROUP_READ)
+		sprintf(value, "Cgroup %s Read Speed (B/s)", stat.data.cgroup_name);
+	else if (stat.type == LOGGER_CGROUP_WRITE)
+		sprintf(value, "Cgroup %s Write Speed (B/s)", stat.data.cgroup_name);
+	else if (stat.type == LOGGER_PSI_SOME)
+		sprintf(value, "%s Pressure Some (%%)",
+				psi_resource_names[stat.data.psi_resource]);
+	else if (stat.type == LOGGER_PSI_FULL)
+		sprintf(value, "%s Pressure Full (%%)",
+				psi_resource_names[stat.data.psi_resource]);
+	else if (stat.type == LOGGER_PROC_CPU)
+		sprintf(value, "Process %d CPU Usage (%%)", stat.data.pid);
+	else if (stat.type == LOGGER_PROC_THREADS)
+		sprintf(value, "Process %d Threads", stat.data.pid);
+	else if (stat.type == LOGGER_PROC_SWITCHES)
+		sprintf(value, "Process %d Context Switches (/s)", stat.data.pid);
+	else if (stat.type == LOGGER_PROC_INVOLUNTARY_SWITCHES)
+		sprintf(value, "Process %d Involuntary Context Switches (/s)",
+				stat.data.pid);
+	else if (stat.type == LOGGER_PROC_READ)
+		sprintf(value, "Process %d Read Speed (B/s)", stat.data.pid);
+	else if (stat.type == LOGGER_PROC_WRITE)
+		sprintf(value, "Process %d Write Speed (B/s)", stat.data.pid);
+	else if (stat.type == LOGGER_THREAD_CPU)
+		sprintf(value, "Thread %d CPU Usage (%%)", stat.data.pid);
+	else if (stat.type == LOGGER_THREAD_LAST_CPU)
+		sprintf(value, "Thread %d Last CPU", stat.data.pid);
+	else if (stat.type == LOGGER_THREAD_SWITCHES)
+		sprintf(value, "Thread %d Context Switches (/s)", stat.data.pid);
+	else if (stat.type == LOGGER_THREAD_INVOLUNTARY_SWITCHES)
+		sprintf(value, "Thread %d Involuntary Context Switches (/s)",
+				stat.data.pid);
+	else if (stat.type == LOGGER_THREAD_READ)
+		sprintf(value, "Thread %d Read Speed (B/s)", stat.data.pid);
+	else if (stat.type == LOGGER_THREAD_WRITE)
+		sprintf(value, "Thread %d Write Speed (B/s)", stat.data.pid);
+	else if (stat.type == LOGGER_SELF_WALL)
+		sprintf(value, "smon %s Wall Time (us)", stat.data.overhead_section);
+	else if (stat.type == LOGGER_SELF_CPU)
+		sprintf(value, "smon %s CPU Time (us)", stat.data.overhead_section);
+	else if (stat.type == LOGGER_SELF_SYSCALLS)
+		sprintf(value, "smon %s Syscalls", stat.data.overhead_section);
+	else if (stat.type == LOGGER_SELF_USAGE)
+		sprintf(value, "smon CPU Usage (%%)");
+	else if (stat.type == LOGGER_SELF_LATENESS)
+		sprintf(value, "smon Tick Lateness (us)");
+	else if (stat.type == LOGGER_SELF_INVOLUNTARY_SWITCHES)
+		sprintf(value, "smon Involuntary Context Switches");
+	else
+		value[0] = '\0';
+}
+
+// The name of stat.data that a stat type uses and its size, NULL for
+// the types without a name
+static char *logger_stat_data_name(struct logger_stat_t *stat, int *size)
+{
+	if (stat->type == LOGGER_DISK_READ || stat->type == LOGGER_DISK_WRITE) {
+		*size = sizeof(stat->data.disk_name);
+		return stat->data.disk_name;
+	} else if (stat->type == LOGGER_IFACE_READ ||
+			stat->type == LOGGER_IFACE_WRITE) {
+		*size = sizeof(stat->data.iface_name);
+		return stat->data.iface_name;
+	} else if (stat->type >= LOGGER_BAT_CHARGE &&
+			stat->type <= LOGGER_BAT_VOLTAGE) {
+		*size = sizeof(stat->data.battery_name);
+		return stat->data.battery_name;
+	} else if (stat->type >= LOGGER_CGROUP_CPU &&
+			stat->type <= LOGGER_CGROUP_WRITE) {
+		*size = sizeof(stat->data.cgroup_name);
+		return stat->data.cgroup_name;
+	} else if (stat->type >= LOGGER_SELF_WALL &&
+			stat->type <= LOGGER_SELF_SYSCALLS) {
+		*size = sizeof(stat->data.overhead_section);
+		return stat->data.overhead_section;
+	}
+	return NULL;
+}
+
+int logger_parse_title(const char *title, struct logger_stat_t *stat)
+{
+	char expected[256];
+	for (int type = 0; type <= LOGGER_SELF_INVOLUNTARY_SWITCHES; ++type) {
+		memset(stat, 0, sizeof(struct logger_stat_t));
+		stat->type = type;
+		int size;
+		char *name = logger_stat_data_name(stat, &size);
+		if (name) {
+			// Find where the name goes, the rest must be the same
+			strcpy(name, "\x01");
+			logger_stat_name(stat, expected);
+			const int prefix_len = strchr(expected, '\x01') - expected;
+			const char *suffix = expected + prefix_len + 1;
+			const int len = (int)strlen(title) - prefix_len - (int)strlen(suffix);
+			if (len <= 0 || len >= size ||
+					strncmp(title, expected, prefix_len) ||
+					strcmp(title + prefix_len + len, suffix))
+				continue;
+			memcpy(name, title + prefix_len, len);
+			name[len] = '\0';
+			return 0;
+		} else if (type >= LOGGER_PSI_SOME && type <= LOGGER_PSI_FULL) {
+			for (int r = 0; r < PSI_RESOURCE_COUNT; ++r) {
+				stat->data.psi_resource = r;
+				logger_stat_name(stat, expected);
+				if (!strcmp(title, expected))
+					return 0;
+			}
+		} else {
+			// The CPU, node and process IDs are the first number of the title
+			const int id = atoi(title + strcspn(title, "0123456789"));
+			if (type <= LOGGER_CPU_TIME_SQUEEZES)
+				stat->data.cpu_id = id;
+			else if (type >= LOGGER_NODE_USED && type <= LOGGER_NODE_FOREIGN)
+				stat->data.node_id = id;
+			else if (type >= LOGGER_PROC_CPU && type <= LOGGER_THREAD_WRITE)
+				stat->data.pid = id;
+			logger_stat_name(stat, expected);
+			if (!strcmp(title, expected))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+int logger_parse_stat(const char *name, struct logger_stat_t *stat)
+{
+	memset(stat, 0, sizeof(struct logger_stat_t));
+	if (!strncmp(name, "cpu", 3)) {
+		char *id_end;
+		int id = strtol(name + 3, &id_end, 10);
+		if (id_end == name + 3 || id < 0)
+			return 1;
+		stat->data.cpu_id = id;
+		if (!strcmp(id_end, "u") || !strcmp(id_end, "usage"))
+			stat->type = LOGGER_CPU_USAGE;
+		else if (!strcmp(id_end, "t") || !strcmp(id_end, "temp"))
+			stat->type = LOGGER_CPU_TEMPERATURE;
+		else if (!strcmp(id_end, "f") || !strcmp(id_end, "freq"))
+			stat->type = LOGGER_CPU_FREQUENCY;
+		else if (!strcmp(id_end, "ctxsw"))
+			stat->type = LOGGER_CPU_CONTEXT_SWITCHES;
+		else if (!strcmp(id_end, "migr"))
+			stat->type = LOGGER_CPU_MIGRATIONS;
+		else if (!strcmp(id_end, "minflt"))
+			stat->type = LOGGER_CPU_MINOR_FAULTS;
+		else if (!strcmp(id_end, "majflt"))
+			stat->type = LOGGER_CPU_MAJOR_FAULTS;
+		else if (!strcmp(id_end, "ipc"))
+			stat->type = LOGGER_CPU_IPC;
+		else if (!strcmp(id_end, "irq"))
+			stat->type = LOGGER_CPU_IRQS;
+		else if (!strcmp(id_end, "softirq"))
+			stat->type = LOGGER_CPU_SOFTIRQS;
+		else if (!strcmp(id_end, "netdrop"))
+			stat->type = LOGGER_CPU_SOFTNET_DROPS;
+		else if (!strcmp(id_end, "squeeze"))
+			stat->type = LOGGER_CPU_TIME_SQUEEZES;
+		else
+			return 1;
+	} else if (!strncmp(name, "ram_", 4)) {
+		const char *s = name + 4;
+		if (!strcmp(s, "u") || !strcmp(s, "used"))
+			stat->type = LOGGER_RAM_USED;
+		else if (!strcmp(s, "b") || !strcmp(s, "buffers"))
+			stat->type = LOGGER_RAM_BUFFERS;
+		else if (!strcmp(s, "c") || !strcmp(s, "cached"))
+			stat->type = LOGGER_RAM_CACHED;
+		else
+			return 1;
+	} else if (!strncmp(name, "vm_", 3)) {
+		int s = 0;
+		while (s < VMSTAT_RATES_COUNT && strcmp(name + 3, vm_stats[s]))
+			++s;
+		if (s == VMSTAT_RATES_COUNT)
+			return 1;
+		stat->type = LOGGER_VM_PAGE_IN + s;
+	} else if (!strncmp(name, "node", 4)) {
+		char *id_end;
+		int id = strtol(name + 4, &id_end, 10);
+		if (id_end == name + 4 || id < 0)
+			return 1;
+		stat->data.node_id = id;
+		if (!strcmp(id_end, "_used"))
+			stat->type = LOGGER_NODE_USED;
+		else if (!strcmp(id_end, "_free"))
+			stat->type = LOGGER_NODE_FREE;
+		else if (!strcmp(id_end, "_cached"))
+			stat->type = LOGGER_NODE_CACHED;
+		else if (!strcmp(id_end, "_cpu"))
+			stat->type = LOGGER_NODE_CPU;
+		else if (!strcmp(id_end, "_miss"))
+			stat->type = LOGGER_NODE_MISS;
+		else if (!strcmp(id_end, "_foreign"))
+			stat->type = LOGGER_NODE_FOREIGN;
+		else
+			return 1;
+	} else if (!strncmp(name, "disk_", 5)) {
+		const char *name_end = strchr(name + 5, '_');
+		int len = name_end ? name_end - name - 5 : 0;
+		if (len <= 0 || len > MAX_DISK_NAME_LENGTH)
+			return 1;
+		strncpy(stat->data.disk_name, name + 5, len);
+		stat->data.disk_name[len] = '\0';
+		++name_end;
+		if (!strcmp(name_end, "r") || !strcmp(name_end, "read"))
+			stat->type = LOGGER_DISK_READ;
+		else if (!strcmp(name_end, "w") || !strcmp(name_end, "write"))
+			stat->type = LOGGER_DISK_WRITE;
+		else
+			return 1;
+	} else if (!strncmp(name, "iface_", 6)) {
+		const char *name_end = strchr(name + 6, '_');
+		int len = name_end ? name_end - name - 6 : 0;
+		if (len <= 0 || len > MAX_INTERFACE_NAME_LENGTH)
+			return 1;
+		strncpy(stat->data.iface_name, name + 6, len);
+		stat->data.iface_name[len] = '\0';
+		++name_end;
+		if (!strcmp(name_end, "r") || !strcmp(name_end, "read"))
+			stat->type = LOGGER_IFACE_READ;
+		else if (!strcmp(name_end, "w") || !strcmp(name_end, "write"))
+			stat->type = LOGGER_IFACE_WRITE;
+		else
+			return 1;
+	} else if (!strncmp(name, "battery_", 8)) {
+		const char *name_end = strchr(name + 8, '_');
+		int len = name_end ? name_end - name - 8 : 0;
+		if (len <= 0 || len > MAX_BATTERY_NAME_LENGTH)
+			return 1;
+		strncpy(stat->data.battery_name, name + 8, len);
+		stat->data.battery_name[len] = '\0';
+		++name_end;
+		if (!strcmp(name_end, "c") || !strcmp(name_end, "charge"))
+			stat->type = LOGGER_BAT_CHARGE;
+		else if (!strcmp(name_end, "cu") || !strcmp(name_end, "current"))
+			stat->type = LOGGER_BAT_CURRENT;
+		else if (!strcmp(name_end, "v") || !strcmp(name_end, "voltage"))
+			stat->type = LOGGER_BAT_VOLTAGE;
+		else
+			return 1;
+	} else if (!strncmp(name, "cgroup_", 7)) {
+		// The cgroup path may contain underscores itself
+		const char *name_end = strrchr(name + 7, '_');
+		int len = name_end ? name_end - name - 7 : 0;
+		if (len <= 0 || len > MAX_CGROUP_NAME_LENGTH)
+			return 1;
+		strncpy(stat->data.cgroup_name, name + 7, len);
+		stat->data.cgroup_name[len] = '\0';
+		++name_end;
+		if (!strcmp(name_end, "c") || !strcmp(name_end, "cpu"))
+			stat->type = LOGGER_CGROUP_CPU;
+		else if (!strcmp(name_end, "m") || !strcmp(name_end, "mem"))
+			stat->type = LOGGER_CGROUP_MEMORY;
+		else if (!strcmp(name_end, "r") || !strcmp(name_end, "read"))
+			stat->type = LOGGER_CGROUP_READ;
+		else if (!strcmp(name_end, "w") || !strcmp(name_end, "write"))
+			stat->type = LOGGER_CGROUP_WRITE;
+		else
+			return 1;
+	} else if (!strncmp(name, "psi_", 4)) {
+		const char *s = name + 4;
+		int len = 0;
+		while (s[len] && s[len] != '_')
+			++len;
+		if (!strncmp(s, "cpu", len) && len == 3)
+			stat->data.psi_resource = PSI_CPU;
+		else if (!strncmp(s, "memory", len) && len == 6)
+			stat->data.psi_resource = PSI_MEMORY;
+		else if (!strncmp(s, "io", len) && len == 2)
+			stat->data.psi_resource = PSI_IO;
+		else
+			return 1;
+		if (!strcmp(s + len, "_some"))
+			stat->type = LOGGER_PSI_SOME;
+		else if (!strcmp(s + len, "_full"))
+			stat->type = LOGGER_PSI_FULL;
+		else
+			return 1;
+	} else if (!strncmp(name, "proc_", 5) || !strncmp(name, "thread_", 7)) {
+		const int thread = name[0] == 't';
+		const char *s = name + (thread ? 7 : 5);
+		char *id_end;
+		int id = strtol(s, &id_end, 10);
+		if (id_end == s || id <= 0 || *id_end != '_')
+			return 1;
+		stat->data.pid = id;
+		++id_end;
+		if (!strcmp(id_end, "cpu"))
+			stat->type = thread ? LOGGER_THREAD_CPU : LOGGER_PROC_CPU;
+		else if (thread && !strcmp(id_end, "lastcpu"))
+			stat->type = LOGGER_THREAD_LAST_CPU;
+		else if (!thread && !strcmp(id_end, "threads"))
+			stat->type = LOGGER_PROC_THREADS;
+		else if (!strcmp(id_end, "ctxsw"))
+			stat->type = thread ? LOGGER_THREAD_SWITCHES : LOGGER_PROC_SWITCHES;
+		else if (!strcmp(id_end, "nvcsw"))
+			stat->type = thread ? LOGGER_THREAD_INVOLUNTARY_SWITCHES :
+				LOGGER_PROC_INVOLUNTARY_SWITCHES;
+		else if (!strcmp(id_end, "read"))
+			stat->type = thread ? LOGGER_THREAD_READ : LOGGER_PROC_READ;
+		else if (!strcmp(id_end, "write"))
+			stat->type = thread ? LOGGER_THREAD_WRITE : LOGGER_PROC_WRITE;
+		else
+			return 1;
+	} else if (!strcmp(name, "self_usage")) {
+		stat->type = LOGGER_SELF_USAGE;
+	} else if (!strcmp(name, "self_late")) {
+		stat->type = LOGGER_SELF_LATENESS;
+	} else if (!strcmp(name, "self_nivcsw")) {
+		stat->type = LOGGER_SELF_INVOLUNTARY_SWITCHES;
+	} else if (!strncmp(name, "self_", 5)) {
+		// The section is checked when logging, sections may be added
+		// after the logger
+		const char *name_end = strrchr(name + 5, '_');
+		int len = name_end ? name_end - name - 5 : 0;
+		if (len <= 0 || len > MAX_OVERHEAD_NAME_LENGTH)
+			return 1;
+		strncpy(stat->data.overhead_section, name + 5, len);
+		stat->data.overhead_section[len] = '\0';
+		++name_end;
+		if (!strcmp(name_end, "wall"))
+			stat->type = LOGGER_SELF_WALL;
+		else if (!strcmp(name_end, "cpu"))
+			stat->type = LOGGER_SELF_CPU;
+		else if (!strcmp(name_end, "sys"))
+			stat->type = LOGGER_SELF_SYSCALLS;
+		else
+			return 1;
+	} else {
+		return 1;
+	}
+	return 0;
+}
+
+// Regular expressions can't be used in cgroup paths, which contain slashes
+static int selector_has_regex(const char *selector)
+{
+	return strncmp(selector, "cgroup_", 7) != 0;
+}
+
+// Expand the first {a,b} of selector (and the rest recursively), adding
+// the results to out. Returns 0 on success
+static int selector_expand_braces(const char *selector, char **out,
+		int *count)
+{
+	// Find the first { outside of a regular expression
+	const int regex = selector_has_regex(selector);
+	const char *open = NULL;
+	int in_regex = 0;
+	for (const char *c = selector; *c && !open; ++c) {
+		if (regex && *c == '/')
+			in_regex = !in_regex;
+		else if (*c == '{' && !in_regex)
+			open = c;
+	}
+	if (open == NULL) {
+		if (*count == MAX_LOGGER_SELECTOR_EXPANSIONS)
+			return 1;
+		out[(*count)++] = strdup(selector);
+		return 0;
+	}
+	const char *close = strchr(open, '}');
+	if (close == NULL)
+		return 1;
+
+	const int len = strlen(selector);
+	char *alternative = (char *)malloc(len + 1);
+	const char *a = open + 1;
+	int ret = 0;
+	while (!ret && a <= close) {
+		const char *a_end = a;
+		while (a_end < close && *a_end != ',')
+			++a_end;
+		const int prefix_len = open - selector;
+		memcpy(alternative, selector, prefix_len);
+		memcpy(alternative + prefix_len, a, a_end - a);
+		strcpy(alternative + prefix_len + (a_end - a), close + 1);
+		ret = selector_expand_braces(alternative, out, count);
+		a = a_end + 1;
+	}
+	free(alternative);
+	return ret;
+}
+
+// Compile a selector without {a,b}. Returns 0 on success
+static int selector_compile(const char *pattern,
+		struct logger_selector_t *selector)
+{
+	const int regex = selector_has_regex(pattern);
+	if (!strpbrk(pattern, regex ? "*?/" : "*?")) {
+		selector->exact = 1;
+		return logger_parse_stat(pattern, &selector->stat);
+	}
+
+	// Globs and the literal characters become an extended regex,
+	// /RE/ is copied as it is
+	selector->exact = 0;
+	char *re = (char *)malloc(strlen(pattern) * 2 + 8);
+	int len = 0, prefix_len = 0, in_prefix = 1;
+	re[len++] = '^';
+	for (const char *c = pattern; *c; ++c) {
+		if (regex && *c == '/') {
+			const char *end = strchr(c + 1, '/');
+			if (end == NULL) {
+				free(re);
+				return 1;
+			}
+			re[len++] = '(';
+			memcpy(re + len, c + 1, end - c - 1);
+			len += end - c - 1;
+			re[len++] = ')';
+			c = end;
+			in_prefix = 0;
+		} else if (*c == '*' || *c == '?') {
+			if (*c == '*')
+				re[len++] = '.';
+			re[len++] = *c == '*' ? '*' : '.';
+			in_prefix = 0;
+		} else {
+			if (strchr(".[]()+^$|\\{}", *c))
+				re[len++] = '\\';
+			re[len++] = *c;
+			if (in_prefix && prefix_len < (int)sizeof(selector->prefix) - 1)
+				selector->prefix[prefix_len++] = *c;
+		}
+	}
+	re[len++] = '$';
+	re[len] = '\0';
+	selector->prefix[prefix_len] = '\0';
+	int ret = regcomp(&selector->regex, re, REG_EXTENDED | REG_NOSUB);
+	free(re);
+	return ret != 0;
+}
+
+int logger_check_selector(const char *selector)
+{
+	char *patterns[MAX_LOGGER_SELECTOR_EXPANSIONS];
+	int count = 0;
+	int ret = selector_expand_braces(selector, patterns, &count);
+	for (int i = 0; i < count; ++i) {
+		struct logger_selector_t compiled;
+		memset(&compiled, 0, sizeof(compiled));
+		if (!ret) {
+			ret = selector_compile(patterns[i], &compiled);
+			if (!ret && !compiled.exact)
+				regfree(&compiled.regex);
+		}
+		free(patterns[i]);
+	}
+	return ret;
+}
+
+static void logger_reset(struct logger_t *logger, int type)
 {
 	logger->type = type;
-	logger->stat_count = stat_count;
+	logger->stat_count = 0;
+	logger->max_stat_count = 0;
+	logger->column_count = 0;
 	logger->file = NULL;
+	logger->binlog = NULL;
+	logger->rrd = NULL;
+	logger->values = NULL;
+	logger->decimals = NULL;
 	logger->stats = NULL;
-	if (stat_count == 0)
-		return 0;
+	logger->columns = NULL;
+	logger->names = NULL;
+	logger->order = NULL;
+	logger->selector_count = 0;
+	logger->selectors = NULL;
+	logger->device_generation = 0;
+	logger->thread_generation = 0;
+	logger->filename = NULL;
+	logger->rrd_tiers = NULL;
+	logger->segment = 0;
+}
 
-	logger->stats = (struct logger_stat_t *)malloc(
-			sizeof(struct logger_stat_t) * stat_count);
-	if (logger->stats == NULL)
-		return 1;
-	for (int i = 0; i < stat_count; ++i)
-		logger->stats[i] = stats[i];
+// Create the file(s) of the log and write the column names
+static int logger_open_file(struct logger_t *logger, const char *filename,
+		const char *rrd_tiers, int column_count, const char * const *names)
+{
+	if (logger->type == BINARY) {
+		logger->binlog = (struct binlog_t *)malloc(sizeof(struct binlog_t));
+		if (binlog_create(logger->binlog, filename, column_count, names)) {
+			free(logger->binlog);
+			logger->binlog = NULL;
+			return 2;
+		}
+	} else if (logger->type == RRD) {
+		logger->rrd = (struct rrd_t *)malloc(sizeof(struct rrd_t));
+		int ret = rrd_open(logger->rrd, filename,
+				rrd_tiers ? rrd_tiers : RRD_DEFAULT_TIERS,
+				column_count, names);
+		if (ret) {
+			free(logger->rrd);
+			logger->rrd = NULL;
+			return ret + 1;
+		}
+	} else {
+		logger->file = fopen(filename, "we");
+		if (logger->file == NULL)
+			return 2;
+		for (int i = 0; i < column_count; ++i) {
+			fprintf(logger->file, "%s", names[i]);
+			fputc(i == column_count - 1 ? '\n' : ',', logger->file);
+		}
+	}
+	return 0;
+}
 
-	logger->file = fopen(filename, "w");
-	if (logger->file == NULL) {
-		free(logger->stats);
-		return 2;
+// Create the file(s) and allocate a row
+static int logger_open(struct logger_t *logger, const char *filename,
+		const char *rrd_tiers, int column_count, const char * const *names)
+{
+	int ret = logger_open_file(logger, filename, rrd_tiers, column_count,
+			names);
+	if (ret)
+		return ret;
+	logger->column_count = column_count;
+	logger->values = (double *)malloc(sizeof(double) * column_count);
+	logger->decimals = (int *)malloc(sizeof(int) * column_count);
+	return 0;
+}
+
+// A stat that a selector can match and its name
+struct logger_candidate_t
+{
+	struct logger_stat_t stat;
+	int name; /**< An offset in the name buffer */
+};
+
+// The names of all stats of system that selectors can match
+struct logger_candidates_t
+{
+	int count;
+	struct logger_candidate_t *candidates;
+	int max_count;
+	char *names;
+	int names_used;
+	int names_size;
+};
+
+static void logger_add_candidate(struct logger_candidates_t *c,
+		const struct logger_stat_t *stat, const char *format, ...)
+{
+	if (c->count == c->max_count) {
+		c->max_count += 128;
+		c->candidates = (struct logger_candidate_t *)realloc(c->candidates,
+				sizeof(struct logger_candidate_t) * c->max_count);
 	}
+	// No name is longer than a cgroup path and a few characters
+	if (c->names_used + MAX_CGROUP_NAME_LENGTH + 32 > c->names_size) {
+		c->names_size = c->names_size * 2 + 4096;
+		c->names = (char *)realloc(c->names, c->names_size);
+	}
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(c->names + c->names_used, MAX_CGROUP_NAME_LENGTH + 32,
+			format, args);
+	va_end(args);
+	c->candidates[c->count].stat = *stat;
+	c->candidates[c->count].name = c->names_used;
+	c->names_used += len + 1;
+	++c->count;
+}
 
-	for (int i = 0; i < logger->stat_count; ++i) {
-		struct logger_stat_t stat = logger->stats[i];
-		char value[128];
-		if (stat.type == LOGGER_CPU_USAGE)
-			sprintf(value, "CPU%d Usage", stat.data.cpu_id);
-		else if (stat.type == LOGGER_CPU_TEMPERATURE)
-			sprintf(value, "CPU%d Temperature", stat.data.cpu_id);
-		else if (stat.type == LOGGER_CPU_FREQUENCY)
-			sprintf(value, "CPU%d Frequency (KHz)", stat.data.cpu_id);
-		else if (stat.type == LOGGER_RAM_USED)
-			sprintf(value, "RAM Used");
-		else if (stat.type == LOGGER_RAM_BUFFERS)
-			sprintf(value, "RAM Buffers");
-		else if (stat.type == LOGGER_RAM_CACHED)
-			sprintf(value, "RAM Caches");
-		else if (stat.type == LOGGER_DISK_READ)
-			sprintf(value, "Disk %s Read Speed (B/s)", stat.data.disk_name);
-		else if (stat.type == LOGGER_DISK_WRITE)
-			sprintf(value, "Disk %s Write Speed (B/s)", stat.data.disk_name);
-		else if (stat.type == LOGGER_IFACE_READ)
-			sprintf(value, "Interface %s Download Speed (B/s)", stat.data.iface_name);
-		else if (stat.type == LOGGER_IFACE_WRITE)
-			sprintf(value, "Interface %s Upload Speed (B/s)", stat.data.iface_name);
-		else if (stat.type == LOGGER_BAT_CHARGE)
-			sprintf(value, "Battery %s Charge (%%)", stat.data.battery_name);
-		else if (stat.type == LOGGER_BAT_CURRENT)
-			sprintf(value, "Battery %s Current (A)", stat.data.battery_name);
-		else if (stat.type == LOGGER_BAT_VOLTAGE)
-			sprintf(value, "Battery %s Voltage (V)", stat.data.battery_name);
+// The stats of the threads of a watched process
+static void logger_list_thread_candidates(struct logger_candidates_t *c,
+		const struct process_t *process)
+{
+	static const char * const thread_stats[] = {
+		"cpu", "lastcpu", "ctxsw", "nvcsw", "read", "write"
+	};
+	struct logger_stat_t stat;
+	char name[64];
+	for (int t = 0; t < process->thread_count; ++t) {
+		for (int s = 0; s < 6; ++s) {
+			snprintf(name, sizeof(name), "thread_%d_%s",
+					process->threads[t].tid, thread_stats[s]);
+			logger_parse_stat(name, &stat);
+			logger_add_candidate(c, &stat, "%s", name);
+		}
+	}
+}
+
+// The stats of system, or only those of threads
+static void logger_list_candidates(struct logger_candidates_t *c,
+		const struct system_t *system, int threads_only)
+{
+	if (threads_only) {
+		for (int p = 0; system->watch && p < system->watch->process_count;
+				++p)
+			logger_list_thread_candidates(c, &system->watch->processes[p]);
+		return;
+	}
+
+	static const char * const cpu_stats[] = {
+		"usage", "temp", "freq", "ctxsw", "migr", "minflt", "majflt", "ipc"
+	};
+	static const char * const irq_stats[] = {
+		"irq", "softirq", "netdrop", "squeeze"
+	};
+	static const char * const ram_stats[] = { "used", "buffers", "cached" };
+	static const char * const node_stats[] = {
+		"used", "free", "cached", "cpu", "miss", "foreign"
+	};
+	static const char * const disk_stats[] = { "read", "write" };
+	static const char * const battery_stats[] = {
+		"charge", "current", "voltage"
+	};
+	static const char * const cgroup_stats[] = { "cpu", "mem", "read", "write" };
+	static const char * const psi_resources[] = { "cpu", "memory", "io" };
+	static const char * const psi_stats[] = { "some", "full" };
+	static const char * const self_stats[] = { "wall", "cpu", "sys" };
+	static const char * const proc_stats[] = {
+		"cpu", "threads", "ctxsw", "nvcsw", "read", "write"
+	};
+	struct logger_stat_t stat;
+	char name[MAX_CGROUP_NAME_LENGTH + 32];
+
+	// Only the per-CPU perf_event stats need -P
+	const int cpu_stat_count = system->perf_cpu_count > 0 ? 8 : 3;
+	for (int i = 0; i < system->cpu_count; ++i) {
+		for (int s = 0; s < cpu_stat_count; ++s) {
+			snprintf(name, sizeof(name), "cpu%d%s", i, cpu_stats[s]);
+			logger_parse_stat(name, &stat);
+			logger_add_candidate(c, &stat, "%s", name);
+		}
+		for (int s = 0; system->irqs && s < 4; ++s) {
+			snprintf(name, sizeof(name), "cpu%d%s", i, irq_stats[s]);
+			logger_parse_stat(name, &stat);
+			logger_add_candidate(c, &stat, "%s", name);
+		}
+	}
+	for (int s = 0; s < 3; ++s) {
+		snprintf(name, sizeof(name), "ram_%s", ram_stats[s]);
+		logger_parse_stat(name, &stat);
+		logger_add_candidate(c, &stat, "%s", name);
+	}
+	for (int s = 0; system->vmstat->fd >= 0 && s < VMSTAT_RATES_COUNT; ++s) {
+		snprintf(name, sizeof(name), "vm_%s", vm_stats[s]);
+		logger_parse_stat(name, &stat);
+		logger_add_candidate(c, &stat, "%s", name);
+	}
+	for (int i = 0; i < system->numa_node_count; ++i) {
+		for (int s = 0; s < 6; ++s) {
+			snprintf(name, sizeof(name), "node%d_%s",
+					system->numa_nodes[i].id, node_stats[s]);
+			logger_parse_stat(name, &stat);
+			logger_add_candidate(c, &stat, "%s", name);
+		}
+	}
+	// Device names may contain underscores, so they are copied
+	// instead of being parsed
+	for (int i = 0; i < system->disk_count; ++i) {
+		memset(&stat, 0, sizeof(stat));
+		strcpy(stat.data.disk_name, system->disks[i].name);
+		for (int s = 0; s < 2; ++s) {
+			stat.type = s ? LOGGER_DISK_WRITE : LOGGER_DISK_READ;
+			logger_add_candidate(c, &stat, "disk_%s_%s",
+					system->disks[i].name, disk_stats[s]);
+		}
+	}
+	for (int i = 0; i < system->interface_count; ++i) {
+		memset(&stat, 0, sizeof(stat));
+		strcpy(stat.data.iface_name, system->interfaces[i].name);
+		for (int s = 0; s < 2; ++s) {
+			stat.type = s ? LOGGER_IFACE_WRITE : LOGGER_IFACE_READ;
+			logger_add_candidate(c, &stat, "iface_%s_%s",
+					system->interfaces[i].name, disk_stats[s]);
+		}
+	}
+	for (int i = 0; i < system->battery_count; ++i) {
+		memset(&stat, 0, sizeof(stat));
+		strcpy(stat.data.battery_name, system->batteries[i].name);
+		for (int s = 0; s < 3; ++s) {
+			stat.type = LOGGER_BAT_CHARGE + s;
+			logger_add_candidate(c, &stat, "battery_%s_%s",
+					system->batteries[i].name, battery_stats[s]);
+		}
+	}
+	for (int i = 0; i < system->cgroup_count; ++i) {
+		memset(&stat, 0, sizeof(stat));
+		strcpy(stat.data.cgroup_name, system->cgroups[i].name);
+		for (int s = 0; s < 4; ++s) {
+			stat.type = LOGGER_CGROUP_CPU + s;
+			logger_add_candidate(c, &stat, "cgroup_%s_%s",
+					system->cgroups[i].name, cgroup_stats[s]);
+		}
+	}
+	if (system->psi) {
+		for (int r = 0; r < PSI_RESOURCE_COUNT; ++r) {
+			for (int s = 0; s < 2; ++s) {
+				snprintf(name, sizeof(name), "psi_%s_%s", psi_resources[r],
+						psi_stats[s]);
+				logger_parse_stat(name, &stat);
+				logger_add_candidate(c, &stat, "%s", name);
+			}
+		}
+	}
+	for (int p = 0; system->watch && p < system->watch->process_count; ++p) {
+		const struct process_t *process = &system->watch->processes[p];
+		for (int s = 0; s < 6; ++s) {
+			snprintf(name, sizeof(name), "proc_%d_%s", process->pid,
+					proc_stats[s]);
+			logger_parse_stat(name, &stat);
+			logger_add_candidate(c, &stat, "%s", name);
+		}
+		logger_list_thread_candidates(c, process);
+	}
+	const struct overhead_t *overhead = system->overhead;
+	for (int i = 0; i <= overhead->section_count; ++i) {
+		const char *section = i < overhead->section_count ?
+			overhead->sections[i].name : "total";
+		for (int s = 0; s < 3; ++s) {
+			snprintf(name, sizeof(name), "self_%s_%s", section, self_stats[s]);
+			if (!logger_parse_stat(name, &stat))
+				logger_add_candidate(c, &stat, "%s", name);
+		}
+	}
+	logger_parse_stat("self_usage", &stat);
+	logger_add_candidate(c, &stat, "self_usage");
+	logger_parse_stat("self_late", &stat);
+	logger_add_candidate(c, &stat, "self_late");
+	logger_parse_stat("self_nivcsw", &stat);
+	logger_add_candidate(c, &stat, "self_nivcsw");
+}
+
+static void logger_add_stat(struct logger_t *logger,
+		const struct logger_stat_t *stat, int pinned)
+{
+	if (logger->stat_count == logger->max_stat_count) {
+		logger->max_stat_count += 128;
+		logger->stats = (struct logger_stat_t *)realloc(logger->stats,
+				sizeof(struct logger_stat_t) * logger->max_stat_count);
+		logger->columns = (struct logger_column_t *)realloc(logger->columns,
+				sizeof(struct logger_column_t) * logger->max_stat_count);
+		logger->names = (char **)realloc(logger->names,
+				sizeof(char *) * logger->max_stat_count);
+		logger->order = (int *)realloc(logger->order,
+				sizeof(int) * logger->max_stat_count);
+	}
+	char name[256];
+	logger_stat_name(stat, name);
+	const int i = logger->stat_count++;
+	logger->stats[i] = *stat;
+	logger->names[i] = strdup(name);
+	memset(&logger->columns[i], 0, sizeof(struct logger_column_t));
+	logger->columns[i].pinned = pinned;
+}
+
+// The column called name among the first count of logger->order,
+// -1 if there is none
+static int logger_find_column(const struct logger_t *logger, int count,
+		const char *name)
+{
+	int low = 0, high = count;
+	while (low < high) {
+		const int mid = (low + high) / 2;
+		const int cmp = strcmp(logger->names[logger->order[mid]], name);
+		if (cmp == 0)
+			return logger->order[mid];
+		if (cmp < 0)
+			low = mid + 1;
 		else
-			value[0] = '\0';
+			high = mid;
+	}
+	return -1;
+}
+
+// Used to sort stats by their names, and by their order for equal names
+struct logger_stat_key_t
+{
+	const char *name;
+	int index;
+};
+
+static int logger_stat_key_cmp(const void *a, const void *b)
+{
+	const struct logger_stat_key_t *x = (const struct logger_stat_key_t *)a;
+	const struct logger_stat_key_t *y = (const struct logger_stat_key_t *)b;
+	int cmp = strcmp(x->name, y->name);
+	return cmp ? cmp : x->index - y->index;
+}
+
+// What the value of a stat is read from
+enum {
+	DEVICE_NONE, // The system itself or a CPU
+	DEVICE_NODE,
+	DEVICE_DISK,
+	DEVICE_IFACE,
+	DEVICE_BATTERY,
+	DEVICE_CGROUP,
+	DEVICE_SECTION, // A section of the overhead, or "total" after them
+	DEVICE_PROCESS,
+	DEVICE_THREAD
+};
+
+static int logger_device_kind(int type)
+{
+	if (type >= LOGGER_NODE_USED && type <= LOGGER_NODE_FOREIGN)
+		return DEVICE_NODE;
+	else if (type == LOGGER_DISK_READ || type == LOGGER_DISK_WRITE)
+		return DEVICE_DISK;
+	else if (type == LOGGER_IFACE_READ || type == LOGGER_IFACE_WRITE)
+		return DEVICE_IFACE;
+	else if (type >= LOGGER_BAT_CHARGE && type <= LOGGER_BAT_VOLTAGE)
+		return DEVICE_BATTERY;
+	else if (type >= LOGGER_CGROUP_CPU && type <= LOGGER_CGROUP_WRITE)
+		return DEVICE_CGROUP;
+	else if (type >= LOGGER_SELF_WALL && type <= LOGGER_SELF_SYSCALLS)
+		return DEVICE_SECTION;
+	else if (type >= LOGGER_PROC_CPU && type <= LOGGER_PROC_WRITE)
+		return DEVICE_PROCESS;
+	else if (type >= LOGGER_THREAD_CPU && type <= LOGGER_THREAD_WRITE)
+		return DEVICE_THREAD;
+	return DEVICE_NONE;
+}
 
-		fprintf(logger->file, "%s", value);
-		fputc(i == logger->stat_count - 1 ? '\n' : ',', logger->file);
+// The number of devices of a kind, except threads
+static int logger_device_count(const struct system_t *system, int kind)
+{
+	switch (kind) {
+		case DEVICE_NODE: return system->numa_node_count;
+		case DEVICE_DISK: return system->disk_count;
+		case DEVICE_IFACE: return system->interface_count;
+		case DEVICE_BATTERY: return system->battery_count;
+		case DEVICE_CGROUP: return system->cgroup_count;
+		case DEVICE_SECTION: return system->overhead->section_count + 1;
+		case DEVICE_PROCESS:
+			return system->watch ? system->watch->process_count : 0;
 	}
 	return 0;
 }
 
-void logger_destroy(struct logger_t *logger)
+// Whether device i of a kind is the one that stat is read from
+static int logger_device_is(const struct system_t *system, int kind, int i,
+		const struct logger_stat_t *stat)
 {
-	free(logger->stats);
-	if (logger->file)
-		fclose(logger->file);
+	const struct overhead_t *overhead = system->overhead;
+	switch (kind) {
+		case DEVICE_NODE:
+			return system->numa_nodes[i].id == stat->data.node_id;
+		case DEVICE_DISK:
+			return !strcmp(system->disks[i].name, stat->data.disk_name);
+		case DEVICE_IFACE:
+			return !strcmp(system->interfaces[i].name, stat->data.iface_name);
+		case DEVICE_BATTERY:
+			return !strcmp(system->batteries[i].name,
+					stat->data.battery_name);
+		case DEVICE_CGROUP:
+			return !strcmp(system->cgroups[i].name, stat->data.cgroup_name);
+		case DEVICE_SECTION:
+			return !strcmp(i < overhead->section_count ?
+					overhead->sections[i].name : "total",
+					stat->data.overhead_section);
+		case DEVICE_PROCESS:
+			return system->watch->processes[i].pid == stat->data.pid;
+	}
+	return 0;
 }
 
-void logger_log(struct logger_t *logger, struct system_t *system)
+// A watched thread, to find threads by TID
+struct logger_tid_t
+{
+	int tid;
+	int process;
+	int thread;
+};
+
+static int logger_tid_cmp(const void *a, const void *b)
 {
+	const int x = ((const struct logger_tid_t *)a)->tid;
+	const int y = ((const struct logger_tid_t *)b)->tid;
+	return (x > y) - (x < y);
+}
+
+// The watched threads sorted by TID
+static struct logger_tid_t *logger_list_tids(const struct system_t *system,
+		int *count)
+{
+	const struct watch_t *watch = system->watch;
+	int total = 0;
+	for (int p = 0; watch && p < watch->process_count; ++p)
+		total += watch->processes[p].thread_count;
+	struct logger_tid_t *tids = (struct logger_tid_t *)malloc(
+			sizeof(struct logger_tid_t) * (total + 1));
+	*count = 0;
+	for (int p = 0; watch && p < watch->process_count; ++p) {
+		for (int t = 0; t < watch->processes[p].thread_count; ++t) {
+			tids[*count].tid = watch->processes[p].threads[t].tid;
+			tids[*count].process = p;
+			tids[*count].thread = t;
+			++*count;
+		}
+	}
+	qsort(tids, *count, sizeof(struct logger_tid_t), logger_tid_cmp);
+	return tids;
+}
+
+// Find the device of every column on system, or only of the columns of
+// threads
+static void logger_resolve(struct logger_t *logger,
+		const struct system_t *system, int threads_only)
+{
+	struct logger_tid_t *tids = NULL;
+	int tid_count = 0;
+	// The columns are usually in the order of the devices, so each search
+	// starts at the device of the previous column of that kind
+	int start[DEVICE_THREAD] = { 0 };
 	for (int i = 0; i < logger->stat_count; ++i) {
-		struct logger_stat_t stat = logger->stats[i];
-		char value[128];
-		if (stat.type == LOGGER_CPU_FREQUENCY) {
-			sprintf(value, "%d", system->cpus[stat.data.cpu_id].cur_freq);
-		} else if (stat.type == LOGGER_CPU_USAGE) {
-			sprintf(value, "%f", system->cpus[stat.data.cpu_id].total_usage * 100.0);
-		} else if (stat.type == LOGGER_CPU_TEMPERATURE) {
-			sprintf(value, "%f", system->cpus[stat.data.cpu_id].cur_temp / 1000.0);
-
-		} else if (stat.type == LOGGER_RAM_USED) {
-			sprintf(value, "%lld", system->ram_used);
-		} else if (stat.type == LOGGER_RAM_BUFFERS) {
-			sprintf(value, "%lld", system->ram_buffers);
-		} else if (stat.type == LOGGER_RAM_CACHED) {
-			sprintf(value, "%lld", system->ram_cached);
-
-		} else if (stat.type == LOGGER_DISK_READ || stat.type == LOGGER_DISK_WRITE) {
-			struct disk_t *disk = NULL;
-			for (int i = 0; i < system->disk_count; ++i) {
-				if (!strcmp(system->disks[i].name, stat.data.disk_name)) {
-					disk = &system->disks[i];
-					break;
-				}
+		struct logger_column_t *column = &logger->columns[i];
+		const struct logger_stat_t *stat = &logger->stats[i];
+		const int kind = logger_device_kind(stat->type);
+		if (kind == DEVICE_NONE || (threads_only && kind != DEVICE_THREAD))
+			continue;
+		column->device = -1;
+		if (kind == DEVICE_THREAD) {
+			if (tids == NULL)
+				tids = logger_list_tids(system, &tid_count);
+			const struct logger_tid_t key = { stat->data.pid, 0, 0 };
+			const struct logger_tid_t *found = (const struct logger_tid_t *)
+				bsearch(&key, tids, tid_count, sizeof(struct logger_tid_t),
+						logger_tid_cmp);
+			if (found) {
+				column->device = found->process;
+				column->thread = found->thread;
 			}
-			int disk_stat = stat.type == LOGGER_DISK_READ ? DISK_READ_SECTORS : DISK_WRITE_SECTORS;
-			sprintf(value, "%d", disk ? disk->stats_delta[disk_stat] * 512 : 0);
-		} else if (stat.type == LOGGER_IFACE_READ || stat.type == LOGGER_IFACE_WRITE) {
-			struct interface_t *interface = NULL;
-			for (int i = 0; i < system->interface_count; ++i) {
-				if (!strcmp(system->interfaces[i].name, stat.data.iface_name)) {
-					interface = &system->interfaces[i];
-					break;
-				}
-			}
-			sprintf(value, "%llu", interface ? ( stat.type == LOGGER_IFACE_READ ?
-						interface->delta_rx_bytes : interface->delta_tx_bytes) : 0);
-		} else if (stat.type == LOGGER_BAT_CHARGE ||
-				stat.type == LOGGER_BAT_CURRENT ||
-				stat.type == LOGGER_BAT_VOLTAGE) {
-			struct battery_t *battery = NULL;
-			for (int i = 0; i < system->battery_count; ++i) {
-				if (!strcmp(system->batteries[i].name, stat.data.battery_name)) {
-					battery = &system->batteries[i];
+		} else {
+			const int count = logger_device_count(system, kind);
+			for (int n = 0, d = start[kind]; n < count;
+					++n, d = d + 1 < count ? d + 1 : 0) {
+				if (logger_device_is(system, kind, d, stat)) {
+					column->device = d;
+					start[kind] = d;
 					break;
 				}
 			}
-			int v;
-			if (stat.type == LOGGER_BAT_CHARGE)
-				v = battery->charge;
-			else if (stat.type == LOGGER_BAT_CURRENT)
-				v = battery->current;
-			else if (stat.type == LOGGER_BAT_VOLTAGE)
-				v = battery->voltage;
-			sprintf(value, "%d", v);
+		}
+		column->missing = column->device < 0 ? column->missing + 1 : 0;
+	}
+	free(tids);
+}
+
+// Whether a column is dropped at this expansion
+static int logger_column_dead(const struct logger_t *logger, int i)
+{
+	const struct logger_column_t *column = &logger->columns[i];
+	if (column->pinned || column->missing == 0)
+		return 0;
+	// A disk or an interface may come back, a PID isn't reused soon
+	const int kind = logger_device_kind(logger->stats[i].type);
+	return kind == DEVICE_PROCESS || kind == DEVICE_THREAD ||
+		column->missing >= LOGGER_COLUMN_LIFETIME;
+}
+
+// Expand the selectors on system, or only on the threads of the watched
+// processes, then add the stats that are new as columns and drop the
+// dead ones, in a new header (CSV) or a new segment (binary and RRD)
+static void logger_expand(struct logger_t *logger,
+		const struct system_t *system, int threads_only)
+{
+	logger->device_generation = system->device_generation;
+	logger->thread_generation = system->watch ?
+		system->watch->thread_generation : 0;
+	const int old_count = logger->stat_count;
+
+	struct logger_candidates_t candidates;
+	memset(&candidates, 0, sizeof(candidates));
+	for (int s = 0; s < logger->selector_count; ++s) {
+		const struct logger_selector_t *selector = &logger->selectors[s];
+		if (selector->exact) {
+			if (!threads_only)
+				logger_add_stat(logger, &selector->stat, 1);
+			continue;
+		}
+		if (candidates.count == 0)
+			logger_list_candidates(&candidates, system, threads_only);
+		const int prefix_len = strlen(selector->prefix);
+		for (int c = 0; c < candidates.count; ++c) {
+			const char *name = candidates.names + candidates.candidates[c].name;
+			if (!strncmp(name, selector->prefix, prefix_len) &&
+					!regexec(&selector->regex, name, 0, NULL, 0))
+				logger_add_stat(logger, &candidates.candidates[c].stat, 0);
+		}
+	}
+	free(candidates.candidates);
+	free(candidates.names);
+
+	// Drop the new stats that are already columns (or came up twice),
+	// keeping the order of the rest. Only the new ones are sorted, the
+	// columns are looked up in logger->order
+	const int added = logger->stat_count - old_count;
+	struct logger_stat_key_t *keys = (struct logger_stat_key_t *)malloc(
+			sizeof(struct logger_stat_key_t) * (added + 1));
+	for (int i = 0; i < added; ++i) {
+		keys[i].name = logger->names[old_count + i];
+		keys[i].index = old_count + i;
+	}
+	qsort(keys, added, sizeof(struct logger_stat_key_t), logger_stat_key_cmp);
+	int *remap = (int *)malloc(sizeof(int) * (logger->stat_count + 1));
+	for (int i = 0, kept = -1; i < added; ++i) {
+		const int index = keys[i].index;
+		if (i == 0 || strcmp(keys[i].name, keys[i - 1].name)) {
+			kept = logger_find_column(logger, old_count, keys[i].name);
+			if (kept < 0)
+				kept = index;
+		}
+		// An exact selector keeps the column that it came up as
+		if (logger->columns[index].pinned)
+			logger->columns[kept].pinned = 1;
+		remap[index] = kept == index ? 0 : -1;
+	}
+	int new_count = old_count;
+	for (int i = old_count; i < logger->stat_count; ++i) {
+		if (remap[i] < 0) {
+			free(logger->names[i]);
+			continue;
+		}
+		remap[i] = new_count;
+		logger->stats[new_count] = logger->stats[i];
+		logger->names[new_count] = logger->names[i];
+		logger->columns[new_count] = logger->columns[i];
+		++new_count;
+	}
+	// The new columns sorted by name
+	int *fresh = (int *)malloc(sizeof(int) * (added + 1));
+	int fresh_count = 0;
+	for (int i = 0; i < added; ++i)
+		if (remap[keys[i].index] >= 0)
+			fresh[fresh_count++] = remap[keys[i].index];
+	free(keys);
+	logger->stat_count = new_count;
+
+	logger_resolve(logger, system, threads_only);
+
+	int kept_count = 0;
+	for (int i = 0; i < new_count; ++i) {
+		remap[i] = logger_column_dead(logger, i) ? -1 : kept_count;
+		kept_count += remap[i] >= 0;
+	}
+	// Nothing changed, or a log without columns
+	if ((new_count == old_count && kept_count == new_count) ||
+			kept_count == 0) {
+		free(fresh);
+		free(remap);
+		return;
+	}
+
+	const char **name_ptrs = (const char **)malloc(
+			sizeof(const char *) * kept_count);
+	for (int i = 0; i < new_count; ++i)
+		if (remap[i] >= 0)
+			name_ptrs[remap[i]] = logger->names[i];
+
+	int ret;
+	if (logger->column_count == 0) {
+		ret = logger_open(logger, logger->filename, logger->rrd_tiers,
+				kept_count, name_ptrs);
+	} else if (logger->file) {
+		// The rows that follow have other columns
+		for (int i = 0; i < kept_count; ++i) {
+			fprintf(logger->file, "%s", name_ptrs[i]);
+			fputc(i == kept_count - 1 ? '\n' : ',', logger->file);
+		}
+		ret = 0;
+	} else {
+		// The columns of binary and RRD logs are fixed, so the log
+		// continues in a new file. The old one is kept if that fails
+		struct binlog_t *binlog = logger->binlog;
+		struct rrd_t *rrd = logger->rrd;
+		logger->binlog = NULL;
+		logger->rrd = NULL;
+		char *filename = (char *)malloc(strlen(logger->filename) + 16);
+		sprintf(filename, "%s.%d", logger->filename, logger->segment + 1);
+		ret = logger_open_file(logger, filename, logger->rrd_tiers,
+				kept_count, name_ptrs);
+		free(filename);
+		if (ret) {
+			logger->binlog = binlog;
+			logger->rrd = rrd;
 		} else {
-			value[0] = '\0';
+			++logger->segment;
+			if (binlog) {
+				binlog_close(binlog);
+				free(binlog);
+			}
+			if (rrd) {
+				rrd_close(rrd);
+				free(rrd);
+			}
+		}
+	}
+	free(name_ptrs);
+
+	if (ret) {
+		// Keep logging the columns that there are
+		for (int i = old_count; i < new_count; ++i)
+			free(logger->names[i]);
+		logger->stat_count = old_count;
+		free(fresh);
+		free(remap);
+		return;
+	}
+
+	// Merge the new columns into the order, without the dead ones, while
+	// the names are still where the indices say
+	int *order = (int *)malloc(sizeof(int) * kept_count);
+	int count = 0;
+	for (int a = 0, b = 0; a < old_count || b < fresh_count;) {
+		if (a < old_count && remap[logger->order[a]] < 0) {
+			++a;
+			continue;
+		}
+		if (b < fresh_count && remap[fresh[b]] < 0) {
+			++b;
+			continue;
+		}
+		const int old_first = b == fresh_count || (a < old_count &&
+				strcmp(logger->names[logger->order[a]],
+					logger->names[fresh[b]]) < 0);
+		order[count++] = remap[old_first ? logger->order[a++] : fresh[b++]];
+	}
+	memcpy(logger->order, order, sizeof(int) * kept_count);
+	free(order);
+	for (int i = 0; i < new_count; ++i) {
+		if (remap[i] < 0) {
+			free(logger->names[i]);
+			continue;
+		}
+		logger->stats[remap[i]] = logger->stats[i];
+		logger->names[remap[i]] = logger->names[i];
+		logger->columns[remap[i]] = logger->columns[i];
+	}
+	logger->stat_count = kept_count;
+	free(fresh);
+	free(remap);
+
+	if (logger->column_count != kept_count) {
+		logger->column_count = kept_count;
+		logger->values = (double *)realloc(logger->values,
+				sizeof(double) * kept_count);
+		logger->decimals = (int *)realloc(logger->decimals,
+				sizeof(int) * kept_count);
+	}
+}
+
+int logger_init(struct logger_t *logger, int type, const char *filename,
+		const char *rrd_tiers, int selector_count,
+		const char * const *selectors, const struct system_t *system)
+{
+	logger_reset(logger, type);
+	if (selector_count <= 0 || filename == NULL)
+		return 0;
+	logger->filename = strdup(filename);
+	logger->rrd_tiers = rrd_tiers ? strdup(rrd_tiers) : NULL;
+
+	int max_selector_count = 0;
+	for (int i = 0; i < selector_count; ++i) {
+		char *patterns[MAX_LOGGER_SELECTOR_EXPANSIONS];
+		int count = 0;
+		int ret = selector_expand_braces(selectors[i], patterns, &count);
+		for (int p = 0; p < count; ++p) {
+			if (logger->selector_count == max_selector_count) {
+				max_selector_count += 128;
+				logger->selectors = (struct logger_selector_t *)realloc(
+						logger->selectors, sizeof(struct logger_selector_t) *
+						max_selector_count);
+			}
+			struct logger_selector_t *selector =
+				&logger->selectors[logger->selector_count];
+			memset(selector, 0, sizeof(struct logger_selector_t));
+			if (!ret) {
+				ret = selector_compile(patterns[p], selector);
+				if (!ret)
+					++logger->selector_count;
+			}
+			free(patterns[p]);
+		}
+		if (ret)
+			return 1;
+	}
+
+	logger_expand(logger, system, 0);
+	if (logger->stat_count > 0 && logger->column_count == 0)
+		return 2;
+	return 0;
+}
+
+int logger_init_columns(struct logger_t *logger, int type,
+		const char *filename, const char *rrd_tiers, int column_count,
+		const char * const *names)
+{
+	logger_reset(logger, type);
+	if (column_count <= 0)
+		return 0;
+	return logger_open(logger, filename, rrd_tiers, column_count, names);
+}
+
+void logger_destroy(struct logger_t *logger)
+{
+	for (int i = 0; i < logger->stat_count; ++i)
+		free(logger->names[i]);
+	free(logger->stats);
+	free(logger->columns);
+	free(logger->names);
+	free(logger->order);
+	for (int i = 0; i < logger->selector_count; ++i)
+		if (!logger->selectors[i].exact)
+			regfree(&logger->selectors[i].regex);
+	free(logger->selectors);
+	free(logger->filename);
+	free(logger->rrd_tiers);
+	if (logger->file)
+		fclose(logger->file);
+	if (logger->binlog) {
+		binlog_close(logger->binlog);
+		free(logger->binlog);
+	}
+	if (logger->rrd) {
+		rrd_close(logger->rrd);
+		free(logger->rrd);
+	}
+	free(logger->values);
+	free(logger->decimals);
+}
+
+// The current value of stat, whose device is given by column. Sets
+// *decimals to the number of decimal places that are worth writing to a
+// text log
+static double logger_stat_value(const struct logger_stat_t *s,
+		const struct logger_column_t *column, struct system_t *system,
+		int *decimals)
+{
+	struct logger_stat_t stat = *s;
+	*decimals = 0;
+	if (stat.type == LOGGER_CPU_FREQUENCY) {
+		return system->cpu_counters->freq[stat.data.cpu_id];
+	} else if (stat.type == LOGGER_CPU_USAGE) {
+		*decimals = 6;
+		return system->cpu_counters->usage[stat.data.cpu_id] * 100.0;
+	} else if (stat.type == LOGGER_CPU_TEMPERATURE) {
+		*decimals = 6;
+		return system->cpus[stat.data.cpu_id].cur_temp / 1000.0;
+	} else if (stat.type == LOGGER_CPU_CONTEXT_SWITCHES) {
+		return system->cpus[stat.data.cpu_id].perf_rate[PERF_CONTEXT_SWITCHES];
+	} else if (stat.type == LOGGER_CPU_MIGRATIONS) {
+		return system->cpus[stat.data.cpu_id].perf_rate[PERF_MIGRATIONS];
+	} else if (stat.type == LOGGER_CPU_MINOR_FAULTS) {
+		return system->cpus[stat.data.cpu_id].perf_rate[PERF_MINOR_FAULTS];
+	} else if (stat.type == LOGGER_CPU_MAJOR_FAULTS) {
+		return system->cpus[stat.data.cpu_id].perf_rate[PERF_MAJOR_FAULTS];
+	} else if (stat.type == LOGGER_CPU_IPC) {
+		*decimals = 6;
+		return system->cpus[stat.data.cpu_id].ipc;
+	} else if (stat.type >= LOGGER_CPU_IRQS &&
+			stat.type <= LOGGER_CPU_TIME_SQUEEZES) {
+		const struct irq_stats_t *irqs = system->irqs;
+		const int c = stat.data.cpu_id;
+		if (irqs == NULL || c >= system->cpu_count)
+			return 0.0;
+		else if (stat.type == LOGGER_CPU_IRQS)
+			return irqs->interrupts.cpu_rates[c];
+		else if (stat.type == LOGGER_CPU_SOFTIRQS)
+			return irqs->softirqs.cpu_rates[c];
+		else if (stat.type == LOGGER_CPU_SOFTNET_DROPS)
+			return irqs->softnet_rate[SOFTNET_DROPPED][c];
+		else
+			return irqs->softnet_rate[SOFTNET_TIME_SQUEEZE][c];
+
+	} else if (stat.type == LOGGER_RAM_USED) {
+		return system->ram_used;
+	} else if (stat.type == LOGGER_RAM_BUFFERS) {
+		return system->ram_buffers;
+	} else if (stat.type == LOGGER_RAM_CACHED) {
+		return system->ram_cached;
+	} else if (stat.type >= LOGGER_VM_PAGE_IN &&
+			stat.type <= LOGGER_VM_OOM_KILLS) {
+		return system->vmstat->rates[stat.type - LOGGER_VM_PAGE_IN];
+
+	} else if (stat.type >= LOGGER_NODE_USED &&
+			stat.type <= LOGGER_NODE_FOREIGN) {
+		if (column->device < 0)
+			return 0.0;
+		const struct numa_node_t *node = &system->numa_nodes[column->device];
+		if (stat.type == LOGGER_NODE_USED)
+			return node->mem_used;
+		else if (stat.type == LOGGER_NODE_FREE)
+			return node->mem_free;
+		else if (stat.type == LOGGER_NODE_CACHED)
+			return node->mem_cached;
+		else if (stat.type == LOGGER_NODE_CPU) {
+			*decimals = 6;
+			return node->cpu_usage * 100.0;
+		} else if (stat.type == LOGGER_NODE_MISS)
+			return node->stats_rate[NUMA_MISS];
+		else
+			return node->stats_rate[NUMA_FOREIGN];
+
+	} else if (stat.type == LOGGER_DISK_READ || stat.type == LOGGER_DISK_WRITE) {
+		const struct disk_t *disk = column->device < 0 ? NULL :
+			&system->disks[column->device];
+		int disk_stat = stat.type == LOGGER_DISK_READ ? DISK_READ_SECTORS : DISK_WRITE_SECTORS;
+		return disk ? disk->stats_rate[disk_stat] * DISK_SECTOR_SIZE : 0.0;
+	} else if (stat.type == LOGGER_IFACE_READ || stat.type == LOGGER_IFACE_WRITE) {
+		const struct interface_t *interface = column->device < 0 ? NULL :
+			&system->interfaces[column->device];
+		return interface ? ( stat.type == LOGGER_IFACE_READ ?
+					interface->rx_rate : interface->tx_rate) : 0.0;
+	} else if (stat.type == LOGGER_BAT_CHARGE ||
+			stat.type == LOGGER_BAT_CURRENT ||
+			stat.type == LOGGER_BAT_VOLTAGE) {
+		if (column->device < 0)
+			return 0.0;
+		const struct battery_t *battery = &system->batteries[column->device];
+		if (stat.type == LOGGER_BAT_CHARGE)
+			return battery->charge;
+		else if (stat.type == LOGGER_BAT_CURRENT)
+			return battery->current;
+		else
+			return battery->voltage;
+	} else if (stat.type == LOGGER_CGROUP_CPU ||
+			stat.type == LOGGER_CGROUP_MEMORY ||
+			stat.type == LOGGER_CGROUP_READ ||
+			stat.type == LOGGER_CGROUP_WRITE) {
+		if (column->device < 0)
+			return 0.0;
+		const struct cgroup_t *cgroup = &system->cgroups[column->device];
+		if (stat.type == LOGGER_CGROUP_CPU) {
+			*decimals = 6;
+			return cgroup->cpu_usage * 100.0;
+		} else if (stat.type == LOGGER_CGROUP_MEMORY)
+			return cgroup->memory_current;
+		else if (stat.type == LOGGER_CGROUP_READ)
+			return cgroup->read_rate;
+		else
+			return cgroup->write_rate;
+	} else if (stat.type == LOGGER_PSI_SOME || stat.type == LOGGER_PSI_FULL) {
+		double stall = 0.0;
+		if (system->psi) {
+			const struct psi_t *psi = &system->psi[stat.data.psi_resource];
+			stall = stat.type == LOGGER_PSI_SOME ?
+				psi->some.stall : psi->full.stall;
 		}
+		*decimals = 6;
+		return stall * 100.0;
+	} else if (stat.type >= LOGGER_PROC_CPU &&
+			stat.type <= LOGGER_PROC_WRITE) {
+		if (column->device < 0)
+			return 0.0;
+		const struct process_t *process =
+			&system->watch->processes[column->device];
+		if (stat.type == LOGGER_PROC_CPU) {
+			*decimals = 6;
+			return process->cpu_usage * 100.0;
+		} else if (stat.type == LOGGER_PROC_THREADS)
+			return process->thread_count;
+		else if (stat.type == LOGGER_PROC_SWITCHES)
+			return process->switches_rate;
+		else if (stat.type == LOGGER_PROC_INVOLUNTARY_SWITCHES)
+			return process->involuntary_rate;
+		else if (stat.type == LOGGER_PROC_READ)
+			return process->read_rate;
+		else
+			return process->write_rate;
+	} else if (stat.type >= LOGGER_THREAD_CPU &&
+			stat.type <= LOGGER_THREAD_WRITE) {
+		if (column->device < 0)
+			return 0.0;
+		const struct thread_t *thread =
+			&system->watch->processes[column->device].threads[column->thread];
+		if (stat.type == LOGGER_THREAD_CPU) {
+			*decimals = 6;
+			return thread->cpu_usage * 100.0;
+		} else if (stat.type == LOGGER_THREAD_LAST_CPU)
+			return thread->last_cpu;
+		else if (stat.type == LOGGER_THREAD_SWITCHES)
+			return thread->switches_rate;
+		else if (stat.type == LOGGER_THREAD_INVOLUNTARY_SWITCHES)
+			return thread->involuntary_rate;
+		else if (stat.type == LOGGER_THREAD_READ)
+			return thread->read_rate;
+		else
+			return thread->write_rate;
+	} else if (stat.type == LOGGER_SELF_WALL ||
+			stat.type == LOGGER_SELF_CPU ||
+			stat.type == LOGGER_SELF_SYSCALLS) {
+		// The collectors have already run during this tick, but the
+		// logger and the rendering show the cost of the previous one
+		const struct overhead_t *overhead = system->overhead;
+		struct overhead_sample_t cost;
+		memset(&cost, 0, sizeof(cost));
+		if (column->device == overhead->section_count)
+			overhead_last_total(overhead, &cost);
+		else if (column->device >= 0)
+			cost = overhead->sections[column->device].last;
+		if (stat.type == LOGGER_SELF_SYSCALLS)
+			return cost.syscalls;
+		*decimals = 1;
+		return (stat.type == LOGGER_SELF_WALL ?
+				cost.wall_ns : cost.cpu_ns) / 1000.0;
+	} else if (stat.type == LOGGER_SELF_USAGE) {
+		*decimals = 6;
+		return system->overhead->cpu_usage * 100.0;
+	} else if (stat.type == LOGGER_SELF_LATENESS) {
+		*decimals = 1;
+		return system->overhead->last_lateness_ns / 1000.0;
+	} else if (stat.type == LOGGER_SELF_INVOLUNTARY_SWITCHES) {
+		return system->overhead->last_involuntary_switches;
+	}
+	return 0.0;
+}
 
-		fprintf(logger->file, "%s", value);
-		fputc(i == logger->stat_count - 1 ? '\n' : ',', logger->file);
+void logger_log(struct logger_t *logger, struct system_t *system)
+{
+	if (logger->selector_count > 0) {
+		if (logger->device_generation != system->device_generation)
+			logger_expand(logger, system, 0);
+		else if (system->watch && logger->thread_generation !=
+				system->watch->thread_generation)
+			logger_expand(logger, system, 1);
+	}
+	if (logger->column_count == 0)
+		return;
+	for (int i = 0; i < logger->stat_count; ++i)
+		logger->values[i] = logger_stat_value(&logger->stats[i],
+				&logger->columns[i], system, &logger->decimals[i]);
+	logger_log_values(logger, logger->values, logger->decimals);
+}
+
+void logger_log_values(struct logger_t *logger, const double *values,
+		const int *decimals)
+{
+	if (logger->binlog) {
+		binlog_append(logger->binlog, realtime_ns(), values);
+	} else if (logger->rrd) {
+		rrd_update(logger->rrd, realtime_ns(), values);
+	} else if (logger->file) {
+		for (int i = 0; i < logger->column_count; ++i) {
+			fprintf(logger->file, "%.*f", decimals[i], values[i]);
+			fputc(i == logger->column_count - 1 ? '\n' : ',', logger->file);
+		}
 	}
 }
@@ -2,15 +2,22 @@
 #define LOGGER_H_INCLUDED
 
 #include <stdio.h>
+#include <regex.h>
 #include "disk.h"
 #include "interface.h"
 #include "battery.h"
+#include "cgroup.h"
+#include "overhead.h"
 
 struct system_t;
+struct binlog_t;
+struct rrd_t;
 
 enum logger_type
 {
-	CSV
+	CSV,
+	BINARY, /**< See binlog.h, read with smon-query */
+	RRD /**< Fixed-size retention tiers, see rrd.h */
 };
 
 struct logger_stat_t
@@ -19,38 +26,182 @@ struct logger_stat_t
 		LOGGER_CPU_FREQUENCY,
 		LOGGER_CPU_USAGE,
 		LOGGER_CPU_TEMPERATURE,
+		LOGGER_CPU_CONTEXT_SWITCHES,
+		LOGGER_CPU_MIGRATIONS,
+		LOGGER_CPU_MINOR_FAULTS,
+		LOGGER_CPU_MAJOR_FAULTS,
+		LOGGER_CPU_IPC,
+		LOGGER_CPU_IRQS,
+		LOGGER_CPU_SOFTIRQS,
+		LOGGER_CPU_SOFTNET_DROPS,
+		LOGGER_CPU_TIME_SQUEEZES,
 		LOGGER_RAM_USED,
 		LOGGER_RAM_BUFFERS,
 		LOGGER_RAM_CACHED,
+		LOGGER_VM_PAGE_IN, /**< In the order of the VMSTAT_* rates */
+		LOGGER_VM_PAGE_OUT,
+		LOGGER_VM_SWAP_IN,
+		LOGGER_VM_SWAP_OUT,
+		LOGGER_VM_FAULTS,
+		LOGGER_VM_MAJOR_FAULTS,
+		LOGGER_VM_SCAN,
+		LOGGER_VM_STEAL,
+		LOGGER_VM_ALLOCSTALLS,
+		LOGGER_VM_OOM_KILLS,
+		LOGGER_NODE_USED,
+		LOGGER_NODE_FREE,
+		LOGGER_NODE_CACHED,
+		LOGGER_NODE_CPU,
+		LOGGER_NODE_MISS,
+		LOGGER_NODE_FOREIGN,
 		LOGGER_DISK_READ,
 		LOGGER_DISK_WRITE,
 		LOGGER_IFACE_READ,
 		LOGGER_IFACE_WRITE,
 		LOGGER_BAT_CHARGE,
 		LOGGER_BAT_CURRENT,
-		LOGGER_BAT_VOLTAGE
+		LOGGER_BAT_VOLTAGE,
+		LOGGER_CGROUP_CPU,
+		LOGGER_CGROUP_MEMORY,
+		LOGGER_CGROUP_READ,
+		LOGGER_CGROUP_WRITE,
+		LOGGER_PSI_SOME,
+		LOGGER_PSI_FULL,
+		LOGGER_PROC_CPU,
+		LOGGER_PROC_THREADS,
+		LOGGER_PROC_SWITCHES,
+		LOGGER_PROC_INVOLUNTARY_SWITCHES,
+		LOGGER_PROC_READ,
+		LOGGER_PROC_WRITE,
+		LOGGER_THREAD_CPU,
+		LOGGER_THREAD_LAST_CPU,
+		LOGGER_THREAD_SWITCHES,
+		LOGGER_THREAD_INVOLUNTARY_SWITCHES,
+		LOGGER_THREAD_READ,
+		LOGGER_THREAD_WRITE,
+		LOGGER_SELF_WALL,
+		LOGGER_SELF_CPU,
+		LOGGER_SELF_SYSCALLS,
+		LOGGER_SELF_USAGE,
+		LOGGER_SELF_LATENESS,
+		LOGGER_SELF_INVOLUNTARY_SWITCHES
 	} type;
 	union logger_stat_data {
 		int cpu_id;
+		int node_id;
+		int psi_resource;
+		int pid; /**< Of a watched process or thread */
 		char iface_name[MAX_INTERFACE_NAME_LENGTH + 1];
 		char disk_name[MAX_DISK_NAME_LENGTH + 1];
 		char battery_name[MAX_BATTERY_NAME_LENGTH + 1];
+		char cgroup_name[MAX_CGROUP_NAME_LENGTH + 1];
+		char overhead_section[MAX_OVERHEAD_NAME_LENGTH + 1]; /**< A section
+				of system->overhead or "total" */
 	} data;
 };
 
+/*
+ * The stats to log are given as selectors, which are stat names (e.g.
+ * cpu3usage or iface_eth0_read) where * and ? match any characters,
+ * {a,b} are alternatives and /RE/ is an extended regular expression
+ * (not in cgroup_ selectors, since cgroup paths contain slashes), e.g.
+ *
+ *   cpu*usage  disk_nvme*_{read,write}  iface_/veth[0-9]+/_read
+ *
+ * Selectors are expanded into the stats of the devices that exist, and
+ * again whenever devices appear or disappear. New stats are added as
+ * columns, and columns are dropped once their device has been gone for
+ * LOGGER_COLUMN_LIFETIME expansions (processes and threads at the next
+ * one), unless a selector names them exactly: a CSV log gets a new header
+ * line with all columns, a binary or RRD log continues in filename.1,
+ * filename.2, ...
+ */
+
+#define MAX_LOGGER_SELECTOR_EXPANSIONS 256
+#define LOGGER_COLUMN_LIFETIME 3
+
+/** A selector after {a,b} expansion */
+struct logger_selector_t
+{
+	int exact; /**< stat is logged as is, otherwise regex is matched
+				 against the names of the stats that exist */
+	struct logger_stat_t stat;
+	regex_t regex;
+	char prefix[32]; /**< What all names that match start with */
+};
+
+/** Where the value of a column is found in the system, which is looked
+ * up again whenever its devices change */
+struct logger_column_t
+{
+	int device; /**< The index of its NUMA node, disk, interface, battery,
+				  cgroup, overhead section or process, -1 if it's gone */
+	int thread; /**< The index of its thread in the process */
+	int pinned; /**< Named by an exact selector, so never dropped */
+	int missing; /**< Expansions since its device was last seen */
+};
+
 struct logger_t
 {
 	int type;
-	FILE *file;
-	int stat_count;
+	FILE *file; /**< The CSV file */
+	struct binlog_t *binlog; /**< The binary log */
+	struct rrd_t *rrd; /**< The retention tiers */
+	int column_count;
+	double *values; /**< One row */
+	int *decimals; /**< The decimal places of each value in a csv file */
+	int stat_count; /**< 0 if the values are given by the caller */
 	struct logger_stat_t *stats;
+	struct logger_column_t *columns; /**< One per stat */
+	char **names; /**< The column name of each stat */
+	int *order; /**< The stats sorted by name */
+	int max_stat_count;
+
+	int selector_count;
+	struct logger_selector_t *selectors;
+	unsigned long long device_generation; /**< Of the system when the
+											selectors were last expanded */
+	unsigned long long thread_generation; /**< The same for the threads
+											of the watched processes */
+	char *filename;
+	char *rrd_tiers;
+	int segment; /**< The binary or RRD log is filename.segment (or
+				   filename for 0) */
 };
 
-int logger_init(struct logger_t *logger, int type,
-		const char *filename, int stat_count, struct logger_stat_t *stats);
+/** Parse a stat name like cpu3usage or iface_eth0_read.
+ * Returns 0 on success */
+int logger_parse_stat(const char *name, struct logger_stat_t *stat);
+
+/** Parse the title of a column of a log, like "CPU3 Usage".
+ * Returns 0 on success */
+int logger_parse_title(const char *title, struct logger_stat_t *stat);
+
+/** Returns 0 if selector is a valid stat selector */
+int logger_check_selector(const char *selector);
+
+/** Log the stats that selectors expand to on system. filename is the
+ * base name of the tier files for RRD, with the tiers given as in
+ * rrd_open() (NULL for RRD_DEFAULT_TIERS). Nothing is created before
+ * the selectors match a stat */
+int logger_init(struct logger_t *logger, int type, const char *filename,
+		const char *rrd_tiers, int selector_count,
+		const char * const *selectors, const struct system_t *system);
+
+/** A logger of values that don't come from a struct system_t */
+int logger_init_columns(struct logger_t *logger, int type,
+		const char *filename, const char *rrd_tiers, int column_count,
+		const char * const *names);
 
 void logger_destroy(struct logger_t *logger);
 
+/** Log the stats of the logger, after expanding the selectors again
+ * if the devices of system have changed */
 void logger_log(struct logger_t *logger, struct system_t *system);
 
+/** Log a row of column_count values, with decimals[i] decimal places
+ * in csv files */
+void logger_log_values(struct logger_t *logger, const double *values,
+		const int *decimals);
+
 #endif
@@ -0,0 +1,152 @@
+#define _GNU_SOURCE
+
+#include "loop.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#define MAX_EPOLL_EVENTS 16
+
+// The terminal as it was before raw mode, restored at exit
+static struct termios orig_termios;
+static int terminal_fd = -1;
+
+static void reset_terminal_mode(void)
+{
+	if (terminal_fd >= 0)
+		tcsetattr(terminal_fd, TCSANOW, &orig_termios);
+	terminal_fd = -1;
+}
+
+static void set_raw_terminal_mode(int fd)
+{
+	static int registered = 0;
+	if (tcgetattr(fd, &orig_termios))
+		return;
+	struct termios raw = orig_termios;
+	cfmakeraw(&raw);
+	// Keep translating "\n" to "\r\n" on output
+	raw.c_oflag |= OPOST;
+	if (tcsetattr(fd, TCSANOW, &raw))
+		return;
+	terminal_fd = fd;
+	if (!registered)
+		atexit(reset_terminal_mode);
+	registered = 1;
+}
+
+int loop_init(struct loop_t *loop, int input_fd)
+{
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	loop->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+			TFD_NONBLOCK | TFD_CLOEXEC);
+
+	// The signals are read from signal_fd instead of being delivered
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGWINCH);
+	sigprocmask(SIG_BLOCK, &mask, &loop->old_mask);
+	loop->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	loop->input_fd = -1;
+	if (loop->epoll_fd < 0 || loop->timer_fd < 0 || loop->signal_fd < 0 ||
+			loop_watch(loop, loop->timer_fd, EPOLLIN, LOOP_TIMER) ||
+			loop_watch(loop, loop->signal_fd, EPOLLIN, LOOP_SIGNAL)) {
+		loop_delete(loop);
+		return 1;
+	}
+	// Regular files and /dev/null can't be waited on, there are no keys
+	if (input_fd < 0 || loop_watch(loop, input_fd, EPOLLIN, LOOP_INPUT))
+		return 0;
+	loop->input_fd = input_fd;
+	if (isatty(input_fd))
+		set_raw_terminal_mode(input_fd);
+	return 0;
+}
+
+int loop_watch(struct loop_t *loop, int fd, unsigned int events, int id)
+{
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.u32 = id;
+	return epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+void loop_set_deadline(struct loop_t *loop, long long deadline_ns)
+{
+	// 0 would disarm the timer
+	if (deadline_ns <= 0)
+		deadline_ns = 1;
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = deadline_ns / 1000000000LL;
+	spec.it_value.tv_nsec = deadline_ns % 1000000000LL;
+	++util_syscall_count;
+	timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+int loop_wait(struct loop_t *loop, struct loop_event_t *events, int max_events)
+{
+	struct epoll_event ready[MAX_EPOLL_EVENTS];
+	if (max_events > MAX_EPOLL_EVENTS)
+		max_events = MAX_EPOLL_EVENTS;
+	int count = 0;
+	while (count == 0) {
+		++util_syscall_count;
+		int ready_count = epoll_wait(loop->epoll_fd, ready, max_events, -1);
+		if (ready_count < 0 && errno != EINTR)
+			return 0;
+		for (int i = 0; i < ready_count; ++i) {
+			struct loop_event_t *event = &events[count];
+			event->id = ready[i].data.u32;
+			event->value = ready[i].events;
+			if (event->id == LOOP_TIMER) {
+				uint64_t expirations;
+				if (read_fd(loop->timer_fd, &expirations,
+							sizeof(expirations)) <= 0)
+					continue;
+			} else if (event->id == LOOP_SIGNAL) {
+				struct signalfd_siginfo info;
+				if (read_fd(loop->signal_fd, &info, sizeof(info)) <= 0)
+					continue;
+				event->value = info.ssi_signo;
+			} else if (event->id == LOOP_INPUT) {
+				// A key per wakeup, the rest stays readable
+				unsigned char c;
+				int r = read_fd(loop->input_fd, &c, sizeof(c));
+				if (r < 0 && (errno == EAGAIN || errno == EINTR))
+					continue;
+				if (r <= 0) {
+					// EOF (e.g. stdin is /dev/null), stop watching it
+					epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL,
+							loop->input_fd, NULL);
+					loop->input_fd = -1;
+					continue;
+				}
+				event->value = c;
+			}
+			++count;
+		}
+	}
+	return count;
+}
+
+void loop_delete(struct loop_t *loop)
+{
+	reset_terminal_mode();
+	close_fd(loop->signal_fd);
+	close_fd(loop->timer_fd);
+	close_fd(loop->epoll_fd);
+	sigprocmask(SIG_SETMASK, &loop->old_mask, NULL);
+}
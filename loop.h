@@ -0,0 +1,58 @@
+#ifndef LOOP_H_INCLUDED
+#define LOOP_H_INCLUDED
+
+#include <signal.h>
+
+/*
+ * The event loop of smon: a single epoll set with the tick timer (an
+ * absolute timerfd), the keyboard, a signalfd for SIGTERM, SIGINT and
+ * SIGWINCH, and any other fds (PSI triggers, sockets) that are added
+ * with loop_watch(). The terminal is switched to raw mode once, for the
+ * whole session, and restored on exit.
+ */
+
+// The ids of the built in sources. loop_watch() ids start at LOOP_USER
+enum loop_id
+{
+	LOOP_TIMER,
+	LOOP_INPUT,
+	LOOP_SIGNAL,
+	LOOP_USER
+};
+
+struct loop_event_t
+{
+	int id; /**< LOOP_TIMER, LOOP_INPUT, LOOP_SIGNAL or a loop_watch() id */
+	int value; /**< The key for LOOP_INPUT, the signal number for
+				 LOOP_SIGNAL, the epoll events for the others */
+};
+
+struct loop_t
+{
+	int epoll_fd;
+	int timer_fd;
+	int signal_fd;
+	int input_fd; /**< -1 if it isn't watched or once it reached EOF */
+	sigset_t old_mask; /**< The signal mask before loop_init */
+};
+
+/** Create the loop and watch input_fd for key presses (-1 for none).
+ * If input_fd is a terminal, it is put in raw mode until loop_delete()
+ * or exit. Returns 0 on success */
+int loop_init(struct loop_t *loop, int input_fd);
+
+/** Also wait for events (e.g. EPOLLIN) on fd, reported with id */
+int loop_watch(struct loop_t *loop, int fd, unsigned int events, int id);
+
+/** Fire LOOP_TIMER once, at deadline_ns of monotonic_ns(). A deadline
+ * that has already passed fires right away */
+void loop_set_deadline(struct loop_t *loop, long long deadline_ns);
+
+/** Wait until something happens and write up to max_events events.
+ * Returns how many were written, 0 if waiting failed */
+int loop_wait(struct loop_t *loop, struct loop_event_t *events, int max_events);
+
+/** Close the fds, unblock the signals and restore the terminal */
+void loop_delete(struct loop_t *loop);
+
+#endif
@@ -1,22 +1,42 @@
 #define _BSD_SOURCE
 #define _DEFAULT_SOURCE
+#define _GNU_SOURCE
 
 #include "logger.h"
 
+#include "smon.h"
+#include "smon_internal.h"
 #include "system.h"
 #include "util.h"
 #include "cpu.h"
 #include "disk.h"
 #include "interface.h"
 #include "battery.h"
+#include "cgroup.h"
+#include "psi.h"
+#include "overhead.h"
+#include "rrd.h"
+#include "export.h"
+#include "aggregate.h"
+#include "stream.h"
+#include "alert.h"
+#include "freq.h"
+#include "observer.h"
+#include "numa.h"
+#include "irq.h"
+#include "vmstat.h"
+#include "filter.h"
+#include "watch.h"
+#include "replay.h"
+#include "loop.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/select.h>
-#include <termios.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
 
 #define error(...) { fprintf(stderr, __VA_ARGS__); exit(-1); }
 
@@ -25,58 +45,42 @@
 #define TERM_ERASE_REST_OF_LINE "\e[K"
 #define TERM_ERASE_DOWN "\e[J"
 
-static struct termios orig_termios;
+// How many of the busiest cgroups to show
+#define TOP_CGROUP_COUNT 5
+// and of the busiest interrupts and softirqs
+#define TOP_IRQ_COUNT 5
+// and of the busiest threads of each watched process
+#define TOP_THREAD_COUNT 5
 
-static void reset_terminal_mode(void)
-{
-	tcsetattr(0, TCSANOW, &orig_termios);
-}
+// When a PSI trigger fires, sample every PSI_BURST_INTERVAL_MS
+// for the next PSI_BURST_TICKS ticks
+#define PSI_BURST_INTERVAL_MS 100
+#define PSI_BURST_TICKS 50
+#define MAX_PSI_TRIGGERS 16
 
-static void set_conio_terminal_mode(void)
-{
-	struct termios new_termios;
+// Big enough for a whole frame, so that it is written at once
+#define STDOUT_BUFFER_SIZE (1 << 16)
 
-	// take two copies - one for now, one for later
-	tcgetattr(0, &orig_termios);
-	memcpy(&new_termios, &orig_termios, sizeof(new_termios));
+// How long --measure-freq leaves the CPUs idle between two refreshes
+#define FREQ_MEASURE_INTERVAL_MS 100
+// and how long it waits for the CPUs that were woken up to go idle again
+#define FREQ_MEASURE_SETTLE_MS 2
 
-	// register cleanup handler, and set the new terminal mode
-	atexit(reset_terminal_mode);
-	cfmakeraw(&new_termios);
-	tcsetattr(0, TCSANOW, &new_termios);
-}
+// How many events are handled per wakeup
+#define MAX_LOOP_EVENTS 16
 
-static int getch(void)
-{
-	int r;
-	unsigned char c;
-	if ((r = read(STDIN_FILENO, &c, sizeof(c))) < 0)
-		return r;
-	return c;
-}
+// How far [ and ] (and { and }) go in a replay
+#define REPLAY_SEEK_SHORT_NS (60 * 1000000000LL)
+#define REPLAY_SEEK_LONG_NS (3600 * 1000000000LL)
 
-static int wait_for_keypress(void)
-{
-	set_conio_terminal_mode();
-	// Set timeout to 1.0 seconds
-	struct timeval timeout;
-	timeout.tv_sec = 1;
-	timeout.tv_usec = 0;
-
-	// Initialize file descriptor sets
-	fd_set read_fds, write_fds, except_fds;
-	FD_ZERO(&read_fds);
-	FD_ZERO(&write_fds);
-	FD_ZERO(&except_fds);
-	FD_SET(STDIN_FILENO, &read_fds);
-
-	int c = -1;
-	if (select(STDIN_FILENO + 1, &read_fds, &write_fds, &except_fds, &timeout) == 1)
-		c = getch();
-	reset_terminal_mode();
-	return c;
-}
+// Receive samples from smon --export on many nodes, then show and log
+// the fleet every second
+static int run_aggregator(const char *address, int log_type,
+		const char *log_filename, const char *rrd_tiers);
 
+// Refresh the CPUs with every frequency source and show what each
+// costs and disturbs
+static int run_freq_measure(struct system_config_t *config, int ticks);
 
 volatile sig_atomic_t must_exit = 0;
 
@@ -95,12 +99,37 @@ int main(int argc, char **argv)
 		sigaction(SIGTERM, &action, NULL);
 	}
 
-	struct system_t system = system_init();
+	struct system_config_t config;
+	system_config_init(&config);
 
 	struct logger_t logger;
-	struct logger_stat_t log_stats[128];
-	int log_stats_count = 0;
+	const char **log_selectors = NULL;
+	int log_selector_count = 0;
+	int max_log_selector_count = 0;
 	const char *log_filename = NULL;
+	int log_type = CSV;
+	const char *rrd_tiers = NULL;
+	const char *psi_triggers[MAX_PSI_TRIGGERS];
+	int psi_trigger_count = 0;
+	int show_overhead = 0;
+	int top_devices = 0;
+	const char *export_address = NULL;
+	int export_batch = EXPORT_DEFAULT_BATCH;
+	const char *aggregate_address = NULL;
+	int stream_format = -1;
+	int freq_source_given = 0;
+	int freq_measure_ticks = 0;
+	int observer = 0;
+	const char *replay_filename = NULL;
+	const char *replay_jump = NULL;
+	// The time typed after g in a replay, -1 when not typing
+	char jump_input[32];
+	int jump_length = -1;
+	struct observer_config_t observer_config;
+	observer_config_init(&observer_config);
+	struct alert_set_t alerts;
+	alert_set_init(&alerts);
+	char alert_error[256];
 
 	// Parse command line arguments
 	for (int i = 1; i < argc; ++i) {
@@ -108,243 +137,1166 @@ int main(int argc, char **argv)
 		if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
 			printf(
 					"-h --help                            Print this help message\n"
-					"-l --log filename stat0 stat1 ...    Log stats to csv file, where each stat can be:\n"
-					"    cpuX{usage,temp,freq}\n"
+					"-r --root dir                        Read /proc and /sys under dir (e.g. the host's\n"
+					"                                     filesystem mounted in a container)\n"
+					"-c --cgroup-root dir                 Where the cgroup v2 hierarchy is mounted\n"
+					"                                     (default /sys/fs/cgroup, \"none\" to disable)\n"
+					"-p --psi-trigger \"res some|full stall window\"\n"
+					"                                     Sample every 100ms for a while when the\n"
+					"                                     stall time (us) of res (cpu, memory or io)\n"
+					"                                     exceeds stall within window (us)\n"
+					"-P --perf                            Count context switches, migrations, page\n"
+					"                                     faults and IPC per CPU with perf_event\n"
+					"-I --irqs                            Show the busiest interrupts and softirqs\n"
+					"                                     and the packet processing of the CPUs\n"
+					"-d --disks PATTERNS                  The disks to watch, as glob patterns like\n"
+					"                                     sd*,nvme* (see filter.h). Those starting\n"
+					"                                     with ! exclude (default !loop*)\n"
+					"-i --interfaces PATTERNS             The same for network interfaces, e.g.\n"
+					"                                     \"!veth*,!cali*\"\n"
+					"-t --top N                           Only show the N busiest disks and\n"
+					"                                     interfaces\n"
+					"-w --watch LIST                      Watch processes given by PID or name\n"
+					"                                     (e.g. 1234,java) and their threads: CPU\n"
+					"                                     usage, last CPU and context switches\n"
+					"-K --topology-cache filename         Keep the CPU topology in filename, which\n"
+					"                                     speeds up starting on big machines. It\n"
+					"                                     is reread after a reboot\n"
+					"-F --freq-source sysfs|cpuinfo|stats|busy|none\n"
+					"                                     Where the CPU frequency comes from (default\n"
+					"                                     sysfs). Reading sysfs may wake up idle CPUs,\n"
+					"                                     see freq.h\n"
+					"-m --measure-freq N                  Refresh the CPUs N times with each frequency\n"
+					"                                     source and show the IPIs and wakeups it causes\n"
+					"-O --observer                        Stay out of the way: run on housekeeping\n"
+					"                                     CPUs at SCHED_IDLE with a large timer slack,\n"
+					"                                     lock memory and don't read the per-CPU files\n"
+					"                                     of isolated CPUs\n"
+					"-C --observer-cpus LIST              The CPUs to run on with -O (e.g. 0-1, default\n"
+					"                                     those that aren't isolated)\n"
+					"-N --observer-nice N                 Run at nice level N instead of SCHED_IDLE\n"
+					"-s --self                            Show what smon itself costs (toggle with s)\n"
+					"-S --stream ndjson|binary            Write a record per tick to stdout instead\n"
+					"                                     of showing the stats\n"
+					"-a --alert RULE                      Watch a condition and act when it holds,\n"
+					"                                     e.g. \"any(cpu.usage) > 95 for 10s do\n"
+					"                                     exec 'notify-send hot'\" (see alert.h)\n"
+					"-R --alert-file filename             Read alert rules from a file, one per line\n"
+					"-e --export host:port                Stream samples to smon --aggregate\n"
+					"-b --export-batch N                  Send N samples per frame (default %d)\n"
+					"-A --aggregate [host:]port           Receive samples from many smon --export\n"
+					"                                     and show the fleet. -l logs fleet-wide\n"
+					"                                     values, no stats are given\n"
+					"-y --replay filename                 Show a binary log instead of the system.\n"
+					"                                     Space pauses, + and - change the speed\n"
+					"                                     (1x to %dx), [ ] and { } go back and\n"
+					"                                     forward a minute and an hour and g goes\n"
+					"                                     to a time\n"
+					"-j --jump time                       Start the replay at time, given as\n"
+					"                                     \"YYYY-MM-DD HH:MM[:SS]\", HH:MM[:SS] on\n"
+					"                                     the first day or seconds since the epoch\n"
+					"-f --log-format csv|binary|rrd       The format of the log file (default csv).\n"
+					"                                     Binary logs are read with smon-query. rrd\n"
+					"                                     keeps min/avg/max in fixed-size files\n"
+					"                                     filename.STEP, one per tier\n"
+					"-T --rrd-tiers STEP:RETENTION,...    The tiers of the rrd format (default\n"
+					"                                     " RRD_DEFAULT_TIERS ")\n"
+					"-l --log filename stat0 stat1 ...    Log stats to a file, where each stat can be:\n"
+					"    cpuX{usage,temp,freq,ctxsw,migr,minflt,majflt,ipc}\n"
+					"    cpuX{irq,softirq,netdrop,squeeze} (with -I)\n"
 					"    ram_{used,buffers,cached}\n"
+					"    vm_{pgin,pgout,swpin,swpout,fault,majfault,scan,steal,stall,oom}\n"
+					"    nodeX_{used,free,cached,cpu,miss,foreign}\n"
 					"    disk_NAME_{read,write}\n"
 					"    iface_NAME_{read,write}\n"
-					"    battery_NAME_{charge,current,voltage}\n");
+					"    battery_NAME_{charge,current,voltage}\n"
+					"    cgroup_PATH_{cpu,mem,read,write}\n"
+					"    psi_{cpu,memory,io}_{some,full}\n"
+					"    proc_PID_{cpu,threads,ctxsw,nvcsw,read,write} (with -w)\n"
+					"    thread_TID_{cpu,lastcpu,ctxsw,nvcsw,read,write} (with -w)\n"
+					"    self_SECTION_{wall,cpu,sys}, where SECTION is a collector,\n"
+					"        logger, render, alerts or total\n"
+					"    self_{usage,late,nivcsw}\n"
+					"    where * and ? match any characters, {a,b} are alternatives\n"
+					"    and /RE/ is a regular expression, e.g. cpu*usage or\n"
+					"    iface_/veth[0-9]+/_read. They are matched again when devices\n"
+					"    appear, which adds columns\n", EXPORT_DEFAULT_BATCH,
+					REPLAY_MAX_SPEED);
 			return 0;
+		} else if (!strcmp(arg, "-r") || !strcmp(arg, "--root")) {
+			++i;
+			if (i == argc)
+				error("Root directory required\n");
+			config.root = argv[i];
+		} else if (!strcmp(arg, "-c") || !strcmp(arg, "--cgroup-root")) {
+			++i;
+			if (i == argc)
+				error("Cgroup root directory required\n");
+			config.cgroup_root = strcmp(argv[i], "none") ? argv[i] : NULL;
+		} else if (!strcmp(arg, "-P") || !strcmp(arg, "--perf")) {
+			config.perf_events = 1;
+		} else if (!strcmp(arg, "-I") || !strcmp(arg, "--irqs")) {
+			config.irqs = 1;
+		} else if (!strcmp(arg, "-d") || !strcmp(arg, "--disks") ||
+				!strcmp(arg, "-i") || !strcmp(arg, "--interfaces")) {
+			++i;
+			if (i == argc)
+				error("Patterns required after %s\n", arg);
+			struct filter_t filter;
+			if (filter_init(&filter, argv[i]))
+				error("At most %d patterns are allowed\n", MAX_FILTER_PATTERNS);
+			filter_delete(&filter);
+			if (!strcmp(arg, "-d") || !strcmp(arg, "--disks"))
+				config.disk_filter = argv[i];
+			else
+				config.interface_filter = argv[i];
+		} else if (!strcmp(arg, "-t") || !strcmp(arg, "--top")) {
+			++i;
+			if (i == argc)
+				error("Device count required\n");
+			top_devices = atoi(argv[i]);
+			if (top_devices <= 0)
+				error("Invalid device count %s\n", argv[i]);
+		} else if (!strcmp(arg, "-w") || !strcmp(arg, "--watch")) {
+			++i;
+			if (i == argc)
+				error("Processes to watch required\n");
+			struct watch_t watch;
+			int ret = watch_init(&watch, argv[i]);
+			if (ret == 1)
+				error("At most %d processes with names of up to %d "
+						"characters can be watched\n", MAX_WATCH_TARGETS,
+						MAX_COMM_LENGTH);
+			if (ret)
+				error("Failed to set up the watched processes\n");
+			watch_delete(&watch);
+			config.watch = argv[i];
+		} else if (!strcmp(arg, "-K") || !strcmp(arg, "--topology-cache")) {
+			++i;
+			if (i == argc)
+				error("Topology cache filename required\n");
+			config.topology_cache = argv[i];
+		} else if (!strcmp(arg, "-F") || !strcmp(arg, "--freq-source")) {
+			++i;
+			if (i == argc)
+				error("Frequency source required\n");
+			config.freq_source = freq_source_parse(argv[i]);
+			if (config.freq_source == -1)
+				error("Unknown frequency source %s\n", argv[i]);
+			freq_source_given = 1;
+		} else if (!strcmp(arg, "-m") || !strcmp(arg, "--measure-freq")) {
+			++i;
+			if (i == argc)
+				error("Number of refreshes required\n");
+			freq_measure_ticks = atoi(argv[i]);
+			if (freq_measure_ticks <= 0)
+				error("At least one refresh is required\n");
+		} else if (!strcmp(arg, "-O") || !strcmp(arg, "--observer")) {
+			observer = 1;
+		} else if (!strcmp(arg, "-C") || !strcmp(arg, "--observer-cpus")) {
+			++i;
+			if (i == argc)
+				error("CPU list required\n");
+			observer_config.cpus = argv[i];
+		} else if (!strcmp(arg, "-N") || !strcmp(arg, "--observer-nice")) {
+			++i;
+			if (i == argc)
+				error("Nice level required\n");
+			observer_config.nice = atoi(argv[i]);
+		} else if (!strcmp(arg, "-s") || !strcmp(arg, "--self")) {
+			show_overhead = 1;
+		} else if (!strcmp(arg, "-S") || !strcmp(arg, "--stream") ||
+				!strncmp(arg, "--stream=", 9)) {
+			const char *format = arg[1] == '-' && arg[8] == '=' ? arg + 9 : NULL;
+			if (format == NULL) {
+				++i;
+				if (i == argc)
+					error("Stream format required\n");
+				format = argv[i];
+			}
+			if (!strcmp(format, "ndjson"))
+				stream_format = STREAM_NDJSON;
+			else if (!strcmp(format, "binary"))
+				stream_format = STREAM_BINARY;
+			else
+				error("Unknown stream format %s\n", format);
+		} else if (!strcmp(arg, "-a") || !strcmp(arg, "--alert")) {
+			++i;
+			if (i == argc)
+				error("Alert rule required\n");
+			if (alert_add_rule(&alerts, argv[i], alert_error, sizeof(alert_error)))
+				error("Invalid alert rule \"%s\": %s\n", argv[i], alert_error);
+		} else if (!strcmp(arg, "-R") || !strcmp(arg, "--alert-file")) {
+			++i;
+			if (i == argc)
+				error("Alert file name required\n");
+			if (alert_add_rule_file(&alerts, argv[i], alert_error,
+						sizeof(alert_error)))
+				error("%s\n", alert_error);
+		} else if (!strcmp(arg, "-e") || !strcmp(arg, "--export")) {
+			++i;
+			if (i == argc)
+				error("Aggregator address required\n");
+			export_address = argv[i];
+		} else if (!strcmp(arg, "-b") || !strcmp(arg, "--export-batch")) {
+			++i;
+			if (i == argc)
+				error("Batch size required\n");
+			export_batch = atoi(argv[i]);
+			if (export_batch < 1 || export_batch > EXPORT_MAX_BATCH)
+				error("The batch size must be between 1 and %d\n",
+						EXPORT_MAX_BATCH);
+		} else if (!strcmp(arg, "-A") || !strcmp(arg, "--aggregate")) {
+			++i;
+			if (i == argc)
+				error("Address to listen on required\n");
+			aggregate_address = argv[i];
+		} else if (!strcmp(arg, "-p") || !strcmp(arg, "--psi-trigger")) {
+			++i;
+			if (i == argc)
+				error("PSI trigger required\n");
+			if (psi_trigger_count == MAX_PSI_TRIGGERS)
+				error("Too many PSI triggers\n");
+			psi_triggers[psi_trigger_count++] = argv[i];
+		} else if (!strcmp(arg, "-y") || !strcmp(arg, "--replay")) {
+			++i;
+			if (i == argc)
+				error("Log file name required\n");
+			replay_filename = argv[i];
+		} else if (!strcmp(arg, "-j") || !strcmp(arg, "--jump")) {
+			++i;
+			if (i == argc)
+				error("Time required\n");
+			replay_jump = argv[i];
+		} else if (!strcmp(arg, "-f") || !strcmp(arg, "--log-format")) {
+			++i;
+			if (i == argc)
+				error("Log format required\n");
+			if (!strcmp(argv[i], "csv"))
+				log_type = CSV;
+			else if (!strcmp(argv[i], "binary"))
+				log_type = BINARY;
+			else if (!strcmp(argv[i], "rrd"))
+				log_type = RRD;
+			else
+				error("Unknown log format %s\n", argv[i]);
+		} else if (!strcmp(arg, "-T") || !strcmp(arg, "--rrd-tiers")) {
+			++i;
+			if (i == argc)
+				error("RRD tiers required\n");
+			rrd_tiers = argv[i];
 		} else if (!strcmp(arg, "-l") || !strcmp(arg, "--log")) {
 			++i;
 			if (i == argc)
 				error("Log file name required\n");
 			log_filename = argv[i++];
-			while (i < argc) {
-				const char *stat_name = argv[i];
-				struct logger_stat_t stat;
-				int ok = 1;
-				if (!strncmp(stat_name, "cpu", 3)) {
-					char *id_end;
-					int id = strtol(stat_name + 3, &id_end, 10);
-					if (id_end != stat_name + 3) {
-						stat.data.cpu_id = id;
-						if (!strcmp(id_end, "u") || !strcmp(id_end, "usage"))
-							stat.type = LOGGER_CPU_USAGE;
-						else if (!strcmp(id_end, "t") || !strcmp(id_end, "temp"))
-							stat.type = LOGGER_CPU_TEMPERATURE;
-						else if (!strcmp(id_end, "f") || !strcmp(id_end, "freq"))
-							stat.type = LOGGER_CPU_FREQUENCY;
-						else
-							ok = 0;
-						if (ok)
-							log_stats[log_stats_count++] = stat;
-					}
-				} else if (!strncmp(stat_name, "ram_", 4)) {
-					const char *s = stat_name + 4;
-					if (!strcmp(s, "u") || !strcmp(s, "used"))
-						stat.type = LOGGER_RAM_USED;
-					else if (!strcmp(s, "b") || !strcmp(s, "buffers"))
-						stat.type = LOGGER_RAM_BUFFERS;
-					else if (!strcmp(s, "c") || !strcmp(s, "cached"))
-						stat.type = LOGGER_RAM_CACHED;
-					else
-						ok = 0;
-					if (ok)
-						log_stats[log_stats_count++] = stat;
-				} else if (!strncmp(stat_name, "disk_", 5)) {
-					const char *name_end = stat_name + 5;
-					while (*name_end && *name_end != '_')
-						++name_end;
-					if (*name_end == '\0') {
-						ok = 0;
-					} else {
-						int len = name_end - stat_name - 5;
-						strncpy(stat.data.disk_name, stat_name + 5, len);
-						stat.data.disk_name[len] = '\0';
-						++name_end;
-						if (!strcmp(name_end, "r") || !strcmp(name_end, "read"))
-							stat.type = LOGGER_DISK_READ;
-						else if (!strcmp(name_end, "w") || !strcmp(name_end, "write"))
-							stat.type = LOGGER_DISK_WRITE;
-						else
-							ok = 0;
-						if (ok)
-							log_stats[log_stats_count++] = stat;
-					}
-				} else if (!strncmp(stat_name, "iface_", 6)) {
-					const char *name_end = stat_name + 6;
-					while (*name_end && *name_end != '_')
-						++name_end;
-					if (*name_end == '\0') {
-						ok = 0;
-					} else {
-						int len = name_end - stat_name - 6;
-						strncpy(stat.data.iface_name, stat_name + 6, len);
-						stat.data.iface_name[len] = '\0';
-						++name_end;
-						if (!strcmp(name_end, "r") || !strcmp(name_end, "read"))
-							stat.type = LOGGER_IFACE_READ;
-						else if (!strcmp(name_end, "w") || !strcmp(name_end, "write"))
-							stat.type = LOGGER_IFACE_WRITE;
-						else
-							ok = 0;
-						if (ok)
-							log_stats[log_stats_count++] = stat;
-					}
-				} else if (!strncmp(stat_name, "battery_", 8)) {
-					const char *name_end = stat_name + 8;
-					while (*name_end && *name_end != '_')
-						++name_end;
-					if (*name_end == '\0') {
-						ok = 0;
-					} else {
-						int len = name_end - stat_name - 8;
-						strncpy(stat.data.battery_name, stat_name + 8, len);
-						stat.data.battery_name[len] = '\0';
-						++name_end;
-						if (!strcmp(name_end, "c") || !strcmp(name_end, "charge"))
-							stat.type = LOGGER_BAT_CHARGE;
-						else if (!strcmp(name_end, "cu") || !strcmp(name_end, "current"))
-							stat.type = LOGGER_BAT_CURRENT;
-						else if (!strcmp(name_end, "v") || !strcmp(name_end, "voltage"))
-							stat.type = LOGGER_BAT_VOLTAGE;
-						else
-							ok = 0;
-						if (ok)
-							log_stats[log_stats_count++] = stat;
-					}
-				} else
-					ok = 0;
-
-				if (!ok) {
-					--i;
-					break;
+			// The selectors end at the first argument that isn't one
+			while (i < argc && !logger_check_selector(argv[i])) {
+				if (log_selector_count == max_log_selector_count) {
+					max_log_selector_count += 128;
+					log_selectors = (const char **)realloc(log_selectors,
+							sizeof(const char *) * max_log_selector_count);
 				}
-				++i;
+				log_selectors[log_selector_count++] = argv[i++];
 			}
+			--i;
 		} else {
 			error("Unknown argument %s. Try %s --help\n", argv[i], argv[0]);
 		}
 	}
 
-	int logger_ret = logger_init(&logger, CSV, log_filename, log_stats_count,
-			log_stats);
+	// Every device keeps its files open, so allow as many as we can
+	raise_open_file_limit();
+
+	if (freq_measure_ticks > 0)
+		return run_freq_measure(&config, freq_measure_ticks);
+
+	if (aggregate_address) {
+		if (log_selector_count > 0)
+			error("Stats can't be logged with --aggregate, "
+					"the fleet-wide values are\n");
+		return run_aggregator(aggregate_address, log_type, log_filename,
+				rrd_tiers);
+	}
+
+	if (replay_jump && replay_filename == NULL)
+		error("--jump is only for --replay\n");
+	// A replay only shows what was logged
+	if (replay_filename && (log_selector_count > 0 || export_address ||
+				stream_format != -1 || alerts.rule_count > 0 ||
+				psi_trigger_count > 0 || observer || config.watch))
+		error("--replay can't log, export, stream, alert, watch PSI "
+				"triggers or processes or run as an observer\n");
+
+	struct exporter_t exporter;
+	if (export_address) {
+		int ret = exporter_init(&exporter, export_address, export_batch);
+		if (ret == 1)
+			error("Invalid address %s, expected host:port\n", export_address);
+		if (ret)
+			error("Failed to resolve %s\n", export_address);
+	}
+
+	// Before anything is allocated, so that it's on the right CPUs
+	if (observer) {
+		char observer_error[256];
+		if (observer_enter(&observer_config, config.root, observer_error,
+					sizeof(observer_error)))
+			error("%s\n", observer_error);
+		config.skip_isolated = 1;
+	}
+
+	// The stats come from a log in a replay, not from the collectors
+	struct replay_t replay;
+	struct system_t system;
+	if (replay_filename) {
+		int ret = replay_open(&replay, replay_filename, &system);
+		if (ret == 1)
+			error("%s is not a binary log\n", replay_filename);
+		if (ret)
+			error("%s has no samples\n", replay_filename);
+		if (replay_jump) {
+			const long long time = replay_parse_time(&replay, replay_jump);
+			if (time == -1)
+				error("Invalid time %s\n", replay_jump);
+			replay_seek(&replay, &system, time, monotonic_ns());
+		}
+	} else {
+		system = system_init(&config);
+		if (freq_source_given && !system.freq->available)
+			error("The %s frequency source is not available\n",
+					freq_source_name(config.freq_source));
+		if (config.perf_events && system.perf_cpu_count == 0)
+			error("Failed to open perf_event counters. Check "
+					"/proc/sys/kernel/perf_event_paranoid\n");
+		for (int i = 0; i < psi_trigger_count; ++i)
+			if (psi_add_trigger(&system, psi_triggers[i]))
+				error("Failed to register PSI trigger \"%s\"\n",
+						psi_triggers[i]);
+	}
+
+	// The display takes its stats from libsmon like any other program,
+	// through a handle on the system_t of the logger, alerts and exporter
+	struct smon_t *smon = smon_attach(&system, replay_filename == NULL);
+	if (smon == NULL)
+		error("Failed to open the collectors\n");
+	struct smon_snapshot_t snapshot;
+
+	struct overhead_t *overhead = system.overhead;
+	const int logger_section = overhead_add_section(overhead, "logger");
+	const int render_section = overhead_add_section(overhead, "render");
+	const int export_section = export_address ?
+		overhead_add_section(overhead, "export") : -1;
+	const int alert_section = alerts.rule_count > 0 ?
+		overhead_add_section(overhead, "alerts") : -1;
+	const int stream_section = stream_format != -1 ?
+		overhead_add_section(overhead, "stream") : -1;
+	const long long start_time = monotonic_ns();
+
+	// The sections exist now, so self_* selectors can match them
+	int logger_ret = logger_init(&logger, log_type, log_filename, rrd_tiers,
+			log_selector_count, log_selectors, &system);
+	free(log_selectors);
 	if (logger_ret != 0) {
 		fprintf(stderr, "Failed to initialize logger: %d\n", logger_ret);
 		return 1;
 	}
 
+	// Stream records to stdout instead of showing them
+	struct stream_t stream;
+	if (stream_format != -1) {
+		// A reader that goes away, like head, must not kill us before
+		// the logs are closed
+		signal(SIGPIPE, SIG_IGN);
+		stream_init(&stream, stream_format, STDOUT_FILENO);
+	} else {
+		setvbuf(stdout, NULL, _IOFBF, STDOUT_BUFFER_SIZE);
+		printf(TERM_CLEAR_SCREEN TERM_POSITION_HOME);
+	}
+
+	// Wait on the tick timer, the keys, the signals and the PSI triggers
+	struct loop_t loop;
+	if (loop_init(&loop, stream_format == -1 ? STDIN_FILENO : -1))
+		error("Failed to create the event loop\n");
+	for (int i = 0; i < system.psi_trigger_count; ++i)
+		loop_watch(&loop, system.psi_triggers[i].fd, EPOLLPRI, LOOP_USER + i);
+
+	// The busiest devices for --top, and the activity they're ranked by
+	int *top = top_devices > 0 ?
+		(int *)malloc(sizeof(int) * top_devices) : NULL;
+	double *activity = NULL;
+	int max_activity_count = 0;
+
+	// Everything is allocated, don't page fault from now on
+	if (observer && observer_lock_memory())
+		error("Failed to lock memory, raise the limit with ulimit -l\n");
+
 	// Loop forever, show CPU usage and frequency and disk usage
-	printf(TERM_CLEAR_SCREEN TERM_POSITION_HOME);
-	for (;;) {
-		system_refresh_info(&system);
-		logger_log(&logger, &system);
-		fflush(logger.file);
-
-		int max_name_length = 9;
-		for (int i = 0; i < system.disk_count; ++i) {
-			int len = strlen(system.disks[i].name);
-			if (len > max_name_length)
-				max_name_length = len;
-		}
-		for (int i = 0; i < system.interface_count; ++i) {
-			int len = strlen(system.interfaces[i].name);
-			if (len > max_name_length)
-				max_name_length = len;
-		}
-		for (int i = 0; i < system.battery_count; ++i) {
-			int len = strlen(system.batteries[i].name);
-			if (len > max_name_length)
-				max_name_length = len;
+	int burst_ticks = 0;
+	long long deadline = 0;
+	// Sample on the ticks and on PSI triggers, key presses only redraw
+	int sample = 1;
+	int timer_fired = 0;
+	int resized = 0;
+	int quit = 0;
+	while (!quit) {
+		long long tick_start = monotonic_ns();
+		if (timer_fired)
+			overhead_tick(overhead, tick_start - deadline);
+
+		if (sample && replay_filename)
+			replay_update(&replay, &system, tick_start);
+		if (sample)
+			smon_sample(smon, SMON_SNAPSHOT_VERSION, &snapshot);
+
+		struct overhead_sample_t start;
+		overhead_sample(&start);
+		if (sample) {
+			if (alerts.rule_count > 0) {
+				if (alert_evaluate(&alerts, &system))
+					burst_ticks = PSI_BURST_TICKS;
+				overhead_charge(overhead, alert_section, &start);
+			}
+			logger_log(&logger, &system);
+			flush_file(logger.file);
+			overhead_charge(overhead, logger_section, &start);
+			if (export_address) {
+				exporter_sample(&exporter, &system);
+				overhead_charge(overhead, export_section, &start);
+			}
 		}
 
-		// CPU frequency and usage
-		for (int c = 0; c < system.cpu_count; ++c) {
-			const struct cpu_t *cpu = &system.cpus[c];
-			if (c == 0 || cpu->core_id != system.cpus[c - 1].core_id) {
-				// CPU info with temperature
-				printf("CPU %d : %4d MHz %3d%% usage %3dC"
+		if (stream_format != -1) {
+			if (sample) {
+				stream_write(&stream, &system);
+				overhead_charge(overhead, stream_section, &start);
+				quit = stream.closed;
+			}
+		} else {
+			// Don't leave parts of the old frame around after a resize
+			if (resized)
+				printf(TERM_CLEAR_SCREEN TERM_POSITION_HOME);
+			resized = 0;
+
+			// Where the replay is and how to move around
+			if (replay_filename) {
+				char shown[20];
+				replay_format_time(replay.time, shown);
+				const long long length = replay.last_time - replay.first_time;
+				printf("Replay of %s at %s (%d%%), %dx%s"
+						TERM_ERASE_REST_OF_LINE "\n", replay_filename, shown,
+						length > 0 ? (int)((replay.time - replay.first_time) *
+							100 / length) : 100,
+						replay.speed, replay.paused ? ", paused" : "");
+				if (jump_length >= 0)
+					printf("Go to: %s" TERM_ERASE_REST_OF_LINE "\n", jump_input);
+				else
+					printf("space: pause  +/-: speed  [ ]: minute  { }: hour  "
+							"g: go to" TERM_ERASE_REST_OF_LINE "\n");
+				printf(TERM_ERASE_REST_OF_LINE "\n");
+			}
+
+			int max_name_length = 9;
+			for (int i = 0; i < snapshot.disk_count; ++i) {
+				int len = strlen(snapshot.disks[i].name);
+				if (len > max_name_length)
+					max_name_length = len;
+			}
+			for (int i = 0; i < snapshot.interface_count; ++i) {
+				int len = strlen(snapshot.interfaces[i].name);
+				if (len > max_name_length)
+					max_name_length = len;
+			}
+			for (int i = 0; i < snapshot.battery_count; ++i) {
+				int len = strlen(snapshot.batteries[i].name);
+				if (len > max_name_length)
+					max_name_length = len;
+			}
+
+			// CPU frequency and usage
+			for (int c = 0; c < snapshot.cpu_count; ++c) {
+				const struct smon_cpu_t *cpu = &snapshot.cpus[c];
+				printf("CPU %d : %4d MHz %3d%% usage",
+						c + 1, cpu->freq / 1000, (int)(cpu->usage * 100));
+				// Temperature is shown only for the first CPU of each core
+				if (c == 0 || cpu->core_id != snapshot.cpus[c - 1].core_id)
+					printf(" %3dC", (int)cpu->temperature);
+				else if (snapshot.cpu_perf)
+					printf("     ");
+				if (snapshot.cpu_perf)
+					printf(" %7.0f cs/s %5.0f migr/s %7.0f flt/s %4.0f majflt/s %4.2f IPC",
+							cpu->context_switches,
+							snapshot.cpu_perf[c].migrations,
+							snapshot.cpu_perf[c].minor_faults,
+							snapshot.cpu_perf[c].major_faults,
+							cpu->ipc);
+				printf(TERM_ERASE_REST_OF_LINE "\n");
+			}
+			printf(TERM_ERASE_REST_OF_LINE "\n");
+
+			// RAM usage
+			{
+				char used[10], buffers[10], cached[10];
+				bytes_to_human_readable(snapshot.ram_used, used);
+				bytes_to_human_readable(snapshot.ram_buffers, buffers);
+				bytes_to_human_readable(snapshot.ram_cached, cached);
+				printf( "Used:    %8s\n" TERM_ERASE_REST_OF_LINE
+						"Buffers: %8s\n" TERM_ERASE_REST_OF_LINE
+						"Cached:  %8s\n" TERM_ERASE_REST_OF_LINE,
+						used, buffers, cached);
+				// Paging and reclaim, when /proc/vmstat is readable
+				if (snapshot.collectors & SMON_VMSTAT) {
+					char page_in[10], page_out[10], swap_in[10], swap_out[10];
+					bytes_to_human_readable(snapshot.page_in, page_in);
+					bytes_to_human_readable(snapshot.page_out, page_out);
+					bytes_to_human_readable(snapshot.swap_in, swap_in);
+					bytes_to_human_readable(snapshot.swap_out, swap_out);
+					printf("Paging:  %8s/s in %8s/s out, swap %8s/s in %8s/s out"
+							TERM_ERASE_REST_OF_LINE "\n"
+							"Reclaim: %8.0f scanned/s %8.0f stolen/s %5.0f stalls/s"
+							" %5.0f majflt/s %3.0f OOM/s"
+							TERM_ERASE_REST_OF_LINE "\n",
+							page_in, page_out, swap_in, swap_out,
+							snapshot.page_scans, snapshot.page_steals,
+							snapshot.allocation_stalls, snapshot.major_faults,
+							snapshot.oom_kills);
+				}
+			}
+			printf(TERM_ERASE_REST_OF_LINE "\n");
+
+			// NUMA nodes, only when there is more than one
+			if (system.numa_node_count > 1) {
+				printf("%-*s  CPU%%     Used     Free   Cached    Miss/s Foreign/s"
+						TERM_ERASE_REST_OF_LINE "\n", max_name_length, "Node");
+				for (int n = 0; n < system.numa_node_count; ++n) {
+					const struct numa_node_t *node = &system.numa_nodes[n];
+					char used[10], unused[10], cached[10];
+					bytes_to_human_readable(node->mem_used, used);
+					bytes_to_human_readable(node->mem_free, unused);
+					bytes_to_human_readable(node->mem_cached, cached);
+					printf("node%-*d %4d%% %8s %8s %8s %9.0f %9.0f"
+							TERM_ERASE_REST_OF_LINE "\n", max_name_length - 4,
+							node->id, (int)(node->cpu_usage * 100), used, unused,
+							cached, node->stats_rate[NUMA_MISS],
+							node->stats_rate[NUMA_FOREIGN]);
+				}
+				printf(TERM_ERASE_REST_OF_LINE "\n");
+			}
+
+			// Make room for ranking the devices
+			if (top && (snapshot.disk_count > max_activity_count ||
+						snapshot.interface_count > max_activity_count)) {
+				while (max_activity_count < snapshot.disk_count ||
+						max_activity_count < snapshot.interface_count)
+					max_activity_count += 128;
+				activity = (double *)realloc(activity,
+						sizeof(double) * max_activity_count);
+			}
+
+			// Disk usage, only the busiest with --top
+			int shown = snapshot.disk_count;
+			if (top) {
+				for (int d = 0; d < snapshot.disk_count; ++d)
+					activity[d] = snapshot.disks[d].read_rate +
+						snapshot.disks[d].write_rate;
+				shown = top_k(activity, snapshot.disk_count, top, top_devices);
+			}
+			printf("%-*s        Read       Write\n", max_name_length, "Disk");
+			for (int i = 0; i < shown; ++i) {
+				const struct smon_disk_t *disk =
+					&snapshot.disks[top ? top[i] : i];
+				char read[10], write[10];
+				bytes_to_human_readable(disk->read_rate, read);
+				bytes_to_human_readable(disk->write_rate, write);
+
+				printf("%-*s %9s/s %9s/s" TERM_ERASE_REST_OF_LINE "\n",
+						max_name_length, disk->name, read, write);
+			}
+			if (shown < snapshot.disk_count)
+				printf("%d more" TERM_ERASE_REST_OF_LINE "\n",
+						snapshot.disk_count - shown);
+
+			printf(TERM_ERASE_REST_OF_LINE "\n");
+			// Network usage
+			shown = snapshot.interface_count;
+			if (top) {
+				for (int i = 0; i < snapshot.interface_count; ++i)
+					activity[i] = snapshot.interfaces[i].rx_rate +
+						snapshot.interfaces[i].tx_rate;
+				shown = top_k(activity, snapshot.interface_count, top,
+						top_devices);
+			}
+			printf("%-*s    Download      Upload\n", max_name_length, "Interface");
+			for (int i = 0; i < shown; ++i) {
+				const struct smon_interface_t *interface =
+					&snapshot.interfaces[top ? top[i] : i];
+				char down[10], up[10];
+				bytes_to_human_readable(interface->rx_rate, down);
+				bytes_to_human_readable(interface->tx_rate, up);
+				printf("%-*s %9s/s %9s/s" TERM_ERASE_REST_OF_LINE "\n",
+						max_name_length, interface->name, down, up);
+			}
+			if (shown < snapshot.interface_count)
+				printf("%d more" TERM_ERASE_REST_OF_LINE "\n",
+						snapshot.interface_count - shown);
+
+			if (system.irqs) {
+				printf(TERM_ERASE_REST_OF_LINE "\n");
+				// The busiest interrupts and softirqs, and where they run
+				const struct irq_stats_t *irqs = system.irqs;
+				printf("%-*s     Rate/s  Busiest CPU" TERM_ERASE_REST_OF_LINE "\n",
+						max_name_length, "Interrupt");
+				for (int t = 0; t < 2; ++t) {
+					const struct irq_table_t *table = t ?
+						&irqs->softirqs : &irqs->interrupts;
+					if (table->row_count > max_activity_count) {
+						while (max_activity_count < table->row_count)
+							max_activity_count += 128;
+						activity = (double *)realloc(activity,
+								sizeof(double) * max_activity_count);
+					}
+					for (int r = 0; r < table->row_count; ++r)
+						activity[r] = table->rows[r].rate;
+					int busiest[TOP_IRQ_COUNT];
+					const int busiest_count = top_k(activity,
+							table->row_count, busiest, TOP_IRQ_COUNT);
+					for (int i = 0; i < busiest_count; ++i) {
+						const struct irq_t *irq = &table->rows[busiest[i]];
+						if (irq->rate <= 0.0)
+							break;
+						printf("%-*s %10.0f  CPU %-4d %3d%%  %s"
+								TERM_ERASE_REST_OF_LINE "\n",
+								max_name_length, irq->name, irq->rate,
+								irq->busiest_cpu + 1,
+								(int)(irq->busiest_rate * 100 / irq->rate),
+								irq->description);
+					}
+				}
+				double softnet[SOFTNET_STATS_COUNT] = { 0.0 };
+				for (int k = 0; k < SOFTNET_STATS_COUNT; ++k)
+					for (int c = 0; c < system.cpu_count; ++c)
+						softnet[k] += irqs->softnet_rate[k][c];
+				printf("Backlog %.0f packets/s, %.0f dropped/s, %.0f squeezed/s"
+						TERM_ERASE_REST_OF_LINE "\n",
+						softnet[SOFTNET_PROCESSED], softnet[SOFTNET_DROPPED],
+						softnet[SOFTNET_TIME_SQUEEZE]);
+			}
+
+			if (snapshot.collectors & SMON_PSI) {
+				printf(TERM_ERASE_REST_OF_LINE "\n");
+				// Pressure stall information
+				static const char * const names[PSI_RESOURCE_COUNT] = {
+					"CPU", "Memory", "IO"
+				};
+				printf("%-*s    Some  Some10    Full  Full10%s"
 						TERM_ERASE_REST_OF_LINE "\n",
-						c + 1,
-						cpu->cur_freq / 1000,
-						(int)(cpu->total_usage * 100),
-						cpu->cur_temp / 1000);
-			} else {
-				// CPU info without temperature
-				printf("CPU %d : %4d MHz %3d%% usage"
+						max_name_length, "Pressure",
+						burst_ticks > 0 ? "  (burst)" : "");
+				for (int r = 0; r < PSI_RESOURCE_COUNT; ++r)
+					printf("%-*s %6.2f%% %6.2f%% %6.2f%% %6.2f%%"
+							TERM_ERASE_REST_OF_LINE "\n",
+							max_name_length, names[r],
+							snapshot.psi_some[r] * 100.0,
+							snapshot.psi_some_avg10[r],
+							snapshot.psi_full[r] * 100.0,
+							snapshot.psi_full_avg10[r]);
+			}
+
+			if (alerts.firing_count > 0) {
+				printf(TERM_ERASE_REST_OF_LINE "\n");
+				// The rules that are firing
+				printf("Alerts" TERM_ERASE_REST_OF_LINE "\n");
+				for (int r = 0; r < alerts.rule_count; ++r) {
+					const struct alert_rule_t *rule = &alerts.rules[r];
+					if (!rule->firing)
+						continue;
+					printf("%-*s %s = %g" TERM_ERASE_REST_OF_LINE "\n",
+							max_name_length, rule->name, rule->subject,
+							alerts.slots[rule->subject_slot].value);
+				}
+			}
+
+			if (snapshot.cgroup_count > 0) {
+				printf(TERM_ERASE_REST_OF_LINE "\n");
+				// The busiest cgroups
+				printf("%-*s   CPU   Memory        Read       Write\n",
+						max_name_length, "Cgroup");
+				int shown[TOP_CGROUP_COUNT];
+				int shown_count = 0;
+				while (shown_count < TOP_CGROUP_COUNT &&
+						shown_count < snapshot.cgroup_count) {
+					// Find the busiest cgroup that we haven't shown yet
+					int best = -1;
+					for (int i = 0; i < snapshot.cgroup_count; ++i) {
+						int is_shown = 0;
+						for (int j = 0; j < shown_count; ++j)
+							is_shown |= shown[j] == i;
+						if (!is_shown && (best == -1 ||
+								snapshot.cgroups[i].cpu_usage >
+								snapshot.cgroups[best].cpu_usage))
+							best = i;
+					}
+					shown[shown_count++] = best;
+
+					const struct smon_cgroup_t *cgroup =
+						&snapshot.cgroups[best];
+					char memory[10], read[10], write[10];
+					bytes_to_human_readable(cgroup->memory, memory);
+					bytes_to_human_readable(cgroup->read_rate, read);
+					bytes_to_human_readable(cgroup->write_rate, write);
+					printf("%-*.*s %4d%% %8s %9s/s %9s/s"
+							TERM_ERASE_REST_OF_LINE "\n",
+							max_name_length, max_name_length, cgroup->name,
+							(int)(cgroup->cpu_usage * 100), memory, read, write);
+				}
+			}
+
+			if (system.watch && system.watch->process_count > 0) {
+				printf(TERM_ERASE_REST_OF_LINE "\n");
+				// The watched processes and their busiest threads, with
+				// the CPU that each of those last ran on. Leave room for
+				// "  TID comm"
+				const int width = max_name_length > MAX_COMM_LENGTH + 10 ?
+					max_name_length : MAX_COMM_LENGTH + 10;
+				printf("%-*s    CPU Threads  Switches/s Involuntary"
+						"        Read       Write\n", width, "Process");
+				for (int p = 0; p < system.watch->process_count; ++p) {
+					const struct process_t *process =
+						&system.watch->processes[p];
+					char name[32], read[10], write[10];
+					snprintf(name, sizeof(name), "%d %s", process->pid,
+							process->comm);
+					bytes_to_human_readable(process->read_rate, read);
+					bytes_to_human_readable(process->write_rate, write);
+					printf("%-*.*s %5d%% %7d %11.0f %11.0f %9s/s %9s/s"
+							TERM_ERASE_REST_OF_LINE "\n", width,
+							width, name,
+							(int)(process->cpu_usage * 100),
+							process->thread_count, process->switches_rate,
+							process->involuntary_rate, read, write);
+
+					if (process->thread_count > max_activity_count) {
+						while (max_activity_count < process->thread_count)
+							max_activity_count += 128;
+						activity = (double *)realloc(activity,
+								sizeof(double) * max_activity_count);
+					}
+					for (int t = 0; t < process->thread_count; ++t)
+						activity[t] = process->threads[t].cpu_usage;
+					int busiest[TOP_THREAD_COUNT];
+					const int busiest_count = top_k(activity,
+							process->thread_count, busiest, TOP_THREAD_COUNT);
+					for (int i = 0; i < busiest_count; ++i) {
+						const struct thread_t *thread =
+							&process->threads[busiest[i]];
+						if (thread->cpu_usage <= 0.0)
+							break;
+						char cpu[16];
+						snprintf(name, sizeof(name), "  %d %s", thread->tid,
+								thread->comm);
+						snprintf(cpu, sizeof(cpu), "cpu%d", thread->last_cpu);
+						bytes_to_human_readable(thread->read_rate, read);
+						bytes_to_human_readable(thread->write_rate, write);
+						printf("%-*.*s %5d%% %7s %11.0f %11.0f %9s/s %9s/s"
+								TERM_ERASE_REST_OF_LINE "\n", width,
+								width, name,
+								(int)(thread->cpu_usage * 100), cpu,
+								thread->switches_rate, thread->involuntary_rate,
+								read, write);
+					}
+				}
+			}
+
+			if (snapshot.battery_count > 0) {
+				printf(TERM_ERASE_REST_OF_LINE "\n");
+				// Battery info
+				printf("%-*s  Charge Current Voltage\n", max_name_length, "Battery");
+				for (int i = 0; i < snapshot.battery_count; ++i) {
+					const struct smon_battery_t *battery =
+						&snapshot.batteries[i];
+					printf("%-*s %6d%% %6.2fA %6.2fV" TERM_ERASE_REST_OF_LINE "\n",
+							max_name_length, battery->name, battery->charge,
+							battery->current, battery->voltage);
+				}
+			}
+
+			if (export_address) {
+				printf(TERM_ERASE_REST_OF_LINE "\n");
+				static const char * const states[] = {
+					"disconnected", "connecting", "connected"
+				};
+				const double uptime = (monotonic_ns() - start_time) / 1e9;
+				printf("Export to %s: %s, %.0f B/s sent, %llu samples dropped"
+						TERM_ERASE_REST_OF_LINE "\n", export_address,
+						states[exporter.state], exporter.bytes_sent / uptime,
+						exporter.dropped_samples);
+			}
+
+			if (show_overhead) {
+				printf(TERM_ERASE_REST_OF_LINE "\n");
+				// The cost of the last tick. The logger and the rendering
+				// are from the previous one, this one isn't over yet
+				int width = max_name_length;
+				for (int i = 0; i < overhead->section_count; ++i) {
+					int len = strlen(overhead->sections[i].name);
+					if (len > width)
+						width = len;
+				}
+				printf("%-*s       Wall        CPU Syscalls" TERM_ERASE_REST_OF_LINE "\n",
+						width, "smon");
+				struct overhead_sample_t total;
+				overhead_last_total(overhead, &total);
+				for (int i = 0; i <= overhead->section_count; ++i) {
+					const struct overhead_sample_t *cost = i < overhead->section_count ?
+						&overhead->sections[i].last : &total;
+					printf("%-*s %8.3fms %8.3fms %8llu" TERM_ERASE_REST_OF_LINE "\n",
+							width, i < overhead->section_count ?
+							overhead->sections[i].name : "total",
+							cost->wall_ns / 1000000.0, cost->cpu_ns / 1000000.0,
+							cost->syscalls);
+				}
+				printf("CPU usage %.3f%%, tick lateness %.3fms (max %.3fms)"
+						TERM_ERASE_REST_OF_LINE "\n", overhead->cpu_usage * 100.0,
+						overhead->last_lateness_ns / 1000000.0,
+						overhead->max_lateness_ns / 1000000.0);
+				printf("Context switches %lld, involuntary %lld (%lld last tick)"
 						TERM_ERASE_REST_OF_LINE "\n",
-						c + 1,
-						cpu->cur_freq / 1000,
-						(int)(cpu->total_usage * 100));
+						overhead->voluntary_switches,
+						overhead->involuntary_switches,
+						overhead->last_involuntary_switches);
+				for (int b = 0; b < OVERHEAD_LATENESS_BUCKETS; ++b)
+					printf("%s %llu ", overhead_lateness_bucket_name(b),
+							overhead->lateness[b]);
+				printf(TERM_ERASE_REST_OF_LINE "\n");
 			}
+
+			printf(TERM_ERASE_REST_OF_LINE
+					TERM_ERASE_DOWN
+					TERM_POSITION_HOME);
+			flush_file(stdout);
 		}
-		printf(TERM_ERASE_REST_OF_LINE "\n");
+		overhead_charge(overhead, render_section, &start);
 
-		// RAM usage
-		{
-			char used[10], buffers[10], cached[10];
-			bytes_to_human_readable(system.ram_used, used);
-			bytes_to_human_readable(system.ram_buffers, buffers);
-			bytes_to_human_readable(system.ram_cached, cached);
-			printf( "Used:    %8s\n" TERM_ERASE_REST_OF_LINE
-					"Buffers: %8s\n" TERM_ERASE_REST_OF_LINE
-					"Cached:  %8s\n" TERM_ERASE_REST_OF_LINE,
-					used, buffers, cached);
+		if (sample && replay_filename) {
+			// When the next row is due, nothing while paused
+			const long long next = replay_next_deadline(&replay);
+			if (next != -1) {
+				deadline = next;
+				loop_set_deadline(&loop, deadline);
+			}
+		} else if (sample) {
+			long long interval_ns = 1000000000LL;
+			if (burst_ticks > 0) {
+				interval_ns = PSI_BURST_INTERVAL_MS * 1000000LL;
+				--burst_ticks;
+			}
+			// The work of this tick counts towards the interval
+			deadline = tick_start + interval_ns;
+			loop_set_deadline(&loop, deadline);
 		}
-		printf(TERM_ERASE_REST_OF_LINE "\n");
 
-		// Disk usage
-		printf("%-*s        Read       Write\n", max_name_length, "Disk");
-		for (int d = 0; d < system.disk_count; ++d) {
-			const struct disk_t *disk = &system.disks[d];
-			char read[10], write[10];
-			// TODO: find a way to check actual sector size
-			bytes_to_human_readable(
-					disk->stats_delta[DISK_READ_SECTORS] * 512, read);
-			bytes_to_human_readable(
-					disk->stats_delta[DISK_WRITE_SECTORS] * 512, write);
-
-			printf("%-*s %9s/s %9s/s" TERM_ERASE_REST_OF_LINE "\n",
-					max_name_length, disk->name, read, write);
+		// Wait for the next tick, a PSI trigger, a key or a signal
+		sample = 0;
+		timer_fired = 0;
+		int redraw = 0;
+		while (!sample && !redraw && !quit) {
+			struct loop_event_t events[MAX_LOOP_EVENTS];
+			int count = loop_wait(&loop, events, MAX_LOOP_EVENTS);
+			if (count == 0)
+				quit = 1;
+			for (int i = 0; i < count; ++i) {
+				const int value = events[i].value;
+				if (events[i].id == LOOP_TIMER) {
+					sample = 1;
+					timer_fired = 1;
+				} else if (events[i].id == LOOP_INPUT && jump_length >= 0) {
+					// Typing the time to go to in a replay
+					if (value == '\r' || value == '\n') {
+						const long long time = replay_parse_time(&replay,
+								jump_input);
+						if (time != -1)
+							replay_seek(&replay, &system, time, monotonic_ns());
+						jump_length = -1;
+						sample = 1;
+					} else if (value == 27) {
+						jump_length = -1;
+					} else if (value == 3) {
+						quit = 1;
+					} else if ((value == 127 || value == '\b') &&
+							jump_length > 0) {
+						jump_input[--jump_length] = '\0';
+					} else if (value >= ' ' && value < 127 &&
+							jump_length < (int)sizeof(jump_input) - 1) {
+						jump_input[jump_length++] = value;
+						jump_input[jump_length] = '\0';
+					}
+					redraw = 1;
+				} else if (events[i].id == LOOP_INPUT) {
+					if (value == 's' || value == 'S')
+						show_overhead = !show_overhead;
+					if (value == 'q' || value == 'Q' || value == 3)
+						quit = 1;
+					if (replay_filename) {
+						// Show the new row and schedule the next one
+						const long long now = monotonic_ns();
+						sample = 1;
+						if (value == ' ') {
+							replay_pause(&replay, !replay.paused, now);
+						} else if (value == '+' || value == '=') {
+							replay_change_speed(&replay, 1, now);
+						} else if (value == '-') {
+							replay_change_speed(&replay, -1, now);
+						} else if (value == '[' || value == ']' ||
+								value == '{' || value == '}') {
+							const long long step = value == '[' || value == ']' ?
+								REPLAY_SEEK_SHORT_NS : REPLAY_SEEK_LONG_NS;
+							replay_seek(&replay, &system, replay.time +
+									(value == '[' || value == '{' ? -step : step),
+									now);
+						} else if (value == 'g' || value == 'G') {
+							jump_length = 0;
+							jump_input[0] = '\0';
+						} else {
+							sample = 0;
+						}
+					}
+					redraw = 1;
+				} else if (events[i].id == LOOP_SIGNAL) {
+					if (value != SIGWINCH)
+						quit = 1;
+					resized = 1;
+					redraw = stream_format == -1;
+				} else {
+					// A PSI trigger fired, sample now and then more often
+					sample = 1;
+					burst_ticks = PSI_BURST_TICKS;
+				}
+			}
 		}
+	}
 
-		printf(TERM_ERASE_REST_OF_LINE "\n");
-		// Network usage
-		printf("%-*s    Download      Upload\n", max_name_length, "Interface");
-		for (int i = 0; i < system.interface_count; ++i) {
-			const struct interface_t *interface = &system.interfaces[i];
-			char down[10], up[10];
-			bytes_to_human_readable(interface->delta_rx_bytes, down);
-			bytes_to_human_readable(interface->delta_tx_bytes, up);
-			printf("%-*s %9s/s %9s/s" TERM_ERASE_REST_OF_LINE "\n",
-					max_name_length, interface->name, down, up);
+	loop_delete(&loop);
+	logger_destroy(&logger);
+	if (export_address)
+		exporter_delete(&exporter);
+	if (stream_format != -1)
+		stream_delete(&stream);
+	alert_set_delete(&alerts);
+	free(top);
+	free(activity);
+
+	smon_close(smon);
+	if (replay_filename)
+		replay_close(&replay, &system);
+	else
+		system_delete(system);
+	return 0;
+}
+
+static int run_aggregator(const char *address, int log_type,
+		const char *log_filename, const char *rrd_tiers)
+{
+	struct fleet_t fleet;
+	int ret = fleet_init(&fleet, address, -1);
+	if (ret == 1)
+		error("Invalid address %s, expected [host:]port\n", address);
+	if (ret)
+		error("Failed to listen on %s\n", address);
+
+	// The first column is the number of nodes, then the metrics
+	struct logger_t logger;
+	char names[1 + EXPORT_METRIC_COUNT][64];
+	const char *name_ptrs[1 + EXPORT_METRIC_COUNT];
+	double values[1 + EXPORT_METRIC_COUNT];
+	int decimals[1 + EXPORT_METRIC_COUNT];
+	strcpy(names[0], "Fleet Nodes");
+	decimals[0] = 0;
+	for (int m = 0; m < EXPORT_METRIC_COUNT; ++m) {
+		snprintf(names[1 + m], sizeof(names[1 + m]), "Fleet %s",
+				export_metric(m)->name);
+		decimals[1 + m] = export_metric(m)->scale < 1.0 ? 2 : 0;
+	}
+	for (int i = 0; i < 1 + EXPORT_METRIC_COUNT; ++i)
+		name_ptrs[i] = names[i];
+	ret = logger_init_columns(&logger, log_type, log_filename, rrd_tiers,
+			log_filename ? 1 + EXPORT_METRIC_COUNT : 0, name_ptrs);
+	if (ret != 0) {
+		fprintf(stderr, "Failed to initialize logger: %d\n", ret);
+		return 1;
+	}
+	setvbuf(stdout, NULL, _IOFBF, STDOUT_BUFFER_SIZE);
+
+	// The connections are received whenever the fleet's epoll set is ready
+	enum { LOOP_FLEET = LOOP_USER };
+	struct loop_t loop;
+	if (loop_init(&loop, STDIN_FILENO) ||
+			loop_watch(&loop, fleet.epoll_fd, EPOLLIN, LOOP_FLEET))
+		error("Failed to create the event loop\n");
+
+	printf(TERM_CLEAR_SCREEN TERM_POSITION_HOME);
+	long long deadline = monotonic_ns();
+	int sample = 1;
+	int quit = 0;
+	while (!quit) {
+		struct fleet_totals_t totals;
+		fleet_totals(&fleet, &totals);
+		if (sample) {
+			values[0] = totals.nodes_up;
+			memcpy(values + 1, totals.values, sizeof(totals.values));
+			logger_log_values(&logger, values, decimals);
+			flush_file(logger.file);
 		}
 
-		if (system.battery_count > 0) {
-			printf(TERM_ERASE_REST_OF_LINE "\n");
-			// Battery info
-			printf("%-*s  Charge Current Voltage\n", max_name_length, "Battery");
-			for (int i = 0; i < system.battery_count; ++i) {
-				const struct battery_t *battery = &system.batteries[i];
-				printf("%-*s %6d%% %6.2fA %6.2fV" TERM_ERASE_REST_OF_LINE "\n",
-						max_name_length, battery->name, battery->charge,
-						battery->current / 1000000.f, battery->voltage / 1000000.f);
+		int width = 4;
+		for (int n = 0; n < fleet.node_count; ++n) {
+			int len = strlen(fleet.nodes[n].name);
+			if (len > width)
+				width = len;
+		}
+
+		char used[10], read[10], write[10], down[10], up[10];
+		bytes_to_human_readable(totals.values[EXPORT_RAM_USED], used);
+		bytes_to_human_readable(totals.values[EXPORT_DISK_READ], read);
+		bytes_to_human_readable(totals.values[EXPORT_DISK_WRITE], write);
+		bytes_to_human_readable(totals.values[EXPORT_NET_RX], down);
+		bytes_to_human_readable(totals.values[EXPORT_NET_TX], up);
+		printf("Fleet: %d nodes up, %d down, %.0f CPUs at %.1f%%, "
+				"%s RAM used" TERM_ERASE_REST_OF_LINE "\n",
+				totals.nodes_up, totals.nodes_down,
+				totals.values[EXPORT_CPU_COUNT],
+				totals.values[EXPORT_CPU_USAGE], used);
+		printf("Disks %s/s read, %s/s written, network %s/s down, %s/s up"
+				TERM_ERASE_REST_OF_LINE "\n", read, write, down, up);
+		printf(TERM_ERASE_REST_OF_LINE "\n");
+
+		printf("%-*s CPUs  CPU%%  Max%%      RAM        Read       Write"
+				"    Download      Upload  MemPSI  Seen   Stream"
+				TERM_ERASE_REST_OF_LINE "\n", width, "Node");
+		const long long now = monotonic_ns();
+		for (int n = 0; n < fleet.node_count; ++n) {
+			const struct fleet_node_t *node = &fleet.nodes[n];
+			const long long *v = node->values;
+			printf("%-*s ", width, node->name);
+			if (!node->connected) {
+				printf("down, was at %s" TERM_ERASE_REST_OF_LINE "\n",
+						node->address);
+				continue;
 			}
+			bytes_to_human_readable(v[EXPORT_RAM_USED] * 1024LL, used);
+			bytes_to_human_readable(v[EXPORT_DISK_READ], read);
+			bytes_to_human_readable(v[EXPORT_DISK_WRITE], write);
+			bytes_to_human_readable(v[EXPORT_NET_RX], down);
+			bytes_to_human_readable(v[EXPORT_NET_TX], up);
+			printf("%4lld %4lld%% %4lld%% %8s %9s/s %9s/s %9s/s %9s/s %6.2f%% "
+					"%4llds %4.0fB/s" TERM_ERASE_REST_OF_LINE "\n",
+					v[EXPORT_CPU_COUNT], v[EXPORT_CPU_USAGE] / 100,
+					v[EXPORT_CPU_MAX_USAGE] / 100, used, read, write,
+					down, up, v[EXPORT_PSI_MEMORY] / 100.0,
+					(now - node->last_seen) / 1000000000LL,
+					node->bytes_received * 1e9 / (now - node->first_seen + 1));
 		}
 
 		printf(TERM_ERASE_REST_OF_LINE
 				TERM_ERASE_DOWN
 				TERM_POSITION_HOME);
-		fflush(stdout);
+		flush_file(stdout);
 
-		int c = wait_for_keypress();
-		if (c == 'q' || c == 'Q' || c == 3 || must_exit)
-			break;
+		// Receive until the next second, redraw early if a key is pressed
+		if (sample) {
+			deadline += 1000000000LL;
+			if (deadline < monotonic_ns())
+				deadline = monotonic_ns();
+			loop_set_deadline(&loop, deadline);
+		}
+		sample = 0;
+		int redraw = 0;
+		while (!sample && !redraw && !quit) {
+			struct loop_event_t events[MAX_LOOP_EVENTS];
+			int count = loop_wait(&loop, events, MAX_LOOP_EVENTS);
+			if (count == 0)
+				quit = 1;
+			for (int i = 0; i < count; ++i) {
+				const int value = events[i].value;
+				if (events[i].id == LOOP_TIMER) {
+					sample = 1;
+				} else if (events[i].id == LOOP_FLEET) {
+					fleet_wait(&fleet, 0);
+				} else if (events[i].id == LOOP_INPUT) {
+					if (value == 'q' || value == 'Q' || value == 3)
+						quit = 1;
+					redraw = 1;
+				} else if (events[i].id == LOOP_SIGNAL) {
+					if (value == SIGWINCH)
+						printf(TERM_CLEAR_SCREEN TERM_POSITION_HOME);
+					else
+						quit = 1;
+					redraw = 1;
+				}
+			}
+		}
 	}
 
+	loop_delete(&loop);
 	logger_destroy(&logger);
+	fleet_delete(&fleet);
+	return 0;
+}
+
+static int run_freq_measure(struct system_config_t *config, int ticks)
+{
+	int cpus_collector = 0;
+	while (strcmp(system_collector_name(cpus_collector), "cpus"))
+		++cpus_collector;
+
+	printf("%-8s %10s %14s %10s %13s\n", "Source", "us/tick",
+			"syscalls/tick", "IPIs/tick", "wakeups/tick");
+	// none comes first, the cost of the rest is on top of it
+	static const int sources[] = {
+		FREQ_NONE, FREQ_SYSFS, FREQ_CPUINFO, FREQ_STATS, FREQ_BUSY
+	};
+	double base_ipis = 0.0, base_wakeups = 0.0;
+	for (int s = 0; s < FREQ_SOURCE_COUNT && !must_exit; ++s) {
+		config->freq_source = sources[s];
+		struct system_t system = system_init(config);
+		if (!system.freq->available) {
+			printf("%-8s not available\n", freq_source_name(sources[s]));
+			system_delete(system);
+			continue;
+		}
 
-	system_delete(system);
+		long long ns = 0;
+		unsigned long long syscalls = 0, ipis = 0, wakeups = 0;
+		for (int t = 0; t < ticks && !must_exit; ++t) {
+			// Let the other CPUs go idle, like between two ticks
+			usleep(FREQ_MEASURE_INTERVAL_MS * 1000);
+			struct freq_disturbance_t before, after;
+			freq_read_disturbance(&system, &before);
+			const unsigned long long syscalls_before = util_syscall_count;
+			const long long start = monotonic_ns();
+			system_refresh_clock(&system);
+			system_refresh_collector(&system, cpus_collector);
+			ns += monotonic_ns() - start;
+			syscalls += util_syscall_count - syscalls_before;
+			usleep(FREQ_MEASURE_SETTLE_MS * 1000);
+			freq_read_disturbance(&system, &after);
+			ipis += after.ipis - before.ipis;
+			wakeups += after.wakeups - before.wakeups;
+		}
+		system_delete(system);
+
+		const double tick_ipis = (double)ipis / ticks;
+		const double tick_wakeups = (double)wakeups / ticks;
+		if (sources[s] == FREQ_NONE) {
+			base_ipis = tick_ipis;
+			base_wakeups = tick_wakeups;
+		}
+		printf("%-8s %10.1f %14llu %10.1f %13.1f", freq_source_name(sources[s]),
+				ns / 1000.0 / ticks, syscalls / ticks, tick_ipis, tick_wakeups);
+		if (sources[s] != FREQ_NONE)
+			printf("  (%+.1f IPIs, %+.1f wakeups)", tick_ipis - base_ipis,
+					tick_wakeups - base_wakeups);
+		printf("\n");
+		fflush(stdout);
+	}
 	return 0;
 }
@@ -0,0 +1,178 @@
+#include "numa.h"
+#include "system.h"
+#include "cpu.h"
+#include "util.h"
+#include "kv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define NODE_DIR "/sys/devices/system/node/"
+
+// The counters of a node's meminfo that are read
+enum {
+	NODE_MEMINFO_TOTAL, NODE_MEMINFO_FREE, NODE_MEMINFO_FILE,
+	NODE_MEMINFO_RECLAIMABLE, NODE_MEMINFO_SHARED, NODE_MEMINFO_COUNT
+};
+static const char * const node_meminfo_names[NODE_MEMINFO_COUNT] = {
+	"MemTotal", "MemFree", "FilePages", "SReclaimable", "Shmem"
+};
+
+static const char * const numastat_names[NUMA_STATS_COUNT] = {
+	"numa_hit", "numa_miss", "numa_foreign", "interleave_hit",
+	"local_node", "other_node"
+};
+
+static int node_cmp(const void *a, const void *b)
+{
+	return ((const struct numa_node_t *)a)->id -
+		((const struct numa_node_t *)b)->id;
+}
+
+void numa_init(struct system_t *system)
+{
+	system->numa_node_count = 0;
+	system->numa_nodes = NULL;
+	for (int c = 0; c < system->cpu_count; ++c)
+		system->cpus[c].node = -1;
+	system->numa_meminfo_keys = (struct kv_table_t *)malloc(
+			sizeof(struct kv_table_t));
+	system->numastat_keys = (struct kv_table_t *)malloc(
+			sizeof(struct kv_table_t));
+	if (kv_table_init(system->numa_meminfo_keys, node_meminfo_names,
+				NODE_MEMINFO_COUNT) ||
+			kv_table_init(system->numastat_keys, numastat_names,
+				NUMA_STATS_COUNT))
+		return;
+
+	// Kernels without CONFIG_NUMA don't have this directory
+	char filename[PATH_MAX];
+	const int dir_len = system_path(system, filename, NODE_DIR);
+	struct dir_t dir;
+	if (dir_open(&dir, filename))
+		return;
+	int max_node_count = 0;
+	const char *name;
+	while ((name = dir_next(&dir, NULL))) {
+		char *end;
+		if (strncmp(name, "node", 4))
+			continue;
+		int id = strtol(name + 4, &end, 10);
+		if (end == name + 4 || *end != '\0')
+			continue;
+		if (system->numa_node_count == max_node_count) {
+			max_node_count += 128;
+			system->numa_nodes = (struct numa_node_t *)realloc(
+					system->numa_nodes,
+					sizeof(struct numa_node_t) * max_node_count);
+		}
+		struct numa_node_t *node = &system->numa_nodes[system->numa_node_count++];
+		memset(node, 0, sizeof(struct numa_node_t));
+		node->id = id;
+		node->meminfo_prefix = snprintf(NULL, 0, "Node %d ", id);
+	}
+	dir_close(&dir);
+	qsort(system->numa_nodes, system->numa_node_count,
+			sizeof(struct numa_node_t), node_cmp);
+
+	const struct cpu_counters_t *counters = system->cpu_counters;
+	unsigned char *set = (unsigned char *)malloc(counters->index_count + 1);
+	for (int n = 0; n < system->numa_node_count; ++n) {
+		struct numa_node_t *node = &system->numa_nodes[n];
+		snprintf(filename + dir_len, PATH_MAX - dir_len, "node%d/meminfo",
+				node->id);
+		node->meminfo_fd = open_file_readonly(filename);
+		snprintf(filename + dir_len, PATH_MAX - dir_len, "node%d/numastat",
+				node->id);
+		node->numastat_fd = open_file_readonly(filename);
+
+		// The CPUs of the node don't change, so they are mapped once
+		char list[4096];
+		snprintf(filename + dir_len, PATH_MAX - dir_len, "node%d/cpulist",
+				node->id);
+		int len = read_file_to_string(filename, list, sizeof(list) - 1);
+		list[len > 0 ? len : 0] = '\0';
+		memset(set, 0, counters->index_count + 1);
+		node->cpus = (int *)malloc(sizeof(int) * (system->cpu_count + 1));
+		if (parse_cpu_list(list, set, counters->index_count) <= 0)
+			continue;
+		for (int id = 0; id < counters->index_count; ++id) {
+			const int c = counters->index[id];
+			if (!set[id] || c < 0)
+				continue;
+			system->cpus[c].node = node->id;
+			node->cpus[node->cpu_count++] = c;
+		}
+	}
+	free(set);
+}
+
+void numa_delete(struct system_t *system)
+{
+	for (int n = 0; n < system->numa_node_count; ++n) {
+		close_fd(system->numa_nodes[n].meminfo_fd);
+		close_fd(system->numa_nodes[n].numastat_fd);
+		free(system->numa_nodes[n].cpus);
+	}
+	free(system->numa_nodes);
+	free(system->numa_meminfo_keys);
+	free(system->numastat_keys);
+}
+
+// Parse lines like "Node 0 MemFree:   3454244 kB"
+static void numa_parse_meminfo(const struct system_t *system,
+		struct numa_node_t *node, const char *buffer)
+{
+	unsigned long long mem[NODE_MEMINFO_COUNT] = {0};
+	kv_parse_skip(system->numa_meminfo_keys, buffer, node->meminfo_prefix,
+			mem);
+	node->mem_total = mem[NODE_MEMINFO_TOTAL] * 1024LL;
+	node->mem_free = mem[NODE_MEMINFO_FREE] * 1024LL;
+
+	// As for the whole system in /proc/meminfo, except that FilePages
+	// includes the buffers
+	node->mem_cached = ((long long)mem[NODE_MEMINFO_FILE] +
+			mem[NODE_MEMINFO_RECLAIMABLE] - mem[NODE_MEMINFO_SHARED]) * 1024LL;
+	node->mem_used = node->mem_total - node->mem_free - node->mem_cached;
+}
+
+// Parse lines like "numa_miss 0"
+static void numa_parse_numastat(const struct system_t *system,
+		struct numa_node_t *node, const char *buffer)
+{
+	unsigned long long stats[NUMA_STATS_COUNT];
+	memcpy(stats, node->stats, sizeof(stats));
+	kv_parse(system->numastat_keys, buffer, stats);
+	for (int s = 0; s < NUMA_STATS_COUNT; ++s) {
+		node->stats_rate[s] = node->stats[s] ? counter_rate(
+				counter_delta(stats[s], node->stats[s]),
+				system->elapsed) : 0.0;
+		node->stats[s] = stats[s];
+	}
+}
+
+void numa_refresh(struct system_t *system)
+{
+	const double *usage = system->cpu_counters->usage;
+	char buffer[4096];
+	for (int n = 0; n < system->numa_node_count; ++n) {
+		struct numa_node_t *node = &system->numa_nodes[n];
+
+		int bytes = read_fd_to_string(node->meminfo_fd, buffer,
+				sizeof(buffer) - 1);
+		buffer[bytes > 0 ? bytes : 0] = '\0';
+		numa_parse_meminfo(system, node, buffer);
+
+		bytes = read_fd_to_string(node->numastat_fd, buffer,
+				sizeof(buffer) - 1);
+		buffer[bytes > 0 ? bytes : 0] = '\0';
+		numa_parse_numastat(system, node, buffer);
+
+		double total = 0.0;
+		for (int i = 0; i < node->cpu_count; ++i)
+			total += usage[node->cpus[i]];
+		node->cpu_usage = node->cpu_count ? total / node->cpu_count : 0.0;
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef NUMA_H_INCLUDED
+#define NUMA_H_INCLUDED
+
+// Counters in /sys/devices/system/node/nodeN/numastat (pages)
+enum {
+	NUMA_HIT = 0, /**< Allocated on this node as intended */
+	NUMA_MISS = 1, /**< Allocated on this node, but intended for another */
+	NUMA_FOREIGN = 2, /**< Intended for this node, but allocated on another */
+	NUMA_INTERLEAVE_HIT = 3,
+	NUMA_LOCAL_NODE = 4, /**< Allocated here by a process running here */
+	NUMA_OTHER_NODE = 5, /**< Allocated here by a process on another node */
+	NUMA_STATS_COUNT = 6
+};
+
+struct system_t;
+
+/** A NUMA node, with its memory and the CPUs that are local to it */
+struct numa_node_t
+{
+	int id; /**< The ID of the node as it appears in /sys e.g. node1 */
+
+	long long mem_total; /**< The RAM of the node (bytes) */
+	long long mem_free; /**< Unused RAM of the node (bytes) */
+	long long mem_used; /**< Used by applications, like system_t::ram_used
+						  (bytes) */
+	long long mem_cached; /**< Used for buffers and caches (bytes) */
+
+	unsigned long long stats[NUMA_STATS_COUNT]; /**< The numastat counters */
+	double stats_rate[NUMA_STATS_COUNT]; /**< Their change per second */
+
+	int cpu_count; /**< The number of CPUs of the node */
+	int *cpus; /**< Their indices in system->cpus */
+	double cpu_usage; /**< The average usage of its CPUs [0.0, 1.0] */
+
+	int meminfo_prefix; /**< The length of the "Node N " before each key
+						  of its meminfo */
+
+	// File descriptors for files that are kept open
+	int meminfo_fd;
+	int numastat_fd;
+};
+
+/** Find the nodes, open their files and set the node of every CPU */
+void numa_init(struct system_t *system);
+
+/** Read the memory and numastat of all nodes. Runs after the CPU usage
+ * is known */
+void numa_refresh(struct system_t *system);
+
+/** Close the files and free the memory */
+void numa_delete(struct system_t *system);
+
+#endif
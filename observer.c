@@ -0,0 +1,102 @@
+#define _GNU_SOURCE
+
+#include "observer.h"
+#include "system.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+
+#define POSSIBLE_CPUS_PATH "/sys/devices/system/cpu/possible"
+
+void observer_config_init(struct observer_config_t *config)
+{
+	config->cpus = NULL;
+	config->nice = OBSERVER_SCHED_IDLE;
+	config->timer_slack_ns = OBSERVER_TIMER_SLACK_NS;
+}
+
+// Read a CPU list from a file under root into set. Returns its size
+static int observer_read_cpu_list(const char *root, const char *path,
+		unsigned char *set)
+{
+	char filename[PATH_MAX];
+	char list[4096];
+	snprintf(filename, sizeof(filename), "%s%s", root, path);
+	int len = read_file_to_string(filename, list, sizeof(list) - 1);
+	list[len > 0 ? len : 0] = '\0';
+	return parse_cpu_list(list, set, CPU_SETSIZE);
+}
+
+int observer_enter(const struct observer_config_t *config, const char *root,
+		char *error, int error_size)
+{
+	// The housekeeping CPUs are the ones that aren't isolated
+	unsigned char cpus[CPU_SETSIZE];
+	memset(cpus, 0, sizeof(cpus));
+	if (config->cpus) {
+		if (parse_cpu_list(config->cpus, cpus, CPU_SETSIZE) <= 0) {
+			snprintf(error, error_size, "Invalid CPU list %s", config->cpus);
+			return 1;
+		}
+	} else {
+		unsigned char isolated[CPU_SETSIZE];
+		memset(isolated, 0, sizeof(isolated));
+		system_read_isolated_cpus(root, isolated, CPU_SETSIZE);
+		if (observer_read_cpu_list(root, POSSIBLE_CPUS_PATH, cpus) <= 0)
+			for (int c = 0; c < CPU_SETSIZE; ++c)
+				cpus[c] = 1;
+		for (int c = 0; c < CPU_SETSIZE; ++c)
+			cpus[c] &= !isolated[c];
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int c = 0; c < CPU_SETSIZE; ++c)
+		if (cpus[c])
+			CPU_SET(c, &set);
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		snprintf(error, error_size, "Failed to set the CPU affinity: %s",
+				strerror(errno));
+		return 1;
+	}
+
+	if (config->nice == OBSERVER_SCHED_IDLE) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		if (sched_setscheduler(0, SCHED_IDLE, &param)) {
+			snprintf(error, error_size, "Failed to switch to SCHED_IDLE: %s",
+					strerror(errno));
+			return 1;
+		}
+	} else if (setpriority(PRIO_PROCESS, 0, config->nice)) {
+		snprintf(error, error_size, "Failed to set the nice level: %s",
+				strerror(errno));
+		return 1;
+	}
+
+	if (prctl(PR_SET_TIMERSLACK, config->timer_slack_ns, 0, 0, 0)) {
+		snprintf(error, error_size, "Failed to set the timer slack: %s",
+				strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+int observer_lock_memory(void)
+{
+	// Touch the stack that the deepest calls will use, so that it's
+	// faulted in (and then locked) now
+	volatile char stack[OBSERVER_STACK_PREFAULT];
+	for (int i = 0; i < OBSERVER_STACK_PREFAULT; i += 4096)
+		stack[i] = 0;
+	(void)stack;
+	return mlockall(MCL_CURRENT | MCL_FUTURE);
+}
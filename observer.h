@@ -0,0 +1,43 @@
+#ifndef OBSERVER_H_INCLUDED
+#define OBSERVER_H_INCLUDED
+
+/*
+ * The observer mode (smon --observer) keeps smon out of the way of the
+ * workload it watches: it runs on housekeeping CPUs only, at SCHED_IDLE
+ * (or a given nice level), with a large timer slack so that its wakeups
+ * are coalesced with others, and with all of its memory faulted in and
+ * locked so that it doesn't page fault while sampling. The per-CPU files
+ * and counters of isolated CPUs aren't read at all (see
+ * system_config_t::skip_isolated).
+ */
+
+// How late the kernel may wake smon up, to batch it with other wakeups
+#define OBSERVER_TIMER_SLACK_NS (20 * 1000000L)
+// How much of the stack is faulted in before it is locked
+#define OBSERVER_STACK_PREFAULT (256 * 1024)
+// A nice level that means SCHED_IDLE instead
+#define OBSERVER_SCHED_IDLE 100
+
+struct observer_config_t
+{
+	const char *cpus; /**< The CPUs to run on (e.g. "0-1"), NULL for
+						all that aren't isolated */
+	int nice; /**< OBSERVER_SCHED_IDLE or a nice level */
+	long timer_slack_ns;
+};
+
+/** Fill config with the defaults */
+void observer_config_init(struct observer_config_t *config);
+
+/** Move smon to the CPUs, set its scheduling policy and timer slack.
+ * root is the prefix of /sys, as in system_config_t. Returns 0 on
+ * success, otherwise writes what failed to error */
+int observer_enter(const struct observer_config_t *config, const char *root,
+		char *error, int error_size);
+
+/** Fault in the stack and lock all memory, current and future. Called
+ * once the devices are discovered and the buffers allocated.
+ * Returns 0 on success */
+int observer_lock_memory(void);
+
+#endif
@@ -0,0 +1,108 @@
+#include "overhead.h"
+#include "util.h"
+
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+static const char * const bucket_names[OVERHEAD_LATENESS_BUCKETS] = {
+	"<10us", "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s"
+};
+
+void overhead_init(struct overhead_t *overhead)
+{
+	memset(overhead, 0, sizeof(struct overhead_t));
+	overhead_sample(&overhead->start);
+}
+
+int overhead_add_section(struct overhead_t *overhead, const char *name)
+{
+	if (overhead->section_count == MAX_OVERHEAD_SECTIONS)
+		return -1;
+	struct overhead_section_t *section =
+		&overhead->sections[overhead->section_count];
+	memset(section, 0, sizeof(struct overhead_section_t));
+	strncpy(section->name, name, MAX_OVERHEAD_NAME_LENGTH);
+	return overhead->section_count++;
+}
+
+int overhead_find_section(const struct overhead_t *overhead, const char *name)
+{
+	for (int i = 0; i < overhead->section_count; ++i)
+		if (!strcmp(overhead->sections[i].name, name))
+			return i;
+	return -1;
+}
+
+void overhead_sample(struct overhead_sample_t *sample)
+{
+	// smon is single-threaded, so the thread clock is the process clock,
+	// but it is cheaper to read
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	sample->cpu_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	sample->wall_ns = monotonic_ns();
+	sample->syscalls = util_syscall_count;
+}
+
+void overhead_charge(struct overhead_t *overhead, int section,
+		struct overhead_sample_t *start)
+{
+	struct overhead_sample_t now;
+	overhead_sample(&now);
+	if (section >= 0 && section < overhead->section_count) {
+		struct overhead_section_t *s = &overhead->sections[section];
+		s->last.wall_ns = now.wall_ns - start->wall_ns;
+		s->last.cpu_ns = now.cpu_ns - start->cpu_ns;
+		s->last.syscalls = now.syscalls - start->syscalls;
+		s->total.wall_ns += s->last.wall_ns;
+		s->total.cpu_ns += s->last.cpu_ns;
+		s->total.syscalls += s->last.syscalls;
+	}
+	*start = now;
+}
+
+void overhead_last_total(const struct overhead_t *overhead,
+		struct overhead_sample_t *total)
+{
+	memset(total, 0, sizeof(struct overhead_sample_t));
+	for (int i = 0; i < overhead->section_count; ++i) {
+		total->wall_ns += overhead->sections[i].last.wall_ns;
+		total->cpu_ns += overhead->sections[i].last.cpu_ns;
+		total->syscalls += overhead->sections[i].last.syscalls;
+	}
+}
+
+void overhead_tick(struct overhead_t *overhead, long long lateness_ns)
+{
+	if (lateness_ns < 0)
+		lateness_ns = 0;
+	int bucket = 0;
+	for (long long limit = 10000; bucket < OVERHEAD_LATENESS_BUCKETS - 1 &&
+			lateness_ns >= limit; limit *= 10)
+		++bucket;
+	++overhead->lateness[bucket];
+	++overhead->tick_count;
+	overhead->last_lateness_ns = lateness_ns;
+	if (lateness_ns > overhead->max_lateness_ns)
+		overhead->max_lateness_ns = lateness_ns;
+
+	struct overhead_sample_t now;
+	overhead_sample(&now);
+	long long wall = now.wall_ns - overhead->start.wall_ns;
+	overhead->cpu_usage = wall > 0 ?
+		(double)(now.cpu_ns - overhead->start.cpu_ns) / wall : 0.0;
+
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		overhead->last_involuntary_switches =
+			usage.ru_nivcsw - overhead->involuntary_switches;
+		overhead->voluntary_switches = usage.ru_nvcsw;
+		overhead->involuntary_switches = usage.ru_nivcsw;
+	}
+}
+
+const char *overhead_lateness_bucket_name(int bucket)
+{
+	return bucket_names[bucket];
+}
@@ -0,0 +1,76 @@
+#ifndef OVERHEAD_H_INCLUDED
+#define OVERHEAD_H_INCLUDED
+
+#define MAX_OVERHEAD_SECTIONS 32
+#define MAX_OVERHEAD_NAME_LENGTH 15
+
+// Buckets of the tick lateness histogram: <10us, <100us, <1ms,
+// <10ms, <100ms, <1s and >=1s
+#define OVERHEAD_LATENESS_BUCKETS 7
+
+/** What a part of smon costs: time and system calls */
+struct overhead_sample_t
+{
+	long long wall_ns; /**< CLOCK_MONOTONIC time (ns) */
+	long long cpu_ns; /**< CPU time used by smon (ns) */
+	unsigned long long syscalls; /**< System calls made through util.h */
+};
+
+/** A measured part of smon, e.g. a collector or the rendering */
+struct overhead_section_t
+{
+	char name[MAX_OVERHEAD_NAME_LENGTH + 1];
+	struct overhead_sample_t last; /**< The cost during the last tick */
+	struct overhead_sample_t total; /**< The cost since smon started */
+};
+
+/** The cost of running smon itself */
+struct overhead_t
+{
+	int section_count;
+	struct overhead_section_t sections[MAX_OVERHEAD_SECTIONS];
+
+	unsigned long long tick_count; /**< The number of ticks with a lateness */
+	unsigned long long lateness[OVERHEAD_LATENESS_BUCKETS]; /**< How many
+			ticks started that late after their intended time */
+	long long last_lateness_ns; /**< The lateness of the last tick */
+	long long max_lateness_ns; /**< The largest lateness so far */
+
+	struct overhead_sample_t start; /**< When overhead_init() was called */
+	double cpu_usage; /**< CPU time used by smon / time since it
+						started [0.0, 1.0]. Updated by overhead_tick() */
+	long long voluntary_switches; /**< Times smon went to sleep */
+	long long involuntary_switches; /**< Times smon was preempted, which
+									  shows that it competes for a CPU */
+	long long last_involuntary_switches; /**< During the last tick */
+};
+
+/** Reset all measurements */
+void overhead_init(struct overhead_t *overhead);
+
+/** Add a section called name. Returns its index or -1 if there are too many */
+int overhead_add_section(struct overhead_t *overhead, const char *name);
+
+/** Returns the index of the section called name or -1 */
+int overhead_find_section(const struct overhead_t *overhead, const char *name);
+
+/** Read the clocks and the syscall counter */
+void overhead_sample(struct overhead_sample_t *sample);
+
+/** Charge everything since *start to a section and move *start to now,
+ * so that consecutive sections take a single sample each */
+void overhead_charge(struct overhead_t *overhead, int section,
+		struct overhead_sample_t *start);
+
+/** The cost of all sections during the last tick */
+void overhead_last_total(const struct overhead_t *overhead,
+		struct overhead_sample_t *total);
+
+/** Record that a tick started lateness_ns after its intended time
+ * and update cpu_usage */
+void overhead_tick(struct overhead_t *overhead, long long lateness_ns);
+
+/** The label of a lateness histogram bucket (e.g. "<1ms") */
+const char *overhead_lateness_bucket_name(int bucket);
+
+#endif
@@ -0,0 +1,151 @@
+#include "perf.h"
+#include "system.h"
+#include "cpu.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// How each of the PERF_* counters is requested from the kernel
+static const struct {
+	unsigned int type;
+	unsigned long long config;
+} perf_events[PERF_COUNTERS_COUNT] = {
+	[PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_CONTEXT_SWITCHES] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+	[PERF_MIGRATIONS] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+	[PERF_MINOR_FAULTS] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN },
+	[PERF_MAJOR_FAULTS] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ },
+};
+
+static int perf_event_open(int counter, int cpu, int group_fd)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = perf_events[counter].type;
+	attr.config = perf_events[counter].config;
+	// The whole group is read with a single read() of the leader
+	attr.read_format = PERF_FORMAT_GROUP |
+		PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	// Only the leader starts disabled, the rest follow it
+	attr.disabled = group_fd == -1;
+	return syscall(__NR_perf_event_open, &attr, -1, cpu, group_fd,
+			PERF_FLAG_FD_CLOEXEC);
+}
+
+// Open the counters in [first, last] as members of the group of the
+// already opened counters, or as a new group if there are none yet
+static int perf_open_counters(struct cpu_t *cpu, int first, int last)
+{
+	int leader = -1;
+	for (int c = 0; c < PERF_COUNTERS_COUNT; ++c) {
+		if (cpu->perf_fds[c] >= 0) {
+			leader = cpu->perf_fds[c];
+			break;
+		}
+	}
+
+	for (int c = first; c <= last; ++c) {
+		int fd = perf_event_open(c, cpu->id, leader);
+		if (fd < 0) {
+			// Don't leave half of the counters opened
+			for (int o = first; o < c; ++o) {
+				close_fd(cpu->perf_fds[o]);
+				cpu->perf_fds[o] = -1;
+			}
+			return 0;
+		}
+		cpu->perf_fds[c] = fd;
+		if (leader == -1)
+			leader = fd;
+	}
+	return 1;
+}
+
+int perf_init(struct system_t *system)
+{
+	int opened = 0;
+	for (int i = 0; i < system->cpu_count; ++i) {
+		struct cpu_t *cpu = &system->cpus[i];
+		// Reading the counters of another CPU interrupts it
+		if (cpu->isolated && system->skip_isolated)
+			continue;
+
+		// Hardware counters first, so that they lead the group.
+		// There is no PMU in most VMs, so they're optional
+		perf_open_counters(cpu, PERF_CYCLES, PERF_INSTRUCTIONS);
+		if (!perf_open_counters(cpu, PERF_CONTEXT_SWITCHES,
+					PERF_MAJOR_FAULTS)) {
+			for (int c = 0; c < PERF_COUNTERS_COUNT; ++c) {
+				close_fd(cpu->perf_fds[c]);
+				cpu->perf_fds[c] = -1;
+			}
+			continue;
+		}
+
+		// Enable the whole group through the leader
+		for (int c = 0; c < PERF_COUNTERS_COUNT; ++c) {
+			if (cpu->perf_fds[c] >= 0) {
+				ioctl(cpu->perf_fds[c], PERF_EVENT_IOC_ENABLE,
+						PERF_IOC_FLAG_GROUP);
+				break;
+			}
+		}
+		++opened;
+	}
+	return opened;
+}
+
+void perf_delete(struct system_t *system)
+{
+	for (int i = 0; i < system->cpu_count; ++i)
+		for (int c = 0; c < PERF_COUNTERS_COUNT; ++c)
+			close_fd(system->cpus[i].perf_fds[c]);
+}
+
+void perf_refresh(struct system_t *system)
+{
+	for (int i = 0; i < system->cpu_count; ++i) {
+		struct cpu_t *cpu = &system->cpus[i];
+
+		// The leader is the first opened counter
+		int leader = -1;
+		for (int c = 0; c < PERF_COUNTERS_COUNT && leader == -1; ++c)
+			leader = cpu->perf_fds[c];
+		if (leader == -1)
+			continue;
+
+		// { nr, time_enabled, time_running, value[nr] }, the values
+		// being in the order in which the counters were opened
+		unsigned long long data[3 + PERF_COUNTERS_COUNT];
+		if (read_fd(leader, data, sizeof(data)) < (int)(3 * sizeof(*data)))
+			continue;
+		// Scale the counters if the PMU had to be multiplexed
+		double scale = data[2] && data[2] < data[1] ?
+			(double)data[1] / data[2] : 1.0;
+
+		int v = 3;
+		for (int c = 0; c < PERF_COUNTERS_COUNT; ++c) {
+			if (cpu->perf_fds[c] < 0)
+				continue;
+			unsigned long long value = data[v++] * scale;
+			// Scaled values can go back a bit when the scale changes
+			cpu->perf_delta[c] = value > cpu->perf_last[c] ?
+				value - cpu->perf_last[c] : 0;
+			cpu->perf_rate[c] = counter_rate(cpu->perf_delta[c],
+					system->elapsed);
+			cpu->perf_last[c] = value;
+		}
+
+		cpu->ipc = cpu->perf_delta[PERF_CYCLES] ?
+			(double)cpu->perf_delta[PERF_INSTRUCTIONS] /
+			cpu->perf_delta[PERF_CYCLES] : 0.0;
+	}
+}
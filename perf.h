@@ -0,0 +1,17 @@
+#ifndef PERF_H_INCLUDED
+#define PERF_H_INCLUDED
+
+struct system_t;
+
+/** Open a perf_event group on every CPU with the software counters
+ * and, when a PMU is available, cycles and instructions.
+ * Returns the number of CPUs with opened counters */
+int perf_init(struct system_t *system);
+
+/** Read the counter groups, one read per CPU */
+void perf_refresh(struct system_t *system);
+
+/** Close all perf_event file descriptors */
+void perf_delete(struct system_t *system);
+
+#endif
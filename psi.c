@@ -0,0 +1,153 @@
+#include "psi.h"
+#include "system.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#define PRESSURE_DIR "/proc/pressure/"
+
+static const char * const resource_names[PSI_RESOURCE_COUNT] = {
+	"cpu", "memory", "io"
+};
+
+void psi_init(struct system_t *system)
+{
+	system->psi = NULL;
+	system->psi_trigger_count = 0;
+	system->psi_triggers = NULL;
+
+	char filename[PATH_MAX];
+	int found = 0;
+	struct psi_t *psi = (struct psi_t *)calloc(PSI_RESOURCE_COUNT,
+			sizeof(struct psi_t));
+	for (int r = 0; r < PSI_RESOURCE_COUNT; ++r) {
+		int len = system_path(system, filename, PRESSURE_DIR);
+		strcpy(filename + len, resource_names[r]);
+		psi[r].fd = open_file_readonly(filename);
+		found |= psi[r].fd >= 0;
+	}
+
+	// Kernels without CONFIG_PSI (or with psi=0) don't have these files
+	if (!found) {
+		free(psi);
+		return;
+	}
+	system->psi = psi;
+}
+
+void psi_delete(struct system_t *system)
+{
+	if (system->psi)
+		for (int r = 0; r < PSI_RESOURCE_COUNT; ++r)
+			close_fd(system->psi[r].fd);
+	for (int i = 0; i < system->psi_trigger_count; ++i)
+		close_fd(system->psi_triggers[i].fd);
+	free(system->psi);
+	free(system->psi_triggers);
+}
+
+int psi_add_trigger(struct system_t *system, const char *trigger)
+{
+	// Split "memory some 150000 1000000" into the resource and the
+	// part that is passed to the kernel
+	int resource = -1;
+	for (int r = 0; r < PSI_RESOURCE_COUNT; ++r) {
+		int len = strlen(resource_names[r]);
+		if (!strncmp(trigger, resource_names[r], len) && trigger[len] == ' ') {
+			resource = r;
+			trigger += len + 1;
+			break;
+		}
+	}
+	if (resource == -1)
+		return 1;
+
+	char filename[PATH_MAX];
+	int len = system_path(system, filename, PRESSURE_DIR);
+	strcpy(filename + len, resource_names[resource]);
+	int fd = open(filename, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return 2;
+	// The kernel validates the trigger and keeps it until fd is closed
+	if (write(fd, trigger, strlen(trigger) + 1) < 0) {
+		close_fd(fd);
+		return 3;
+	}
+
+	system->psi_triggers = (struct psi_trigger_t *)realloc(
+			system->psi_triggers, sizeof(struct psi_trigger_t) *
+			(system->psi_trigger_count + 1));
+	struct psi_trigger_t *t = &system->psi_triggers[system->psi_trigger_count++];
+	t->resource = resource;
+	t->fd = fd;
+	return 0;
+}
+
+// Parse "avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+static void psi_parse_stats(const char *line, struct psi_stats_t *stats,
+		double elapsed)
+{
+	char *end;
+	unsigned long long total = stats->total;
+	for (const char *s = line; *s && *s != '\n'; s = end) {
+		const char *value = strchr(s, '=');
+		if (value == NULL)
+			break;
+		++value;
+		if (!strncmp(s, "avg10=", 6))
+			stats->avg10 = strtod(value, &end);
+		else if (!strncmp(s, "avg60=", 6))
+			stats->avg60 = strtod(value, &end);
+		else if (!strncmp(s, "avg300=", 7))
+			stats->avg300 = strtod(value, &end);
+		else if (!strncmp(s, "total=", 6))
+			total = strtoull(value, &end, 10);
+		else
+			strtod(value, &end);
+		if (end == value)
+			break;
+		while (*end == ' ')
+			++end;
+	}
+
+	stats->stall = stats->total ? counter_rate(
+			counter_delta(total, stats->total), elapsed * 1000000.0) : 0.0;
+	// Make sure the value is in [0.0, 1.0]
+	if (!(stats->stall >= 0.0))
+		stats->stall = 0.0;
+	else if (stats->stall > 1.0)
+		stats->stall = 1.0;
+	stats->total = total;
+}
+
+void psi_refresh(struct system_t *system)
+{
+	if (system->psi == NULL)
+		return;
+
+	for (int r = 0; r < PSI_RESOURCE_COUNT; ++r) {
+		struct psi_t *psi = &system->psi[r];
+		if (psi->fd < 0)
+			continue;
+
+		char buffer[256];
+		int bytes = read_fd_to_string(psi->fd, buffer, sizeof(buffer) - 1);
+		if (bytes <= 0)
+			continue;
+		buffer[bytes] = '\0';
+
+		for (const char *line = buffer; line; line = strchr(line, '\n')) {
+			if (*line == '\n')
+				++line;
+			if (!strncmp(line, "some ", 5))
+				psi_parse_stats(line + 5, &psi->some, system->elapsed);
+			else if (!strncmp(line, "full ", 5))
+				psi_parse_stats(line + 5, &psi->full, system->elapsed);
+		}
+	}
+}
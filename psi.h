@@ -0,0 +1,55 @@
+#ifndef PSI_H_INCLUDED
+#define PSI_H_INCLUDED
+
+// Resources with pressure stall information in /proc/pressure/
+enum {
+	PSI_CPU = 0,
+	PSI_MEMORY = 1,
+	PSI_IO = 2,
+	PSI_RESOURCE_COUNT = 3
+};
+
+struct system_t;
+
+/** One line of a /proc/pressure/ file */
+struct psi_stats_t
+{
+	double avg10; /**< Percentage of time stalled over the last 10s */
+	double avg60; /**< Percentage of time stalled over the last 60s */
+	double avg300; /**< Percentage of time stalled over the last 300s */
+	unsigned long long total; /**< Total stall time in us */
+	double stall; /**< Fraction of time stalled since last checked [0.0, 1.0] */
+};
+
+/** Pressure stall information for a resource */
+struct psi_t
+{
+	struct psi_stats_t some; /**< Some tasks were stalled */
+	struct psi_stats_t full; /**< All non-idle tasks were stalled */
+
+	// File descriptors for files that are kept open
+	int fd;
+};
+
+/** A PSI trigger registered with the kernel */
+struct psi_trigger_t
+{
+	int resource; /**< PSI_CPU, PSI_MEMORY or PSI_IO */
+	int fd; /**< Polls with POLLPRI when the threshold is crossed */
+};
+
+/** Open the files in /proc/pressure/ */
+void psi_init(struct system_t *system);
+
+/** Register a trigger like "memory some 150000 1000000" (resource,
+ * some/full, stall time in us and window in us).
+ * Returns 0 on success */
+int psi_add_trigger(struct system_t *system, const char *trigger);
+
+/** Read the pressure stall information for all resources */
+void psi_refresh(struct system_t *system);
+
+/** Close all PSI files and free the memory */
+void psi_delete(struct system_t *system);
+
+#endif
@@ -0,0 +1,390 @@
+#define _XOPEN_SOURCE 700
+
+#include "../binlog.h"
+#include "../rrd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#define error(...) { fprintf(stderr, __VA_ARGS__); exit(-1); }
+
+#define MAX_PATTERNS 64
+
+// Parse seconds since the epoch or a local "YYYY-MM-DD[ HH:MM[:SS]]"
+static long long parse_time(const char *s)
+{
+	char *end;
+	double seconds = strtod(s, &end);
+	if (end != s && *end == '\0')
+		return seconds * 1e9;
+
+	static const char * const formats[] = {
+		"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d"
+	};
+	for (int f = 0; f < 3; ++f) {
+		struct tm tm;
+		memset(&tm, 0, sizeof(tm));
+		const char *rest = strptime(s, formats[f], &tm);
+		if (rest && *rest == '\0') {
+			tm.tm_isdst = -1;
+			return mktime(&tm) * 1000000000LL;
+		}
+	}
+	error("Invalid time %s\n", s);
+}
+
+static void print_time(long long time_ns)
+{
+	time_t seconds = time_ns / 1000000000;
+	struct tm tm;
+	localtime_r(&seconds, &tm);
+	char buffer[32];
+	strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+	printf("%s.%03d", buffer, (int)(time_ns % 1000000000 / 1000000));
+}
+
+// Print ",value" with as few digits as read back to the same double
+static void print_value(double value)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.15g", value);
+	if (strtod(buffer, NULL) != value)
+		snprintf(buffer, sizeof(buffer), "%.17g", value);
+	printf(",%s", buffer);
+}
+
+/** A bucket of downsampled values */
+struct bucket_t
+{
+	long long index; /**< The start time is index * step */
+	long long count; /**< The number of rows in the bucket */
+	struct binlog_summary_t *columns; /**< One per selected column */
+};
+
+static void bucket_print(const struct bucket_t *bucket, int column_count,
+		long long step)
+{
+	if (bucket->count == 0)
+		return;
+	print_time(bucket->index * step);
+	for (int c = 0; c < column_count; ++c) {
+		print_value(bucket->columns[c].min);
+		print_value(bucket->columns[c].sum / bucket->count);
+		print_value(bucket->columns[c].max);
+	}
+	printf("\n");
+}
+
+static void bucket_reset(struct bucket_t *bucket, long long index,
+		int column_count)
+{
+	bucket->index = index;
+	bucket->count = 0;
+	for (int c = 0; c < column_count; ++c) {
+		bucket->columns[c].min = INFINITY;
+		bucket->columns[c].max = -INFINITY;
+		bucket->columns[c].sum = 0.0;
+	}
+}
+
+// Add a summary of count rows to a bucket column
+static void bucket_merge(struct binlog_summary_t *column,
+		const struct binlog_summary_t *s)
+{
+	if (s->min < column->min)
+		column->min = s->min;
+	if (s->max > column->max)
+		column->max = s->max;
+	column->sum += s->sum;
+}
+
+// Is the column called name with index c selected by the patterns
+static int column_selected(const char *name, int c,
+		const char * const *patterns, int pattern_count)
+{
+	int selected = pattern_count == 0;
+	for (int p = 0; p < pattern_count && !selected; ++p) {
+		char *end;
+		long index = strtol(patterns[p], &end, 10);
+		selected = *end == '\0' ? index == c :
+			strstr(name, patterns[p]) != NULL;
+	}
+	return selected;
+}
+
+// Print the slots of a retention tier file from the oldest to the
+// newest. Every slot is already a min/avg/max summary of its step
+static void query_rrd(const struct rrd_reader_t *rrd, int list,
+		const char * const *patterns, int pattern_count,
+		long long from, long long to, long long step,
+		int filter, double above)
+{
+	const long long newest = rrd_newest_slot(rrd);
+	if (list) {
+		for (int c = 0; c < rrd->column_count; ++c)
+			printf("%3d %s\n", c, rrd_column_name(rrd, c));
+		printf("%lld slots of %gs\n", rrd->slot_count, rrd->step / 1e9);
+		if (newest >= 0) {
+			printf("Up to ");
+			print_time(rrd_slot(rrd, newest)->time);
+			printf("\n");
+		}
+		return;
+	}
+
+	int *columns = (int *)malloc(sizeof(int) * rrd->column_count);
+	int column_count = 0;
+	for (int c = 0; c < rrd->column_count; ++c)
+		if (column_selected(rrd_column_name(rrd, c), c, patterns,
+					pattern_count))
+			columns[column_count++] = c;
+	if (column_count == 0)
+		error("No such columns\n");
+
+	printf("Time");
+	for (int c = 0; c < column_count; ++c) {
+		const char *name = rrd_column_name(rrd, columns[c]);
+		printf(",%s min,%s avg,%s max", name, name, name);
+	}
+	printf("\n");
+
+	// Steps are merged into buckets only when downsampling further
+	if (step < rrd->step)
+		step = rrd->step;
+	struct bucket_t bucket;
+	bucket.columns = (struct binlog_summary_t *)malloc(
+			sizeof(struct binlog_summary_t) * column_count);
+	bucket_reset(&bucket, -1, column_count);
+
+	// Slots older than slot_count steps before the newest one
+	// were not overwritten only because nothing was logged since
+	const long long oldest_time = newest < 0 ? 0 :
+		rrd_slot(rrd, newest)->time - (rrd->slot_count - 1) * rrd->step;
+	for (long long i = 1; newest >= 0 && i <= rrd->slot_count; ++i) {
+		const struct rrd_slot_t *slot =
+			rrd_slot(rrd, (newest + i) % rrd->slot_count);
+		if (slot->count == 0 || slot->time < oldest_time ||
+				(from != -1 && slot->time < from) ||
+				(to != -1 && slot->time > to))
+			continue;
+		const struct binlog_summary_t *summaries = rrd_slot_summaries(slot);
+		if (filter) {
+			int skip = 1;
+			for (int c = 0; c < column_count && skip; ++c)
+				skip = summaries[columns[c]].max <= above;
+			if (skip)
+				continue;
+		}
+		if (slot->time / step != bucket.index) {
+			bucket_print(&bucket, column_count, step);
+			bucket_reset(&bucket, slot->time / step, column_count);
+		}
+		for (int c = 0; c < column_count; ++c)
+			bucket_merge(&bucket.columns[c], &summaries[columns[c]]);
+		bucket.count += slot->count;
+	}
+	bucket_print(&bucket, column_count, step);
+
+	free(bucket.columns);
+	free(columns);
+}
+
+int main(int argc, char **argv)
+{
+	const char *filename = NULL;
+	const char *patterns[MAX_PATTERNS];
+	int pattern_count = 0;
+	int list = 0;
+	long long from = -1, to = -1;
+	long long step = 0;
+	int filter = 0;
+	double above = 0.0;
+
+	// Parse command line arguments
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+			printf(
+					"Usage: %s [options] file\n"
+					"Read a binary log written by smon -f binary\n"
+					"or a retention tier file written by smon -f rrd\n"
+					"-h --help               Print this help message\n"
+					"-l --list               List the columns and the time range\n"
+					"-c --column NAME        Only output columns whose name contains NAME\n"
+					"                        or with index NAME (can be repeated)\n"
+					"-f --from TIME          Start at TIME, in seconds since the epoch\n"
+					"                        or as local \"YYYY-MM-DD[ HH:MM[:SS]]\"\n"
+					"-t --to TIME            End at TIME\n"
+					"-s --step SECONDS       Downsample to the min, average and max of\n"
+					"                        every SECONDS\n"
+					"-a --above VALUE        Only output rows where a column is above VALUE\n",
+					argv[0]);
+			return 0;
+		} else if (!strcmp(arg, "-l") || !strcmp(arg, "--list")) {
+			list = 1;
+		} else if (i + 1 == argc && arg[0] != '-') {
+			filename = arg;
+		} else if (i + 1 == argc) {
+			error("Value required after %s\n", arg);
+		} else if (!strcmp(arg, "-c") || !strcmp(arg, "--column")) {
+			if (pattern_count == MAX_PATTERNS)
+				error("Too many columns\n");
+			patterns[pattern_count++] = argv[++i];
+		} else if (!strcmp(arg, "-f") || !strcmp(arg, "--from")) {
+			from = parse_time(argv[++i]);
+		} else if (!strcmp(arg, "-t") || !strcmp(arg, "--to")) {
+			to = parse_time(argv[++i]);
+		} else if (!strcmp(arg, "-s") || !strcmp(arg, "--step")) {
+			step = atof(argv[++i]) * 1e9;
+			if (step <= 0)
+				error("Invalid step %s\n", argv[i]);
+		} else if (!strcmp(arg, "-a") || !strcmp(arg, "--above")) {
+			filter = 1;
+			above = atof(argv[++i]);
+		} else {
+			error("Unknown argument %s. Try %s --help\n", arg, argv[0]);
+		}
+	}
+	if (filename == NULL)
+		error("File name required. Try %s --help\n", argv[0]);
+	struct rrd_reader_t rrd;
+	if (rrd_reader_open(&rrd, filename) == 0) {
+		query_rrd(&rrd, list, patterns, pattern_count, from, to, step,
+				filter, above);
+		rrd_reader_close(&rrd);
+		return 0;
+	}
+	if (filter && step)
+		error("--above can't be used with --step\n");
+
+	struct binlog_reader_t log;
+	if (binlog_open(&log, filename))
+		error("Failed to open %s as an smon binary log\n", filename);
+
+	if (list) {
+		for (int c = 0; c < log.column_count; ++c)
+			printf("%3d %s\n", c, binlog_column_name(&log, c));
+		long long last = log.block_count - 1;
+		while (last >= 0 && binlog_block_rows(&log, last) == 0)
+			--last;
+		if (last >= 0) {
+			printf("From ");
+			print_time(binlog_block(&log, 0)->first_time);
+			printf(" to ");
+			print_time(binlog_row_time(&log, binlog_block(&log, last),
+						binlog_block_rows(&log, last) - 1));
+			printf(", %lld blocks\n", last + 1);
+		}
+		binlog_reader_close(&log);
+		return 0;
+	}
+
+	// Select the columns
+	int *columns = (int *)malloc(sizeof(int) * log.column_count);
+	int column_count = 0;
+	for (int c = 0; c < log.column_count; ++c)
+		if (column_selected(binlog_column_name(&log, c), c, patterns,
+					pattern_count))
+			columns[column_count++] = c;
+	if (column_count == 0)
+		error("No such columns\n");
+
+	printf("Time");
+	for (int c = 0; c < column_count; ++c) {
+		const char *name = binlog_column_name(&log, columns[c]);
+		if (step)
+			printf(",%s min,%s avg,%s max", name, name, name);
+		else
+			printf(",%s", name);
+	}
+	printf("\n");
+
+	struct bucket_t bucket;
+	bucket.columns = (struct binlog_summary_t *)malloc(
+			sizeof(struct binlog_summary_t) * column_count);
+	bucket_reset(&bucket, -1, column_count);
+
+	// Find the first block with the binary search, then
+	// go on until a block starts after the end
+	for (long long b = from == -1 ? 0 : binlog_find_block(&log, from);
+			b < log.block_count; ++b) {
+		const struct binlog_block_t *block = binlog_block(&log, b);
+		const int rows = binlog_block_rows(&log, b);
+		if (rows == 0)
+			continue;
+		if (to != -1 && block->first_time > to)
+			break;
+		const struct binlog_summary_t *summaries = binlog_block_summaries(block);
+		const int whole = rows == (int)block->row_count &&
+			(from == -1 || block->first_time >= from) &&
+			(to == -1 || block->last_time <= to);
+
+		// Skip blocks where no column is above the limit
+		if (filter) {
+			int skip = 1;
+			for (int c = 0; c < column_count && skip; ++c)
+				skip = summaries[columns[c]].max <= above;
+			if (skip)
+				continue;
+		}
+
+		// Use the summaries if the whole block is in one bucket
+		if (step && whole && block->first_time / step ==
+				block->last_time / step) {
+			if (block->first_time / step != bucket.index) {
+				bucket_print(&bucket, column_count, step);
+				bucket_reset(&bucket, block->first_time / step, column_count);
+			}
+			for (int c = 0; c < column_count; ++c)
+				bucket_merge(&bucket.columns[c], &summaries[columns[c]]);
+			bucket.count += rows;
+			continue;
+		}
+
+		for (int r = 0; r < rows; ++r) {
+			const long long time = binlog_row_time(&log, block, r);
+			if ((from != -1 && time < from) || (to != -1 && time > to))
+				continue;
+			const double *values = binlog_row_values(&log, block, r);
+
+			if (step) {
+				if (time / step != bucket.index) {
+					bucket_print(&bucket, column_count, step);
+					bucket_reset(&bucket, time / step, column_count);
+				}
+				for (int c = 0; c < column_count; ++c) {
+					const double v = values[columns[c]];
+					if (v < bucket.columns[c].min)
+						bucket.columns[c].min = v;
+					if (v > bucket.columns[c].max)
+						bucket.columns[c].max = v;
+					bucket.columns[c].sum += v;
+				}
+				++bucket.count;
+				continue;
+			}
+
+			if (filter) {
+				int skip = 1;
+				for (int c = 0; c < column_count && skip; ++c)
+					skip = values[columns[c]] <= above;
+				if (skip)
+					continue;
+			}
+			print_time(time);
+			for (int c = 0; c < column_count; ++c)
+				print_value(values[columns[c]]);
+			printf("\n");
+		}
+	}
+	if (step)
+		bucket_print(&bucket, column_count, step);
+
+	free(bucket.columns);
+	free(columns);
+	binlog_reader_close(&log);
+	return 0;
+}
@@ -0,0 +1,529 @@
+#define _XOPEN_SOURCE 700
+
+#include "replay.h"
+#include "logger.h"
+#include "system.h"
+#include "cpu.h"
+#include "disk.h"
+#include "interface.h"
+#include "battery.h"
+#include "cgroup.h"
+#include "psi.h"
+#include "numa.h"
+#include "vmstat.h"
+#include "overhead.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+
+// Don't show more frames per second than this, however fast the replay
+#define REPLAY_MIN_FRAME_NS (40 * 1000000LL)
+
+static const int speeds[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+
+// Find the device called name in an array of count structs that start
+// with their name. It's usually the one after the last match, so start
+// looking there. If add is set, a missing device is added at the end
+static char *replay_device(char *array, int *count, int element_size,
+		int *cursor, const char *name, int add)
+{
+	for (int i = 0; i < *count; ++i) {
+		const int d = (*cursor + i) % *count;
+		char *device = array + (size_t)d * element_size;
+		if (!strcmp(device, name)) {
+			*cursor = d + 1;
+			return device;
+		}
+	}
+	if (!add)
+		return NULL;
+	char *device = array + (size_t)*count * element_size;
+	// The name fits, logger_parse_title() checks its length
+	memcpy(device, name, strlen(name) + 1);
+	++*count;
+	return device;
+}
+
+// The NUMA node with the given ID in the nodes ordered by ID. If add is
+// set, a missing node is inserted
+static struct numa_node_t *replay_node(struct system_t *system, int id,
+		int add)
+{
+	int n = 0;
+	while (n < system->numa_node_count && system->numa_nodes[n].id < id)
+		++n;
+	if (n < system->numa_node_count && system->numa_nodes[n].id == id)
+		return &system->numa_nodes[n];
+	if (!add)
+		return NULL;
+	memmove(&system->numa_nodes[n + 1], &system->numa_nodes[n],
+			sizeof(struct numa_node_t) * (system->numa_node_count - n));
+	memset(&system->numa_nodes[n], 0, sizeof(struct numa_node_t));
+	system->numa_nodes[n].id = id;
+	++system->numa_node_count;
+	return &system->numa_nodes[n];
+}
+
+// Add the CPU, node or device of stat to system, or find it if add isn't
+// set, and point column at the value of stat. Rates are logged per
+// second and usage in percent, as in logger.c
+static void replay_map(struct system_t *system, const struct logger_stat_t *stat,
+		struct replay_column_t *column, int add, int *cursors)
+{
+	const int type = stat->type;
+	column->type = REPLAY_DOUBLE;
+	column->target = NULL;
+	column->scale = 1.0;
+
+	if (type <= LOGGER_CPU_IPC) {
+		const int c = stat->data.cpu_id;
+		if (add) {
+			if (c >= system->cpu_count)
+				system->cpu_count = c + 1;
+			if (type >= LOGGER_CPU_CONTEXT_SWITCHES)
+				system->perf_cpu_count = 1;
+			return;
+		}
+		struct cpu_t *cpu = &system->cpus[c];
+		if (type == LOGGER_CPU_FREQUENCY) {
+			column->type = REPLAY_INT;
+			column->target = &system->cpu_counters->freq[c];
+		} else if (type == LOGGER_CPU_USAGE) {
+			column->target = &system->cpu_counters->usage[c];
+			column->scale = 0.01;
+		} else if (type == LOGGER_CPU_TEMPERATURE) {
+			column->type = REPLAY_INT;
+			column->target = &cpu->cur_temp;
+			column->scale = 1000.0;
+		} else if (type == LOGGER_CPU_IPC) {
+			column->target = &cpu->ipc;
+		} else {
+			column->target = &cpu->perf_rate[PERF_CONTEXT_SWITCHES +
+				type - LOGGER_CPU_CONTEXT_SWITCHES];
+		}
+	} else if (type == LOGGER_RAM_USED || type == LOGGER_RAM_BUFFERS ||
+			type == LOGGER_RAM_CACHED) {
+		column->type = REPLAY_LONG_LONG;
+		column->target = type == LOGGER_RAM_USED ? &system->ram_used :
+			type == LOGGER_RAM_BUFFERS ? &system->ram_buffers :
+			&system->ram_cached;
+	} else if (type >= LOGGER_VM_PAGE_IN && type <= LOGGER_VM_OOM_KILLS) {
+		// Only set so that the rates are shown, it is never read or closed
+		system->vmstat->fd = 0;
+		column->target = &system->vmstat->rates[type - LOGGER_VM_PAGE_IN];
+	} else if (type >= LOGGER_NODE_USED && type <= LOGGER_NODE_FOREIGN) {
+		struct numa_node_t *node = replay_node(system, stat->data.node_id, add);
+		if (add)
+			return;
+		column->type = REPLAY_LONG_LONG;
+		if (type == LOGGER_NODE_USED) {
+			column->target = &node->mem_used;
+		} else if (type == LOGGER_NODE_FREE) {
+			column->target = &node->mem_free;
+		} else if (type == LOGGER_NODE_CACHED) {
+			column->target = &node->mem_cached;
+		} else {
+			column->type = REPLAY_DOUBLE;
+			if (type == LOGGER_NODE_CPU) {
+				column->target = &node->cpu_usage;
+				column->scale = 0.01;
+			} else {
+				column->target = &node->stats_rate[type == LOGGER_NODE_MISS ?
+					NUMA_MISS : NUMA_FOREIGN];
+			}
+		}
+	} else if (type == LOGGER_DISK_READ || type == LOGGER_DISK_WRITE) {
+		struct disk_t *disk = (struct disk_t *)replay_device(
+				(char *)system->disks, &system->disk_count,
+				sizeof(struct disk_t), &cursors[0], stat->data.disk_name,
+				add);
+		// The logger writes bytes, the disks count sectors
+		column->target = &disk->stats_rate[type == LOGGER_DISK_READ ?
+			DISK_READ_SECTORS : DISK_WRITE_SECTORS];
+		column->scale = 1.0 / DISK_SECTOR_SIZE;
+	} else if (type == LOGGER_IFACE_READ || type == LOGGER_IFACE_WRITE) {
+		struct interface_t *interface = (struct interface_t *)replay_device(
+				(char *)system->interfaces, &system->interface_count,
+				sizeof(struct interface_t), &cursors[1], stat->data.iface_name,
+				add);
+		column->target = type == LOGGER_IFACE_READ ?
+			&interface->rx_rate : &interface->tx_rate;
+	} else if (type >= LOGGER_BAT_CHARGE && type <= LOGGER_BAT_VOLTAGE) {
+		struct battery_t *battery = (struct battery_t *)replay_device(
+				(char *)system->batteries, &system->battery_count,
+				sizeof(struct battery_t), &cursors[2], stat->data.battery_name,
+				add);
+		column->type = REPLAY_INT;
+		column->target = type == LOGGER_BAT_CHARGE ? &battery->charge :
+			type == LOGGER_BAT_CURRENT ? &battery->current :
+			&battery->voltage;
+	} else if (type >= LOGGER_CGROUP_CPU && type <= LOGGER_CGROUP_WRITE) {
+		struct cgroup_t *cgroup = (struct cgroup_t *)replay_device(
+				(char *)system->cgroups, &system->cgroup_count,
+				sizeof(struct cgroup_t), &cursors[3], stat->data.cgroup_name,
+				add);
+		if (type == LOGGER_CGROUP_CPU) {
+			column->target = &cgroup->cpu_usage;
+			column->scale = 0.01;
+		} else if (type == LOGGER_CGROUP_MEMORY) {
+			column->type = REPLAY_LONG_LONG;
+			column->target = &cgroup->memory_current;
+		} else {
+			column->target = type == LOGGER_CGROUP_READ ?
+				&cgroup->read_rate : &cgroup->write_rate;
+		}
+	} else if (type == LOGGER_PSI_SOME || type == LOGGER_PSI_FULL) {
+		if (add) {
+			if (system->psi == NULL)
+				system->psi = (struct psi_t *)calloc(PSI_RESOURCE_COUNT,
+						sizeof(struct psi_t));
+			return;
+		}
+		struct psi_t *psi = &system->psi[stat->data.psi_resource];
+		column->target = type == LOGGER_PSI_SOME ?
+			&psi->some.stall : &psi->full.stall;
+		column->scale = 0.01;
+	}
+	// The interrupts, the watched processes and the cost of smon
+	// aren't shown from logs
+	if (column->target == NULL)
+		column->type = REPLAY_SKIP;
+}
+
+// The row after *block, *row. Returns 0 at the end of the log
+static int replay_next_row(const struct replay_t *replay, long long *block,
+		int *row)
+{
+	if (*row + 1 < binlog_block_rows(&replay->log, *block)) {
+		++*row;
+		return 1;
+	}
+	if (*block + 1 < replay->log.block_count &&
+			binlog_block_rows(&replay->log, *block + 1) > 0) {
+		++*block;
+		*row = 0;
+		return 1;
+	}
+	return 0;
+}
+
+static long long replay_row_time(const struct replay_t *replay,
+		long long block, int row)
+{
+	return binlog_row_time(&replay->log,
+			binlog_block(&replay->log, block), row);
+}
+
+// Write a row to system
+static void replay_show(struct replay_t *replay, struct system_t *system,
+		long long block, int row)
+{
+	const struct binlog_block_t *b = binlog_block(&replay->log, block);
+	const double *values = binlog_row_values(&replay->log, b, row);
+	for (int c = 0; c < replay->log.column_count; ++c) {
+		const struct replay_column_t *column = &replay->columns[c];
+		const double value = values[c] * column->scale;
+		if (column->type == REPLAY_INT)
+			*(int *)column->target = value;
+		else if (column->type == REPLAY_LONG_LONG)
+			*(long long *)column->target = value;
+		else if (column->type == REPLAY_DOUBLE)
+			*(double *)column->target = value;
+	}
+
+	replay->block = block;
+	replay->row = row;
+	const long long time = binlog_row_time(&replay->log, b, row);
+	long long previous = time;
+	if (row > 0)
+		previous = replay_row_time(replay, block, row - 1);
+	else if (block > 0)
+		previous = replay_row_time(replay, block - 1,
+				binlog_block_rows(&replay->log, block - 1) - 1);
+	replay->time = time;
+	system->timestamp = time;
+	system->elapsed = (time - previous) / 1e9;
+}
+
+// Find the last row at or before time_ns, or the first row
+static void replay_find(const struct replay_t *replay, long long time_ns,
+		long long *block, int *row)
+{
+	const struct binlog_reader_t *log = &replay->log;
+	long long b = binlog_find_block(log, time_ns);
+	int rows = b < log->block_count ? binlog_block_rows(log, b) : 0;
+	if (rows == 0) {
+		// After the last row. Blocks after it don't have rows yet
+		for (b = log->block_count - 1; b > 0 &&
+				binlog_block_rows(log, b) == 0; --b)
+			;
+		*block = b;
+		*row = binlog_block_rows(log, b) - 1;
+		return;
+	}
+
+	// The first row after time_ns, which is in the block since
+	// the block ends at or after it
+	const struct binlog_block_t *header = binlog_block(log, b);
+	int low = 0, high = rows;
+	while (low < high) {
+		const int mid = low + (high - low) / 2;
+		if (binlog_row_time(log, header, mid) <= time_ns)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low > 0) {
+		*block = b;
+		*row = low - 1;
+	} else if (b > 0) {
+		*block = b - 1;
+		*row = binlog_block_rows(log, b - 1) - 1;
+	} else {
+		*block = 0;
+		*row = 0;
+	}
+}
+
+// The time of the log that is due at now_ns
+static long long replay_position(const struct replay_t *replay,
+		long long now_ns)
+{
+	if (replay->paused)
+		return replay->anchor_time;
+	const long long position = replay->anchor_time +
+		(now_ns - replay->anchor_ns) * replay->speed;
+	return position < replay->last_time ? position : replay->last_time;
+}
+
+int replay_open(struct replay_t *replay, const char *filename,
+		struct system_t *system)
+{
+	struct binlog_reader_t *log = &replay->log;
+	if (binlog_open(log, filename))
+		return 1;
+	if (log->block_count == 0 || binlog_block_rows(log, 0) == 0) {
+		binlog_reader_close(log);
+		return 2;
+	}
+
+	memset(system, 0, sizeof(struct system_t));
+	// Everything that is in the log is shown
+	system->collectors = ~0u;
+	system->vmstat = (struct vmstat_t *)calloc(1, sizeof(struct vmstat_t));
+	system->vmstat->fd = -1;
+	system->overhead = (struct overhead_t *)malloc(sizeof(struct overhead_t));
+	overhead_init(system->overhead);
+	system->proc_stat_fd = -1;
+	system->meminfo_fd = -1;
+
+	// Parse the columns and count how many of each kind there are
+	const int column_count = log->column_count;
+	struct logger_stat_t *stats = (struct logger_stat_t *)malloc(
+			sizeof(struct logger_stat_t) * column_count);
+	replay->columns = (struct replay_column_t *)calloc(column_count,
+			sizeof(struct replay_column_t));
+	char *parsed = (char *)calloc(column_count, 1);
+	int nodes = 0, disks = 0, interfaces = 0, batteries = 0, cgroups = 0;
+	for (int c = 0; c < column_count; ++c) {
+		char title[BINLOG_NAME_LENGTH];
+		strncpy(title, binlog_column_name(log, c), BINLOG_NAME_LENGTH - 1);
+		title[BINLOG_NAME_LENGTH - 1] = '\0';
+		parsed[c] = !logger_parse_title(title, &stats[c]);
+		if (!parsed[c])
+			continue;
+		const int type = stats[c].type;
+		nodes += type >= LOGGER_NODE_USED && type <= LOGGER_NODE_FOREIGN;
+		disks += type == LOGGER_DISK_READ || type == LOGGER_DISK_WRITE;
+		interfaces += type == LOGGER_IFACE_READ || type == LOGGER_IFACE_WRITE;
+		batteries += type >= LOGGER_BAT_CHARGE && type <= LOGGER_BAT_VOLTAGE;
+		cgroups += type >= LOGGER_CGROUP_CPU && type <= LOGGER_CGROUP_WRITE;
+	}
+	system->numa_nodes = (struct numa_node_t *)calloc(nodes + 1,
+			sizeof(struct numa_node_t));
+	system->disks = (struct disk_t *)calloc(disks + 1, sizeof(struct disk_t));
+	system->max_disk_count = disks;
+	system->interfaces = (struct interface_t *)calloc(interfaces + 1,
+			sizeof(struct interface_t));
+	system->max_interface_count = interfaces;
+	system->batteries = (struct battery_t *)calloc(batteries + 1,
+			sizeof(struct battery_t));
+	system->max_battery_count = batteries;
+	system->cgroups = (struct cgroup_t *)calloc(cgroups + 1,
+			sizeof(struct cgroup_t));
+	system->max_cgroup_count = cgroups;
+
+	// Add the CPUs, nodes and devices, then point the columns at them
+	int cursors[4] = { 0 };
+	for (int c = 0; c < column_count; ++c)
+		if (parsed[c])
+			replay_map(system, &stats[c], &replay->columns[c], 1, cursors);
+	system->cpus = (struct cpu_t *)calloc(system->cpu_count + 1,
+			sizeof(struct cpu_t));
+	for (int c = 0; c < system->cpu_count; ++c) {
+		system->cpus[c].id = c;
+		system->cpus[c].core_id = c;
+		system->cpus[c].node = -1;
+	}
+	if (system->perf_cpu_count)
+		system->perf_cpu_count = system->cpu_count;
+	system->cpu_counters = (struct cpu_counters_t *)malloc(
+			sizeof(struct cpu_counters_t));
+	cpu_counters_init(system->cpu_counters, system->cpus, system->cpu_count);
+	memset(cursors, 0, sizeof(cursors));
+	for (int c = 0; c < column_count; ++c)
+		if (parsed[c])
+			replay_map(system, &stats[c], &replay->columns[c], 0, cursors);
+	free(stats);
+	free(parsed);
+
+	long long last_block;
+	int last_row;
+	replay_find(replay, LLONG_MAX, &last_block, &last_row);
+	replay->first_time = replay_row_time(replay, 0, 0);
+	replay->last_time = replay_row_time(replay, last_block, last_row);
+
+	replay->speed = 1;
+	replay->paused = 0;
+	replay->anchor_time = replay->first_time;
+	replay->anchor_ns = monotonic_ns();
+	replay->shown_ns = replay->anchor_ns;
+	replay_show(replay, system, 0, 0);
+	return 0;
+}
+
+void replay_close(struct replay_t *replay, struct system_t *system)
+{
+	binlog_reader_close(&replay->log);
+	free(replay->columns);
+	free(system->cpus);
+	cpu_counters_delete(system->cpu_counters);
+	free(system->cpu_counters);
+	free(system->numa_nodes);
+	free(system->disks);
+	free(system->interfaces);
+	free(system->batteries);
+	free(system->cgroups);
+	free(system->psi);
+	free(system->vmstat);
+	free(system->overhead);
+}
+
+void replay_seek(struct replay_t *replay, struct system_t *system,
+		long long time_ns, long long now_ns)
+{
+	if (time_ns < replay->first_time)
+		time_ns = replay->first_time;
+	if (time_ns > replay->last_time)
+		time_ns = replay->last_time;
+	long long block;
+	int row;
+	replay_find(replay, time_ns, &block, &row);
+	replay_show(replay, system, block, row);
+	replay->anchor_time = time_ns;
+	replay->anchor_ns = now_ns;
+	replay->shown_ns = now_ns;
+}
+
+void replay_update(struct replay_t *replay, struct system_t *system,
+		long long now_ns)
+{
+	if (replay->paused)
+		return;
+	const long long position = replay_position(replay, now_ns);
+	long long block = replay->block;
+	int row = replay->row;
+	if (position < replay->time ||
+			position > binlog_block(&replay->log, block)->last_time) {
+		// Back or far ahead, search instead of going through the rows
+		replay_find(replay, position, &block, &row);
+	} else {
+		long long next_block = block;
+		int next_row = row;
+		while (replay_next_row(replay, &next_block, &next_row) &&
+				replay_row_time(replay, next_block, next_row) <= position) {
+			block = next_block;
+			row = next_row;
+		}
+	}
+	replay_show(replay, system, block, row);
+	replay->shown_ns = now_ns;
+	if (position >= replay->last_time)
+		replay_pause(replay, 1, now_ns);
+}
+
+long long replay_next_deadline(const struct replay_t *replay)
+{
+	long long block = replay->block;
+	int row = replay->row;
+	if (replay->paused || !replay_next_row(replay, &block, &row))
+		return -1;
+	const long long next = replay_row_time(replay, block, row);
+	const long long deadline = replay->anchor_ns +
+		(next - replay->anchor_time + replay->speed - 1) / replay->speed;
+	const long long earliest = replay->shown_ns + REPLAY_MIN_FRAME_NS;
+	return deadline > earliest ? deadline : earliest;
+}
+
+void replay_pause(struct replay_t *replay, int paused, long long now_ns)
+{
+	// Start over when continuing at the end
+	if (!paused && replay->paused &&
+			replay->anchor_time >= replay->last_time)
+		replay->anchor_time = replay->first_time;
+	else
+		replay->anchor_time = replay_position(replay, now_ns);
+	replay->anchor_ns = now_ns;
+	replay->paused = paused;
+}
+
+void replay_change_speed(struct replay_t *replay, int faster,
+		long long now_ns)
+{
+	const int count = sizeof(speeds) / sizeof(speeds[0]);
+	int s = 0;
+	while (s < count - 1 && speeds[s] < replay->speed)
+		++s;
+	s += faster > 0 ? 1 : -1;
+	if (s < 0 || s >= count)
+		return;
+	replay->anchor_time = replay_position(replay, now_ns);
+	replay->anchor_ns = now_ns;
+	replay->speed = speeds[s];
+}
+
+long long replay_parse_time(const struct replay_t *replay, const char *s)
+{
+	char *end;
+	const double seconds = strtod(s, &end);
+	if (end != s && *end == '\0')
+		return seconds * 1e9;
+
+	static const char * const formats[] = {
+		"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%H:%M:%S", "%H:%M"
+	};
+	for (int f = 0; f < 4; ++f) {
+		// The times of day are on the day of the shown row
+		const time_t shown = replay->time / 1000000000;
+		struct tm tm;
+		localtime_r(&shown, &tm);
+		tm.tm_sec = 0;
+		const char *rest = strptime(s, formats[f], &tm);
+		if (rest && *rest == '\0') {
+			tm.tm_isdst = -1;
+			return mktime(&tm) * 1000000000LL;
+		}
+	}
+	return -1;
+}
+
+void replay_format_time(long long time_ns, char *out)
+{
+	const time_t seconds = time_ns / 1000000000;
+	struct tm tm;
+	localtime_r(&seconds, &tm);
+	strftime(out, 20, "%Y-%m-%d %H:%M:%S", &tm);
+}
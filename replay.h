@@ -0,0 +1,93 @@
+#ifndef REPLAY_H_INCLUDED
+#define REPLAY_H_INCLUDED
+
+#include "binlog.h"
+
+/*
+ * Replay of a binary log (see binlog.h) in the place of the collectors.
+ * The columns are parsed as logger stats when the log is opened, which
+ * gives the CPUs, NUMA nodes and devices of a struct system_t, and every
+ * row that is shown is written into it. Only the stats that were logged
+ * have values, the rest stay 0.
+ *
+ * The log is mapped, so seeking is a binary search of the block headers
+ * and then of the rows of a block, and nothing that is allocated depends
+ * on the size of the file.
+ */
+
+struct system_t;
+
+#define REPLAY_MAX_SPEED 1000
+
+/** Where the value of a column goes in the struct system_t */
+struct replay_column_t
+{
+	enum {
+		REPLAY_SKIP, /**< Not shown, e.g. self_* stats */
+		REPLAY_INT,
+		REPLAY_LONG_LONG,
+		REPLAY_DOUBLE
+	} type;
+	void *target;
+	double scale; /**< The logged value is multiplied by it */
+};
+
+struct replay_t
+{
+	struct binlog_reader_t log;
+	struct replay_column_t *columns; /**< One per column of the log */
+
+	// The row that is shown
+	long long block;
+	int row;
+	long long time; /**< Its time (ns since the epoch) */
+
+	long long first_time; /**< Of the first row of the log */
+	long long last_time; /**< Of the last row of the log */
+
+	int speed; /**< Log seconds per second, 1 to REPLAY_MAX_SPEED */
+	int paused;
+	long long anchor_time; /**< The log was at anchor_time (ns) */
+	long long anchor_ns; /**< at anchor_ns of monotonic_ns() */
+	long long shown_ns; /**< When the shown row was last updated */
+};
+
+/** Map a binary log and make system hold its stats, with the first row
+ * shown and playing at 1x. Returns 0 on success, 1 if the file isn't
+ * a binary log and 2 if it has no rows */
+int replay_open(struct replay_t *replay, const char *filename,
+		struct system_t *system);
+
+/** Unmap the log and free the memory of system */
+void replay_close(struct replay_t *replay, struct system_t *system);
+
+/** Show the last row at or before time_ns (the first row if there is
+ * none), and continue playing from it */
+void replay_seek(struct replay_t *replay, struct system_t *system,
+		long long time_ns, long long now_ns);
+
+/** Show the row that is due at now_ns while playing. Pauses at the end
+ * of the log */
+void replay_update(struct replay_t *replay, struct system_t *system,
+		long long now_ns);
+
+/** When the row after the shown one is due (monotonic_ns()), or -1 if
+ * paused or at the end of the log */
+long long replay_next_deadline(const struct replay_t *replay);
+
+/** Pause or continue playing */
+void replay_pause(struct replay_t *replay, int paused, long long now_ns);
+
+/** Go to the next (faster > 0) or previous speed of 1, 2, 5, 10, ... */
+void replay_change_speed(struct replay_t *replay, int faster,
+		long long now_ns);
+
+/** Parse "YYYY-MM-DD HH:MM[:SS]" or "HH:MM[:SS]" on the day of the shown
+ * row, both local time, or seconds since the epoch. Returns the time in
+ * ns or -1 if s is neither */
+long long replay_parse_time(const struct replay_t *replay, const char *s);
+
+/** Write time_ns as local "YYYY-MM-DD HH:MM:SS" to out (20 bytes) */
+void replay_format_time(long long time_ns, char *out);
+
+#endif
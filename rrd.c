@@ -0,0 +1,261 @@
+#include "rrd.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static size_t header_size(int column_count)
+{
+	return (sizeof(struct rrd_header_t) +
+			(size_t)column_count * BINLOG_NAME_LENGTH + 7) / 8 * 8;
+}
+
+static size_t slot_size(int column_count)
+{
+	return sizeof(struct rrd_slot_t) +
+		(size_t)column_count * sizeof(struct binlog_summary_t);
+}
+
+// Parse a duration like "30d" into ns. Returns the number of
+// characters used, or 0 if it's invalid
+static int parse_duration(const char *s, long long *ns)
+{
+	char *end;
+	long long value = strtoll(s, &end, 10);
+	if (end == s || value <= 0)
+		return 0;
+	long long unit;
+	switch (*end) {
+		case 's': unit = 1; break;
+		case 'm': unit = 60; break;
+		case 'h': unit = 3600; break;
+		case 'd': unit = 86400; break;
+		case 'w': unit = 7 * 86400; break;
+		case 'y': unit = 365 * 86400; break;
+		default: return 0;
+	}
+	*ns = value * unit * 1000000000LL;
+	return end + 1 - s;
+}
+
+// Open or create the file of a tier
+static int rrd_open_tier(struct rrd_t *rrd, struct rrd_tier_t *tier,
+		const char *filename, const char * const *names)
+{
+	char *header = (char *)calloc(1, rrd->header_size);
+	struct rrd_header_t *h = (struct rrd_header_t *)header;
+	memcpy(h->magic, RRD_MAGIC, sizeof(h->magic));
+	h->version = RRD_VERSION;
+	h->column_count = rrd->column_count;
+	h->step = tier->step;
+	h->slot_count = tier->slot_count;
+	h->header_size = rrd->header_size;
+	for (int i = 0; i < rrd->column_count; ++i)
+		strncpy(header + sizeof(struct rrd_header_t) + i * BINLOG_NAME_LENGTH,
+				names[i], BINLOG_NAME_LENGTH - 1);
+
+	int ret = 0;
+	tier->fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	struct stat st;
+	if (tier->fd < 0 || fstat(tier->fd, &st)) {
+		ret = 2;
+	} else if (st.st_size > 0) {
+		// Continue an existing file, if it has the same layout
+		char *existing = (char *)malloc(rrd->header_size);
+		if (pread(tier->fd, existing, rrd->header_size, 0) !=
+				(ssize_t)rrd->header_size ||
+				memcmp(existing, header, rrd->header_size))
+			ret = 3;
+		free(existing);
+	} else {
+		// Allocate the whole file now, the slots start out as zeros
+		const off_t size = rrd->header_size + tier->slot_count * rrd->slot_size;
+		if (write_fd_at(tier->fd, header, rrd->header_size, 0) !=
+				(int)rrd->header_size || ftruncate(tier->fd, size) ||
+				posix_fallocate(tier->fd, 0, size))
+			ret = 2;
+	}
+	free(header);
+	if (ret && tier->fd >= 0) {
+		close_fd(tier->fd);
+		tier->fd = -1;
+	}
+	return ret;
+}
+
+int rrd_open(struct rrd_t *rrd, const char *basename, const char *tiers,
+		int column_count, const char * const *names)
+{
+	rrd->column_count = column_count;
+	rrd->header_size = header_size(column_count);
+	rrd->slot_size = slot_size(column_count);
+	rrd->tier_count = 0;
+
+	// Parse "1s:6h,1m:30d,..."
+	const char *s = tiers;
+	while (*s) {
+		if (rrd->tier_count == RRD_MAX_TIERS)
+			break;
+		struct rrd_tier_t *tier = &rrd->tiers[rrd->tier_count];
+		long long retention;
+		int len = parse_duration(s, &tier->step);
+		if (len == 0 || len >= (int)sizeof(tier->name) || s[len] != ':')
+			break;
+		memcpy(tier->name, s, len);
+		tier->name[len] = '\0';
+		s += len + 1;
+		if ((len = parse_duration(s, &retention)) == 0 ||
+				retention < tier->step)
+			break;
+		s += len;
+		tier->slot_count = retention / tier->step;
+		tier->fd = -1;
+		++rrd->tier_count;
+		if (*s == ',')
+			++s;
+		else if (*s)
+			break;
+	}
+	if (*s || rrd->tier_count == 0) {
+		rrd->tier_count = 0;
+		return 1;
+	}
+
+	char filename[PATH_MAX];
+	for (int t = 0; t < rrd->tier_count; ++t) {
+		struct rrd_tier_t *tier = &rrd->tiers[t];
+		tier->step_index = -1;
+		tier->slot = (struct rrd_slot_t *)calloc(1, rrd->slot_size);
+		snprintf(filename, sizeof(filename), "%s.%s", basename, tier->name);
+		int ret = rrd_open_tier(rrd, tier, filename, names);
+		if (ret) {
+			rrd->tier_count = t + 1;
+			rrd_close(rrd);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+int rrd_update(struct rrd_t *rrd, long long time_ns, const double *values)
+{
+	int ret = 0;
+	for (int t = 0; t < rrd->tier_count; ++t) {
+		struct rrd_tier_t *tier = &rrd->tiers[t];
+		struct rrd_slot_t *slot = tier->slot;
+		struct binlog_summary_t *summaries = (struct binlog_summary_t *)(slot + 1);
+		const long long step_index = time_ns / tier->step;
+		const off_t offset = rrd->header_size +
+			step_index % tier->slot_count * rrd->slot_size;
+
+		if (step_index != tier->step_index) {
+			// A new step. If smon was restarted during this step,
+			// continue with what is already in the slot
+			tier->step_index = step_index;
+			if (read_fd_at(tier->fd, slot, rrd->slot_size, offset) !=
+					(int)rrd->slot_size ||
+					slot->time != step_index * tier->step)
+				slot->count = 0;
+			slot->time = step_index * tier->step;
+		}
+
+		for (int c = 0; c < rrd->column_count; ++c) {
+			if (slot->count == 0 || values[c] < summaries[c].min)
+				summaries[c].min = values[c];
+			if (slot->count == 0 || values[c] > summaries[c].max)
+				summaries[c].max = values[c];
+			summaries[c].sum = (slot->count ? summaries[c].sum : 0.0) +
+				values[c];
+		}
+		++slot->count;
+
+		if (write_fd_at(tier->fd, slot, rrd->slot_size, offset) !=
+				(int)rrd->slot_size)
+			ret = 1;
+	}
+	return ret;
+}
+
+void rrd_close(struct rrd_t *rrd)
+{
+	for (int t = 0; t < rrd->tier_count; ++t) {
+		close_fd(rrd->tiers[t].fd);
+		free(rrd->tiers[t].slot);
+	}
+	rrd->tier_count = 0;
+}
+
+
+int rrd_reader_open(struct rrd_reader_t *reader, const char *filename)
+{
+	int fd = open_file_readonly(filename);
+	if (fd < 0)
+		return 1;
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct rrd_header_t)) {
+		close_fd(fd);
+		return 2;
+	}
+	reader->size = st.st_size;
+	void *data = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, fd, 0);
+	close_fd(fd);
+	if (data == MAP_FAILED)
+		return 3;
+	reader->data = (const char *)data;
+
+	const struct rrd_header_t *h = (const struct rrd_header_t *)data;
+	if (memcmp(h->magic, RRD_MAGIC, sizeof(h->magic)) ||
+			h->version != RRD_VERSION || h->step <= 0 || h->slot_count <= 0 ||
+			h->header_size != header_size(h->column_count) ||
+			h->header_size + h->slot_count * slot_size(h->column_count) >
+			reader->size) {
+		rrd_reader_close(reader);
+		return 4;
+	}
+	reader->column_count = h->column_count;
+	reader->header_size = h->header_size;
+	reader->slot_size = slot_size(h->column_count);
+	reader->step = h->step;
+	reader->slot_count = h->slot_count;
+	return 0;
+}
+
+void rrd_reader_close(struct rrd_reader_t *reader)
+{
+	munmap((void *)reader->data, reader->size);
+}
+
+const char *rrd_column_name(const struct rrd_reader_t *reader, int column)
+{
+	return reader->data + sizeof(struct rrd_header_t) +
+		column * BINLOG_NAME_LENGTH;
+}
+
+const struct rrd_slot_t *rrd_slot(const struct rrd_reader_t *reader,
+		long long i)
+{
+	return (const struct rrd_slot_t *)(reader->data + reader->header_size +
+			i * reader->slot_size);
+}
+
+const struct binlog_summary_t *rrd_slot_summaries(const struct rrd_slot_t *slot)
+{
+	return (const struct binlog_summary_t *)(slot + 1);
+}
+
+long long rrd_newest_slot(const struct rrd_reader_t *reader)
+{
+	long long newest = -1;
+	for (long long i = 0; i < reader->slot_count; ++i) {
+		const struct rrd_slot_t *slot = rrd_slot(reader, i);
+		if (slot->count > 0 && (newest == -1 ||
+					slot->time > rrd_slot(reader, newest)->time))
+			newest = i;
+	}
+	return newest;
+}
@@ -0,0 +1,116 @@
+#ifndef RRD_H_INCLUDED
+#define RRD_H_INCLUDED
+
+#include "binlog.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Round-robin retention tiers. Every tier is a file of a fixed size that
+ * is allocated when it is created, so disk usage never grows.
+ *
+ * A tier file starts with a struct rrd_header_t and the names of the
+ * columns (BINLOG_NAME_LENGTH bytes each), followed by slot_count slots.
+ * A slot is a struct rrd_slot_t followed by one struct binlog_summary_t
+ * (min, max and sum) per column. The samples of the step that starts at
+ * time T are consolidated into slot (T / step) % slot_count, so a slot
+ * is valid only if its time is within the last slot_count steps.
+ */
+
+#define RRD_MAGIC "SMONRRD1"
+#define RRD_VERSION 1
+#define RRD_MAX_TIERS 8
+#define RRD_DEFAULT_TIERS "1s:6h,1m:30d,1h:2y"
+
+struct rrd_header_t
+{
+	char magic[8]; /**< RRD_MAGIC */
+	uint32_t version; /**< RRD_VERSION */
+	uint32_t column_count;
+	int64_t step; /**< The time covered by a slot (ns) */
+	int64_t slot_count;
+	uint32_t header_size; /**< The offset of the first slot */
+	uint32_t reserved;
+};
+
+struct rrd_slot_t
+{
+	int64_t time; /**< The start of the step (ns since the epoch),
+					0 if the slot was never written */
+	int64_t count; /**< The number of consolidated samples */
+};
+
+/** A tier that is being written */
+struct rrd_tier_t
+{
+	char name[16]; /**< The step as given, e.g. "1m". Used as the suffix
+					 of the file name */
+	long long step; /**< ns */
+	long long slot_count;
+	int fd;
+
+	long long step_index; /**< The step in slot, -1 before the first sample */
+	struct rrd_slot_t *slot; /**< The slot that is being consolidated,
+							   followed by its summaries */
+};
+
+/** A set of retention tiers, e.g. 1s for 6h, 1m for 30d and 1h for 2y */
+struct rrd_t
+{
+	int column_count;
+	size_t header_size;
+	size_t slot_size;
+	int tier_count;
+	struct rrd_tier_t tiers[RRD_MAX_TIERS];
+};
+
+/** Open or create the tier files basename.STEP for tiers given as
+ * "STEP:RETENTION,..." (e.g. RRD_DEFAULT_TIERS), with units s, m, h, d,
+ * w and y. Existing files are continued if they have the same columns.
+ * Returns 0 on success, 1 for invalid tiers, 2 if a file can't be
+ * created and 3 if an existing file has different columns */
+int rrd_open(struct rrd_t *rrd, const char *basename, const char *tiers,
+		int column_count, const char * const *names);
+
+/** Consolidate a sample into every tier. The slots are written
+ * right away, so nothing is lost if smon stops */
+int rrd_update(struct rrd_t *rrd, long long time_ns, const double *values);
+
+/** Close the files and free the memory */
+void rrd_close(struct rrd_t *rrd);
+
+
+/** A tier file mapped for reading */
+struct rrd_reader_t
+{
+	const char *data;
+	size_t size;
+	int column_count;
+	size_t header_size;
+	size_t slot_size;
+	long long step;
+	long long slot_count;
+};
+
+/** Map a tier file. Returns 0 on success */
+int rrd_reader_open(struct rrd_reader_t *reader, const char *filename);
+
+/** Unmap the file */
+void rrd_reader_close(struct rrd_reader_t *reader);
+
+/** The name of a column */
+const char *rrd_column_name(const struct rrd_reader_t *reader, int column);
+
+/** Slot i */
+const struct rrd_slot_t *rrd_slot(const struct rrd_reader_t *reader,
+		long long i);
+
+/** The summaries of a slot, one per column */
+const struct binlog_summary_t *rrd_slot_summaries(const struct rrd_slot_t *slot);
+
+/** The index of the most recently written slot, or -1 if there is none.
+ * The slots after it (wrapping around) are the oldest */
+long long rrd_newest_slot(const struct rrd_reader_t *reader);
+
+#endif
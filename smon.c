@@ -0,0 +1,288 @@
+#include "smon.h"
+#include "smon_internal.h"
+#include "system.h"
+#include "cpu.h"
+#include "disk.h"
+#include "interface.h"
+#include "battery.h"
+#include "cgroup.h"
+#include "psi.h"
+#include "vmstat.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+// The collectors of system.c for each bit of enum smon_collector
+static const char * const collector_names[] = {
+	"cpus", "ram", "vmstat", "numa", "disks", "interfaces", "batteries",
+	"cgroups", "psi", "perf", "irqs"
+};
+
+// The size of each version of struct smon_snapshot_t, which only grows at
+// the end. The version 1 fields end where those of version 2 start
+static const size_t snapshot_sizes[SMON_SNAPSHOT_VERSION + 1] = {
+	0,
+	offsetof(struct smon_snapshot_t, collectors),
+	sizeof(struct smon_snapshot_t)
+};
+
+struct smon_t
+{
+	struct system_t *system; /**< &own_system, or the one of smon_attach() */
+	struct system_t own_system;
+	int refresh; /**< Run the collectors in smon_sample() */
+	unsigned int collectors; /**< The enum smon_collector bits that are
+							   enabled */
+
+	struct smon_snapshot_t snapshot; /**< Filled as the latest version,
+									   then copied out as far as the
+									   caller's version goes */
+	// The arrays of the snapshot, reused between samples
+	struct smon_cpu_t *cpus;
+	struct smon_cpu_perf_t *cpu_perf;
+	struct smon_disk_t *disks;
+	int max_disk_count;
+	struct smon_interface_t *interfaces;
+	int max_interface_count;
+	struct smon_battery_t *batteries;
+	int max_battery_count;
+	struct smon_cgroup_t *cgroups;
+	int max_cgroup_count;
+};
+
+void smon_options_init(struct smon_options_t *options)
+{
+	struct system_config_t config;
+	system_config_init(&config);
+	options->root = config.root;
+	options->cgroup_root = config.cgroup_root;
+	options->cgroup_max_depth = config.cgroup_max_depth;
+	options->collectors = SMON_DEFAULT_COLLECTORS;
+	options->disk_filter = config.disk_filter;
+	options->interface_filter = config.interface_filter;
+	options->topology_cache = config.topology_cache;
+}
+
+struct smon_t *smon_open(const struct smon_options_t *options)
+{
+	struct system_config_t config;
+	system_config_init(&config);
+	config.root = options->root;
+	config.cgroup_root = options->collectors & SMON_CGROUPS ?
+		options->cgroup_root : NULL;
+	config.cgroup_max_depth = options->cgroup_max_depth;
+	config.perf_events = (options->collectors & SMON_PERF) != 0;
+	config.irqs = (options->collectors & SMON_IRQS) != 0;
+	config.disk_filter = options->disk_filter;
+	config.interface_filter = options->interface_filter;
+	config.topology_cache = options->topology_cache;
+	// Map the bits to the collectors of system.c by name, so that they
+	// don't depend on the order in which it runs them
+	config.collectors = 0;
+	const int count = sizeof(collector_names) / sizeof(collector_names[0]);
+	for (int c = 0; c < system_collector_count(); ++c)
+		for (int b = 0; b < count; ++b)
+			if (options->collectors & 1u << b &&
+					!strcmp(system_collector_name(c), collector_names[b]))
+				config.collectors |= 1u << c;
+	if (system_config_check(&config))
+		return NULL;
+
+	struct smon_t *smon = (struct smon_t *)calloc(1, sizeof(struct smon_t));
+	if (smon == NULL)
+		return NULL;
+	smon->own_system = system_init(&config);
+	smon->system = &smon->own_system;
+	smon->refresh = 1;
+	smon->collectors = options->collectors;
+	smon->cpus = (struct smon_cpu_t *)calloc(smon->system->cpu_count,
+			sizeof(struct smon_cpu_t));
+	smon->cpu_perf = (struct smon_cpu_perf_t *)calloc(smon->system->cpu_count,
+			sizeof(struct smon_cpu_perf_t));
+	return smon;
+}
+
+struct smon_t *smon_attach(struct system_t *system, int refresh)
+{
+	struct smon_t *smon = (struct smon_t *)calloc(1, sizeof(struct smon_t));
+	if (smon == NULL)
+		return NULL;
+	smon->system = system;
+	smon->refresh = refresh;
+	const int count = sizeof(collector_names) / sizeof(collector_names[0]);
+	for (int c = 0; c < system_collector_count(); ++c)
+		for (int b = 0; b < count; ++b)
+			if (system->collectors & 1u << c &&
+					!strcmp(system_collector_name(c), collector_names[b]))
+				smon->collectors |= 1u << b;
+	smon->cpus = (struct smon_cpu_t *)calloc(system->cpu_count,
+			sizeof(struct smon_cpu_t));
+	smon->cpu_perf = (struct smon_cpu_perf_t *)calloc(system->cpu_count,
+			sizeof(struct smon_cpu_perf_t));
+	return smon;
+}
+
+void smon_close(struct smon_t *smon)
+{
+	if (smon->system == &smon->own_system)
+		system_delete(smon->own_system);
+	free(smon->cpus);
+	free(smon->cpu_perf);
+	free(smon->disks);
+	free(smon->interfaces);
+	free(smon->batteries);
+	free(smon->cgroups);
+	free(smon);
+}
+
+// Make room for count elements in *array
+static void *smon_reserve(void *array, int *max_count, int count,
+		int element_size)
+{
+	if (count <= *max_count)
+		return array;
+	while (*max_count < count)
+		*max_count += 128;
+	return realloc(array, (size_t)*max_count * element_size);
+}
+
+// The enum smon_collector bits of the enabled collectors that have data
+static unsigned int smon_available(const struct smon_t *smon)
+{
+	const struct system_t *system = smon->system;
+	unsigned int collectors = smon->collectors;
+	if (system->vmstat->fd < 0)
+		collectors &= ~SMON_VMSTAT;
+	if (system->psi == NULL)
+		collectors &= ~SMON_PSI;
+	if (system->perf_cpu_count == 0)
+		collectors &= ~SMON_PERF;
+	if (system->irqs == NULL)
+		collectors &= ~SMON_IRQS;
+	if (system->cgroup_root == NULL)
+		collectors &= ~SMON_CGROUPS;
+	return collectors;
+}
+
+// Fill smon->snapshot, all of it, from smon->system
+static void smon_fill(struct smon_t *smon)
+{
+	const struct system_t *system = smon->system;
+	struct smon_snapshot_t *snapshot = &smon->snapshot;
+	memset(snapshot, 0, sizeof(struct smon_snapshot_t));
+	snapshot->version = SMON_SNAPSHOT_VERSION;
+	snapshot->collectors = smon_available(smon);
+	snapshot->timestamp = system->timestamp;
+	snapshot->elapsed = system->elapsed;
+
+	snapshot->cpu_count = system->cpu_count;
+	snapshot->cpus = smon->cpus;
+	for (int c = 0; c < system->cpu_count; ++c) {
+		const struct cpu_t *cpu = &system->cpus[c];
+		struct smon_cpu_t *out = &smon->cpus[c];
+		out->id = cpu->id;
+		out->core_id = cpu->core_id;
+		out->package_id = cpu->package_id;
+		out->node = cpu->node;
+		out->usage = system->cpu_counters->usage[c];
+		out->freq = system->cpu_counters->freq[c];
+		out->temperature = cpu->cur_temp / 1000.0;
+		out->ipc = cpu->ipc;
+		out->context_switches = cpu->perf_rate[PERF_CONTEXT_SWITCHES];
+		struct smon_cpu_perf_t *perf = &smon->cpu_perf[c];
+		perf->migrations = cpu->perf_rate[PERF_MIGRATIONS];
+		perf->minor_faults = cpu->perf_rate[PERF_MINOR_FAULTS];
+		perf->major_faults = cpu->perf_rate[PERF_MAJOR_FAULTS];
+	}
+	if (snapshot->collectors & SMON_PERF)
+		snapshot->cpu_perf = smon->cpu_perf;
+
+	snapshot->ram_used = system->ram_used;
+	snapshot->ram_buffers = system->ram_buffers;
+	snapshot->ram_cached = system->ram_cached;
+	const double *vm = system->vmstat->rates;
+	snapshot->page_in = vm[VMSTAT_PAGE_IN];
+	snapshot->page_out = vm[VMSTAT_PAGE_OUT];
+	snapshot->swap_in = vm[VMSTAT_SWAP_IN];
+	snapshot->swap_out = vm[VMSTAT_SWAP_OUT];
+	snapshot->major_faults = vm[VMSTAT_MAJOR_FAULTS];
+	snapshot->allocation_stalls = vm[VMSTAT_ALLOCSTALLS];
+	snapshot->page_scans = vm[VMSTAT_SCAN];
+	snapshot->page_steals = vm[VMSTAT_STEAL];
+	snapshot->oom_kills = vm[VMSTAT_OOM_KILLS];
+
+	smon->disks = (struct smon_disk_t *)smon_reserve(smon->disks,
+			&smon->max_disk_count, system->disk_count,
+			sizeof(struct smon_disk_t));
+	for (int d = 0; d < system->disk_count; ++d) {
+		const struct disk_t *disk = &system->disks[d];
+		smon->disks[d].name = disk->name;
+		smon->disks[d].read_rate =
+			disk->stats_rate[DISK_READ_SECTORS] * DISK_SECTOR_SIZE;
+		smon->disks[d].write_rate =
+			disk->stats_rate[DISK_WRITE_SECTORS] * DISK_SECTOR_SIZE;
+	}
+	snapshot->disk_count = system->disk_count;
+	snapshot->disks = smon->disks;
+
+	smon->interfaces = (struct smon_interface_t *)smon_reserve(
+			smon->interfaces, &smon->max_interface_count,
+			system->interface_count, sizeof(struct smon_interface_t));
+	for (int i = 0; i < system->interface_count; ++i) {
+		const struct interface_t *interface = &system->interfaces[i];
+		smon->interfaces[i].name = interface->name;
+		smon->interfaces[i].rx_rate = interface->rx_rate;
+		smon->interfaces[i].tx_rate = interface->tx_rate;
+	}
+	snapshot->interface_count = system->interface_count;
+	snapshot->interfaces = smon->interfaces;
+
+	smon->batteries = (struct smon_battery_t *)smon_reserve(smon->batteries,
+			&smon->max_battery_count, system->battery_count,
+			sizeof(struct smon_battery_t));
+	for (int b = 0; b < system->battery_count; ++b) {
+		const struct battery_t *battery = &system->batteries[b];
+		smon->batteries[b].name = battery->name;
+		smon->batteries[b].charge = battery->charge;
+		smon->batteries[b].current = battery->current / 1000000.0;
+		smon->batteries[b].voltage = battery->voltage / 1000000.0;
+	}
+	snapshot->battery_count = system->battery_count;
+	snapshot->batteries = smon->batteries;
+
+	smon->cgroups = (struct smon_cgroup_t *)smon_reserve(smon->cgroups,
+			&smon->max_cgroup_count, system->cgroup_count,
+			sizeof(struct smon_cgroup_t));
+	for (int g = 0; g < system->cgroup_count; ++g) {
+		const struct cgroup_t *cgroup = &system->cgroups[g];
+		smon->cgroups[g].name = cgroup->name;
+		smon->cgroups[g].cpu_usage = cgroup->cpu_usage;
+		smon->cgroups[g].memory = cgroup->memory_current;
+		smon->cgroups[g].read_rate = cgroup->read_rate;
+		smon->cgroups[g].write_rate = cgroup->write_rate;
+	}
+	snapshot->cgroup_count = system->cgroup_count;
+	snapshot->cgroups = smon->cgroups;
+
+	for (int r = 0; system->psi && r < PSI_RESOURCE_COUNT; ++r) {
+		snapshot->psi_some[r] = system->psi[r].some.stall;
+		snapshot->psi_full[r] = system->psi[r].full.stall;
+		snapshot->psi_some_avg10[r] = system->psi[r].some.avg10;
+		snapshot->psi_full_avg10[r] = system->psi[r].full.avg10;
+	}
+}
+
+int smon_sample(struct smon_t *smon, int version,
+		struct smon_snapshot_t *snapshot)
+{
+	if (version < 1 || version > SMON_SNAPSHOT_VERSION)
+		return 1;
+	if (smon->refresh)
+		system_refresh_info(smon->system);
+	smon_fill(smon);
+	// A caller built against an older smon.h has a smaller struct
+	smon->snapshot.version = version;
+	memcpy(snapshot, &smon->snapshot, snapshot_sizes[version]);
+	return 0;
+}
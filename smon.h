@@ -0,0 +1,196 @@
+#ifndef SMON_H_INCLUDED
+#define SMON_H_INCLUDED
+
+/*
+ * libsmon: the collectors of smon for use in other programs.
+ *
+ *	struct smon_options_t options;
+ *	smon_options_init(&options);
+ *	options.collectors = SMON_CPUS | SMON_RAM;
+ *	struct smon_t *smon = smon_open(&options);
+ *	struct smon_snapshot_t snapshot;
+ *	while (smon_sample(smon, SMON_SNAPSHOT_VERSION, &snapshot) == 0) {
+ *		... use snapshot.cpus[0].usage etc. ...
+ *		sleep(1);
+ *	}
+ *	smon_close(smon);
+ *
+ * Rates are per second since the previous smon_sample(), or since
+ * smon_open() for the first one. New versions of the snapshot only append
+ * fields, and smon_sample() only writes the fields of the version it is
+ * given, so a program built against an older smon.h keeps working with a
+ * newer library. A handle must not be used by two threads at once.
+ */
+
+#if defined(__GNUC__)
+#define SMON_API __attribute__((visibility("default")))
+#else
+#define SMON_API
+#endif
+
+/** The version of struct smon_snapshot_t in this header */
+#define SMON_SNAPSHOT_VERSION 2
+
+/** The collectors, for smon_options_t::collectors */
+enum smon_collector
+{
+	SMON_CPUS = 1 << 0, /**< Usage, frequency and temperature of each CPU */
+	SMON_RAM = 1 << 1,
+	SMON_VMSTAT = 1 << 2, /**< Paging, swap and reclaim */
+	SMON_NUMA = 1 << 3,
+	SMON_DISKS = 1 << 4,
+	SMON_INTERFACES = 1 << 5,
+	SMON_BATTERIES = 1 << 6,
+	SMON_CGROUPS = 1 << 7,
+	SMON_PSI = 1 << 8, /**< Pressure stall information */
+	SMON_PERF = 1 << 9, /**< Per-CPU perf_event counters */
+	SMON_IRQS = 1 << 10, /**< Interrupts and softirqs, expensive with
+							many CPUs */
+	SMON_DEFAULT_COLLECTORS = (1 << 9) - 1,
+	SMON_ALL_COLLECTORS = (1 << 11) - 1
+};
+
+struct smon_options_t
+{
+	const char *root; /**< Prefix for all /proc and /sys paths, "" by
+						default */
+	const char *cgroup_root; /**< Where the cgroup v2 hierarchy is mounted
+							   (relative to root) */
+	int cgroup_max_depth; /**< How many levels below cgroup_root to scan */
+	unsigned int collectors; /**< A combination of enum smon_collector,
+							   SMON_DEFAULT_COLLECTORS by default */
+	const char *disk_filter; /**< Glob patterns of the disks to watch,
+							   those starting with ! exclude. "!loop*" by
+							   default */
+	const char *interface_filter; /**< The same for network interfaces,
+									NULL for all */
+	const char *topology_cache; /**< A file to keep the CPU topology in,
+								  which speeds up smon_open() on big
+								  machines. NULL by default */
+};
+
+struct smon_cpu_t
+{
+	int id; /**< As in /sys and /proc, e.g. 3 for cpu3 */
+	int core_id;
+	int package_id;
+	int node; /**< The NUMA node, -1 if unknown */
+	double usage; /**< [0.0, 1.0] */
+	int freq; /**< KHz */
+	double temperature; /**< Degrees Celsius */
+	double ipc; /**< Instructions per cycle, with SMON_PERF */
+	double context_switches; /**< Per second, with SMON_PERF */
+};
+
+struct smon_disk_t
+{
+	const char *name;
+	double read_rate; /**< Bytes per second */
+	double write_rate; /**< Bytes per second */
+};
+
+struct smon_interface_t
+{
+	const char *name;
+	double rx_rate; /**< Bytes received per second */
+	double tx_rate; /**< Bytes sent per second */
+};
+
+struct smon_battery_t
+{
+	const char *name;
+	int charge; /**< Percent */
+	double current; /**< Amperes */
+	double voltage; /**< Volts */
+};
+
+struct smon_cgroup_t
+{
+	const char *name; /**< The path relative to the cgroup root */
+	double cpu_usage; /**< 1.0 is one fully busy CPU */
+	long long memory; /**< Bytes */
+	double read_rate; /**< Bytes per second */
+	double write_rate; /**< Bytes per second */
+};
+
+/** The perf_event counters of a CPU that aren't in smon_cpu_t, per
+ * second */
+struct smon_cpu_perf_t
+{
+	double migrations; /**< Tasks moved to another CPU */
+	double minor_faults;
+	double major_faults;
+};
+
+/** The state of the system at one point in time. The arrays and names
+ * belong to the handle and stay valid until the next smon_sample() or
+ * smon_close() */
+struct smon_snapshot_t
+{
+	int version; /**< The version the snapshot was filled as */
+	long long timestamp; /**< CLOCK_MONOTONIC (ns) */
+	double elapsed; /**< Seconds since the previous snapshot */
+
+	int cpu_count;
+	const struct smon_cpu_t *cpus;
+
+	long long ram_used; /**< Bytes used by applications */
+	long long ram_buffers;
+	long long ram_cached;
+
+	double page_in; /**< Bytes per second */
+	double page_out;
+	double swap_in;
+	double swap_out;
+	double major_faults; /**< Per second */
+	double allocation_stalls; /**< Per second */
+
+	int disk_count;
+	const struct smon_disk_t *disks;
+	int interface_count;
+	const struct smon_interface_t *interfaces;
+	int battery_count;
+	const struct smon_battery_t *batteries;
+	int cgroup_count;
+	const struct smon_cgroup_t *cgroups;
+
+	double psi_some[3]; /**< The share of time that some tasks were stalled
+						  on CPU, memory and IO since the previous
+						  snapshot [0.0, 1.0] */
+	double psi_full[3]; /**< The same for all non-idle tasks */
+
+	// Version 2
+	unsigned int collectors; /**< The enum smon_collector bits of the
+							   collectors that have data, e.g. not SMON_PSI
+							   on kernels without it */
+	double page_scans; /**< Pages scanned for reclaim per second */
+	double page_steals; /**< Pages reclaimed per second */
+	double oom_kills; /**< Per second */
+	double psi_some_avg10[3]; /**< The kernel's 10 second average of
+								psi_some (percent) */
+	double psi_full_avg10[3];
+	const struct smon_cpu_perf_t *cpu_perf; /**< Indexed like cpus, NULL
+											  without SMON_PERF */
+};
+
+struct smon_t;
+
+/** Fill options with the defaults */
+SMON_API void smon_options_init(struct smon_options_t *options);
+
+/** Find the devices and open the files of the enabled collectors. Every
+ * device keeps its files open, so on big machines the program may have to
+ * raise RLIMIT_NOFILE first. Returns NULL on failure, e.g. if a filter has
+ * more than 32 patterns */
+SMON_API struct smon_t *smon_open(const struct smon_options_t *options);
+
+/** Run the enabled collectors and fill snapshot. version must be
+ * SMON_SNAPSHOT_VERSION, only the fields of that version are written.
+ * Returns 0 on success, or 1 if this library is older than version */
+SMON_API int smon_sample(struct smon_t *smon, int version,
+		struct smon_snapshot_t *snapshot);
+
+/** Close the files and free the memory of smon */
+SMON_API void smon_close(struct smon_t *smon);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef SMON_INTERNAL_H_INCLUDED
+#define SMON_INTERNAL_H_INCLUDED
+
+/*
+ * What the smon executable uses of libsmon beyond smon.h. It has options
+ * that smon_options_t doesn't, and its logger, alerts and exporter work on
+ * a system_t, so it makes the system_t itself and samples that through a
+ * handle. Not installed.
+ */
+
+struct system_t;
+struct smon_t;
+
+/** A handle on system, which stays the caller's. smon_sample() runs the
+ * collectors of system first if refresh is set, and otherwise only takes
+ * a snapshot of what is in system, e.g. a replay. Returns NULL on
+ * failure */
+struct smon_t *smon_attach(struct system_t *system, int refresh);
+
+#endif
@@ -0,0 +1,403 @@
+#include "stream.h"
+#include "system.h"
+#include "util.h"
+#include "cpu.h"
+#include "disk.h"
+#include "interface.h"
+#include "psi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+// What a field is
+enum {
+	FIELD_TIME, // Only in JSON, binary rows have their own time
+	FIELD_CPU_USAGE,
+	FIELD_CPU_FREQUENCY,
+	FIELD_CPU_TEMPERATURE,
+	FIELD_RAM_USED,
+	FIELD_RAM_BUFFERS,
+	FIELD_RAM_CACHED,
+	FIELD_DISK_READ,
+	FIELD_DISK_WRITE,
+	FIELD_IFACE_READ,
+	FIELD_IFACE_WRITE,
+	FIELD_PSI_SOME,
+	FIELD_PSI_FULL
+};
+
+// How long to wait for the reader when exiting
+#define STREAM_EXIT_TIMEOUT_MS 1000
+
+static const char * const psi_names[PSI_RESOURCE_COUNT] = {
+	"cpu", "memory", "io"
+};
+
+void stream_init(struct stream_t *stream, int format, int fd)
+{
+	memset(stream, 0, sizeof(struct stream_t));
+	stream->format = format;
+	stream->fd = fd;
+	// A slow reader must not stall the sampling
+	stream->fd_flags = fcntl(fd, F_GETFL);
+	fcntl(fd, F_SETFL, stream->fd_flags | O_NONBLOCK);
+}
+
+static void stream_flush(struct stream_t *stream);
+
+void stream_delete(struct stream_t *stream)
+{
+	// Don't leave half a record behind, unless nobody reads it
+	const long long deadline = monotonic_ns() + STREAM_EXIT_TIMEOUT_MS * 1000000LL;
+	while (stream->out_used > 0 && monotonic_ns() < deadline) {
+		struct pollfd fd = { stream->fd, POLLOUT, 0 };
+		if (poll(&fd, 1, STREAM_EXIT_TIMEOUT_MS) != 1)
+			break;
+		stream_flush(stream);
+	}
+	// The fd may be shared with the shell, e.g. a terminal
+	fcntl(stream->fd, F_SETFL, stream->fd_flags);
+
+	free(stream->fields);
+	free(stream->values);
+	free(stream->text);
+	free(stream->text_end);
+	free(stream->out);
+}
+
+// Append size bytes to the template text
+static void stream_append(struct stream_t *stream, const char *data, size_t size)
+{
+	if (stream->text_size + size > stream->max_text_size) {
+		stream->max_text_size = (stream->text_size + size) * 2;
+		stream->text = (char *)realloc(stream->text, stream->max_text_size);
+	}
+	memcpy(stream->text + stream->text_size, data, size);
+	stream->text_size += size;
+}
+
+// Append JSON text. It is not a part of the binary schema
+static void stream_text(struct stream_t *stream, const char *text)
+{
+	if (stream->format == STREAM_NDJSON)
+		stream_append(stream, text, strlen(text));
+}
+
+// Append a name as a JSON string
+static void stream_json_string(struct stream_t *stream, const char *name)
+{
+	if (stream->format != STREAM_NDJSON)
+		return;
+	stream_append(stream, "\"", 1);
+	for (const char *c = name; *c; ++c) {
+		if (*c == '"' || *c == '\\') {
+			char escaped[2] = { '\\', *c };
+			stream_append(stream, escaped, 2);
+		} else if ((unsigned char)*c < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+			stream_append(stream, escaped, 6);
+		} else {
+			stream_append(stream, c, 1);
+		}
+	}
+	stream_append(stream, "\"", 1);
+}
+
+// Add a field after the JSON text. name is its name in the binary schema
+static void stream_field(struct stream_t *stream, const char *text,
+		int source, int index, int decimals, const char *name)
+{
+	if (stream->format == STREAM_BINARY && source == FIELD_TIME)
+		return;
+	if (stream->field_count == stream->max_field_count) {
+		stream->max_field_count += 128;
+		stream->fields = (struct stream_field_t *)realloc(stream->fields,
+				sizeof(struct stream_field_t) * stream->max_field_count);
+		stream->text_end = (size_t *)realloc(stream->text_end,
+				sizeof(size_t) * stream->max_field_count);
+		stream->values = (double *)realloc(stream->values,
+				sizeof(double) * stream->max_field_count);
+	}
+	if (stream->format == STREAM_NDJSON)
+		stream_text(stream, text);
+	else
+		stream_append(stream, name, strlen(name) + 1);
+	struct stream_field_t *field = &stream->fields[stream->field_count];
+	field->source = source;
+	field->index = index;
+	field->decimals = decimals;
+	stream->text_end[stream->field_count++] = stream->text_size;
+}
+
+// A hash of everything that the template depends on
+static unsigned long long stream_layout(const struct system_t *system)
+{
+	// FNV-1a
+	unsigned long long hash = 14695981039346656037ULL;
+#define HASH(data, size) \
+	for (size_t i = 0; i < (size); ++i) \
+		hash = (hash ^ ((const unsigned char *)(data))[i]) * 1099511628211ULL;
+	HASH(&system->cpu_count, sizeof(int));
+	HASH(&system->disk_count, sizeof(int));
+	HASH(&system->interface_count, sizeof(int));
+	const int has_psi = system->psi != NULL;
+	HASH(&has_psi, sizeof(int));
+	for (int d = 0; d < system->disk_count; ++d)
+		HASH(system->disks[d].name, strlen(system->disks[d].name) + 1);
+	for (int i = 0; i < system->interface_count; ++i)
+		HASH(system->interfaces[i].name,
+				strlen(system->interfaces[i].name) + 1);
+#undef HASH
+	return hash;
+}
+
+// Render the template for the devices of system
+static void stream_build(struct stream_t *stream, const struct system_t *system)
+{
+	stream->field_count = 0;
+	stream->text_size = 0;
+	if (stream->format == STREAM_BINARY) {
+		// The schema header is filled in at the end
+		struct stream_record_t header = { STREAM_SCHEMA, 0 };
+		uint32_t count = 0;
+		stream_append(stream, (const char *)&header, sizeof(header));
+		stream_append(stream, (const char *)&count, sizeof(count));
+	}
+
+	char text[128], name[128];
+	stream_field(stream, "{\"time\":", FIELD_TIME, 0, 3, "time");
+
+	stream_text(stream, ",\"cpus\":[");
+	for (int c = 0; c < system->cpu_count; ++c) {
+		const int id = system->cpus[c].id;
+		snprintf(text, sizeof(text), "%s{\"id\":%d,\"usage\":",
+				c ? "}," : "", id);
+		snprintf(name, sizeof(name), "cpu%d.usage", id);
+		stream_field(stream, text, FIELD_CPU_USAGE, c, 2, name);
+		snprintf(name, sizeof(name), "cpu%d.freq", id);
+		stream_field(stream, ",\"freq\":", FIELD_CPU_FREQUENCY, c, 0, name);
+		snprintf(name, sizeof(name), "cpu%d.temp", id);
+		stream_field(stream, ",\"temp\":", FIELD_CPU_TEMPERATURE, c, 1, name);
+	}
+	stream_text(stream, system->cpu_count ? "}]" : "]");
+
+	stream_field(stream, ",\"ram\":{\"used\":", FIELD_RAM_USED, 0, 0,
+			"ram.used");
+	stream_field(stream, ",\"buffers\":", FIELD_RAM_BUFFERS, 0, 0,
+			"ram.buffers");
+	stream_field(stream, ",\"cached\":", FIELD_RAM_CACHED, 0, 0,
+			"ram.cached");
+	stream_text(stream, "}");
+
+	stream_text(stream, ",\"disks\":{");
+	for (int d = 0; d < system->disk_count; ++d) {
+		const char *disk = system->disks[d].name;
+		if (d)
+			stream_text(stream, "},");
+		stream_json_string(stream, disk);
+		snprintf(name, sizeof(name), "disk.%s.read", disk);
+		stream_field(stream, ":{\"read\":", FIELD_DISK_READ, d, 0, name);
+		snprintf(name, sizeof(name), "disk.%s.write", disk);
+		stream_field(stream, ",\"write\":", FIELD_DISK_WRITE, d, 0, name);
+	}
+	stream_text(stream, system->disk_count ? "}}" : "}");
+
+	stream_text(stream, ",\"interfaces\":{");
+	for (int i = 0; i < system->interface_count; ++i) {
+		const char *iface = system->interfaces[i].name;
+		if (i)
+			stream_text(stream, "},");
+		stream_json_string(stream, iface);
+		snprintf(name, sizeof(name), "iface.%s.rx", iface);
+		stream_field(stream, ":{\"rx\":", FIELD_IFACE_READ, i, 0, name);
+		snprintf(name, sizeof(name), "iface.%s.tx", iface);
+		stream_field(stream, ",\"tx\":", FIELD_IFACE_WRITE, i, 0, name);
+	}
+	stream_text(stream, system->interface_count ? "}}" : "}");
+
+	if (system->psi) {
+		stream_text(stream, ",\"psi\":{");
+		for (int r = 0; r < PSI_RESOURCE_COUNT; ++r) {
+			snprintf(text, sizeof(text), "%s\"%s\":{\"some\":",
+					r ? "}," : "", psi_names[r]);
+			snprintf(name, sizeof(name), "psi.%s.some", psi_names[r]);
+			stream_field(stream, text, FIELD_PSI_SOME, r, 2, name);
+			snprintf(name, sizeof(name), "psi.%s.full", psi_names[r]);
+			stream_field(stream, ",\"full\":", FIELD_PSI_FULL, r, 2, name);
+		}
+		stream_text(stream, "}}");
+	}
+	stream_text(stream, "}\n");
+
+	if (stream->format == STREAM_BINARY) {
+		struct stream_record_t header;
+		header.type = STREAM_SCHEMA;
+		header.size = stream->text_size - sizeof(header);
+		const uint32_t count = stream->field_count;
+		memcpy(stream->text, &header, sizeof(header));
+		memcpy(stream->text + sizeof(header), &count, sizeof(count));
+	}
+	stream->layout = stream_layout(system);
+	stream->schema_pending = 1;
+}
+
+// The current value of a field
+static double stream_value(const struct stream_field_t *field,
+		const struct system_t *system, long long time_ns)
+{
+	const int i = field->index;
+	switch (field->source) {
+		case FIELD_TIME:
+			return time_ns / 1e9;
+		case FIELD_CPU_USAGE:
+			return system->cpu_counters->usage[i] * 100.0;
+		case FIELD_CPU_FREQUENCY:
+			return system->cpu_counters->freq[i];
+		case FIELD_CPU_TEMPERATURE:
+			return system->cpus[i].cur_temp / 1000.0;
+		case FIELD_RAM_USED:
+			return system->ram_used;
+		case FIELD_RAM_BUFFERS:
+			return system->ram_buffers;
+		case FIELD_RAM_CACHED:
+			return system->ram_cached;
+		case FIELD_DISK_READ:
+			return system->disks[i].stats_rate[DISK_READ_SECTORS] *
+				DISK_SECTOR_SIZE;
+		case FIELD_DISK_WRITE:
+			return system->disks[i].stats_rate[DISK_WRITE_SECTORS] *
+				DISK_SECTOR_SIZE;
+		case FIELD_IFACE_READ:
+			return system->interfaces[i].rx_rate;
+		case FIELD_IFACE_WRITE:
+			return system->interfaces[i].tx_rate;
+		case FIELD_PSI_SOME:
+			return system->psi[i].some.stall * 100.0;
+		case FIELD_PSI_FULL:
+			return system->psi[i].full.stall * 100.0;
+	}
+	return 0.0;
+}
+
+int stream_format_number(char *out, double value, int decimals)
+{
+	static const double powers[] = { 1.0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6 };
+	if (!isfinite(value)) {
+		memcpy(out, "null", 4);
+		return 4;
+	}
+	char *p = out;
+	if (value < 0) {
+		*p++ = '-';
+		value = -value;
+	}
+	if (decimals > 6 || value * powers[decimals] >= 1e18)
+		return (p - out) + snprintf(p, STREAM_MAX_NUMBER_LENGTH - 1, "%.17g", value);
+
+	// Round to an integer number of 10^-decimals, then print its digits
+	unsigned long long scaled = value * powers[decimals] + 0.5;
+	char digits[24];
+	int count = 0;
+	do {
+		digits[count++] = '0' + scaled % 10;
+		scaled /= 10;
+	} while (scaled || count <= decimals);
+	for (int d = count - 1; d >= 0; --d) {
+		*p++ = digits[d];
+		if (d == decimals && d > 0)
+			*p++ = '.';
+	}
+	return p - out;
+}
+
+// Write what fd takes without blocking
+static void stream_flush(struct stream_t *stream)
+{
+	if (stream->out_used == 0)
+		return;
+	size_t written = 0;
+	while (written < stream->out_used) {
+		ssize_t bytes = write(stream->fd, stream->out + written,
+				stream->out_used - written);
+		if (bytes < 0 && errno == EINTR)
+			continue;
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (bytes <= 0) {
+			// Nobody is reading anymore
+			if (bytes < 0 && errno == EPIPE)
+				stream->closed = 1;
+			written = stream->out_used;
+			break;
+		}
+		written += bytes;
+	}
+	memmove(stream->out, stream->out + written, stream->out_used - written);
+	stream->out_used -= written;
+}
+
+void stream_write(struct stream_t *stream, const struct system_t *system)
+{
+	if (stream->text_size == 0 || stream_layout(system) != stream->layout)
+		stream_build(stream, system);
+
+	// The record is dropped if a slow reader is too far behind, but
+	// one record is always taken so that a big one can't get stuck
+	stream_flush(stream);
+	const size_t max_size = stream->format == STREAM_NDJSON ?
+		stream->text_size + stream->field_count * STREAM_MAX_NUMBER_LENGTH :
+		stream->text_size + sizeof(struct stream_record_t) +
+		sizeof(int64_t) + stream->field_count * sizeof(double);
+	if (stream->out_used > 0 &&
+			stream->out_used + max_size > STREAM_MAX_PENDING) {
+		++stream->dropped_records;
+		return;
+	}
+	if (stream->out_used + max_size > stream->out_size) {
+		stream->out_size = stream->out_used + max_size;
+		stream->out = (char *)realloc(stream->out, stream->out_size);
+	}
+
+	const long long time_ns = realtime_ns();
+	for (int i = 0; i < stream->field_count; ++i)
+		stream->values[i] = stream_value(&stream->fields[i], system, time_ns);
+
+	char *out = stream->out + stream->out_used;
+	if (stream->format == STREAM_NDJSON) {
+		size_t text = 0;
+		for (int i = 0; i < stream->field_count; ++i) {
+			memcpy(out, stream->text + text, stream->text_end[i] - text);
+			out += stream->text_end[i] - text;
+			text = stream->text_end[i];
+			out += stream_format_number(out, stream->values[i],
+					stream->fields[i].decimals);
+		}
+		memcpy(out, stream->text + text, stream->text_size - text);
+		out += stream->text_size - text;
+	} else {
+		if (stream->schema_pending) {
+			memcpy(out, stream->text, stream->text_size);
+			out += stream->text_size;
+		}
+		struct stream_record_t header;
+		header.type = STREAM_ROW;
+		header.size = sizeof(int64_t) + stream->field_count * sizeof(double);
+		const int64_t time = time_ns;
+		memcpy(out, &header, sizeof(header));
+		memcpy(out + sizeof(header), &time, sizeof(time));
+		memcpy(out + sizeof(header) + sizeof(time), stream->values,
+				stream->field_count * sizeof(double));
+		out += sizeof(header) + header.size;
+	}
+	stream->schema_pending = 0;
+	stream->out_used = out - stream->out;
+	++stream->record_count;
+	stream_flush(stream);
+}
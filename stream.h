@@ -0,0 +1,103 @@
+#ifndef STREAM_H_INCLUDED
+#define STREAM_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * One record per tick on stdout (smon --stream ndjson|binary).
+ *
+ * The layout of a record only changes when devices appear or disappear,
+ * so it is rendered once into a template: the text between the values
+ * (the JSON keys and punctuation) and a field per value. Writing a
+ * record copies the text and formats the numbers, nothing else.
+ *
+ * The binary stream is a sequence of records, each starting with a
+ * struct stream_record_t. A STREAM_SCHEMA record holds the number of
+ * values (uint32_t) and their names, each terminated by '\0', and comes
+ * first and whenever the layout changes. A STREAM_ROW record holds the
+ * time (int64_t, ns since the epoch) and the values (doubles).
+ */
+
+#define STREAM_SCHEMA 0x53534d53 /**< "SMSS" in a little-endian file */
+#define STREAM_ROW 0x52534d53 /**< "SMSR" */
+
+// How much output is kept for a slow reader before records are dropped
+#define STREAM_MAX_PENDING (1 << 20)
+
+enum stream_format
+{
+	STREAM_NDJSON,
+	STREAM_BINARY
+};
+
+struct stream_record_t
+{
+	uint32_t type; /**< STREAM_SCHEMA or STREAM_ROW */
+	uint32_t size; /**< The number of bytes after the header */
+};
+
+/** A value in a record */
+struct stream_field_t
+{
+	int source; /**< What the value is, see stream.c */
+	int index; /**< The CPU, disk, ... it is of */
+	int decimals; /**< Decimal places in JSON */
+};
+
+struct system_t;
+
+struct stream_t
+{
+	int format; /**< STREAM_NDJSON or STREAM_BINARY */
+	int fd; /**< Where records are written */
+	int fd_flags; /**< The flags of fd before it was made non-blocking */
+
+	int field_count;
+	struct stream_field_t *fields;
+	int max_field_count;
+	double *values; /**< One per field */
+
+	char *text; /**< The template text. For JSON, the text before field i
+				  is text[text_end[i - 1], text_end[i]), and the text after
+				  the last field ends at text_size. For binary, it is
+				  the schema record */
+	size_t text_size;
+	size_t max_text_size;
+	size_t *text_end; /**< One per field */
+
+	unsigned long long layout; /**< A hash of the devices that the
+								 template was rendered for */
+	int schema_pending; /**< The schema hasn't been written since
+						  the layout changed */
+
+	char *out; /**< Records that were not written yet */
+	size_t out_used;
+	size_t out_size;
+
+	unsigned long long record_count; /**< Records written so far */
+	unsigned long long dropped_records; /**< Records dropped because the
+										  reader was too slow */
+	int closed; /**< The reader has gone away */
+};
+
+/** Stream records to fd, which is made non-blocking */
+void stream_init(struct stream_t *stream, int format, int fd);
+
+/** Write what is still pending if the reader takes it within a second,
+ * restore the flags of the fd and free the memory */
+void stream_delete(struct stream_t *stream);
+
+/** Write a record of the current values of system. The template is
+ * rendered again if the devices have changed. Never blocks: what fd
+ * doesn't take now is written with the next record, and if more than
+ * STREAM_MAX_PENDING bytes are pending, the record is dropped */
+void stream_write(struct stream_t *stream, const struct system_t *system);
+
+/** Format value with the given decimal places, as fast as possible.
+ * Writes at most STREAM_MAX_NUMBER_LENGTH characters, returns how many */
+int stream_format_number(char *out, double value, int decimals);
+
+#define STREAM_MAX_NUMBER_LENGTH 32
+
+#endif
@@ -4,78 +4,333 @@
 #include "disk.h"
 #include "interface.h"
 #include "battery.h"
+#include "cgroup.h"
+#include "psi.h"
+#include "perf.h"
+#include "overhead.h"
+#include "arena.h"
+#include "freq.h"
+#include "numa.h"
+#include "irq.h"
+#include "kv.h"
+#include "vmstat.h"
+#include "topology.h"
+#include "filter.h"
+#include "watch.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <dirent.h>
+#include <limits.h>
 #include <sys/types.h>
 
+// All paths are relative to system->root
 #define CPU_DEVICES_DIR "/sys/bus/cpu/devices/"
-static const int cpu_devices_dir_len = sizeof(CPU_DEVICES_DIR) - 1;
 #define HWMON_DIR "/sys/class/hwmon/"
-static const int hwmon_dir_len = sizeof(HWMON_DIR) - 1;
 #define BLOCK_DEVICES_DIR "/sys/block/"
-static const int block_devices_dir_len = sizeof(BLOCK_DEVICES_DIR) - 1;
 #define INTERFACES_DIR "/sys/class/net/"
-static const int interfaces_dir_len = sizeof(INTERFACES_DIR) - 1;
 #define POWER_DIR "/sys/class/power_supply/"
-static const int power_dir_len = sizeof(POWER_DIR) - 1;
 #define PROC_STAT_DIR "/proc/stat"
 #define MEMINFO_PATH "/proc/meminfo"
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define ISOLATED_CPUS_PATH "/sys/devices/system/cpu/isolated"
+#define NOHZ_FULL_CPUS_PATH "/sys/devices/system/cpu/nohz_full"
 
+// How many devices of each kind can appear after startup
+// before their array has to be reallocated
+#define DEVICE_HEADROOM 128
+// The longest possible "cpuN ..." line in /proc/stat
+#define PROC_STAT_LINE_MAX (3 + 10 + CPU_STATS_COUNT * 21 + 1)
 
-static void system_cpu_init(struct system_t *);
+
+static void system_cpu_init(struct system_t *, const char *topology_cache);
 static void system_disk_init(struct system_t *);
 static void system_net_init(struct system_t *);
 static void system_bat_init(struct system_t *);
+static void system_move_to_arena(struct system_t *);
+static void system_find_isolated_cpus(struct system_t *);
+
+// The counters of /proc/meminfo that are read
+enum {
+	MEMINFO_TOTAL, MEMINFO_FREE, MEMINFO_BUFFERS, MEMINFO_CACHED,
+	MEMINFO_RECLAIMABLE, MEMINFO_SHARED, MEMINFO_COUNT
+};
+static const char * const meminfo_names[MEMINFO_COUNT] = {
+	"MemTotal", "MemFree", "Buffers", "Cached", "SReclaimable", "Shmem"
+};
+
+int system_path(const struct system_t *system, char *out, const char *path)
+{
+	strcpy(out, system->root);
+	strcpy(out + system->root_len, path);
+	return system->root_len + strlen(path);
+}
 
-struct system_t system_init(void)
+void system_reserve_buffer(struct system_t *system, int fd)
 {
-	struct system_t system;
+	if (fd < 0)
+		return;
+	// Grow the buffer until the whole file fits, then leave room for
+	// the file to double, as /proc files grow with the kernel's state
+	int len;
+	while ((len = read_fd_to_string(fd, system->buffer,
+					system->buffer_size - 1)) == system->buffer_size - 1) {
+		system->buffer_size *= 2;
+		system->buffer = (char *)realloc(system->buffer, system->buffer_size);
+	}
+	if (system->buffer_size < 2 * len + 4096) {
+		system->buffer_size = 2 * len + 4096;
+		system->buffer = (char *)realloc(system->buffer, system->buffer_size);
+	}
+}
 
-	system.proc_stat_fd = open_file_readonly(PROC_STAT_DIR);
-	system.meminfo_fd = open_file_readonly(MEMINFO_PATH);
+void system_config_init(struct system_config_t *config)
+{
+	config->root = "";
+	config->cgroup_root = CGROUP_ROOT;
+	config->cgroup_max_depth = 4;
+	config->perf_events = 0;
+	config->freq_source = FREQ_SYSFS;
+	config->skip_isolated = 0;
+	config->irqs = 0;
+	config->collectors = ~0u;
+	config->topology_cache = NULL;
+	config->disk_filter = "!loop*";
+	config->interface_filter = NULL;
+	config->watch = NULL;
+}
 
-	system_cpu_init(&system);
+int system_config_check(const struct system_config_t *config)
+{
+	struct filter_t filter;
+	if (filter_init(&filter, config->disk_filter))
+		return 1;
+	filter_delete(&filter);
+	if (filter_init(&filter, config->interface_filter))
+		return 1;
+	filter_delete(&filter);
+	return 0;
+}
+
+struct system_t system_init(const struct system_config_t *config)
+{
+	struct system_t system;
+
+	// Drop trailing slashes, all paths start with one
+	system.root = strdup(config->root);
+	system.root_len = strlen(system.root);
+	while (system.root_len > 0 && system.root[system.root_len - 1] == '/')
+		system.root[--system.root_len] = '\0';
+
+	char filename[PATH_MAX];
+	system_path(&system, filename, PROC_STAT_DIR);
+	system.proc_stat_fd = open_file_readonly(filename);
+	system_path(&system, filename, MEMINFO_PATH);
+	system.meminfo_fd = open_file_readonly(filename);
+
+	system_cpu_init(&system, config->topology_cache);
+	system.cpu_counters = (struct cpu_counters_t *)malloc(
+			sizeof(struct cpu_counters_t));
+	cpu_counters_init(system.cpu_counters, system.cpus, system.cpu_count);
+	// Only the cpu lines at the start of /proc/stat are read
+	system.buffer_size = (system.cpu_count + 1) * PROC_STAT_LINE_MAX + 1;
+	system.buffer = (char *)malloc(system.buffer_size);
+	system_reserve_buffer(&system, system.meminfo_fd);
+	system.meminfo_keys = (struct kv_table_t *)malloc(
+			sizeof(struct kv_table_t));
+	if (kv_table_init(system.meminfo_keys, meminfo_names, MEMINFO_COUNT)) {
+		close_fd(system.meminfo_fd);
+		system.meminfo_fd = -1;
+	}
+	vmstat_init(&system);
+	system.skip_isolated = config->skip_isolated;
+	system_find_isolated_cpus(&system);
+	system.perf_cpu_count = config->perf_events ? perf_init(&system) : 0;
+	freq_init(&system, config->freq_source);
+	numa_init(&system);
+	system.irqs = NULL;
+	if (config->irqs)
+		irq_init(&system);
+	// Invalid lists (see system_config_check()) watch nothing rather
+	// than everything
+	system.disk_filter = (struct filter_t *)malloc(sizeof(struct filter_t));
+	if (filter_init(system.disk_filter, config->disk_filter))
+		filter_init(system.disk_filter, "!*");
+	system.interface_filter = (struct filter_t *)malloc(
+			sizeof(struct filter_t));
+	if (filter_init(system.interface_filter, config->interface_filter))
+		filter_init(system.interface_filter, "!*");
 	system_disk_init(&system);
 	system_net_init(&system);
 	system_bat_init(&system);
+	if (config->cgroup_root) {
+		system_path(&system, filename, config->cgroup_root);
+		cgroup_init(&system, filename, config->cgroup_max_depth);
+	} else {
+		cgroup_init(&system, NULL, config->cgroup_max_depth);
+	}
+	psi_init(&system);
+	system.watch = NULL;
+	if (config->watch) {
+		system.watch = (struct watch_t *)malloc(sizeof(struct watch_t));
+		if (watch_init(system.watch, config->watch)) {
+			free(system.watch);
+			system.watch = NULL;
+		}
+	}
+
+	system.arena = (struct arena_t *)malloc(sizeof(struct arena_t));
+	arena_init(system.arena, 0);
+
+	system.collectors = config->collectors;
+	system.timestamp = 0;
+	system.elapsed = 0.0;
+	system.device_generation = 0;
 
-	system.buffer = NULL;
-	system.buffer_size = 0;
+	system.overhead = (struct overhead_t *)malloc(sizeof(struct overhead_t));
+	overhead_init(system.overhead);
+	for (int c = 0; c < system_collector_count(); ++c)
+		overhead_add_section(system.overhead, system_collector_name(c));
 
+	// The first refresh discovers the devices, which tells us how
+	// much memory is needed
 	system_refresh_info(&system);
+	system_move_to_arena(&system);
 
 	return system;
 }
 
+void *system_grow_array(struct system_t *system, void *array,
+		int *max_count, int element_size, int step)
+{
+	const int max = *max_count + step;
+	void *grown;
+	if (arena_owns(system->arena, array)) {
+		// The arena can't grow, move the array to the heap
+		grown = malloc((size_t)max * element_size);
+		memcpy(grown, array, (size_t)*max_count * element_size);
+	} else {
+		grown = realloc(array, (size_t)max * element_size);
+	}
+	*max_count = max;
+	return grown;
+}
+
+void system_free_array(struct system_t *system, void *array)
+{
+	if (!arena_owns(system->arena, array))
+		free(array);
+}
+
+// Move the first count elements of an array to a new array
+// of max_count elements in the arena
+static void *move_array(struct system_t *system, void *array, int count,
+		int max_count, int element_size)
+{
+	void *moved = arena_alloc(system->arena, (size_t)max_count * element_size);
+	if (count > 0)
+		memcpy(moved, array, (size_t)count * element_size);
+	free(array);
+	return moved;
+}
+
+// Put all arrays in a single block, leaving room for devices that
+// appear later, so that refreshing doesn't allocate anything
+static void system_move_to_arena(struct system_t *system)
+{
+	const int max_disks = system->disk_count + DEVICE_HEADROOM;
+	const int max_interfaces = system->interface_count + DEVICE_HEADROOM;
+	const int max_batteries = system->battery_count + DEVICE_HEADROOM;
+	const int max_cgroups = system->cgroup_count + DEVICE_HEADROOM;
+	const int buffer_size = system->buffer_size;
+
+	size_t size = arena_size(sizeof(struct cpu_t) * system->cpu_count) +
+		arena_size(sizeof(struct disk_t) * max_disks) +
+		arena_size(sizeof(struct interface_t) * max_interfaces) +
+		arena_size(sizeof(struct battery_t) * max_batteries) +
+		arena_size(buffer_size);
+	if (system->cgroup_root)
+		size += arena_size(sizeof(struct cgroup_t) * max_cgroups);
+	// Keep using the heap if this fails
+	if (arena_init(system->arena, size))
+		return;
+
+	system->cpus = (struct cpu_t *)move_array(system, system->cpus,
+			system->cpu_count, system->cpu_count, sizeof(struct cpu_t));
+	system->disks = (struct disk_t *)move_array(system, system->disks,
+			system->disk_count, max_disks, sizeof(struct disk_t));
+	system->max_disk_count = max_disks;
+	system->interfaces = (struct interface_t *)move_array(system,
+			system->interfaces, system->interface_count, max_interfaces,
+			sizeof(struct interface_t));
+	system->max_interface_count = max_interfaces;
+	system->batteries = (struct battery_t *)move_array(system,
+			system->batteries, system->battery_count, max_batteries,
+			sizeof(struct battery_t));
+	system->max_battery_count = max_batteries;
+	if (system->cgroup_root) {
+		system->cgroups = (struct cgroup_t *)move_array(system,
+				system->cgroups, system->cgroup_count, max_cgroups,
+				sizeof(struct cgroup_t));
+		system->max_cgroup_count = max_cgroups;
+	}
+	system->buffer = (char *)move_array(system, system->buffer,
+			system->buffer_size, buffer_size, 1);
+	system->buffer_size = buffer_size;
+}
+
 void system_delete(struct system_t system)
 {
 	// Close files
-	close(system.proc_stat_fd);
-	close(system.meminfo_fd);
+	close_fd(system.proc_stat_fd);
+	close_fd(system.meminfo_fd);
+	free(system.meminfo_keys);
 	for (int i = 0; i < system.cpu_count; ++i)
-		close(system.cpus[i].cur_freq_fd);
+		close_fd(system.cpus[i].cur_freq_fd);
 	for (int i = 0; i < system.disk_count; ++i)
-		close(system.disks[i].stat_fd);
+		close_fd(system.disks[i].stat_fd);
 	for (int i = 0; i < system.interface_count; ++i) {
-		close(system.interfaces[i].rx_bytes_fd);
-		close(system.interfaces[i].tx_bytes_fd);
+		close_fd(system.interfaces[i].rx_bytes_fd);
+		close_fd(system.interfaces[i].tx_bytes_fd);
 	}
+	for (int i = 0; system.excluded_interfaces && i < 2; ++i)
+		free(system.excluded_interfaces[i].names);
+	free(system.excluded_interfaces);
 	for (int i = 0; i < system.battery_count; ++i) {
-		close(system.batteries[i].charge_fd);
-		close(system.batteries[i].current_fd);
-		close(system.batteries[i].voltage_fd);
+		close_fd(system.batteries[i].charge_fd);
+		close_fd(system.batteries[i].current_fd);
+		close_fd(system.batteries[i].voltage_fd);
+	}
+
+	cgroup_delete(&system);
+	psi_delete(&system);
+	perf_delete(&system);
+	freq_delete(&system);
+	numa_delete(&system);
+	irq_delete(&system);
+	vmstat_delete(&system);
+	filter_delete(system.disk_filter);
+	free(system.disk_filter);
+	filter_delete(system.interface_filter);
+	free(system.interface_filter);
+	if (system.watch) {
+		watch_delete(system.watch);
+		free(system.watch);
 	}
 
 	// Free memory
-	free(system.buffer);
-	free(system.cpus);
-	free(system.disks);
-	free(system.interfaces);
-	free(system.batteries);
+	system_free_array(&system, system.buffer);
+	system_free_array(&system, system.cpus);
+	cpu_counters_delete(system.cpu_counters);
+	free(system.cpu_counters);
+	system_free_array(&system, system.disks);
+	system_free_array(&system, system.interfaces);
+	system_free_array(&system, system.batteries);
+	free(system.root);
+	free(system.overhead);
+	arena_delete(system.arena);
+	free(system.arena);
 }
 
 
@@ -85,13 +340,62 @@ static void system_refresh_disks(struct system_t *system);
 static void system_refresh_interfaces(struct system_t *system);
 static void system_refresh_batteries(struct system_t *system);
 
+// The collectors, in the order in which system_refresh_info() runs them
+static const struct {
+	const char *name;
+	void (*refresh)(struct system_t *system);
+} collectors[] = {
+	{ "cpus", system_refresh_cpus },
+	{ "ram", system_refresh_ram },
+	{ "vmstat", vmstat_refresh },
+	{ "numa", numa_refresh },
+	{ "disks", system_refresh_disks },
+	{ "interfaces", system_refresh_interfaces },
+	{ "batteries", system_refresh_batteries },
+	{ "cgroups", cgroup_refresh },
+	{ "psi", psi_refresh },
+	{ "perf", perf_refresh },
+	{ "irqs", irq_refresh },
+	{ "watch", watch_refresh },
+};
+
+int system_collector_count(void)
+{
+	return sizeof(collectors) / sizeof(collectors[0]);
+}
+
+const char *system_collector_name(int collector)
+{
+	return collectors[collector].name;
+}
+
+void system_refresh_clock(struct system_t *system)
+{
+	// Ticks can be late or cut short by a key press, so every rate is
+	// divided by the actual time since the previous refresh
+	long long now = monotonic_ns();
+	system->elapsed = system->timestamp ?
+		(now - system->timestamp) / 1000000000.0 : 0.0;
+	system->timestamp = now;
+}
+
+void system_refresh_collector(struct system_t *system, int collector)
+{
+	collectors[collector].refresh(system);
+}
+
 void system_refresh_info(struct system_t *system)
 {
-	system_refresh_cpus(system);
-	system_refresh_ram(system);
-	system_refresh_disks(system);
-	system_refresh_interfaces(system);
-	system_refresh_batteries(system);
+	system_refresh_clock(system);
+	// The sections of the collectors have the same indices
+	struct overhead_sample_t start;
+	overhead_sample(&start);
+	for (int c = 0; c < system_collector_count(); ++c) {
+		if (!(system->collectors & 1u << c))
+			continue;
+		collectors[c].refresh(system);
+		overhead_charge(system->overhead, c, &start);
+	}
 }
 
 
@@ -110,53 +414,45 @@ static int cpu_cmp(const void *a, const void *b)
 }
 
 // Initialize the CPU portion of system
-static void system_cpu_init(struct system_t *system)
+static void system_cpu_init(struct system_t *system, const char *topology_cache)
 {
 	system->cpu_count = 0;
 	system->cpus = NULL;
 	int cpus_container_size = 0;
 
 	// List /sys/bus/cpu/devices/
-	char fname[128];
-	strcpy(fname, CPU_DEVICES_DIR);
-	DIR *cpu_devices_dir = opendir(CPU_DEVICES_DIR);
-	if (cpu_devices_dir == NULL)
+	char fname[PATH_MAX];
+	system_path(system, fname, CPU_DEVICES_DIR);
+	struct dir_t cpu_devices_dir;
+	if (dir_open(&cpu_devices_dir, fname))
 		return;
-	struct dirent *cpu_ent;
-	while ((cpu_ent = readdir(cpu_devices_dir))) {
+	const char *cpu_name;
+	while ((cpu_name = dir_next(&cpu_devices_dir, NULL))) {
 		// Skip entities not starting with "cpu"
-		if (strncmp(cpu_ent->d_name, "cpu", 3))
+		if (strncmp(cpu_name, "cpu", 3))
 			continue;
 
 		struct cpu_t cpu;
-		for (int i = 0; i < CPU_STATS_COUNT; ++i)
-			cpu.stats[i] = 0;
-		cpu.id = atoi(cpu_ent->d_name + 3);
-
-		// Set fname to /sys/bus/cpu/devices/cpuN
-		strcpy(fname + cpu_devices_dir_len, cpu_ent->d_name);
-		int cpu_dir_len = cpu_devices_dir_len +
-			strlen(cpu_ent->d_name);
-		
-		// Load static CPU parameters
-		strcpy(fname + cpu_dir_len, "/topology/core_id");
-		cpu.core_id = read_int_from_file(fname);
+		cpu.id = atoi(cpu_name + 3);
 
-		strcpy(fname + cpu_dir_len, "/topology/physical_package_id");
-		cpu.package_id = read_int_from_file(fname);
-
-		strcpy(fname + cpu_dir_len, "/cpufreq/cpuinfo_max_freq");
-		cpu.max_freq = read_int_from_file(fname);
-
-		strcpy(fname + cpu_dir_len, "/cpufreq/cpuinfo_min_freq");
-		cpu.min_freq = read_int_from_file(fname);
-
-		// Open the files for the dynamic CPU parameters
-		strcpy(fname + cpu_dir_len, "/cpufreq/scaling_cur_freq");
-		cpu.cur_freq_fd = open_file_readonly(fname);
+		// The topology is filled in below, scaling_cur_freq is
+		// opened by freq_init() if it is read
+		cpu.core_id = 0;
+		cpu.package_id = 0;
+		cpu.cur_freq_fd = -1;
 
 		// Set the current cpu temperature to the default
 		cpu.cur_temp = 0;
+		cpu.isolated = 0;
+
+		// perf_event counters are opened later, if at all
+		for (int i = 0; i < PERF_COUNTERS_COUNT; ++i) {
+			cpu.perf_delta[i] = 0;
+			cpu.perf_rate[i] = 0.0;
+			cpu.perf_last[i] = 0;
+			cpu.perf_fds[i] = -1;
+		}
+		cpu.ipc = 0.0;
 
 		// Add cpu to system.cpus
 		if (cpus_container_size <= system->cpu_count) {
@@ -166,13 +462,50 @@ static void system_cpu_init(struct system_t *system)
 		}
 		system->cpus[system->cpu_count++] = cpu;
 	}
-	closedir(cpu_devices_dir);
+	dir_close(&cpu_devices_dir);
+
+	// Reading the topology from sysfs takes two files per CPU,
+	// so use the cache if it's still valid and update it if not
+	if (topology_cache == NULL || topology_load(system, topology_cache)) {
+		topology_read(system);
+		if (topology_cache)
+			topology_save(system, topology_cache);
+	}
 
 	// Sort the cpus array by package and core IDs
 	qsort(system->cpus, system->cpu_count,
 			sizeof(struct cpu_t), cpu_cmp);
 }
 
+void system_read_isolated_cpus(const char *root, unsigned char *set,
+		int max_cpus)
+{
+	static const char * const paths[] = {
+		ISOLATED_CPUS_PATH, NOHZ_FULL_CPUS_PATH
+	};
+	for (int p = 0; p < 2; ++p) {
+		char filename[PATH_MAX];
+		char list[4096];
+		snprintf(filename, sizeof(filename), "%s%s", root, paths[p]);
+		int len = read_file_to_string(filename, list, sizeof(list) - 1);
+		list[len > 0 ? len : 0] = '\0';
+		parse_cpu_list(list, set, max_cpus);
+	}
+}
+
+// Mark the CPUs in isolcpus= and nohz_full=
+static void system_find_isolated_cpus(struct system_t *system)
+{
+	const int max_cpus = system->cpu_counters->index_count;
+	unsigned char *isolated = (unsigned char *)calloc(max_cpus + 1, 1);
+	system_read_isolated_cpus(system->root, isolated, max_cpus);
+	for (int i = 0; i < system->cpu_count; ++i) {
+		struct cpu_t *cpu = &system->cpus[i];
+		cpu->isolated = cpu->id < max_cpus && isolated[cpu->id];
+	}
+	free(isolated);
+}
+
 static void system_disk_init(struct system_t *system)
 {
 	system->disks = NULL;
@@ -185,6 +518,8 @@ static void system_net_init(struct system_t *system)
 	system->interfaces = NULL;
 	system->interface_count = 0;
 	system->max_interface_count = 0;
+	system->excluded_interfaces = (struct interface_names_t *)calloc(2,
+			sizeof(struct interface_names_t));
 }
 
 static void system_bat_init(struct system_t *system)
@@ -198,92 +533,52 @@ static void system_bat_init(struct system_t *system)
 // Refresh system CPU stats
 static void system_refresh_cpus(struct system_t *system)
 {
-	// Update current CPU frequency
-	for (int i = 0; i < system->cpu_count; ++i) {
-		struct cpu_t *cpu = &system->cpus[i];
-		lseek(cpu->cur_freq_fd, 0, SEEK_SET);
-		cpu->cur_freq = read_int_from_fd(cpu->cur_freq_fd);
-	}
-
-	// Read the whole /proc/stat file
-	lseek(system->proc_stat_fd, 0, SEEK_SET);
-	int len = 0;
-	for (;;) {
-		if (system->buffer_size == len) {
-			system->buffer_size += 2048;
-			system->buffer = (char *)realloc(system->buffer,
-					system->buffer_size);
-		}
-
-		int bytes_to_read = system->buffer_size - len;
-
-		int bytes_read = read_fd_to_string(system->proc_stat_fd,
-				system->buffer + len, bytes_to_read);
-		if (bytes_read <= 0)
-			break;
-		len += bytes_read;
-	}
+	struct cpu_counters_t *counters = system->cpu_counters;
+
+	// Read /proc/stat. The buffer fits the cpu lines of all CPUs, which
+	// come first, so the rest of the file (e.g. intr) doesn't matter
+	int len = read_fd_to_string(system->proc_stat_fd, system->buffer,
+			system->buffer_size - 1);
+	if (len < 0)
+		len = 0;
 	system->buffer[len] = '\0';
 
-	// Skip the first line
-	int i = 0;
-	while (i < len && system->buffer[i] != '\n')
-		++i;
+	// Skip the first line, it's the sum of all CPUs
+	const char *line = strchr(system->buffer, '\n');
 
 	// For each cpuN line in /proc/stat
-	for (;;) {
-		// Make sure this line starts with cpuN
-		char cpuname[16];
-		int bytes;
-		int fields_read = sscanf(system->buffer + i,
-				"%s%n", cpuname, &bytes);
-		i += bytes;
-		if (fields_read <= 0 || strncmp(cpuname, "cpu", 3) != 0)
-			break;
-
+	while (line && !strncmp(++line, "cpu", 3)) {
 		// Get the cpu id (the N in cpuN)
-		int cpu_id = atoi(cpuname + 3);
-		struct cpu_t *cpu = NULL;
-		for (int c = 0; c < system->cpu_count; ++c) {
-			if (system->cpus[c].id == cpu_id) {
-				cpu = &system->cpus[c];
-				break;
-			}
-		}
-
-		// Calculate the cpu usage
+		const char *s = line + 3;
+		unsigned int cpu_id = 0;
+		for (; *s >= '0' && *s <= '9'; ++s)
+			cpu_id = cpu_id * 10 + (*s - '0');
+
+		// Ignore the last line if it didn't fit
+		line = strchr(s, '\n');
+		if (line == NULL)
+			break;
+		if (cpu_id >= counters->index_count ||
+				counters->index[cpu_id] == -1)
+			continue;
+		const int c = counters->index[cpu_id];
 
-		int stats[CPU_STATS_COUNT];
+		// Older kernels have fewer fields, those are left as 0
 		for (int t = 0; t < CPU_STATS_COUNT; ++t) {
-			sscanf(system->buffer + i, "%d%n", &stats[t], &bytes);
-			i += bytes;
+			while (*s == ' ')
+				++s;
+			unsigned long long value = 0;
+			for (; *s >= '0' && *s <= '9'; ++s)
+				value = value * 10 + (*s - '0');
+			counters->times[t][c] = value;
 		}
+	}
 
-		int delta_stats[CPU_STATS_COUNT];
-		for (int t = 0; t < CPU_STATS_COUNT; ++t)
-			delta_stats[t] = stats[t] - cpu->stats[t];
-
-
-		int total_cpu_time = 0;
-		for (int t = CPU_USER_TIME; t <= CPU_STEAL_TIME; ++t)
-			total_cpu_time += delta_stats[t];
-
-		int idle_cpu_time = delta_stats[CPU_IDLE_TIME] +
-							delta_stats[CPU_IOWAIT_TIME];
-
-		cpu->total_usage = (double)(total_cpu_time - idle_cpu_time) /
-							total_cpu_time;
-
-		// Make sure the value is in [0.0, 1.0]
-		// It will also change nan values to 0.0
-		if (!(cpu->total_usage >= 0.0))
-			cpu->total_usage = 0.0;
-		else if (cpu->total_usage > 1.0)
-			cpu->total_usage = 1.0;
+	// Calculate the usage of all CPUs at once
+	cpu_counters_compute_usage(counters);
 
-		for (int f = 0; f < CPU_STATS_COUNT; ++f)
-			cpu->stats[f] = stats[f];
-	}
+	// Then the frequency, which may depend on the usage
+	freq_refresh(system);
 
 	// Get the cpu core temperatures
 
@@ -292,31 +587,30 @@ static void system_refresh_cpus(struct system_t *system)
 		system->cpus[i].cur_temp = 0;
 
 	// Open /sys/class/hwmon/
-	DIR *hwmon_dir = opendir(HWMON_DIR);
-	if (hwmon_dir == NULL)
+	char filename[PATH_MAX];
+	const int hwmon_dir_len = system_path(system, filename, HWMON_DIR);
+	struct dir_t hwmon_dir;
+	if (dir_open(&hwmon_dir, filename))
 		return;
-	char filename[hwmon_dir_len + 100];
-	strcpy(filename, HWMON_DIR);
 	// List /sys/class/hwmon/
-	struct dirent *hwmon_ent;
-	while ((hwmon_ent = readdir(hwmon_dir))) {
-		const char *hwmon_subdir_name = hwmon_ent->d_name;
+	const char *hwmon_subdir_name;
+	while ((hwmon_subdir_name = dir_next(&hwmon_dir, NULL))) {
 		const int hwmon_subdir_name_len = strlen(hwmon_subdir_name);
 		// Ignore dotfiles
-		if (hwmon_subdir_name[0] == '.')
+		if (hwmon_subdir_name[0] == '.' ||
+				hwmon_dir_len + hwmon_subdir_name_len + 100 > PATH_MAX)
 			continue;
 
 		// Open /sys/class/hwmon/$hwmon_subdir_name
 		strcpy(filename + hwmon_dir_len, hwmon_subdir_name);
 		strcpy(filename + hwmon_dir_len + hwmon_subdir_name_len, "/");
-		DIR *hwmon_subdir = opendir(filename);
-		if (hwmon_subdir == NULL)
+		struct dir_t hwmon_subdir;
+		if (dir_open(&hwmon_subdir, filename))
 			continue;
 		// List /sys/class/hwmon/$hwmon_subdir_name
-		struct dirent *hwmon_subent;
-		while ((hwmon_subent = readdir(hwmon_subdir))) {
+		const char *fnm;
+		while ((fnm = dir_next(&hwmon_subdir, NULL))) {
 			// We're looking for files that match /^temp[0-9]+_label$/
-			const char *fnm = hwmon_subent->d_name;
 			// Name starts with temp
 			if (strncmp(fnm, "temp", 4))
 				continue;
@@ -366,109 +660,97 @@ static void system_refresh_cpus(struct system_t *system)
 				if (system->cpus[i].core_id == core_id)
 					system->cpus[i].cur_temp = temperature;
 		}
-		closedir(hwmon_subdir);
+		dir_close(&hwmon_subdir);
 	}
-	closedir(hwmon_dir);
+	dir_close(&hwmon_dir);
 }
 
 static void system_refresh_ram(struct system_t *system)
 {
 	// Read /proc/meminfo
-	lseek(system->meminfo_fd, 0, SEEK_SET);
-	const int MAX_MEMINFO_LEN = 4096;
-	char meminfo[MAX_MEMINFO_LEN];
-	int bytes = read_fd_to_string(system->meminfo_fd, meminfo,
-			MAX_MEMINFO_LEN);
-	long long mem_total = -1, mem_free = -1,
-		 mem_buffers = -1, mem_cached = -1,
-		 mem_reclaimable = -1, mem_shared = -1;
-
-	char key[128];
-	for (int i = 0; i < bytes;) {
-		// Read the key
-		int key_len = 0;
-		for (; i < bytes && meminfo[i] != ':' && key_len < 127; ++i)
-			key[key_len++] = meminfo[i];
-		if (i == bytes)
-			break;
-		key[key_len] = '\0';
-
-		// Find the begining of the value
-		for (; i < bytes && (meminfo[i] < '0' || meminfo[i] > '9'); ++i);
-
-		// Read the value
-		int value = 0;
-		for (; i < bytes && meminfo[i] >= '0' && meminfo[i] <= '9'; ++i)
-			value = value * 10 + (meminfo[i] - '0');
-
-		// Find the end of the line
-		for (; i < bytes && meminfo[i - 1] != '\n'; ++i);
-
-		// If we have successfully read the whole line...
-		if (meminfo[i - 1] == '\n') {
-			if (!strcmp(key, "MemTotal"))
-				mem_total = value;
-			else if (!strcmp(key, "MemFree"))
-				mem_free = value;
-			else if (!strcmp(key, "Buffers"))
-				mem_buffers = value;
-			else if (!strcmp(key, "Cached"))
-				mem_cached = value;
-			else if (!strcmp(key, "SReclaimable"))
-				mem_reclaimable = value;
-			else if (!strcmp(key, "Shmem"))
-				mem_shared = value;
-		}
-	}
-
-	int total_used = mem_total - mem_free;
-	int cached = mem_cached + mem_reclaimable - mem_shared;
-	int used = total_used - mem_buffers - cached;
-	system->ram_buffers = mem_buffers * 1024LL;
+	if (system->meminfo_fd < 0)
+		return;
+	int bytes = read_fd_to_string(system->meminfo_fd, system->buffer,
+			system->buffer_size - 1);
+	if (bytes <= 0)
+		return;
+	system->buffer[bytes] = '\0';
+	unsigned long long mem[MEMINFO_COUNT] = {0};
+	kv_parse(system->meminfo_keys, system->buffer, mem);
+
+	long long total_used = (long long)mem[MEMINFO_TOTAL] - mem[MEMINFO_FREE];
+	long long cached = (long long)mem[MEMINFO_CACHED] +
+		mem[MEMINFO_RECLAIMABLE] - mem[MEMINFO_SHARED];
+	long long used = total_used - (long long)mem[MEMINFO_BUFFERS] - cached;
+	system->ram_buffers = mem[MEMINFO_BUFFERS] * 1024LL;
 	system->ram_cached = cached * 1024LL;
 	system->ram_used = used * 1024LL;
 }
 
+// Read and parse the stat file of a block device. Returns 0 on error
+static int read_disk_stats(int fd, unsigned long long *stats)
+{
+	const int stat_buffer_size = 511; // Should be enough
+	char stat_buffer[stat_buffer_size + 1];
+	int bytes_read = read_fd_to_string(fd, stat_buffer, stat_buffer_size);
+	if (bytes_read <= 0)
+		return 0;
+	stat_buffer[bytes_read] = '\0';
+
+	char *s = stat_buffer;
+	for (int i = 0; i < DISK_STATS_COUNT; ++i)
+		stats[i] = strtoull(s, &s, 10);
+	return 1;
+}
+
 static void system_refresh_disks(struct system_t *system)
 {
 	// Will be used to store the path to the stat file for each device
-	char filepath[block_devices_dir_len + 20];
-	strcpy(filepath, BLOCK_DEVICES_DIR);
+	char filepath[PATH_MAX];
+	const int block_devices_dir_len = system_path(system, filepath,
+			BLOCK_DEVICES_DIR);
+	if (block_devices_dir_len + MAX_DISK_NAME_LENGTH + 20 > PATH_MAX)
+		return;
 
 	// Open /sys/block/
-	DIR *block_devices_dir = opendir(BLOCK_DEVICES_DIR);
-	if (block_devices_dir == NULL) {
+	struct dir_t block_devices_dir;
+	if (dir_open(&block_devices_dir, filepath)) {
 		system->disk_count = 0;
 		return;
 	}
 	// List /sys/block
-	struct dirent *block_device_ent;
-	while ((block_device_ent = readdir(block_devices_dir))) {
-		// Ignore loop devices, dotfiles and devices with
-		// too long names
-		if (strncmp(block_device_ent->d_name, "loop", 4) == 0 ||
-				block_device_ent->d_name[0] == '.' ||
-				strlen(block_device_ent->d_name) >
+	const char *block_device_name;
+	int next = 0;
+	while ((block_device_name = dir_next(&block_devices_dir, NULL))) {
+		// Ignore dotfiles and devices with too long names
+		if (block_device_name[0] == '.' ||
+				strlen(block_device_name) >
 					MAX_DISK_NAME_LENGTH)
 			continue;
 
-		// Check for a disk with the same name in system
+		// Check for a disk with the same name in system. They are
+		// listed in the same order every time, so try the next one first
 		struct disk_t *diskptr = NULL;
-		for (int i = 0; i < system->disk_count; ++i) {
-			if (strcmp(block_device_ent->d_name,
-						system->disks[i].name) == 0) {
-				diskptr = &system->disks[i];
-				break;
+		if (next < system->disk_count &&
+				!strcmp(block_device_name, system->disks[next].name)) {
+			diskptr = &system->disks[next++];
+		} else {
+			for (int i = 0; i < system->disk_count; ++i) {
+				if (strcmp(block_device_name,
+							system->disks[i].name) == 0) {
+					diskptr = &system->disks[i];
+					next = i + 1;
+					break;
+				}
 			}
 		}
-		// If it's not found, add it
-		if (diskptr == NULL) {
+		// If it's not found and not filtered out, add it
+		if (diskptr == NULL &&
+				filter_match(system->disk_filter, block_device_name)) {
 			struct disk_t disk;
-			for (int i = 0; i < DISK_STATS_COUNT; ++i)
-				disk.last_stats[i] = 0;
 
 			// Set the disk name
-			strcpy(disk.name, block_device_ent->d_name);
+			strcpy(disk.name, block_device_name);
 
 			// Open the stat file
 			strcpy(filepath + block_devices_dir_len, disk.name);
@@ -479,60 +761,57 @@ static void system_refresh_disks(struct system_t *system)
 				continue;
 			}
 
+			// The current values are the baseline for the first rates
+			if (!read_disk_stats(disk.stat_fd, disk.last_stats)) {
+				close_fd(disk.stat_fd);
+				continue;
+			}
+
 			// Allocate memory if necessary
 			if (system->disk_count == system->max_disk_count) {
-				system->max_disk_count += 128;
-				system->disks = (struct disk_t *)realloc(
-						system->disks,
-						sizeof(struct disk_t) * system->max_disk_count);
+				system->disks = (struct disk_t *)system_grow_array(
+						system, system->disks, &system->max_disk_count,
+						sizeof(struct disk_t), 128);
 			}
 			system->disks[system->disk_count++] = disk;
+			++system->device_generation;
 		}
 	}
-	closedir(block_devices_dir);
+	dir_close(&block_devices_dir);
 
 	// Loop over all disks
 	for (int d = 0; d < system->disk_count; ++d) {
 		struct disk_t *disk = &system->disks[d];
 
 		// Read the disk stats
-		lseek(disk->stat_fd, 0, SEEK_SET);
-		const int stat_buffer_size = 511; // Should be enough
-		char stat_buffer[stat_buffer_size + 1];
-		int bytes_read = read_fd_to_string(disk->stat_fd,
-				stat_buffer, stat_buffer_size);
-		if (bytes_read <= 0) {
+		unsigned long long stats[DISK_STATS_COUNT];
+		int ok = read_disk_stats(disk->stat_fd, stats);
+		if (!ok) {
 			// On error, try to reopen the stat file
-			close(disk->stat_fd);
-			char filename[block_devices_dir_len + 20];
-			strcpy(filename, BLOCK_DEVICES_DIR);
+			close_fd(disk->stat_fd);
+			char *filename = filepath;
 			strcpy(filename + block_devices_dir_len, disk->name);
 			strcpy(filename + block_devices_dir_len +
 					strlen(disk->name), "/stat");
 			if ((disk->stat_fd = open_file_readonly(filename)) < 0)
 				continue;
-			bytes_read = read_fd_to_string(disk->stat_fd,
-					stat_buffer, stat_buffer_size);
+			ok = read_disk_stats(disk->stat_fd, stats);
 		}
-		if (bytes_read <= 0) {
-			close(disk->stat_fd);
+		if (!ok) {
+			close_fd(disk->stat_fd);
 			// Mark it with -1 so that we can delete it
 			// from the array
 			disk->stat_fd = -1;
 			continue;
 		}
-		stat_buffer[bytes_read] = '\0';
 
 		// Save the stats
-		int buf_index = 0;
 		for (int s = 0; s < DISK_STATS_COUNT; ++s) {
-			int bytes_read;
-			int stat;
-			sscanf(stat_buffer + buf_index, "%d%n",
-					&stat, &bytes_read);
-			disk->stats_delta[s] = stat - disk->last_stats[s];
-			disk->last_stats[s] = stat;
-			buf_index += bytes_read;
+			disk->stats_delta[s] = counter_delta(stats[s],
+					disk->last_stats[s]);
+			disk->stats_rate[s] = counter_rate(disk->stats_delta[s],
+					system->elapsed);
+			disk->last_stats[s] = stats[s];
 		}
 	}
 
@@ -545,81 +824,168 @@ static void system_refresh_disks(struct system_t *system)
 			++i;
 		}
 	}
+	if (i != system->disk_count)
+		++system->device_generation;
 	system->disk_count = i;
 }
 
+// Whether name is in names. They are listed in the same order every
+// time, so the one at *next is tried first
+static int interface_names_find(const struct interface_names_t *names,
+		const char *name, int *next)
+{
+	if (*next < names->count && !strcmp(names->names[*next], name)) {
+		++*next;
+		return 1;
+	}
+	for (int i = 0; i < names->count; ++i) {
+		if (!strcmp(names->names[i], name)) {
+			*next = i + 1;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void interface_names_add(struct interface_names_t *names,
+		const char *name)
+{
+	if (names->count == names->max_count) {
+		names->max_count += 128;
+		names->names = (char (*)[MAX_INTERFACE_NAME_LENGTH + 1])realloc(
+				names->names, sizeof(names->names[0]) * names->max_count);
+	}
+	strcpy(names->names[names->count++], name);
+}
+
 static void system_refresh_interfaces(struct system_t *system)
 {
 	// Will be used to store the path to various files
-	char filepath[interfaces_dir_len + MAX_INTERFACE_NAME_LENGTH + 32];
-	strcpy(filepath, INTERFACES_DIR);
+	char filepath[PATH_MAX];
+	const int interfaces_dir_len = system_path(system, filepath,
+			INTERFACES_DIR);
+	if (interfaces_dir_len + MAX_INTERFACE_NAME_LENGTH + 32 > PATH_MAX)
+		return;
 
 	// Open /sys/class/net/
-	DIR *interfaces_dir = opendir(INTERFACES_DIR);
-	if (interfaces_dir == NULL) {
+	struct dir_t interfaces_dir;
+	if (dir_open(&interfaces_dir, filepath)) {
 		system->interface_count = 0;
 		return;
 	}
 	// List /sys/class/net/
-	struct dirent *interface_ent;
-	while ((interface_ent = readdir(interfaces_dir))) {
+	for (int i = 0; i < system->interface_count; ++i)
+		system->interfaces[i].seen = 0;
+	struct interface_names_t *excluded = &system->excluded_interfaces[0];
+	struct interface_names_t *listed = &system->excluded_interfaces[1];
+	listed->count = 0;
+	const char *interface_name;
+	int next = 0;
+	int next_excluded = 0;
+	while ((interface_name = dir_next(&interfaces_dir, NULL))) {
 		// Ignore dotfiles and devices with too long names
-		if (interface_ent->d_name[0] == '.' ||
-				strlen(interface_ent->d_name) >
+		if (interface_name[0] == '.' ||
+				strlen(interface_name) >
 				MAX_INTERFACE_NAME_LENGTH)
 			continue;
 
 
-		// Check for an known interface with the same name
+		// Check for a known interface with the same name, or one that was
+		// excluded. They are listed in the same order every time, so try
+		// the next ones first
 		struct interface_t *ifaceptr = NULL;
-		for (int i = 0; i < system->interface_count; ++i) {
-			if (strcmp(interface_ent->d_name,
-						system->interfaces[i].name) == 0) {
-				ifaceptr = &system->interfaces[i];
-				break;
+		if (next < system->interface_count &&
+				!strcmp(interface_name, system->interfaces[next].name)) {
+			ifaceptr = &system->interfaces[next++];
+		} else if (next_excluded >= excluded->count ||
+				strcmp(interface_name, excluded->names[next_excluded])) {
+			for (int i = 0; i < system->interface_count; ++i) {
+				if (strcmp(interface_name,
+							system->interfaces[i].name) == 0) {
+					ifaceptr = &system->interfaces[i];
+					next = i + 1;
+					break;
+				}
 			}
 		}
-		// If it's not found, add it
-		if (ifaceptr == NULL) {
-			struct interface_t interface;
-			interface.last_total_rx_bytes = 0;
-			interface.last_total_tx_bytes = 0;
+		if (ifaceptr) {
+			ifaceptr->seen = 1;
+			continue;
+		}
+		// Excluded names are only matched against the filter once, which
+		// matters with thousands of container interfaces
+		if (interface_names_find(excluded, interface_name,
+					&next_excluded) ||
+				!filter_match(system->interface_filter, interface_name)) {
+			interface_names_add(listed, interface_name);
+			continue;
+		}
 
-			// Set the interface name
-			strcpy(interface.name, interface_ent->d_name);
+		// Add it
+		struct interface_t interface;
+		interface.seen = 1;
 
-			// Append the name to the path
-			strcpy(filepath + interfaces_dir_len, interface.name);
+		// Set the interface name
+		strcpy(interface.name, interface_name);
 
-			// Open the rx_bytes file
-			strcpy(filepath + interfaces_dir_len +
-					strlen(interface.name), "/statistics/rx_bytes");
-			interface.rx_bytes_fd = open_file_readonly(filepath);
-			if (interface.rx_bytes_fd == -1) {
-				continue;
-			}
+		// Append the name to the path
+		strcpy(filepath + interfaces_dir_len, interface.name);
 
-			// Open the tx_bytes file
-			strcpy(filepath + interfaces_dir_len +
-					strlen(interface.name), "/statistics/tx_bytes");
-			interface.tx_bytes_fd = open_file_readonly(filepath);
-			if (interface.tx_bytes_fd == -1) {
-				close(interface.rx_bytes_fd);
-				continue;
-			}
+		// Open the rx_bytes file
+		strcpy(filepath + interfaces_dir_len +
+				strlen(interface.name), "/statistics/rx_bytes");
+		interface.rx_bytes_fd = open_file_readonly(filepath);
+		if (interface.rx_bytes_fd == -1) {
+			continue;
+		}
 
-			// Allocate memory if necessary
-			if (system->interface_count == system->max_interface_count) {
-				system->max_interface_count += 128;
-				system->interfaces = (struct interface_t *)realloc(
-						system->interfaces,
-						sizeof(struct interface_t) *
-						system->max_interface_count);
-			}
-			system->interfaces[system->interface_count++] = interface;
+		// Open the tx_bytes file
+		strcpy(filepath + interfaces_dir_len +
+				strlen(interface.name), "/statistics/tx_bytes");
+		interface.tx_bytes_fd = open_file_readonly(filepath);
+		if (interface.tx_bytes_fd == -1) {
+			close_fd(interface.rx_bytes_fd);
+			continue;
+		}
+
+		// The current values are the baseline for the first rates
+		interface.last_total_rx_bytes =
+			read_ull_from_fd(interface.rx_bytes_fd);
+		interface.last_total_tx_bytes =
+			read_ull_from_fd(interface.tx_bytes_fd);
+
+		// Allocate memory if necessary
+		if (system->interface_count == system->max_interface_count) {
+			system->interfaces = (struct interface_t *)system_grow_array(
+					system, system->interfaces,
+					&system->max_interface_count,
+					sizeof(struct interface_t), 128);
 		}
+		system->interfaces[system->interface_count++] = interface;
+		++system->device_generation;
 	}
-	closedir(interfaces_dir);
+	dir_close(&interfaces_dir);
+	// The names excluded now are those to look up next time
+	const struct interface_names_t last = *excluded;
+	*excluded = *listed;
+	*listed = last;
+
+	// Drop the interfaces that are gone
+	int kept = 0;
+	for (int i = 0; i < system->interface_count; ++i) {
+		struct interface_t *interface = &system->interfaces[i];
+		if (!interface->seen) {
+			close_fd(interface->rx_bytes_fd);
+			close_fd(interface->tx_bytes_fd);
+			continue;
+		}
+		if (kept != i)
+			system->interfaces[kept] = *interface;
+		++kept;
+	}
+	if (kept != system->interface_count)
+		++system->device_generation;
+	system->interface_count = kept;
 
 	// Loop over all interfaces
 	for (int i = 0; i < system->interface_count; ++i) {
@@ -627,14 +993,18 @@ static void system_refresh_interfaces(struct system_t *system)
 
 		// Read the interface stats
 
-		lseek(interface->rx_bytes_fd, 0, SEEK_SET);
 		unsigned long long rx = read_ull_from_fd(interface->rx_bytes_fd);
-		interface->delta_rx_bytes = rx - interface->last_total_rx_bytes;
+		interface->delta_rx_bytes = counter_delta(rx,
+				interface->last_total_rx_bytes);
+		interface->rx_rate = counter_rate(interface->delta_rx_bytes,
+				system->elapsed);
 		interface->last_total_rx_bytes = rx;
 
-		lseek(interface->tx_bytes_fd, 0, SEEK_SET);
 		unsigned long long tx = read_ull_from_fd(interface->tx_bytes_fd);
-		interface->delta_tx_bytes = tx - interface->last_total_tx_bytes;
+		interface->delta_tx_bytes = counter_delta(tx,
+				interface->last_total_tx_bytes);
+		interface->tx_rate = counter_rate(interface->delta_tx_bytes,
+				system->elapsed);
 		interface->last_total_tx_bytes = tx;
 
 	}
@@ -643,29 +1013,31 @@ static void system_refresh_interfaces(struct system_t *system)
 static void system_refresh_batteries(struct system_t *system)
 {
 	// Will be used to store the path to various files
-	char filepath[power_dir_len + MAX_BATTERY_NAME_LENGTH + 32];
-	strcpy(filepath, POWER_DIR);
+	char filepath[PATH_MAX];
+	const int power_dir_len = system_path(system, filepath, POWER_DIR);
+	if (power_dir_len + MAX_BATTERY_NAME_LENGTH + 32 > PATH_MAX)
+		return;
 
 	// Open /sys/class/power_supply/
-	DIR *power_dir = opendir(POWER_DIR);
-	if (power_dir == NULL) {
+	struct dir_t power_dir;
+	if (dir_open(&power_dir, filepath)) {
 		system->battery_count = 0;
 		return;
 	}
 	// List /sys/class/power_supply/
-	struct dirent *power_ent;
-	while ((power_ent = readdir(power_dir))) {
+	const char *power_name;
+	while ((power_name = dir_next(&power_dir, NULL))) {
 		// Ignore devices with too long names and
 		// directories with names not starting with BAT
-		if (strlen(power_ent->d_name) > MAX_BATTERY_NAME_LENGTH ||
-				strncmp(power_ent->d_name, "BAT", 3))
+		if (strlen(power_name) > MAX_BATTERY_NAME_LENGTH ||
+				strncmp(power_name, "BAT", 3))
 			continue;
 
 
 		// Check for an known battery with the same name
 		struct battery_t *batptr = NULL;
 		for (int i = 0; i < system->battery_count; ++i) {
-			if (strcmp(power_ent->d_name,
+			if (strcmp(power_name,
 						system->batteries[i].name) == 0) {
 				batptr = &system->batteries[i];
 				break;
@@ -676,7 +1048,7 @@ static void system_refresh_batteries(struct system_t *system)
 			struct battery_t battery;
 
 			// Set the battery name
-			strcpy(battery.name, power_ent->d_name);
+			strcpy(battery.name, power_name);
 
 			// Append the name to the path
 			strcpy(filepath + power_dir_len, battery.name);
@@ -693,7 +1065,7 @@ static void system_refresh_batteries(struct system_t *system)
 					strlen(battery.name), "/current_now");
 			battery.current_fd = open_file_readonly(filepath);
 			if (battery.current_fd == -1) {
-				close(battery.charge_fd);
+				close_fd(battery.charge_fd);
 				continue;
 			}
 
@@ -702,24 +1074,24 @@ static void system_refresh_batteries(struct system_t *system)
 					strlen(battery.name), "/voltage_now");
 			battery.voltage_fd = open_file_readonly(filepath);
 			if (battery.voltage_fd == -1) {
-				close(battery.charge_fd);
-				close(battery.current_fd);
+				close_fd(battery.charge_fd);
+				close_fd(battery.current_fd);
 				continue;
 			}
 
 
 			// Allocate memory if necessary
 			if (system->battery_count == system->max_battery_count) {
-				system->max_battery_count += 128;
-				system->batteries = (struct battery_t *)realloc(
-						system->batteries,
-						sizeof(struct battery_t) *
-						system->max_battery_count);
+				system->batteries = (struct battery_t *)system_grow_array(
+						system, system->batteries,
+						&system->max_battery_count,
+						sizeof(struct battery_t), 128);
 			}
 			system->batteries[system->battery_count++] = battery;
+			++system->device_generation;
 		}
 	}
-	closedir(power_dir);
+	dir_close(&power_dir);
 
 	// Loop over all batteries
 	for (int i = 0; i < system->battery_count; ++i) {
@@ -727,13 +1099,10 @@ static void system_refresh_batteries(struct system_t *system)
 
 		// Read the battery stats
 
-		lseek(battery->charge_fd, 0, SEEK_SET);
 		battery->charge = read_int_from_fd(battery->charge_fd);
 
-		lseek(battery->current_fd, 0, SEEK_SET);
 		battery->current = read_int_from_fd(battery->current_fd);
 
-		lseek(battery->voltage_fd, 0, SEEK_SET);
 		battery->voltage = read_int_from_fd(battery->voltage_fd);
 	}
 }
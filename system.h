@@ -2,9 +2,58 @@
 #define SYSTEM_H_INCLUDED
 
 struct cpu_t;
+struct cpu_counters_t;
 struct disk_t;
 struct interface_t;
+struct interface_names_t;
 struct battery_t;
+struct cgroup_t;
+struct psi_t;
+struct psi_trigger_t;
+struct overhead_t;
+struct arena_t;
+struct freq_t;
+struct numa_node_t;
+struct vmstat_t;
+struct irq_stats_t;
+struct filter_t;
+struct watch_t;
+struct kv_table_t;
+
+/** Options for system_init() */
+struct system_config_t
+{
+	const char *root; /**< Prefix for all /proc and /sys paths, e.g. the
+						mount point of the host's filesystem in a container */
+	const char *cgroup_root; /**< Where the cgroup v2 hierarchy is mounted.
+							   NULL disables the cgroup collector */
+	int cgroup_max_depth; /**< How many levels below cgroup_root to scan */
+	int perf_events; /**< Open per-CPU perf_event counters */
+	int freq_source; /**< Where the CPU frequency comes from, see freq.h */
+	int skip_isolated; /**< Don't read the per-CPU files or counters of
+						 isolated CPUs, which can interrupt them */
+	int irqs; /**< Read /proc/interrupts, /proc/softirqs and
+				/proc/net/softnet_stat, which are big on big machines */
+	unsigned int collectors; /**< Bit c enables collector c (see
+							   system_collector_name()), all by default */
+	const char *disk_filter; /**< The disks to watch (see filter.h),
+							   "!loop*" by default */
+	const char *interface_filter; /**< The network interfaces to watch,
+									NULL for all */
+	const char *topology_cache; /**< A file to keep the CPU topology in
+								  between runs (see topology.h), NULL to
+								  always read it from sysfs */
+	const char *watch; /**< The processes to watch with their threads, as
+						 PIDs and names separated by commas (see
+						 watch.h). NULL by default */
+};
+
+/** Fill config with the default options */
+void system_config_init(struct system_config_t *config);
+
+/** Returns 0 if the filters of config are valid, or 1 if one has more
+ * than MAX_FILTER_PATTERNS patterns */
+int system_config_check(const struct system_config_t *config);
 
 /** All the data about the system is stored here */
 struct system_t
@@ -12,6 +61,19 @@ struct system_t
 	int cpu_count; /**< The number of CPUs in the system */
 	struct cpu_t *cpus; /**< All CPUs in the system ordered
 						  by core_id and package_id */
+	struct cpu_counters_t *cpu_counters; /**< The usage and frequency
+										   of the CPUs */
+	int perf_cpu_count; /**< The number of CPUs with perf_event counters */
+	int skip_isolated; /**< Isolated CPUs have no per-CPU files or
+						 counters open */
+	struct freq_t *freq; /**< The source of the CPU frequency */
+
+	char *root; /**< Prefix for all /proc and /sys paths */
+	int root_len;
+
+	struct filter_t *disk_filter; /**< Disks that don't match it are
+									never opened */
+	struct filter_t *interface_filter; /**< The same for interfaces */
 
 	int disk_count; /**< The number of disks (block devices) */
 	struct disk_t *disks; /**< The actual disks in the system */
@@ -20,29 +82,125 @@ struct system_t
 	int interface_count; /**< The number of network interfaces */
 	struct interface_t *interfaces; /**< The network interfaces */
 	int max_interface_count;
+	struct interface_names_t *excluded_interfaces; /**< Those that the
+													 filter excluded at the
+													 last refresh, which
+													 aren't matched again,
+													 and those of this one */
 
 	int battery_count; /**< The number of batteries */
 	struct battery_t *batteries; /**< The batteries */
 	int max_battery_count;
 
+	int cgroup_count; /**< The number of tracked cgroups */
+	struct cgroup_t *cgroups; /**< The tracked cgroups */
+	int max_cgroup_count;
+	char *cgroup_root; /**< NULL if the cgroup collector is disabled */
+	int cgroup_max_depth;
+	int cgroup_inotify_fd; /**< Tells when cgroups are created or removed,
+							 -1 without inotify */
+	int cgroup_rescan_ticks; /**< Refreshes until the hierarchy is scanned
+							   again, -1 until inotify reports a change */
+	char *cgroup_buffer; /**< Where the files of the cgroups are read, as
+						   big as the largest of them */
+	int cgroup_buffer_size;
+	struct kv_table_t *memory_stat_keys; /**< The keys of memory.stat */
+
+	unsigned long long device_generation; /**< Changes whenever a disk,
+											interface, battery, cgroup or
+											watched process appears or
+											disappears. Threads have
+											watch_t::thread_generation */
+
+	struct psi_t *psi; /**< Pressure stall information indexed by PSI_CPU,
+						 PSI_MEMORY and PSI_IO. NULL if not supported */
+	int psi_trigger_count; /**< The number of registered PSI triggers */
+	struct psi_trigger_t *psi_triggers; /**< The registered PSI triggers */
+
 	long long ram_used; /**< The ammount of RAM used by applications (bytes) */
 	long long ram_buffers; /**< The ammount of RAM used as buffers (bytes) */
 	long long ram_cached; /**< THe ammount of RAM used for caches (bytes) */
 
+	int numa_node_count; /**< The number of NUMA nodes, 0 without NUMA */
+	struct numa_node_t *numa_nodes; /**< The NUMA nodes ordered by ID */
+	struct kv_table_t *numa_meminfo_keys; /**< The keys of a node's
+											meminfo */
+	struct kv_table_t *numastat_keys; /**< The keys of a node's numastat */
+
+	struct vmstat_t *vmstat; /**< Paging, swap and reclaim activity */
+
+	struct irq_stats_t *irqs; /**< Interrupts, softirqs and softnet_stat
+								per CPU. NULL unless enabled */
+
+	struct watch_t *watch; /**< The watched processes and their threads.
+							 NULL unless some are given */
+
+	long long timestamp; /**< CLOCK_MONOTONIC time of the last refresh (ns) */
+	double elapsed; /**< Seconds between the last two refreshes. All rates
+					  are divided by it */
+
+	unsigned int collectors; /**< The collectors that
+							   system_refresh_info() runs, one bit each */
+
+	struct overhead_t *overhead; /**< The cost of smon itself. There is
+								   one section per collector */
+
 	// File descriptors for files that are kept open
 	int proc_stat_fd;
 	int meminfo_fd;
+	struct kv_table_t *meminfo_keys; /**< The keys of /proc/meminfo */
 
-	// Generic buffer. Used when reading from /proc/stat
+	// Generic buffer. Used when reading from /proc/stat, /proc/meminfo
+	// and /proc/vmstat
 	char *buffer;
 	int buffer_size;
+
+	struct arena_t *arena; /**< Holds the arrays above once the devices
+							 are discovered, so that refreshing allocates
+							 nothing. Arrays that outgrow their space
+							 move to the heap */
 };
 
-struct system_t system_init(void);
+struct system_t system_init(const struct system_config_t *config);
 
 void system_delete(struct system_t system);
 
-/** Refresh all dynamically changing system stats */
+/** Refresh all dynamically changing system stats of the enabled
+ * collectors */
 void system_refresh_info(struct system_t *system);
 
+/** The number of collectors that system_refresh_info() runs */
+int system_collector_count(void);
+
+/** The name of a collector (e.g. "cpus" or "disks") */
+const char *system_collector_name(int collector);
+
+/** Start a new sample by updating system->timestamp and system->elapsed.
+ * Used with system_refresh_collector() to run the collectors one by one */
+void system_refresh_clock(struct system_t *system);
+
+/** Run a single collector. Unlike system_refresh_info(), this does not
+ * charge its cost to system->overhead */
+void system_refresh_collector(struct system_t *system, int collector);
+
+/** Grow an array of system (e.g. system->disks) by step elements, whether
+ * it is in system->arena or on the heap. Returns the new array */
+void *system_grow_array(struct system_t *system, void *array,
+		int *max_count, int element_size, int step);
+
+/** Free an array of system that may be in system->arena */
+void system_free_array(struct system_t *system, void *array);
+
+/** Make system->buffer big enough to read the whole of fd, with room
+ * to spare. Only called before the first refresh */
+void system_reserve_buffer(struct system_t *system, int fd);
+
+/** Set the entries of set for the CPUs in isolcpus= and nohz_full=,
+ * reading /sys under root. CPUs from max_cpus on are ignored */
+void system_read_isolated_cpus(const char *root, unsigned char *set,
+		int max_cpus);
+
+/** Prefix path with system->root. Returns the length of the result */
+int system_path(const struct system_t *system, char *out, const char *path);
+
 #endif
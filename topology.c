@@ -0,0 +1,143 @@
+#include "topology.h"
+#include "system.h"
+#include "util.h"
+#include "cpu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#define CPU_DEVICES_DIR "/sys/bus/cpu/devices/cpu"
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+#define TOPOLOGY_HEADER "smon topology 1\n"
+
+// The longest "<id> <core_id> <package_id>" line
+#define TOPOLOGY_LINE_MAX (3 * 11 + 3)
+
+// Read the ID of the current boot into boot_id. Returns 0 on success
+static int read_boot_id(const struct system_t *system, char *boot_id,
+		int size)
+{
+	char filename[PATH_MAX];
+	system_path(system, filename, BOOT_ID_PATH);
+	int len = read_file_to_string(filename, boot_id, size - 1);
+	while (len > 0 && boot_id[len - 1] == '\n')
+		--len;
+	if (len <= 0)
+		return 1;
+	boot_id[len] = '\0';
+	return 0;
+}
+
+// Compare the line at *s with expected and move *s past it.
+// Returns 0 if they match
+static int match_line(const char **s, const char *key, const char *value)
+{
+	const int key_len = strlen(key);
+	const int value_len = strlen(value);
+	const char *line = *s;
+	if (strncmp(line, key, key_len) || line[key_len] != ' ' ||
+			strncmp(line + key_len + 1, value, value_len) ||
+			line[key_len + 1 + value_len] != '\n')
+		return 1;
+	*s = line + key_len + 1 + value_len + 1;
+	return 0;
+}
+
+int topology_load(struct system_t *system, const char *filename)
+{
+	char boot_id[64];
+	if (system->cpu_count == 0 || read_boot_id(system, boot_id,
+				sizeof(boot_id)))
+		return 1;
+
+	const int size = strlen(TOPOLOGY_HEADER) + sizeof(boot_id) +
+		system->root_len + 64 + system->cpu_count * TOPOLOGY_LINE_MAX;
+	char *contents = (char *)malloc(size + 1);
+	int len = read_file_to_string(filename, contents, size);
+	contents[len > 0 ? len : 0] = '\0';
+
+	// The CPUs by ID, to check that the cache has each of them once
+	int max_id = 0;
+	for (int c = 0; c < system->cpu_count; ++c)
+		if (system->cpus[c].id > max_id)
+			max_id = system->cpus[c].id;
+	int *index = (int *)malloc(sizeof(int) * (max_id + 1));
+	for (int id = 0; id <= max_id; ++id)
+		index[id] = -1;
+	for (int c = 0; c < system->cpu_count; ++c)
+		index[system->cpus[c].id] = c;
+
+	char count[16];
+	sprintf(count, "%d", system->cpu_count);
+	const char *s = contents;
+	int ret = strncmp(s, TOPOLOGY_HEADER, strlen(TOPOLOGY_HEADER));
+	s += ret ? 0 : strlen(TOPOLOGY_HEADER);
+	ret = ret || match_line(&s, "boot", boot_id) ||
+		match_line(&s, "root", system->root) ||
+		match_line(&s, "cpus", count);
+	for (int i = 0; !ret && i < system->cpu_count; ++i) {
+		char *end;
+		long values[3];
+		for (int v = 0; !ret && v < 3; ++v) {
+			values[v] = strtol(s, &end, 10);
+			ret = end == s || *end != (v < 2 ? ' ' : '\n');
+			s = end + 1;
+		}
+		if (ret || values[0] < 0 || values[0] > max_id ||
+				index[values[0]] == -1) {
+			ret = 1;
+			break;
+		}
+		struct cpu_t *cpu = &system->cpus[index[values[0]]];
+		cpu->core_id = values[1];
+		cpu->package_id = values[2];
+		index[values[0]] = -1;
+	}
+	free(index);
+	free(contents);
+	return ret;
+}
+
+void topology_read(struct system_t *system)
+{
+	char filename[PATH_MAX];
+	const int dir_len = system_path(system, filename, CPU_DEVICES_DIR);
+	for (int c = 0; c < system->cpu_count; ++c) {
+		struct cpu_t *cpu = &system->cpus[c];
+		const int len = dir_len + sprintf(filename + dir_len, "%d", cpu->id);
+		strcpy(filename + len, "/topology/core_id");
+		cpu->core_id = read_int_from_file(filename);
+		strcpy(filename + len, "/topology/physical_package_id");
+		cpu->package_id = read_int_from_file(filename);
+	}
+}
+
+int topology_save(const struct system_t *system, const char *filename)
+{
+	char boot_id[64];
+	if (read_boot_id(system, boot_id, sizeof(boot_id)))
+		return 1;
+
+	// Write a new file and rename it over the old one, so that another
+	// smon starting at the same time never reads half of it
+	char temp_filename[PATH_MAX];
+	if (snprintf(temp_filename, sizeof(temp_filename), "%s.%d", filename,
+				(int)getpid()) >= (int)sizeof(temp_filename))
+		return 1;
+	FILE *file = fopen(temp_filename, "we");
+	if (file == NULL)
+		return 1;
+	fprintf(file, TOPOLOGY_HEADER "boot %s\nroot %s\ncpus %d\n", boot_id,
+			system->root, system->cpu_count);
+	for (int c = 0; c < system->cpu_count; ++c)
+		fprintf(file, "%d %d %d\n", system->cpus[c].id,
+				system->cpus[c].core_id, system->cpus[c].package_id);
+	if (fclose(file) || rename(temp_filename, filename)) {
+		remove(temp_filename);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef TOPOLOGY_H_INCLUDED
+#define TOPOLOGY_H_INCLUDED
+
+/*
+ * The core and package IDs of the CPUs take two sysfs reads per CPU,
+ * which adds up to seconds on big VMs with slow sysfs. They don't change
+ * until the next boot, so they can be kept in a cache file:
+ *
+ *	smon topology 1
+ *	boot <boot_id>
+ *	root <the root of system_config_t>
+ *	cpus <count>
+ *	<id> <core_id> <package_id>
+ *	...
+ *
+ * The cache is only used if it is from the same boot and root and lists
+ * exactly the CPUs that were found.
+ */
+
+struct system_t;
+
+/** Fill in the core_id and package_id of system->cpus from the cache
+ * file. Returns 0 on success, or 1 if the cache is missing or stale */
+int topology_load(struct system_t *system, const char *filename);
+
+/** Read the core_id and package_id of system->cpus from sysfs */
+void topology_read(struct system_t *system);
+
+/** Write the topology of system->cpus to the cache file. Returns 0 on
+ * success */
+int topology_save(const struct system_t *system, const char *filename);
+
+#endif
@@ -3,49 +3,164 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
+#include <dirent.h>
+
+__thread unsigned long long util_syscall_count = 0;
 
 int open_file_readonly(const char *filename)
 {
-	return open(filename, O_RDONLY);
+	++util_syscall_count;
+	return open(filename, O_RDONLY | O_CLOEXEC);
+}
+
+void close_fd(int fd)
+{
+	if (fd < 0)
+		return;
+	++util_syscall_count;
+	close(fd);
+}
+
+
+int read_fd(int fd, void *out, int maxbytes)
+{
+	++util_syscall_count;
+	return read(fd, out, maxbytes);
 }
 
+int read_fd_at(int fd, void *out, int size, long long offset)
+{
+	++util_syscall_count;
+	return pread(fd, out, size, offset);
+}
+
+int write_fd_at(int fd, const void *data, int size, long long offset)
+{
+	++util_syscall_count;
+	return pwrite(fd, data, size, offset);
+}
 
 int read_fd_to_string(int fd, char *out, int maxbytes)
 {
 	int bytes_read = 0;
 	int bytes;
-	while ((bytes = read(fd, out + bytes_read,
-						 maxbytes - bytes_read)) > 0)
-		bytes_read += bytes;
+	do {
+		++util_syscall_count;
+		bytes = pread(fd, out + bytes_read, maxbytes - bytes_read,
+				bytes_read);
+		if (bytes > 0)
+			bytes_read += bytes;
+	} while (bytes > 0 && bytes_read < maxbytes);
 	return bytes_read;
 }
 
 int read_file_to_string(const char *filename, char *out, int maxbytes)
 {
 	int fd = open_file_readonly(filename);
+	if (fd < 0)
+		return 0;
 	int bytes = read_fd_to_string(fd, out, maxbytes);
-	close(fd);
+	close_fd(fd);
 	return bytes;
 }
 
 
+// The layout of the records returned by getdents64()
+struct linux_dirent64
+{
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+int dir_open(struct dir_t *dir, const char *path)
+{
+	++util_syscall_count;
+	dir->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	dir->pos = 0;
+	dir->len = 0;
+	return dir->fd < 0 ? -1 : 0;
+}
+
+const char *dir_next(struct dir_t *dir, unsigned char *type)
+{
+	if (dir->pos >= dir->len) {
+		++util_syscall_count;
+		dir->len = syscall(SYS_getdents64, dir->fd, dir->buffer,
+				sizeof(dir->buffer));
+		dir->pos = 0;
+		if (dir->len <= 0)
+			return NULL;
+	}
+	struct linux_dirent64 *ent =
+		(struct linux_dirent64 *)(dir->buffer + dir->pos);
+	dir->pos += ent->d_reclen;
+	if (type)
+		*type = ent->d_type;
+	return ent->d_name;
+}
+
+void dir_close(struct dir_t *dir)
+{
+	close_fd(dir->fd);
+}
+
+
+int parse_cpu_list(const char *list, unsigned char *set, int max_cpus)
+{
+	int count = 0;
+	const char *s = list;
+	while (*s && *s != '\n') {
+		char *end;
+		long first = strtol(s, &end, 10);
+		if (end == s || first < 0)
+			return -1;
+		long last = first;
+		s = end;
+		if (*s == '-') {
+			last = strtol(s + 1, &end, 10);
+			if (end == s + 1 || last < first)
+				return -1;
+			s = end;
+		}
+		for (long cpu = first; cpu <= last; ++cpu) {
+			if (cpu < max_cpus)
+				set[cpu] = 1;
+			++count;
+		}
+		if (*s == ',')
+			++s;
+		else if (*s && *s != '\n')
+			return -1;
+	}
+	return count;
+}
+
+// Files with a single value are returned whole by the first read
 int read_int_from_fd(int fd)
 {
 	char buf[16];
-	int l = read_fd_to_string(fd, buf, 15);
-	buf[l] = '\0';
+	++util_syscall_count;
+	int l = pread(fd, buf, 15, 0);
+	buf[l > 0 ? l : 0] = '\0';
 	return atoi(buf);
 }
 
 unsigned long long read_ull_from_fd(int fd)
 {
 	char buf[24];
-	int l = read_fd_to_string(fd, buf, 23);
-	buf[l] = '\0';
+	++util_syscall_count;
+	int l = pread(fd, buf, 23, 0);
+	buf[l > 0 ? l : 0] = '\0';
 	return strtoull(buf, NULL, 10);
 }
 
@@ -58,6 +173,107 @@ int read_int_from_file(const char *filename)
 }
 
 
+int flush_file(FILE *file)
+{
+	// fflush(NULL) would flush every stream
+	if (file == NULL)
+		return 0;
+	++util_syscall_count;
+	return fflush(file);
+}
+
+void raise_open_file_limit(void)
+{
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+			limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+}
+
+long long monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long realtime_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+unsigned long long counter_delta(unsigned long long cur, unsigned long long last)
+{
+	return cur >= last ? cur - last : 0;
+}
+
+unsigned long long counter_delta32(unsigned long long cur,
+		unsigned long long last)
+{
+	return (cur - last) & 0xffffffffULL;
+}
+
+double counter_rate(unsigned long long delta, double elapsed)
+{
+	return elapsed > 0.0 ? delta / elapsed : 0.0;
+}
+
+// Whether values[a] ranks below values[b]
+static int top_below(const double *values, int a, int b)
+{
+	return values[a] < values[b] || (values[a] == values[b] && a > b);
+}
+
+// Move top[i] down the min-heap top[0..count) to its place
+static void top_sift_down(const double *values, int *top, int count, int i)
+{
+	for (;;) {
+		int least = i;
+		const int left = 2 * i + 1, right = 2 * i + 2;
+		if (left < count && top_below(values, top[left], top[least]))
+			least = left;
+		if (right < count && top_below(values, top[right], top[least]))
+			least = right;
+		if (least == i)
+			return;
+		const int t = top[i];
+		top[i] = top[least];
+		top[least] = t;
+		i = least;
+	}
+}
+
+int top_k(const double *values, int n, int *top, int k)
+{
+	// A min-heap of the k largest so far, the smallest is top[0]
+	int count = 0;
+	for (int v = 0; v < n && k > 0; ++v) {
+		if (count < k) {
+			int i = count++;
+			for (; i > 0 && top_below(values, v, top[(i - 1) / 2]); i = (i - 1) / 2)
+				top[i] = top[(i - 1) / 2];
+			top[i] = v;
+		} else if (top_below(values, top[0], v)) {
+			top[0] = v;
+			top_sift_down(values, top, count, 0);
+		}
+	}
+	// Take the smallest out to the end one by one, which leaves the
+	// largest first
+	for (int end = count - 1; end > 0; --end) {
+		const int t = top[0];
+		top[0] = top[end];
+		top[end] = t;
+		top_sift_down(values, top, end, 0);
+	}
+	return count;
+}
+
+
 void bytes_to_human_readable(unsigned long long bytes, char *out)
 {
 	static const char * const units[] = {
@@ -1,17 +1,66 @@
 #ifndef UTIL_H_INCLUDED
 #define UTIL_H_INCLUDED
 
+#include <stdio.h>
+
+/** The number of system calls made by the functions below in this
+ * thread. The collectors do all of their I/O through them, so this
+ * measures their cost. A handle is only used by one thread at a time, so
+ * the difference over a refresh is the cost of that handle */
+extern __thread unsigned long long util_syscall_count;
+
+
 /** Open a file for reading */
 int open_file_readonly(const char *filename);
 
+/** Close an opened file */
+void close_fd(int fd);
 
-/** Writes the contents of opened file to out */
+
+/** A single read() from an opened file */
+int read_fd(int fd, void *out, int maxbytes);
+
+/** Writes the contents of opened file to out. The file is always read
+ * from the beginning, so files that are kept open don't need a seek */
 int read_fd_to_string(int fd, char *out, int maxbytes);
 
+/** A single pread() from an opened file */
+int read_fd_at(int fd, void *out, int size, long long offset);
+
+/** A single pwrite() to an opened file */
+int write_fd_at(int fd, const void *data, int size, long long offset);
+
 /** Writes the contents of file 'filename' to out */
 int read_file_to_string(const char *filename, char *out, int maxbytes);
 
 
+/** A directory listed with getdents64() into a fixed buffer */
+struct dir_t
+{
+	int fd;
+	int pos; /**< The offset of the next entry in buffer */
+	int len; /**< The number of bytes in buffer */
+	// Aligned for the records of getdents64(), which start with 64-bit
+	// integers
+	char buffer[8192] __attribute__((aligned(8)));
+};
+
+/** Open a directory for listing. Returns 0 on success */
+int dir_open(struct dir_t *dir, const char *path);
+
+/** Returns the name of the next directory entry or NULL at the end.
+ * If type is not NULL it is set to the entry type (DT_DIR, DT_LNK...) */
+const char *dir_next(struct dir_t *dir, unsigned char *type);
+
+/** Close a directory opened with dir_open() */
+void dir_close(struct dir_t *dir);
+
+
+/** Parse a CPU list like "0-3,8,10-11" (as in /sys and isolcpus=) into
+ * set, where set[N] is set to 1 for cpuN. CPUs from max_cpus up are
+ * ignored. Returns the number of CPUs in the list or -1 if it's invalid */
+int parse_cpu_list(const char *list, unsigned char *set, int max_cpus);
+
 /** Read an int value from an already opened file */
 int read_int_from_fd(int fd);
 
@@ -22,6 +71,40 @@ unsigned long long read_ull_from_fd(int fd);
 int read_int_from_file(const char *filename);
 
 
+/** fflush() a stream, counted as a single system call. That holds if
+ * the stream's buffer fits everything written between two flushes */
+int flush_file(FILE *file);
+
+
+/** Raise the soft limit of open files to the hard limit. The collectors
+ * keep the files of every device open, so the executables call this
+ * before system_init(). The library leaves the limit to the program */
+void raise_open_file_limit(void);
+
+/** The current CLOCK_MONOTONIC time in nanoseconds */
+long long monotonic_ns(void);
+
+/** The current CLOCK_REALTIME time in nanoseconds since the epoch */
+long long realtime_ns(void);
+
+/** The increase of a counter from last to cur. If the counter went back,
+ * it was reset (e.g. its device was replaced) and 0 is returned */
+unsigned long long counter_delta(unsigned long long cur, unsigned long long last);
+
+/** The increase of a counter that the kernel keeps in 32 bits, like the
+ * counts of /proc/interrupts and /proc/net/softnet_stat, which wrap */
+unsigned long long counter_delta32(unsigned long long cur,
+		unsigned long long last);
+
+/** Converts the change of a counter to a rate per second */
+double counter_rate(unsigned long long delta, double elapsed);
+
+/** Find the k largest of values[0..n) without sorting all of them
+ * (O(n log k)). Writes their indices to top, largest first, and returns
+ * how many there are. Equal values are ordered by index */
+int top_k(const double *values, int n, int *top, int k);
+
+
 /** Converts bytes to a human readable string (e.g. 37 MiB) */
 void bytes_to_human_readable(unsigned long long bytes, char *out);
 
@@ -0,0 +1,77 @@
+#include "vmstat.h"
+#include "system.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#define VMSTAT_PATH "/proc/vmstat"
+
+static const char * const counter_names[VMSTAT_COUNTERS_COUNT] = {
+	"pgpgin", "pgpgout", "pswpin", "pswpout", "pgfault", "pgmajfault",
+	"pgscan_kswapd", "pgscan_direct", "pgsteal_kswapd", "pgsteal_direct",
+	"allocstall_dma", "allocstall_dma32", "allocstall_normal",
+	"allocstall_movable", "oom_kill"
+};
+
+void vmstat_init(struct system_t *system)
+{
+	struct vmstat_t *vmstat = (struct vmstat_t *)calloc(1,
+			sizeof(struct vmstat_t));
+	system->vmstat = vmstat;
+	vmstat->page_size = sysconf(_SC_PAGESIZE);
+	vmstat->fd = -1;
+	if (kv_table_init(&vmstat->keys, counter_names, VMSTAT_COUNTERS_COUNT))
+		return;
+
+	char filename[PATH_MAX];
+	system_path(system, filename, VMSTAT_PATH);
+	vmstat->fd = open_file_readonly(filename);
+	system_reserve_buffer(system, vmstat->fd);
+}
+
+void vmstat_delete(struct system_t *system)
+{
+	close_fd(system->vmstat->fd);
+	free(system->vmstat);
+}
+
+void vmstat_refresh(struct system_t *system)
+{
+	struct vmstat_t *vmstat = system->vmstat;
+	if (vmstat->fd < 0)
+		return;
+	int len = read_fd_to_string(vmstat->fd, system->buffer,
+			system->buffer_size - 1);
+	if (len <= 0)
+		return;
+	system->buffer[len] = '\0';
+
+	unsigned long long counters[VMSTAT_COUNTERS_COUNT];
+	memcpy(counters, vmstat->counters, sizeof(counters));
+	kv_parse(&vmstat->keys, system->buffer, counters);
+
+	// The first refresh only sets the baseline
+	double rates[VMSTAT_COUNTERS_COUNT];
+	for (int i = 0; i < VMSTAT_COUNTERS_COUNT; ++i)
+		rates[i] = counter_rate(counter_delta(counters[i],
+					vmstat->counters[i]), system->elapsed);
+	memcpy(vmstat->counters, counters, sizeof(counters));
+
+	double *r = vmstat->rates;
+	r[VMSTAT_PAGE_IN] = rates[VMSTAT_PGPGIN] * 1024.0;
+	r[VMSTAT_PAGE_OUT] = rates[VMSTAT_PGPGOUT] * 1024.0;
+	r[VMSTAT_SWAP_IN] = rates[VMSTAT_PSWPIN] * vmstat->page_size;
+	r[VMSTAT_SWAP_OUT] = rates[VMSTAT_PSWPOUT] * vmstat->page_size;
+	r[VMSTAT_FAULTS] = rates[VMSTAT_PGFAULT];
+	r[VMSTAT_MAJOR_FAULTS] = rates[VMSTAT_PGMAJFAULT];
+	r[VMSTAT_SCAN] = rates[VMSTAT_PGSCAN_KSWAPD] + rates[VMSTAT_PGSCAN_DIRECT];
+	r[VMSTAT_STEAL] = rates[VMSTAT_PGSTEAL_KSWAPD] +
+		rates[VMSTAT_PGSTEAL_DIRECT];
+	r[VMSTAT_ALLOCSTALLS] = rates[VMSTAT_ALLOCSTALL_DMA] +
+		rates[VMSTAT_ALLOCSTALL_DMA32] + rates[VMSTAT_ALLOCSTALL_NORMAL] +
+		rates[VMSTAT_ALLOCSTALL_MOVABLE];
+	r[VMSTAT_OOM_KILLS] = rates[VMSTAT_OOM_KILL];
+}
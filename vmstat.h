@@ -0,0 +1,66 @@
+#ifndef VMSTAT_H_INCLUDED
+#define VMSTAT_H_INCLUDED
+
+#include "kv.h"
+
+// The counters of /proc/vmstat that are read
+enum {
+	VMSTAT_PGPGIN = 0, /**< KB paged in from disk */
+	VMSTAT_PGPGOUT = 1, /**< KB paged out to disk */
+	VMSTAT_PSWPIN = 2, /**< Pages swapped in */
+	VMSTAT_PSWPOUT = 3, /**< Pages swapped out */
+	VMSTAT_PGFAULT = 4,
+	VMSTAT_PGMAJFAULT = 5,
+	VMSTAT_PGSCAN_KSWAPD = 6, /**< Pages scanned by kswapd */
+	VMSTAT_PGSCAN_DIRECT = 7, /**< Pages scanned by allocating tasks */
+	VMSTAT_PGSTEAL_KSWAPD = 8, /**< Pages reclaimed by kswapd */
+	VMSTAT_PGSTEAL_DIRECT = 9, /**< Pages reclaimed by allocating tasks */
+	VMSTAT_ALLOCSTALL_DMA = 10, /**< Allocations that had to reclaim */
+	VMSTAT_ALLOCSTALL_DMA32 = 11,
+	VMSTAT_ALLOCSTALL_NORMAL = 12,
+	VMSTAT_ALLOCSTALL_MOVABLE = 13,
+	VMSTAT_OOM_KILL = 14,
+	VMSTAT_COUNTERS_COUNT = 15
+};
+
+// The paging, swap and reclaim rates, combined from the counters
+enum {
+	VMSTAT_PAGE_IN = 0, /**< Bytes read from disk per second */
+	VMSTAT_PAGE_OUT = 1, /**< Bytes written to disk per second */
+	VMSTAT_SWAP_IN = 2, /**< Bytes swapped in per second */
+	VMSTAT_SWAP_OUT = 3, /**< Bytes swapped out per second */
+	VMSTAT_FAULTS = 4, /**< Page faults per second */
+	VMSTAT_MAJOR_FAULTS = 5, /**< Faults that read from disk per second */
+	VMSTAT_SCAN = 6, /**< Pages scanned for reclaim per second */
+	VMSTAT_STEAL = 7, /**< Pages reclaimed per second */
+	VMSTAT_ALLOCSTALLS = 8, /**< Allocations stalled in direct reclaim
+							  per second */
+	VMSTAT_OOM_KILLS = 9, /**< OOM kills per second */
+	VMSTAT_RATES_COUNT = 10
+};
+
+struct system_t;
+
+/** Virtual memory statistics from /proc/vmstat */
+struct vmstat_t
+{
+	unsigned long long counters[VMSTAT_COUNTERS_COUNT]; /**< As of the last
+														  refresh */
+	double rates[VMSTAT_RATES_COUNT];
+	struct kv_table_t keys;
+	int page_size;
+
+	// File descriptors for files that are kept open
+	int fd;
+};
+
+/** Open /proc/vmstat and make room for it in system->buffer */
+void vmstat_init(struct system_t *system);
+
+/** Read /proc/vmstat and compute the rates */
+void vmstat_refresh(struct system_t *system);
+
+/** Close the file and free the memory */
+void vmstat_delete(struct system_t *system);
+
+#endif
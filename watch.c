@@ -0,0 +1,458 @@
+#include "watch.h"
+#include "system.h"
+#include "util.h"
+#include "kv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+
+// The fields of /proc/PID/stat that are read, counted from 1
+#define STAT_UTIME 14
+#define STAT_STIME 15
+#define STAT_NUM_THREADS 20
+#define STAT_PROCESSOR 39
+
+// The counters of /proc/PID/task/TID/status that are read
+enum { STATUS_SWITCHES, STATUS_INVOLUNTARY, STATUS_COUNT };
+static const char * const status_names[STATUS_COUNT] = {
+	"voluntary_ctxt_switches", "nonvoluntary_ctxt_switches"
+};
+
+// The counters of /proc/PID/task/TID/io that are read
+enum { IO_READ_BYTES, IO_WRITE_BYTES, IO_COUNT };
+static const char * const io_names[IO_COUNT] = {
+	"read_bytes", "write_bytes"
+};
+
+int watch_init(struct watch_t *watch, const char *list)
+{
+	memset(watch, 0, sizeof(struct watch_t));
+	for (const char *s = list; s && *s;) {
+		const char *end = strchr(s, ',');
+		const int len = end ? end - s : (int)strlen(s);
+		if (len > 0) {
+			if (watch->target_count == MAX_WATCH_TARGETS ||
+					len > MAX_COMM_LENGTH)
+				return 1;
+			memcpy(watch->targets[watch->target_count], s, len);
+			watch->targets[watch->target_count][len] = '\0';
+			++watch->target_count;
+		}
+		s += len + (end != NULL);
+	}
+	watch->clock_ticks = sysconf(_SC_CLK_TCK);
+	if (watch->clock_ticks <= 0)
+		watch->clock_ticks = 100;
+	if (kv_table_init(&watch->status_keys, status_names, STATUS_COUNT) ||
+			kv_table_init(&watch->io_keys, io_names, IO_COUNT))
+		return 2;
+	return 0;
+}
+
+static void watch_thread_close(struct thread_t *thread)
+{
+	close_fd(thread->stat_fd);
+	close_fd(thread->schedstat_fd);
+	close_fd(thread->status_fd);
+	close_fd(thread->io_fd);
+}
+
+static void watch_process_close(struct process_t *process)
+{
+	close_fd(process->stat_fd);
+	for (int i = 0; i < process->thread_count; ++i)
+		watch_thread_close(&process->threads[i]);
+	free(process->threads);
+}
+
+void watch_delete(struct watch_t *watch)
+{
+	for (int i = 0; i < watch->process_count; ++i)
+		watch_process_close(&watch->processes[i]);
+	free(watch->processes);
+	watch->processes = NULL;
+	watch->process_count = 0;
+	watch->max_process_count = 0;
+}
+
+// Read a file that is kept open. These files are smaller than the
+// buffers, so a single pread gets all of it, which saves the read that
+// would find the end on the many threads. Returns the number of bytes
+// read, <= 0 if the process or thread is gone
+static int reread_fd(int fd, char *buffer, int buffer_size)
+{
+	if (fd < 0)
+		return -1;
+	int bytes = read_fd_at(fd, buffer, buffer_size - 1, 0);
+	buffer[bytes > 0 ? bytes : 0] = '\0';
+	return bytes;
+}
+
+// The field of a stat file (counted from 1, at least 3) as a number.
+// The comm in parentheses may contain spaces, so count from its end
+static unsigned long long stat_field(const char *buffer, int field)
+{
+	const char *s = strrchr(buffer, ')');
+	if (s == NULL)
+		return 0;
+	for (int f = 2; f < field && s; ++f)
+		s = strchr(s + 1, ' ');
+	return s ? strtoull(s + 1, NULL, 10) : 0;
+}
+
+// Copy the comm of a stat file (between the first '(' and the last ')')
+static void stat_comm(const char *buffer, char *comm)
+{
+	const char *start = strchr(buffer, '(');
+	const char *end = strrchr(buffer, ')');
+	int len = start && end > start ? end - start - 1 : 0;
+	if (len > MAX_COMM_LENGTH)
+		len = MAX_COMM_LENGTH;
+	if (len > 0)
+		memcpy(comm, start + 1, len);
+	comm[len] = '\0';
+}
+
+// Read the files of a thread other than schedstat, which show what it
+// did since the last read. Returns 0 if the thread is gone
+static int watch_thread_read(struct watch_t *watch, struct thread_t *thread,
+		double elapsed, int first)
+{
+	char buffer[2048];
+	if (reread_fd(thread->stat_fd, buffer, sizeof(buffer)) <= 0)
+		return 0;
+	stat_comm(buffer, thread->comm);
+	thread->last_cpu = stat_field(buffer, STAT_PROCESSOR);
+	if (thread->schedstat_fd < 0) {
+		// Only tick precision without schedstat
+		const unsigned long long run_ns = (stat_field(buffer, STAT_UTIME) +
+				stat_field(buffer, STAT_STIME)) * 1000000000ull /
+			watch->clock_ticks;
+		thread->cpu_usage = first ? 0.0 : counter_rate(
+				counter_delta(run_ns, thread->last_run_ns), elapsed) / 1e9;
+		thread->last_run_ns = run_ns;
+	}
+
+	unsigned long long status[STATUS_COUNT] = { 0 };
+	if (reread_fd(thread->status_fd, buffer, sizeof(buffer)) > 0)
+		kv_parse(&watch->status_keys, buffer, status);
+	if (!first) {
+		thread->switches_rate = counter_rate(counter_delta(
+					status[STATUS_SWITCHES], thread->last_switches), elapsed);
+		thread->involuntary_rate = counter_rate(counter_delta(
+					status[STATUS_INVOLUNTARY], thread->last_involuntary),
+				elapsed);
+	}
+	thread->last_switches = status[STATUS_SWITCHES];
+	thread->last_involuntary = status[STATUS_INVOLUNTARY];
+
+	// io can be opened but not read without ptrace access
+	if (thread->io_fd >= 0) {
+		unsigned long long io[IO_COUNT] = { 0 };
+		if (reread_fd(thread->io_fd, buffer, sizeof(buffer)) > 0) {
+			kv_parse(&watch->io_keys, buffer, io);
+		} else {
+			close_fd(thread->io_fd);
+			thread->io_fd = -1;
+		}
+		if (!first) {
+			thread->read_rate = counter_rate(counter_delta(
+						io[IO_READ_BYTES], thread->last_read_bytes), elapsed);
+			thread->write_rate = counter_rate(counter_delta(
+						io[IO_WRITE_BYTES], thread->last_write_bytes), elapsed);
+		}
+		thread->last_read_bytes = io[IO_READ_BYTES];
+		thread->last_write_bytes = io[IO_WRITE_BYTES];
+	}
+	return 1;
+}
+
+// Refresh the stats of a thread. Returns 0 if it's gone
+static int watch_thread_refresh(struct watch_t *watch, struct thread_t *thread,
+		double elapsed)
+{
+	if (thread->schedstat_fd >= 0) {
+		// "run_ns wait_ns timeslices"
+		char buffer[128];
+		if (reread_fd(thread->schedstat_fd, buffer, sizeof(buffer)) <= 0)
+			return 0;
+		char *s;
+		const unsigned long long run_ns = strtoull(buffer, &s, 10);
+		strtoull(s, &s, 10);
+		const unsigned long long timeslices = strtoull(s, NULL, 10);
+		if (run_ns == thread->last_run_ns &&
+				timeslices == thread->last_timeslices) {
+			// It hasn't run, so nothing else has changed either
+			thread->cpu_usage = 0.0;
+			thread->switches_rate = 0.0;
+			thread->involuntary_rate = 0.0;
+			thread->read_rate = 0.0;
+			thread->write_rate = 0.0;
+			return 1;
+		}
+		thread->cpu_usage = counter_rate(
+				counter_delta(run_ns, thread->last_run_ns), elapsed) / 1e9;
+		thread->last_run_ns = run_ns;
+		thread->last_timeslices = timeslices;
+	}
+	return watch_thread_read(watch, thread, elapsed, 0);
+}
+
+// Open the files of a new thread and take the first sample
+static void watch_thread_add(struct system_t *system, struct process_t *process,
+		int tid)
+{
+	struct thread_t thread;
+	memset(&thread, 0, sizeof(thread));
+	thread.tid = tid;
+	char path[PATH_MAX];
+	char name[64];
+	static const char * const files[] = { "stat", "schedstat", "status", "io" };
+	int *fds[] = {
+		&thread.stat_fd, &thread.schedstat_fd, &thread.status_fd, &thread.io_fd
+	};
+	for (int f = 0; f < 4; ++f) {
+		snprintf(name, sizeof(name), "/proc/%d/task/%d/%s", process->pid, tid,
+				files[f]);
+		system_path(system, path, name);
+		*fds[f] = open_file_readonly(path);
+	}
+	if (thread.schedstat_fd >= 0) {
+		char buffer[128];
+		if (reread_fd(thread.schedstat_fd, buffer, sizeof(buffer)) > 0) {
+			char *s;
+			thread.last_run_ns = strtoull(buffer, &s, 10);
+			strtoull(s, &s, 10);
+			thread.last_timeslices = strtoull(s, NULL, 10);
+		}
+	}
+	if (!watch_thread_read(system->watch, &thread, system->elapsed, 1)) {
+		watch_thread_close(&thread);
+		return;
+	}
+	thread.seen = 1;
+
+	if (process->thread_count == process->max_thread_count) {
+		process->max_thread_count += 128;
+		process->threads = (struct thread_t *)realloc(process->threads,
+				sizeof(struct thread_t) * process->max_thread_count);
+	}
+	process->threads[process->thread_count++] = thread;
+}
+
+// List the task directory of a process, adding the new threads and
+// dropping those that exited. Returns 1 if the threads changed
+static int watch_list_threads(struct system_t *system,
+		struct process_t *process)
+{
+	char path[PATH_MAX];
+	char name[64];
+	snprintf(name, sizeof(name), "/proc/%d/task", process->pid);
+	system_path(system, path, name);
+	struct dir_t dir;
+	if (dir_open(&dir, path))
+		return 0;
+
+	const int known = process->thread_count;
+	for (int i = 0; i < known; ++i)
+		process->threads[i].seen = 0;
+	// The directory lists the threads in the same order every time,
+	// so the next one is usually the one after the last that was found
+	int cursor = 0;
+	const char *entry;
+	while ((entry = dir_next(&dir, NULL))) {
+		if (entry[0] < '0' || entry[0] > '9')
+			continue;
+		const int tid = atoi(entry);
+		int t = cursor;
+		if (t >= known || process->threads[t].tid != tid)
+			for (t = 0; t < known && process->threads[t].tid != tid; ++t)
+				;
+		if (t < known) {
+			process->threads[t].seen = 1;
+			cursor = t + 1;
+		} else {
+			watch_thread_add(system, process, tid);
+		}
+	}
+	dir_close(&dir);
+
+	int changed = process->thread_count != known;
+	int i = 0;
+	for (int j = 0; j < process->thread_count; ++j) {
+		if (process->threads[j].seen) {
+			if (i != j)
+				process->threads[i] = process->threads[j];
+			++i;
+		} else {
+			watch_thread_close(&process->threads[j]);
+			changed = 1;
+		}
+	}
+	process->thread_count = i;
+	return changed;
+}
+
+// Refresh a process and its threads. Returns 0 if it's gone
+static int watch_process_refresh(struct system_t *system,
+		struct process_t *process, int rescan)
+{
+	char buffer[1024];
+	if (reread_fd(process->stat_fd, buffer, sizeof(buffer)) <= 0)
+		return 0;
+	const unsigned long long ticks = stat_field(buffer, STAT_UTIME) +
+		stat_field(buffer, STAT_STIME);
+	process->cpu_usage = counter_rate(counter_delta(ticks,
+				process->last_cpu_ticks), system->elapsed) /
+		system->watch->clock_ticks;
+	process->last_cpu_ticks = ticks;
+	process->task_count = stat_field(buffer, STAT_NUM_THREADS);
+
+	// Only list the threads if some were created or exited
+	if ((rescan || process->task_count != process->thread_count) &&
+			watch_list_threads(system, process))
+		++system->watch->thread_generation;
+
+	process->switches_rate = 0.0;
+	process->involuntary_rate = 0.0;
+	process->read_rate = 0.0;
+	process->write_rate = 0.0;
+	int i = 0;
+	for (int j = 0; j < process->thread_count; ++j) {
+		struct thread_t *thread = &process->threads[j];
+		if (!watch_thread_refresh(system->watch, thread, system->elapsed)) {
+			// It exited since the directory was listed
+			watch_thread_close(thread);
+			++system->watch->thread_generation;
+			continue;
+		}
+		process->switches_rate += thread->switches_rate;
+		process->involuntary_rate += thread->involuntary_rate;
+		process->read_rate += thread->read_rate;
+		process->write_rate += thread->write_rate;
+		if (i != j)
+			process->threads[i] = *thread;
+		++i;
+	}
+	process->thread_count = i;
+	return 1;
+}
+
+// Start watching a process
+static void watch_process_add(struct system_t *system, int pid)
+{
+	struct watch_t *watch = system->watch;
+	for (int i = 0; i < watch->process_count; ++i)
+		if (watch->processes[i].pid == pid)
+			return;
+
+	struct process_t process;
+	memset(&process, 0, sizeof(process));
+	process.pid = pid;
+	char path[PATH_MAX];
+	char name[64];
+	snprintf(name, sizeof(name), "/proc/%d/stat", pid);
+	system_path(system, path, name);
+	process.stat_fd = open_file_readonly(path);
+	char buffer[1024];
+	if (reread_fd(process.stat_fd, buffer, sizeof(buffer)) <= 0) {
+		close_fd(process.stat_fd);
+		return;
+	}
+	stat_comm(buffer, process.comm);
+	process.last_cpu_ticks = stat_field(buffer, STAT_UTIME) +
+		stat_field(buffer, STAT_STIME);
+	process.task_count = stat_field(buffer, STAT_NUM_THREADS);
+	watch_list_threads(system, &process);
+
+	if (watch->process_count == watch->max_process_count) {
+		watch->max_process_count += 128;
+		watch->processes = (struct process_t *)realloc(watch->processes,
+				sizeof(struct process_t) * watch->max_process_count);
+	}
+	watch->processes[watch->process_count++] = process;
+	++system->device_generation;
+}
+
+// Add the targets that aren't watched yet: PIDs directly and names
+// by reading the comm of every process
+static void watch_scan(struct system_t *system)
+{
+	struct watch_t *watch = system->watch;
+	int names = 0;
+	for (int t = 0; t < watch->target_count; ++t) {
+		const char *target = watch->targets[t];
+		if (target[strspn(target, "0123456789")] == '\0')
+			watch_process_add(system, atoi(target));
+		else
+			names = 1;
+	}
+	if (!names)
+		return;
+
+	char path[PATH_MAX];
+	char name[64];
+	system_path(system, path, "/proc");
+	struct dir_t dir;
+	if (dir_open(&dir, path))
+		return;
+	const char *entry;
+	while ((entry = dir_next(&dir, NULL))) {
+		if (entry[0] < '0' || entry[0] > '9')
+			continue;
+		const int pid = atoi(entry);
+		int watched = 0;
+		for (int i = 0; i < watch->process_count && !watched; ++i)
+			watched = watch->processes[i].pid == pid;
+		if (watched)
+			continue;
+		char comm[MAX_COMM_LENGTH + 2];
+		snprintf(name, sizeof(name), "/proc/%d/comm", pid);
+		system_path(system, path, name);
+		const int len = read_file_to_string(path, comm, sizeof(comm) - 1);
+		if (len <= 0)
+			continue;
+		comm[len] = '\0';
+		comm[strcspn(comm, "\n")] = '\0';
+		for (int t = 0; t < watch->target_count; ++t) {
+			if (!strcmp(watch->targets[t], comm)) {
+				watch_process_add(system, pid);
+				break;
+			}
+		}
+	}
+	dir_close(&dir);
+}
+
+void watch_refresh(struct system_t *system)
+{
+	struct watch_t *watch = system->watch;
+	if (watch == NULL)
+		return;
+
+	int rescan = 0;
+	if (watch->rescan_ticks == 0) {
+		watch_scan(system);
+		watch->rescan_ticks = WATCH_RESCAN_TICKS;
+		rescan = 1;
+	}
+	--watch->rescan_ticks;
+
+	int i = 0;
+	for (int j = 0; j < watch->process_count; ++j) {
+		struct process_t *process = &watch->processes[j];
+		if (!watch_process_refresh(system, process, rescan)) {
+			watch_process_close(process);
+			++system->device_generation;
+			continue;
+		}
+		if (i != j)
+			watch->processes[i] = *process;
+		++i;
+	}
+	watch->process_count = i;
+}
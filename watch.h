@@ -0,0 +1,110 @@
+#ifndef WATCH_H_INCLUDED
+#define WATCH_H_INCLUDED
+
+#include "kv.h"
+
+/*
+ * A watch list of processes, given by PID or by name (comm), with all of
+ * their threads. The stat, schedstat, status and io files of each thread
+ * are kept open and reread with pread, like the per-CPU files.
+ *
+ * schedstat is the cheapest of them and tells whether a thread has run
+ * since the last refresh, so the others are only read for the threads
+ * that ran, which in a big JVM are a few of its thousands. The task
+ * directory of a process is listed again only when the thread count in
+ * its stat file differs from the threads that are known, or every
+ * WATCH_RESCAN_TICKS refreshes in case threads came and went. Names are
+ * looked up in /proc at the same rate, which picks up restarted services.
+ */
+
+#define MAX_WATCH_TARGETS 16
+#define MAX_COMM_LENGTH 15
+#define WATCH_RESCAN_TICKS 10
+
+/** A thread of a watched process */
+struct thread_t
+{
+	int tid;
+	char comm[MAX_COMM_LENGTH + 1]; /**< The name of the thread */
+	int seen; /**< Set while listing the task directory, used to
+				detect exited threads */
+
+	double cpu_usage; /**< CPU time used per second [0.0, 1.0] */
+	int last_cpu; /**< The CPU it last ran on */
+	double switches_rate; /**< Voluntary context switches per second */
+	double involuntary_rate; /**< Involuntary context switches per second */
+	double read_rate; /**< Bytes read from storage per second */
+	double write_rate; /**< Bytes written to storage per second */
+
+	unsigned long long last_run_ns; /**< The CPU time it has used */
+	unsigned long long last_timeslices; /**< How many times it has run */
+	unsigned long long last_switches;
+	unsigned long long last_involuntary;
+	unsigned long long last_read_bytes;
+	unsigned long long last_write_bytes;
+
+	// File descriptors for files that are kept open
+	int stat_fd;
+	int schedstat_fd; /**< -1 without CONFIG_SCHED_INFO, then the other
+						files are read on every refresh */
+	int status_fd;
+	int io_fd; /**< -1 unless we may ptrace the process */
+};
+
+/** A watched process */
+struct process_t
+{
+	int pid;
+	char comm[MAX_COMM_LENGTH + 1];
+
+	double cpu_usage; /**< CPU time used per second by all of its
+						threads, also those that exited (1.0 means
+						one fully busy CPU) */
+	int task_count; /**< num_threads from its stat file */
+	double switches_rate; /**< The sums of the rates of its threads */
+	double involuntary_rate;
+	double read_rate;
+	double write_rate;
+	unsigned long long last_cpu_ticks; /**< utime + stime */
+
+	int thread_count; /**< The number of threads that are watched */
+	struct thread_t *threads; /**< Ordered as in the task directory */
+	int max_thread_count;
+
+	int stat_fd;
+};
+
+struct watch_t
+{
+	int target_count;
+	char targets[MAX_WATCH_TARGETS][MAX_COMM_LENGTH + 1]; /**< PIDs or
+															names */
+	int process_count; /**< The number of watched processes */
+	struct process_t *processes;
+	int max_process_count;
+	long clock_ticks; /**< The unit of the times in stat files (Hz) */
+	int rescan_ticks; /**< Refreshes until the next rescan */
+	unsigned long long thread_generation; /**< Changes whenever a thread
+											of a watched process appears
+											or disappears, which is too
+											often for the device
+											generation of the system */
+	struct kv_table_t status_keys;
+	struct kv_table_t io_keys;
+};
+
+struct system_t;
+
+/** Parse list, a comma-separated list of PIDs and process names.
+ * Returns 0 on success, 1 if there are too many or a name is too long,
+ * 2 if the keys of the files it reads can't be hashed */
+int watch_init(struct watch_t *watch, const char *list);
+
+/** Find the processes and threads that appeared, drop those that
+ * exited and refresh the stats of the rest */
+void watch_refresh(struct system_t *system);
+
+/** Close all files and free the memory */
+void watch_delete(struct watch_t *watch);
+
+#endif